@@ -0,0 +1,71 @@
+// The allocation patterns of alloc.k on glibc malloc, built with gcc -O2
+#include <stdio.h>
+#include <stdlib.h>
+
+// Called through volatile pointers so gcc cannot drop a calloc paired with
+// its free
+static void* (*volatile allocate)(size_t, size_t) = calloc;
+static void (*volatile release)(void*) = free;
+
+static long temp(long n) {
+    long* xs = allocate(n, sizeof(long));
+    xs[n - 1] = n;
+    long result = xs[n - 1];
+    release(xs);
+    return result;
+}
+
+static long churn(int d, long i) {
+    if (d == 0) return temp(1 + i % 64);
+    return churn(d - 1, i * 2) + churn(d - 1, i * 2 + 1);
+}
+
+static long keep(long** table, int d, long i) {
+    if (d == 0) {
+        long n = 1 + i % 64;
+        long* xs = allocate(n, sizeof(long));
+        xs[0] = i;
+        table[i] = xs;
+        return n;
+    }
+    return keep(table, d - 1, i * 2) + keep(table, d - 1, i * 2 + 1);
+}
+
+// A request frees everything it allocated when it ends
+static long** request;
+static long request_size;
+
+static long fill(int d, long i) {
+    if (d == 0) {
+        long n = 1 + i % 64;
+        long* xs = allocate(n, sizeof(long));
+        request[request_size++] = xs;
+        xs[n - 1] = n;
+        return xs[n - 1];
+    }
+    return fill(d - 1, i * 2) + fill(d - 1, i * 2 + 1);
+}
+
+static long requests(int d, long i) {
+    if (d == 0) {
+        long sum = fill(10, i * 1024);
+        while (request_size) release(request[--request_size]);
+        return sum;
+    }
+    return requests(d - 1, i * 2) + requests(d - 1, i * 2 + 1);
+}
+
+int main(void) {
+    int pattern, d;
+    if (scanf("%d %d", &pattern, &d) != 2) return 1;
+    if (pattern == 0) {
+        printf("%ld\n", churn(d, 0));
+    } else if (pattern == 1) {
+        long** table = calloc(1L << d, sizeof(long*));
+        printf("%ld\n", keep(table, d, 0));
+    } else {
+        request = calloc(1024, sizeof(long*));
+        printf("%ld\n", requests(d - 10, 0));
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+// matmul.k in C with the same halving recursions, built with gcc -O2
+#include <stdio.h>
+#include <stdlib.h>
+
+static long fill(long* xs, long m, long lo, long hi) {
+    if (hi - lo == 1) {
+        xs[lo] = lo % m;
+        return 0;
+    }
+    long mid = (lo + hi) / 2;
+    fill(xs, m, lo, mid);
+    fill(xs, m, mid, hi);
+    return 0;
+}
+
+static long dot(long* a, long* b, long n, long cell, long lo, long hi) {
+    if (hi - lo == 1) {
+        long j = cell % n;
+        return a[cell - j + lo] * b[lo * n + j];
+    }
+    long mid = (lo + hi) / 2;
+    return dot(a, b, n, cell, lo, mid) + dot(a, b, n, cell, mid, hi);
+}
+
+static long multiply(long* a, long* b, long* c, long n, long lo, long hi) {
+    if (hi - lo == 1) {
+        c[lo] = dot(a, b, n, lo, 0, n);
+        return 0;
+    }
+    long mid = (lo + hi) / 2;
+    multiply(a, b, c, n, lo, mid);
+    multiply(a, b, c, n, mid, hi);
+    return 0;
+}
+
+static long total(long* xs, long lo, long hi) {
+    if (hi - lo == 1) return xs[lo];
+    long mid = (lo + hi) / 2;
+    return total(xs, lo, mid) + total(xs, mid, hi);
+}
+
+int main(void) {
+    long n = 0;
+    if (scanf("%ld", &n) != 1) return 1;
+    long* a = calloc(n * n, sizeof(long));
+    long* b = calloc(n * n, sizeof(long));
+    long* c = calloc(n * n, sizeof(long));
+    fill(a, 7, 0, n * n);
+    fill(b, 5, 0, n * n);
+    multiply(a, b, c, n, 0, n * n);
+    printf("%ld\n", total(c, 0, n * n));
+    free(a);
+    free(b);
+    free(c);
+    return 0;
+}
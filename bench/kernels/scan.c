@@ -0,0 +1,27 @@
+// scan.k in C reading through stdio, built with gcc -O2
+#include <stdio.h>
+
+int main(void) {
+    long bytes = 0, lines = 0, words = 0, digits = 0;
+    int in_word = 0;
+    int c;
+    while ((c = getchar_unlocked()) != EOF) {
+        bytes++;
+        switch (c) {
+            case '\n':
+                lines++;
+                in_word = 0;
+                break;
+            case '\t': case ' ':
+                in_word = 0;
+                break;
+            default:
+                if (c >= '0' && c <= '9') digits += c - '0';
+                if (!in_word) words++;
+                in_word = 1;
+                break;
+        }
+    }
+    printf("%ld %ld %ld %ld\n", bytes, lines, words, digits);
+    return 0;
+}
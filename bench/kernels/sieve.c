@@ -0,0 +1,45 @@
+// sieve.k in C with the same halving recursions, built with gcc -O2
+#include <stdio.h>
+#include <stdlib.h>
+
+static long mark(long* flags, long p, long lo, long hi) {
+    if (hi - lo == 1) {
+        flags[p * p + lo * p] = 1;
+        return 0;
+    }
+    if (hi - lo > 1) {
+        long mid = (lo + hi) / 2;
+        mark(flags, p, lo, mid);
+        mark(flags, p, mid, hi);
+    }
+    return 0;
+}
+
+static long sieve(long* flags, long n, long lo, long hi) {
+    if (hi - lo == 1) {
+        if (flags[lo] == 0 && lo * lo <= n) mark(flags, lo, 0, (n - lo * lo) / lo + 1);
+        return 0;
+    }
+    if (hi - lo > 1) {
+        long mid = (lo + hi) / 2;
+        sieve(flags, n, lo, mid);
+        sieve(flags, n, mid, hi);
+    }
+    return 0;
+}
+
+static long count(long* flags, long lo, long hi) {
+    if (hi - lo == 1) return flags[lo] == 0;
+    long mid = (lo + hi) / 2;
+    return count(flags, lo, mid) + count(flags, mid, hi);
+}
+
+int main(void) {
+    long n = 0;
+    if (scanf("%ld", &n) != 1) return 1;
+    long* flags = calloc(n + 1, sizeof(long));
+    sieve(flags, n, 2, n + 1);
+    printf("%ld\n", count(flags, 2, n + 1));
+    free(flags);
+    return 0;
+}
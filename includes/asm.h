@@ -4,135 +4,4534 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
 #include "ast.h"
+#include "list.h"
+#include "module.h"
+#include "profile.h"
+#include "types.h"
+#include "ctfe.h"
+#include "escape.h"
+#include "record.h"
+#include "trace.h"
 
-char* asm_f_compound(ast_t* ast);
-char* asm_f_assignment(ast_t* ast);
-char* asm_f_variable(ast_t* ast, int id);
-char* asm_f_call(ast_t* ast);
-char* asm_f_int(ast_t* ast);
-char* asm_f_root(ast_t* ast);
-char* asm_f(ast_t* ast);
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} asm_buf_t;
+
+// Instruction sets vector code is lowered to
+enum {
+    ASM_ISA_SSE2,           // Any x86-64, 8 lane vectors are unavailable
+    ASM_ISA_AVX2,
+};
+
+typedef struct {
+    char* name;
+    int offset;             // The slot starts at [rbp - offset], 8 bytes or a whole vector
+    int data_type;
+    long length;            // Elements the array in the slot is known to have, 0 when unknown
+} asm_local_t;
+
+// Range fact: the value in slot index is a valid index of the array in
+// slot array, established by a bounds check that passed or by the condition
+// of the branch it is in. With array 0 it only states that the value is not
+// negative, no slot starts at offset 0.
+typedef struct {
+    int array;
+    int index;
+} asm_fact_t;
+
+// What is known at one point of the code about the locals visible there:
+// the lengths of their arrays and the range facts
+typedef struct {
+    bool reached;           // Set once some branch gets to the point
+    size_t count;           // Locals covered
+    long* lengths;
+    asm_fact_t* facts;
+    size_t fact_count;
+} asm_flow_t;
+
+// One label of a match and the arm it selects
+typedef struct {
+    long label;
+    size_t arm;
+    uint64_t count;         // Runs of the arm in the profile, compared first when higher
+} asm_case_t;
+
+// An array or string made in the function being emitted that escape
+// analysis showed never outlives it
+typedef struct {
+    ast_t* call;            // The array() or concat() making it
+    int offset;             // On the stack: its length at [rbp - offset], the elements above.
+                            // On the heap: the slot keeping the last one made, freed on return
+    bool on_stack;
+} asm_alloc_t;
+
+// A generic function specialized for one list of type arguments
+typedef struct {
+    ast_t* function;        // The assignment defining the generic function
+    int types[TYPE_MAX_PARAMS];
+    char* name;             // Symbol of the specialized code
+} asm_instance_t;
+
+// Where a function merged into a whole program build was written
+typedef struct {
+    ast_t* function;        // The AST_FUNCTION, shared with its generic instances
+    char* source;
+} asm_origin_t;
+
+typedef struct asmContextStruct {
+    asm_buf_t text;
+    asm_buf_t cold;         // Functions the profile never saw run, placed apart from the rest
+    asm_buf_t data;
+    asm_buf_t rodata;       // Vector constants
+    asm_buf_t bss;
+    asm_buf_t eh_frame;     // One FDE per function
+    asm_buf_t* out;         // Where code is emitted right now
+    asm_buf_t tail;         // Branches the profile saw rarely taken, placed after the function's ret
+    module_interface_t* symbols;  // Functions and globals of this module and its imports
+    list_t* externs;        // char*, symbols defined by imported modules
+    list_t* functions;      // ast_t*, the assignments defining this module's functions
+    list_t* instances;      // asm_instance_t*, every instantiation requested so far
+    const int* type_args;   // Type arguments of the instance being emitted, NULL otherwise
+    ast_t* body;            // Body of the function being emitted
+    ast_t* read_only_call;  // Call whose array result is only ever read where it is stored
+    ast_t* folded;          // Last array call replaced by a table computed at compile time
+    long folded_length;     // and the length of that table
+    list_t* locals;         // asm_local_t*, of the function being emitted
+    escape_t* escape;       // Which parameters of this module's functions escape
+    list_t* allocations;    // asm_alloc_t*, of the function being emitted
+    list_t* facts;          // asm_fact_t*, hold at the point code is emitted
+    size_t scope_start;     // First local visible to the code being emitted
+    int frame_size;
+    int depth;              // Values currently pushed on top of the frame
+    int label_count;
+    const char* function;   // Function the code being emitted comes from
+    int call_site;          // Calls emitted so far for that function
+    int branch_site;        // Ifs and matches emitted so far for that function
+    char return_label[32];
+    int return_depth;       // depth when return_label was set up
+    int inline_depth;
+    bool entry;             // Emit a _start calling main, only for executables
+    bool shared;            // Build a shared library: the runtimes without _start, relocated data
+    bool instrument;        // Count function entries, calls and branch arms, dumped when main returns
+    char* profile_path;     // Where an instrumented program writes its counters
+    list_t* counters;       // char*, the key of every counter when instrumenting
+    skull_profile_t* profile;  // Drives inlining and function placement, may be NULL
+    const char* source_name;   // Source file for %line, NULL emits no line information
+    list_t* origins;        // asm_origin_t*, functions of other sources in a whole program build
+    const char* line_source;   // Source of the function being emitted, NULL for source_name
+    bool inline_small;      // Inline calls to small leaf functions without a profile
+    bool arrays;            // Code uses the array runtime
+    bool io;                // Code uses the I/O runtime
+    int isa;                // ASM_ISA_*
+    bool fma;               // Fuse float multiplies into the adds using them
+    int return_type;        // Declared return type of the function being emitted
+    list_t* records;        // record_t*, the record types this module declares
+    record_t* new_records;  // Records the array() being emitted holds, NULL for 8 byte elements
+    int record_temp;        // Slot the record value just emitted was built in, 0 when it points elsewhere
+    int return_slot;        // Slot of the address a record returned in memory goes to
+} asm_ctx_t;
+
+asm_ctx_t* init_asm_ctx(void);
+void free_asm_ctx(asm_ctx_t* ctx);
+int asm_isa_from_name(const char* name);
+void asm_emit(asm_buf_t* buf, const char* fmt, ...);
+void asm_import(asm_ctx_t* ctx, module_interface_t* iface);
+void asm_add_origin(asm_ctx_t* ctx, ast_t* function, const char* source);
+void asm_f_compound(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_function(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_global(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_assignment(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_variable(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_call(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_inline(asm_ctx_t* ctx, ast_t* ast, ast_t* callee);
+void asm_f_return(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_int(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_float(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_index(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_index_assignment(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_field(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_field_assignment(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_binary(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_if(asm_ctx_t* ctx, ast_t* ast);
+void asm_f_match(asm_ctx_t* ctx, ast_t* ast);
+char* asm_f_root(asm_ctx_t* ctx, ast_t* ast);
+void asm_f(asm_ctx_t* ctx, ast_t* ast);
 
 #ifdef SKULL_ASM_H_IMPLEMENTATION
 
-char* asm_f_compound(ast_t* ast) {
-    char* value = calloc(1, sizeof(char));
-    for (int i = 0; i < (int) ast->children->size; i++) {
-        ast_t* child_ast = (ast_t*) ast->children->items[i];
-        char* next_value = asm_f(child_ast);
-        value = realloc(value, strlen(value) + strlen(next_value) + 1);
-        strcat(value, next_value);
-        free(next_value);
+// Bound on instances per module, recursion through ever larger types such
+// as f<T> calling f<Array<T>> would instantiate forever
+#ifndef ASM_MAX_INSTANCES
+#define ASM_MAX_INSTANCES 1024
+#endif
+
+// Inlining limits, in AST nodes of the callee body and nested inlines
+#ifndef ASM_INLINE_MAX_NODES
+#define ASM_INLINE_MAX_NODES 24
+#endif
+// Without a profile only leaf functions up to this size are inlined
+#ifndef ASM_INLINE_SMALL_NODES
+#define ASM_INLINE_SMALL_NODES 12
+#endif
+#ifndef ASM_MAX_INLINE_DEPTH
+#define ASM_MAX_INLINE_DEPTH 2
+#endif
+
+// Match lowering: up to ASM_MATCH_CHAIN_MAX labels are compared one by one,
+// at least ASM_MATCH_TABLE_MIN labels whose range has at most
+// ASM_MATCH_TABLE_SPREAD values per label get a jump table, anything else
+// a binary search
+#ifndef ASM_MATCH_CHAIN_MAX
+#define ASM_MATCH_CHAIN_MAX 3
+#endif
+#ifndef ASM_MATCH_TABLE_MIN
+#define ASM_MATCH_TABLE_MIN 4
+#endif
+#ifndef ASM_MATCH_TABLE_SPREAD
+#define ASM_MATCH_TABLE_SPREAD 3
+#endif
+#ifndef ASM_MATCH_TABLE_MAX
+#define ASM_MATCH_TABLE_MAX 4096
+#endif
+
+// Arrays of a constant length that do not escape live in the frame up to
+// ASM_STACK_ARRAY_MAX elements each and ASM_STACK_MAX bytes per function
+#ifndef ASM_STACK_ARRAY_MAX
+#define ASM_STACK_ARRAY_MAX 512
+#endif
+#ifndef ASM_STACK_MAX
+#define ASM_STACK_MAX 16384
+#endif
+
+// Heap runtime: blocks of up to ASM_HEAP_SMALL_MAX bytes, header included,
+// come in size classes of whole cache lines carved from ASM_HEAP_CHUNK byte
+// mappings and are recycled through a free list per class. Larger ones are
+// mapped on their own. Regions grow by ASM_REGION_CHUNK bytes at a time.
+#ifndef ASM_HEAP_SMALL_MAX
+#define ASM_HEAP_SMALL_MAX 32768
+#endif
+#ifndef ASM_HEAP_CHUNK
+#define ASM_HEAP_CHUNK (1 << 20)
+#endif
+#ifndef ASM_REGION_CHUNK
+#define ASM_REGION_CHUNK 65536
+#endif
+
+static const char* asm_arg_regs[MODULE_MAX_PARAMS] = { "rdi", "rsi", "rdx", "rcx", "r8", "r9" };
+
+asm_ctx_t* init_asm_ctx(void) {
+    asm_ctx_t* ctx = calloc(1, sizeof(asm_ctx_t));
+    if (!ctx) {
+        fprintf(stderr, "Memory allocation failed for codegen context\n");
+        exit(1);
+    }
+    ctx->out = &ctx->text;
+    ctx->symbols = init_module_interface();
+    ctx->externs = init_list(sizeof(char*));
+    ctx->functions = init_list(sizeof(ast_t*));
+    ctx->instances = init_list(sizeof(asm_instance_t*));
+    ctx->locals = init_list(sizeof(asm_local_t*));
+    ctx->allocations = init_list(sizeof(asm_alloc_t*));
+    ctx->facts = init_list(sizeof(asm_fact_t*));
+    ctx->counters = init_list(sizeof(char*));
+    ctx->origins = init_list(sizeof(asm_origin_t*));
+    ctx->records = init_list(sizeof(record_t*));
+    return ctx;
+}
+
+static void asm_clear_facts(asm_ctx_t* ctx) {
+    for (size_t i = 0; i < ctx->facts->size; i++) {
+        free(ctx->facts->items[i]);
+    }
+    ctx->facts->size = 0;
+}
+
+static void asm_clear_locals(asm_ctx_t* ctx) {
+    for (size_t i = 0; i < ctx->locals->size; i++) {
+        asm_local_t* local = (asm_local_t*) ctx->locals->items[i];
+        free(local->name);
+        free(local);
+    }
+    for (size_t i = 0; i < ctx->allocations->size; i++) {
+        free(ctx->allocations->items[i]);
+    }
+    asm_clear_facts(ctx);
+    ctx->allocations->size = 0;
+    ctx->locals->size = 0;
+    ctx->scope_start = 0;
+    ctx->frame_size = 0;
+    ctx->depth = 0;
+}
+
+void free_asm_ctx(asm_ctx_t* ctx) {
+    if (!ctx) return;
+
+    asm_clear_locals(ctx);
+    free_list(ctx->locals);
+    free_list(ctx->allocations);
+    free_list(ctx->facts);
+    free_escape(ctx->escape);
+    for (size_t i = 0; i < ctx->externs->size; i++) {
+        free(ctx->externs->items[i]);
+    }
+    free_list(ctx->externs);
+    for (size_t i = 0; i < ctx->counters->size; i++) {
+        free(ctx->counters->items[i]);
+    }
+    free_list(ctx->counters);
+    for (size_t i = 0; i < ctx->origins->size; i++) {
+        asm_origin_t* origin = (asm_origin_t*) ctx->origins->items[i];
+        free(origin->source);
+        free(origin);
+    }
+    free_list(ctx->origins);
+    for (size_t i = 0; i < ctx->records->size; i++) {
+        free_record(ctx->records->items[i]);
+    }
+    free_list(ctx->records);
+    free_list(ctx->functions);
+    for (size_t i = 0; i < ctx->instances->size; i++) {
+        asm_instance_t* instance = (asm_instance_t*) ctx->instances->items[i];
+        free(instance->name);
+        free(instance);
+    }
+    free_list(ctx->instances);
+    free_module_interface(ctx->symbols);
+    free(ctx->profile_path);
+    free(ctx->text.data);
+    free(ctx->cold.data);
+    free(ctx->tail.data);
+    free(ctx->data.data);
+    free(ctx->rodata.data);
+    free(ctx->bss.data);
+    free(ctx->eh_frame.data);
+    free(ctx);
+}
+
+// -1 for names of instruction sets vectors cannot be lowered to
+int asm_isa_from_name(const char* name) {
+    if (strcmp(name, "sse2") == 0) return ASM_ISA_SSE2;
+    if (strcmp(name, "avx2") == 0) return ASM_ISA_AVX2;
+    return -1;
+}
+
+void asm_emit(asm_buf_t* buf, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    if (buf->size + len + 1 > buf->capacity) {
+        buf->capacity = MAX(buf->capacity * 2, buf->size + len + 1024);
+        buf->data = realloc(buf->data, buf->capacity);
+        if (!buf->data) {
+            fprintf(stderr, "Memory reallocation failed in asm_emit\n");
+            exit(1);
+        }
+    }
+
+    va_start(args, fmt);
+    vsnprintf(buf->data + buf->size, len + 1, fmt, args);
+    va_end(args);
+    buf->size += len;
+}
+
+static void asm_error(const char* message, const char* name) {
+    fprintf(stderr, "ERROR: %s: '%s'\n", message, name ? name : "?");
+    exit(1);
+}
+
+static module_symbol_t* asm_add_symbol(asm_ctx_t* ctx, module_symbol_t* symbol) {
+    if (module_interface_find(ctx->symbols, symbol->name)) {
+        asm_error("Redefinition of", symbol->name);
+    }
+    list_push(ctx->symbols->symbols, symbol);
+    return symbol;
+}
+
+// Makes the symbols of an imported module callable, they are resolved by the linker
+void asm_import(asm_ctx_t* ctx, module_interface_t* iface) {
+    for (size_t i = 0; i < iface->symbols->size; i++) {
+        module_symbol_t* symbol = (module_symbol_t*) iface->symbols->items[i];
+        module_symbol_t* copy = malloc(sizeof(module_symbol_t));
+        if (!copy) {
+            fprintf(stderr, "Memory allocation failed for module symbol\n");
+            exit(1);
+        }
+        *copy = *symbol;
+        copy->name = strdup(symbol->name);
+        asm_add_symbol(ctx, copy);
+        list_push(ctx->externs, strdup(symbol->name));
+    }
+}
+
+// The record type is, NULL for any other type
+static record_t* asm_record(asm_ctx_t* ctx, int type) {
+    return type ? record_find(ctx->records, type) : NULL;
+}
+
+// The record the elements of an array of type are, NULL unless type is an
+// array of records
+static record_t* asm_array_record(asm_ctx_t* ctx, int type) {
+    return type_is_array(type) ? asm_record(ctx, type_element(type)) : NULL;
+}
+
+static asm_local_t* asm_find_local(asm_ctx_t* ctx, const char* name) {
+    for (size_t i = ctx->locals->size; i > ctx->scope_start; i--) {
+        asm_local_t* local = (asm_local_t*) ctx->locals->items[i - 1];
+        if (strcmp(local->name, name) == 0) return local;
+    }
+    return NULL;
+}
+
+// Drops every fact about the slot at offset, its value is about to change
+static void asm_forget(asm_ctx_t* ctx, int offset) {
+    size_t kept = 0;
+    for (size_t i = 0; i < ctx->facts->size; i++) {
+        asm_fact_t* fact = (asm_fact_t*) ctx->facts->items[i];
+        if (fact->array == offset || fact->index == offset) {
+            free(fact);
+        } else {
+            ctx->facts->items[kept++] = fact;
+        }
+    }
+    ctx->facts->size = kept;
+}
+
+static void asm_add_fact(asm_ctx_t* ctx, int array, int index) {
+    for (size_t i = 0; i < ctx->facts->size; i++) {
+        asm_fact_t* fact = (asm_fact_t*) ctx->facts->items[i];
+        if (fact->array == array && fact->index == index) return;
+    }
+    asm_fact_t* fact = malloc(sizeof(asm_fact_t));
+    if (!fact) {
+        fprintf(stderr, "Memory allocation failed for range fact\n");
+        exit(1);
+    }
+    fact->array = array;
+    fact->index = index;
+    list_push(ctx->facts, fact);
+}
+
+static asm_local_t* asm_add_local(asm_ctx_t* ctx, const char* name, int data_type) {
+    asm_local_t* local = calloc(1, sizeof(asm_local_t));
+    if (!local) {
+        fprintf(stderr, "Memory allocation failed for local variable\n");
+        exit(1);
+    }
+    if (type_lanes(data_type) == 8 && ctx->isa != ASM_ISA_AVX2) {
+        asm_error("8 lane vectors need --isa avx2", name);
+    }
+
+    // Slots are packed below the ones still in scope, vectors get their own
+    // size and records whole 8 byte words
+    int size = type_is_vector(data_type) ? type_lanes(data_type) * 4 : 8;
+    int align = size;
+    record_t* record = asm_record(ctx, data_type);
+    if (record) size = (record->size + 7) & ~7;
+    int top = ctx->locals->size ? ((asm_local_t*) ctx->locals->items[ctx->locals->size - 1])->offset : 0;
+    local->name = strdup(name);
+    local->data_type = data_type;
+    local->offset = (top + size + align - 1) / align * align;
+    list_push(ctx->locals, local);
+    // Slots are reused once an inlined body is done with them
+    asm_forget(ctx, local->offset);
+
+    // Keep rsp 16 byte aligned for calls
+    ctx->frame_size = MAX(ctx->frame_size, (local->offset + 15) & ~15);
+    return local;
+}
+
+// Register n holding a value of the vector type
+static const char* asm_vreg(int type, int n) {
+    static const char* regs[2][3] = { { "xmm0", "xmm1", "xmm2" }, { "ymm0", "ymm1", "ymm2" } };
+    return regs[type_lanes(type) == 8][n];
+}
+
+static const char* asm_vmove(asm_ctx_t* ctx, int type) {
+    if (type_is_float_vector(type)) return ctx->isa == ASM_ISA_AVX2 ? "vmovups" : "movups";
+    return ctx->isa == ASM_ISA_AVX2 ? "vmovdqu" : "movdqu";
+}
+
+static bool asm_is_comparison(int op) {
+    return op == TOKEN_EQ || op == TOKEN_NEQ || op == TOKEN_LT ||
+           op == TOKEN_GT || op == TOKEN_LTE || op == TOKEN_GTE;
+}
+
+// Vector code keeps its operands in registers 0 and 1 and the result in 0.
+// SSE2 has two operand forms only, AVX2 the three operand VEX forms, which
+// are used for 4 lane vectors too so the two never mix.
+static void asm_vector_insn(asm_ctx_t* ctx, int type, const char* insn) {
+    if (ctx->isa == ASM_ISA_AVX2) {
+        asm_emit(ctx->out, "    v%s %s, %s, %s\n", insn, asm_vreg(type, 0), asm_vreg(type, 0), asm_vreg(type, 1));
+    } else {
+        asm_emit(ctx->out, "    %s xmm0, xmm1\n", insn);
+    }
+}
+
+static void asm_vector_zero(asm_ctx_t* ctx, int type) {
+    if (ctx->isa == ASM_ISA_AVX2) {
+        asm_emit(ctx->out, "    vpxor %s, %s, %s\n", asm_vreg(type, 0), asm_vreg(type, 0), asm_vreg(type, 0));
+    } else {
+        asm_emit(ctx->out, "    pxor xmm0, xmm0\n");
+    }
+}
+
+// Flips every bit of register 0
+static void asm_vector_not(asm_ctx_t* ctx, int type) {
+    if (ctx->isa == ASM_ISA_AVX2) {
+        asm_emit(ctx->out, "    vpcmpeqd %s, %s, %s\n"
+                           "    vpxor %s, %s, %s\n",
+                 asm_vreg(type, 2), asm_vreg(type, 2), asm_vreg(type, 2),
+                 asm_vreg(type, 0), asm_vreg(type, 0), asm_vreg(type, 2));
+    } else {
+        asm_emit(ctx->out, "    pcmpeqd xmm2, xmm2\n"
+                           "    pxor xmm0, xmm2\n");
+    }
+}
+
+// Register 0 = register 1 op register 0, for comparisons without a
+// swapped form
+static void asm_vector_swapped(asm_ctx_t* ctx, int type, const char* insn, int predicate) {
+    char imm[16] = "";
+    if (predicate >= 0) snprintf(imm, sizeof(imm), ", %d", predicate);
+
+    if (ctx->isa == ASM_ISA_AVX2) {
+        asm_emit(ctx->out, "    v%s %s, %s, %s%s\n", insn, asm_vreg(type, 0), asm_vreg(type, 1), asm_vreg(type, 0), imm);
+    } else {
+        asm_emit(ctx->out, "    %s xmm1, xmm0%s\n"
+                           "    movaps xmm0, xmm1\n", insn, imm);
+    }
+}
+
+// SSE2 has no pmulld, multiply the even and the odd lanes as 64 bit
+// products and interleave their low halves
+static void asm_vector_mul_sse2(asm_ctx_t* ctx) {
+    asm_emit(ctx->out, "    movdqa xmm2, xmm0\n"
+                       "    pmuludq xmm0, xmm1\n"
+                       "    psrlq xmm2, 32\n"
+                       "    psrlq xmm1, 32\n"
+                       "    pmuludq xmm2, xmm1\n"
+                       "    pshufd xmm0, xmm0, 0x08\n"
+                       "    pshufd xmm2, xmm2, 0x08\n"
+                       "    punpckldq xmm0, xmm2\n");
+}
+
+// Nor pminsd and pmaxsd, select through a greater than mask
+static void asm_vector_minmax_sse2(asm_ctx_t* ctx, bool min) {
+    asm_emit(ctx->out, min ? "    movdqa xmm2, xmm0\n"
+                             "    pcmpgtd xmm2, xmm1\n"
+                           : "    movdqa xmm2, xmm1\n"
+                             "    pcmpgtd xmm2, xmm0\n");
+    asm_emit(ctx->out, "    pand xmm1, xmm2\n"
+                       "    pandn xmm2, xmm0\n"
+                       "    por xmm2, xmm1\n"
+                       "    movdqa xmm0, xmm2\n");
+}
+
+// Pseudo operators of the horizontal reductions
+enum {
+    ASM_VECTOR_MIN = -1,
+    ASM_VECTOR_MAX = -2,
+};
+
+// Lane wise op, an operator token or ASM_VECTOR_*, on registers 0 and 1
+static void asm_vector_op(asm_ctx_t* ctx, int type, int op) {
+    bool avx = ctx->isa == ASM_ISA_AVX2;
+
+    if (type_is_float_vector(type)) {
+        // cmpps predicates: eq 0, lt 1, le 2, neq 4
+        switch (op) {
+            case TOKEN_PLUS:     asm_vector_insn(ctx, type, "addps"); return;
+            case TOKEN_MINUS:    asm_vector_insn(ctx, type, "subps"); return;
+            case TOKEN_MULTIPLY: asm_vector_insn(ctx, type, "mulps"); return;
+            case TOKEN_DIVIDE:   asm_vector_insn(ctx, type, "divps"); return;
+            case ASM_VECTOR_MIN: asm_vector_insn(ctx, type, "minps"); return;
+            case ASM_VECTOR_MAX: asm_vector_insn(ctx, type, "maxps"); return;
+            case TOKEN_EQ:       asm_vector_insn(ctx, type, "cmpeqps"); return;
+            case TOKEN_NEQ:      asm_vector_insn(ctx, type, "cmpneqps"); return;
+            case TOKEN_LT:       asm_vector_insn(ctx, type, "cmpltps"); return;
+            case TOKEN_LTE:      asm_vector_insn(ctx, type, "cmpleps"); return;
+            case TOKEN_GT:       asm_vector_swapped(ctx, type, "cmpps", 1); return;
+            case TOKEN_GTE:      asm_vector_swapped(ctx, type, "cmpps", 2); return;
+        }
+        asm_error("Float vectors have no remainder", "%");
+    }
+
+    switch (op) {
+        case TOKEN_PLUS:  asm_vector_insn(ctx, type, "paddd"); return;
+        case TOKEN_MINUS: asm_vector_insn(ctx, type, "psubd"); return;
+        case TOKEN_MULTIPLY:
+            if (avx) asm_vector_insn(ctx, type, "pmulld");
+            else asm_vector_mul_sse2(ctx);
+            return;
+        case ASM_VECTOR_MIN:
+        case ASM_VECTOR_MAX:
+            if (avx) asm_vector_insn(ctx, type, op == ASM_VECTOR_MIN ? "pminsd" : "pmaxsd");
+            else asm_vector_minmax_sse2(ctx, op == ASM_VECTOR_MIN);
+            return;
+        case TOKEN_EQ:  asm_vector_insn(ctx, type, "pcmpeqd"); return;
+        case TOKEN_NEQ: asm_vector_insn(ctx, type, "pcmpeqd"); asm_vector_not(ctx, type); return;
+        case TOKEN_GT:  asm_vector_insn(ctx, type, "pcmpgtd"); return;
+        case TOKEN_LTE: asm_vector_insn(ctx, type, "pcmpgtd"); asm_vector_not(ctx, type); return;
+        case TOKEN_LT:  asm_vector_swapped(ctx, type, "pcmpgtd", -1); return;
+        case TOKEN_GTE: asm_vector_swapped(ctx, type, "pcmpgtd", -1); asm_vector_not(ctx, type); return;
+    }
+    asm_error("Integer vectors cannot be divided", op == TOKEN_MODULUS ? "%" : "/");
+}
+
+// Scalar float code keeps its operands in xmm0 and xmm1 and the result in
+// xmm0, with the VEX forms under AVX2 like vector code
+static const char* asm_vex(asm_ctx_t* ctx) {
+    return ctx->isa == ASM_ISA_AVX2 ? "v" : "";
+}
+
+static void asm_float_insn(asm_ctx_t* ctx, const char* insn, const char* operand) {
+    if (ctx->isa == ASM_ISA_AVX2) {
+        asm_emit(ctx->out, "    v%s xmm0, xmm0, %s\n", insn, operand);
+    } else {
+        asm_emit(ctx->out, "    %s xmm0, %s\n", insn, operand);
+    }
+}
+
+// Loads the double a float literal stands for into xmm register n
+static void asm_float_constant(asm_ctx_t* ctx, const char* literal, int n) {
+    double value = strtod(literal, NULL);
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if (bits == 0 && n == 0) {
+        asm_float_insn(ctx, "xorps", "xmm0");
+        return;
+    }
+    asm_emit(ctx->out, "    mov rax, 0x%016llx\n"
+                       "    %smovq xmm%d, rax\n", (unsigned long long) bits, asm_vex(ctx), n);
+}
+
+static void asm_push_float(asm_ctx_t* ctx) {
+    asm_emit(ctx->out, "    %smovq rax, xmm0\n"
+                       "    push rax\n", asm_vex(ctx));
+    ctx->depth++;
+}
+
+static void asm_pop_float(asm_ctx_t* ctx, int n) {
+    asm_emit(ctx->out, "    %smovsd xmm%d, [rsp]\n"
+                       "    add rsp, 8\n", asm_vex(ctx), n);
+    ctx->depth--;
+}
+
+// Stores the value of an expression, rax, xmm0 for floats or vector
+// register 0, in local.
+// length is what is known about it as an array.
+static void asm_store_local(asm_ctx_t* ctx, asm_local_t* local, long length) {
+    if (type_is_vector(local->data_type)) {
+        asm_emit(ctx->out, "    %s [rbp-%d], %s\n", asm_vmove(ctx, local->data_type), local->offset, asm_vreg(local->data_type, 0));
+    } else if (type_is_float(local->data_type)) {
+        asm_emit(ctx->out, "    %smovsd [rbp-%d], xmm0\n", asm_vex(ctx), local->offset);
+    } else {
+        asm_emit(ctx->out, "    mov [rbp-%d], rax\n", local->offset);
+    }
+    asm_forget(ctx, local->offset);
+    local->length = length;
+}
+
+// Copies size bytes from [src_base + src] to [dst_base + dst] through r11,
+// whole words first
+static void asm_copy(asm_ctx_t* ctx, const char* dst_base, int dst, const char* src_base, int src, int size) {
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        asm_emit(ctx->out, "    mov r11, [%s%+d]\n"
+                           "    mov [%s%+d], r11\n", src_base, src + i, dst_base, dst + i);
+    }
+    for (; i < size; i++) {
+        asm_emit(ctx->out, "    mov r11b, byte [%s%+d]\n"
+                           "    mov byte [%s%+d], r11b\n", src_base, src + i, dst_base, dst + i);
+    }
+}
+
+static void asm_zero(asm_ctx_t* ctx, const char* base, int offset, int size) {
+    int i = 0;
+    for (; i + 8 <= size; i += 8) asm_emit(ctx->out, "    mov qword [%s%+d], 0\n", base, offset + i);
+    for (; i < size; i++) asm_emit(ctx->out, "    mov byte [%s%+d], 0\n", base, offset + i);
+}
+
+// Loads the field at address into rax, a float into xmm0
+static void asm_load_field(asm_ctx_t* ctx, record_field_t* field, const char* address) {
+    if (type_is_float(field->data_type)) {
+        asm_emit(ctx->out, "    %smovsd xmm0, [%s]\n", asm_vex(ctx), address);
+    } else if (field->size == 1) {
+        asm_emit(ctx->out, "    movzx eax, byte [%s]\n", address);
+    } else {
+        asm_emit(ctx->out, "    mov rax, [%s]\n", address);
+    }
+}
+
+// Stores the bits in reg, whose low byte is byte_reg, to the field at
+// address. Bools are stored as 0 or 1.
+static void asm_store_field(asm_ctx_t* ctx, record_field_t* field, const char* address, const char* reg,
+                            const char* byte_reg) {
+    if (field->size == 8) {
+        asm_emit(ctx->out, "    mov [%s], %s\n", address, reg);
+    } else if (field->data_type == typename_to_int("bool")) {
+        asm_emit(ctx->out, "    test %s, %s\n"
+                           "    setne byte [%s]\n", reg, reg, address);
+    } else {
+        asm_emit(ctx->out, "    mov byte [%s], %s\n", address, byte_reg);
+    }
+}
+
+static ast_t* asm_find_function(asm_ctx_t* ctx, const char* name) {
+    for (size_t i = 0; i < ctx->functions->size; i++) {
+        ast_t* function = (ast_t*) ctx->functions->items[i];
+        if (strcmp(function->name, name) == 0) return function;
+    }
+    return NULL;
+}
+
+static bool asm_is_generic(ast_t* function) {
+    return function && function->value->int_value > 0;
+}
+
+// Declared types mention type parameters inside a generic function
+static int asm_type(asm_ctx_t* ctx, int type) {
+    return type_substitute(type, ctx->type_args);
+}
+
+// Emits the increment of the counter for key and records its key
+static void asm_count(asm_ctx_t* ctx, const char* key) {
+    asm_emit(ctx->out, "    inc qword [__skull_prof_counts + %zu]\n", ctx->counters->size * 8);
+    list_push(ctx->counters, strdup(key));
+}
+
+// Runs the profile counted for one arm of the site-th if or match of the
+// function being emitted, 0 without a profile
+static uint64_t asm_arm_count(asm_ctx_t* ctx, const char* kind, int site, const char* arm) {
+    if (!ctx->profile) return 0;
+
+    char key[512];
+    snprintf(key, sizeof(key), "%s:%s:%d:%s", kind, ctx->function, site, arm);
+    return profile_count(ctx->profile, key);
+}
+
+// Counts runs of that arm where it starts, when instrumenting
+static void asm_count_arm(asm_ctx_t* ctx, const char* kind, int site, const char* arm) {
+    if (!ctx->instrument) return;
+
+    char key[512];
+    snprintf(key, sizeof(key), "%s:%s:%d:%s", kind, ctx->function, site, arm);
+    asm_count(ctx, key);
+}
+
+// Functions only go cold on evidence, ones without a counter in the
+// profile are newer than the training run
+static bool asm_is_cold(asm_ctx_t* ctx, const char* name) {
+    if (!ctx->profile || strcmp(name, "main") == 0) return false;
+
+    char key[512];
+    snprintf(key, sizeof(key), "fn:%s", name);
+    return profile_has(ctx->profile, key) && profile_count(ctx->profile, key) == 0;
+}
+
+void asm_add_origin(asm_ctx_t* ctx, ast_t* function, const char* source) {
+    asm_origin_t* origin = malloc(sizeof(asm_origin_t));
+    if (origin) origin->source = strdup(source);
+    if (!origin || !origin->source) {
+        fprintf(stderr, "Memory allocation failed for function origin\n");
+        exit(1);
+    }
+    origin->function = function;
+    list_push(ctx->origins, origin);
+}
+
+// Source of function, NULL when it comes from source_name
+static const char* asm_origin(asm_ctx_t* ctx, ast_t* function) {
+    for (size_t i = 0; i < ctx->origins->size; i++) {
+        asm_origin_t* origin = (asm_origin_t*) ctx->origins->items[i];
+        if (origin->function == function) return origin->source;
+    }
+    return NULL;
+}
+
+// Maps the code that follows to the line of ast in the Skull source,
+// nasm turns these into the .debug_line table
+static void asm_line(asm_ctx_t* ctx, ast_t* ast) {
+    if (ctx->source_name && ast->line) {
+        asm_emit(ctx->out, "%%line %u+0 %s\n", ast->line, ctx->line_source ? ctx->line_source : ctx->source_name);
+    }
+}
+
+// Call frame information for a function. Every function has the same
+// frame: after `push rbp` the CFA is rsp+16 with rbp saved at CFA-16,
+// after `mov rbp, rsp` it is rbp+16 until `leave` restores rsp+8.
+static void asm_f_fde(asm_ctx_t* ctx, const char* name) {
+    asm_emit(&ctx->eh_frame, "    dd __skull_fde_%s_end - __skull_fde_%s\n"
+                             "__skull_fde_%s:\n"
+                             "    dd __skull_fde_%s - __skull_cie ; CIE pointer\n"
+                             "    dd %s - $                      ; pc_begin\n"
+                             "    dd %s.end - %s                 ; pc_range\n"
+                             "    db 0                           ; no augmentation data\n"
+                             "    db 0x41, 0x0e, 16, 0x86, 2     ; +1: cfa rsp+16, rbp at cfa-16\n"
+                             "    db 0x43, 0x0d, 6               ; +3: cfa rbp+16\n"
+                             "    db 0x04                        ; past leave\n"
+                             "    dd %s.return + 1 - %s - 4\n"
+                             "    db 0x0c, 7, 8                  ; cfa rsp+8\n"
+                             "    align 8, db 0\n"
+                             "__skull_fde_%s_end:\n",
+             name, name, name, name, name, name, name, name, name, name);
+}
+
+static size_t asm_count_statements(ast_t* ast) {
+    if (!ast) return 0;
+
+    size_t count = 1;
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            count += asm_count_statements((ast_t*) ast->children->items[i]);
+        }
+    }
+    return count + asm_count_statements(ast->value);
+}
+
+// Whether ast calls a function of the program, builtins do not count
+static bool asm_calls_functions(asm_ctx_t* ctx, ast_t* ast) {
+    if (!ast) return false;
+    if (ast->type == AST_CALL && asm_find_function(ctx, ast->name)) return true;
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            if (asm_calls_functions(ctx, (ast_t*) ast->children->items[i])) return true;
+        }
+    }
+    return asm_calls_functions(ctx, ast->value);
+}
+
+void asm_f_compound(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_compound");
+    if (!ast->children || ast->children->size == 0) {
+        asm_emit(ctx->out, "    xor eax, eax\n");
+        return;
+    }
+
+    // The value of a compound is the value of its last expression
+    for (size_t i = 0; i < ast->children->size; i++) {
+        ast_t* child = (ast_t*) ast->children->items[i];
+        asm_line(ctx, child);
+        asm_f(ctx, child);
+    }
+}
+
+// The value of falling off the end of a function, 0 of its return type.
+// Records come back as zero words, or zeroed where the caller asked for
+// one returned in memory.
+static void asm_f_zero_return(asm_ctx_t* ctx) {
+    record_t* record = asm_record(ctx, ctx->return_type);
+    if (record && record->classes[0] == RECORD_MEMORY) {
+        asm_emit(ctx->out, "    mov rax, [rbp-%d]\n", ctx->return_slot);
+        asm_zero(ctx, "rax", 0, record->size);
+        return;
+    }
+    asm_emit(ctx->out, "    xor eax, eax\n");
+    if (type_is_float(ctx->return_type) || record) asm_float_insn(ctx, "xorps", "xmm0");
+    if (record) {
+        asm_emit(ctx->out, "    xor edx, edx\n");
+        asm_emit(ctx->out, ctx->isa == ASM_ISA_AVX2 ? "    vxorps xmm1, xmm1, xmm1\n" : "    xorps xmm1, xmm1\n");
+    }
+}
+
+// A call of the builtin name, which a function of the program shadows
+static bool asm_is_builtin(asm_ctx_t* ctx, ast_t* ast, const char* name) {
+    return ast->type == AST_CALL && strcmp(ast->name, name) == 0 &&
+           !module_interface_find(ctx->symbols, name);
+}
+
+static size_t asm_arg_count(ast_t* ast) {
+    return ast->value && ast->value->children ? ast->value->children->size : 0;
+}
+
+static ast_t* asm_arg(ast_t* ast, size_t i) {
+    return (ast_t*) ast->value->children->items[i];
+}
+
+// Widest element in bytes of the arrays of records name is declared as
+// within ast, 0 when it is never declared one
+static int asm_declared_element(asm_ctx_t* ctx, ast_t* ast, const char* name) {
+    if (!ast) return 0;
+
+    int size = 0;
+    if ((ast->type == AST_VARIABLE || ast->type == AST_ASSIGNMENT) && ast->data_type && ast->name &&
+        strcmp(ast->name, name) == 0) {
+        record_t* record = asm_array_record(ctx, asm_type(ctx, ast->data_type));
+        if (record) size = record->element_size;
+    }
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            size = MAX(size, asm_declared_element(ctx, (ast_t*) ast->children->items[i], name));
+        }
+    }
+    return MAX(size, asm_declared_element(ctx, ast->value, name));
+}
+
+// Finds the arrays and strings ast makes with `name = array(n)` or
+// `name = concat(a, b)` that do not escape the body of function. Constant
+// lengths within the limits get frame space below *size, the rest a slot
+// for freeing them.
+static void asm_find_allocations(asm_ctx_t* ctx, ast_t* function, ast_t* ast, int* size) {
+    if (!ast) return;
+
+    if (ast->type == AST_ASSIGNMENT && ast->value && !module_interface_find(ctx->symbols, ast->name) &&
+        (asm_is_builtin(ctx, ast->value, "array") || asm_is_builtin(ctx, ast->value, "concat")) &&
+        !escape_local(ctx->escape, function->value, ast->name)) {
+        asm_alloc_t* alloc = calloc(1, sizeof(asm_alloc_t));
+        if (!alloc) {
+            fprintf(stderr, "Memory allocation failed for stack allocation\n");
+            exit(1);
+        }
+        alloc->call = ast->value;
+        ast_t* length = asm_is_builtin(ctx, ast->value, "array") && asm_arg_count(ast->value) == 1
+                      ? asm_arg(ast->value, 0) : NULL;
+        // Arrays of records take their elements' bytes, at least 8 as the
+        // name may hold other arrays elsewhere
+        long element = MAX(8, asm_declared_element(ctx, function, ast->name));
+        long bytes = length && length->type == AST_INT && length->int_value >= 0
+                   ? (length->int_value * element + 7) / 8 * 8 + 8 : 0;
+        alloc->on_stack = bytes > 0 && length->int_value <= ASM_STACK_ARRAY_MAX && *size + bytes <= ASM_STACK_MAX;
+        *size += alloc->on_stack ? bytes : 8;
+        alloc->offset = *size;
+        list_push(ctx->allocations, alloc);
+    }
+
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            asm_find_allocations(ctx, function, (ast_t*) ast->children->items[i], size);
+        }
+    }
+    asm_find_allocations(ctx, function, ast->value, size);
+}
+
+// The allocation of ast in the function being emitted. Inlined bodies add
+// their own after the function's, and a body inlined into a copy of itself
+// has to find the innermost copy's, so the search goes from the end.
+static asm_alloc_t* asm_find_alloc(asm_ctx_t* ctx, ast_t* ast) {
+    for (size_t i = ctx->allocations->size; i > 0; i--) {
+        asm_alloc_t* alloc = (asm_alloc_t*) ctx->allocations->items[i - 1];
+        if (alloc->call == ast) return alloc;
+    }
+    return NULL;
+}
+
+static bool asm_has_heap_allocations(asm_ctx_t* ctx) {
+    for (size_t i = 0; i < ctx->allocations->size; i++) {
+        if (!((asm_alloc_t*) ctx->allocations->items[i])->on_stack) return true;
+    }
+    return false;
+}
+
+// Where an argument goes by the System V ABI: a register of its class for
+// each eightbyte, or the stack
+typedef struct {
+    record_t* record;       // NULL for scalars
+    int regs[2];            // Register number within the class of each eightbyte
+    int stack;              // Offset in the argument area, -1 in registers
+} asm_arg_t;
+
+// Places arguments of types after the hidden pointer a record returned in
+// memory takes. Records over 16 bytes, and ones whose eightbytes do not all
+// fit the registers left, go on the stack whole, like scalars once the
+// registers run out. Returns the bytes of the stack arguments.
+static int asm_classify(asm_ctx_t* ctx, const int* types, size_t count, bool hidden, asm_arg_t* args) {
+    int ints = hidden ? 1 : 0, floats = 0, stack = 0;
+    for (size_t i = 0; i < count; i++) {
+        asm_arg_t* arg = &args[i];
+        arg->record = asm_record(ctx, types[i]);
+        arg->regs[0] = arg->regs[1] = -1;
+        arg->stack = -1;
+
+        int classes[2] = { type_is_float(types[i]) ? RECORD_SSE : RECORD_INTEGER, RECORD_MEMORY };
+        int words = 1;
+        if (arg->record) {
+            memcpy(classes, arg->record->classes, sizeof(classes));
+            // Over 16 bytes the first class already says memory
+            words = arg->record->size > 16 ? 1 : record_eightbytes(arg->record);
+        }
+        int need_ints = 0, need_floats = 0;
+        bool memory = false;
+        for (int k = 0; k < words; k++) {
+            if (classes[k] == RECORD_MEMORY) memory = true;
+            else if (classes[k] == RECORD_SSE) need_floats++;
+            else need_ints++;
+        }
+
+        if (!memory && ints + need_ints <= MODULE_MAX_PARAMS && floats + need_floats <= 8) {
+            for (int k = 0; k < words; k++) arg->regs[k] = classes[k] == RECORD_SSE ? floats++ : ints++;
+        } else {
+            arg->stack = stack;
+            stack += arg->record ? (arg->record->size + 7) & ~7 : 8;
+        }
+    }
+    return stack;
+}
+
+// Emits `name = (params): type -> { ... }`. The body is generated first so
+// the prologue knows how many local slots to reserve.
+void asm_f_function(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_function");
+    ast_t* function = ast->value;
+    asm_buf_t body = {0};
+
+    asm_clear_locals(ctx);
+    ctx->body = function->value;
+    ctx->out = &body;
+    ctx->function = ast->name;
+    ctx->line_source = asm_origin(ctx, function);
+    ctx->call_site = 0;
+    ctx->branch_site = 0;
+    ctx->inline_depth = 0;
+    ctx->return_depth = 0;
+    strcpy(ctx->return_label, ".return");
+
+    // Objects that stay in the function take the top of the frame, under
+    // an unnamed local so the other locals pack below them
+    int allocated = 0;
+    asm_find_allocations(ctx, function, function->value, &allocated);
+    if (allocated) {
+        asm_local_t* reserved = asm_add_local(ctx, "", 0);
+        reserved->offset = (allocated + 15) & ~15;
+        ctx->frame_size = MAX(ctx->frame_size, reserved->offset);
+    }
+    for (size_t i = 0; i < ctx->allocations->size; i++) {
+        asm_alloc_t* alloc = (asm_alloc_t*) ctx->allocations->items[i];
+        if (!alloc->on_stack) asm_emit(&body, "    mov qword [rbp-%d], 0\n", alloc->offset);
+    }
+    // and the heap ones are freed on the way out
+    bool frees = asm_has_heap_allocations(ctx);
+    if (frees) strcpy(ctx->return_label, ".free");
+
+    if (ctx->instrument) {
+        char key[512];
+        snprintf(key, sizeof(key), "fn:%s", ast->name);
+        asm_count(ctx, key);
+    }
+
+    // A record returned in memory goes where the caller's pointer in rdi says
+    ctx->return_type = asm_type(ctx, function->data_type);
+    record_t* returned = asm_record(ctx, ctx->return_type);
+    bool hidden = returned && returned->classes[0] == RECORD_MEMORY;
+    if (hidden) {
+        ctx->return_slot = asm_add_local(ctx, "", typename_to_int("int"))->offset;
+        asm_emit(&body, "    mov [rbp-%d], rdi\n", ctx->return_slot);
+    }
+
+    // Ints arrive in the System V integer registers and floats in xmm0 to
+    // xmm7, each class numbered on its own, the rest above the return address
+    size_t param_count = function->children ? function->children->size : 0;
+    int types[MODULE_MAX_PARAMS] = {0};
+    asm_arg_t args[MODULE_MAX_PARAMS];
+    for (size_t i = 0; i < param_count; i++) {
+        ast_t* param = (ast_t*) function->children->items[i];
+        if (param->type != AST_VARIABLE) {
+            asm_error("Expected a parameter name in function", ast->name);
+        }
+        types[i] = asm_type(ctx, param->data_type);
+        if (type_is_vector(types[i])) {
+            asm_error("Vectors cannot be passed to functions, parameter", param->name);
+        }
+    }
+    asm_classify(ctx, types, param_count, hidden, args);
+    for (size_t i = 0; i < param_count; i++) {
+        ast_t* param = (ast_t*) function->children->items[i];
+        asm_local_t* local = asm_add_local(ctx, param->name, types[i]);
+        asm_arg_t* arg = &args[i];
+        if (arg->stack >= 0) {
+            asm_copy(ctx, "rbp", -local->offset, "rbp", 16 + arg->stack, arg->record ? arg->record->size : 8);
+        } else if (arg->record) {
+            for (int k = 0; k < record_eightbytes(arg->record); k++) {
+                if (arg->record->classes[k] == RECORD_SSE) {
+                    asm_emit(&body, "    %smovsd [rbp-%d], xmm%d\n", asm_vex(ctx), local->offset - 8 * k, arg->regs[k]);
+                } else {
+                    asm_emit(&body, "    mov [rbp-%d], %s\n", local->offset - 8 * k, asm_arg_regs[arg->regs[k]]);
+                }
+            }
+        } else if (type_is_float(types[i])) {
+            asm_emit(&body, "    %smovsd [rbp-%d], xmm%d\n", asm_vex(ctx), local->offset, arg->regs[0]);
+        } else {
+            asm_emit(&body, "    mov [rbp-%d], %s\n", local->offset, asm_arg_regs[arg->regs[0]]);
+        }
+    }
+
+    if (function->value) asm_f(ctx, function->value);
+    // Falling off the end returns 0
+    asm_f_zero_return(ctx);
+    // Records returned in registers use rdx and xmm1 as well
+    bool pair = returned && !hidden;
+    if (frees && pair) {
+        asm_emit(&body, ".free:\n"
+                        "    push rax\n"
+                        "    push rdx\n"
+                        "    sub rsp, 16\n"
+                        "    movsd [rsp], xmm0\n"
+                        "    movsd [rsp+8], xmm1\n");
+    } else if (frees) {
+        asm_emit(&body, ".free:\n"
+                        "    push rax\n"
+                        "    sub rsp, 8\n"
+                        "    movsd [rsp], xmm0\n");
+    }
+    if (frees) {
+        for (size_t i = 0; i < ctx->allocations->size; i++) {
+            asm_alloc_t* alloc = (asm_alloc_t*) ctx->allocations->items[i];
+            if (!alloc->on_stack) asm_emit(&body, "    mov rdi, [rbp-%d]\n"
+                                                  "    call __skull_free\n", alloc->offset);
+        }
+        if (pair) {
+            asm_emit(&body, "    movsd xmm0, [rsp]\n"
+                            "    movsd xmm1, [rsp+8]\n"
+                            "    add rsp, 16\n"
+                            "    pop rdx\n"
+                            "    pop rax\n");
+        } else {
+            asm_emit(&body, "    movsd xmm0, [rsp]\n"
+                            "    add rsp, 8\n"
+                            "    pop rax\n");
+        }
+    }
+
+    ctx->out = asm_is_cold(ctx, ast->name) ? &ctx->cold : &ctx->text;
+    asm_line(ctx, ast);
+    asm_emit(ctx->out, "global %s%s\n"
+                       "%s:\n"
+                       "    push rbp\n"
+                       "    mov rbp, rsp\n", ast->name, ctx->shared ? ":function" : "", ast->name);
+    if (ctx->frame_size) {
+        asm_emit(ctx->out, "    sub rsp, %d\n", ctx->frame_size);
+    }
+    if (body.size) asm_emit(ctx->out, "%s", body.data);
+    asm_emit(ctx->out, ".return:\n"
+                       "    leave\n"
+                       "    ret\n");
+    if (ctx->tail.size) asm_emit(ctx->out, "%s", ctx->tail.data);
+    asm_emit(ctx->out, ".end:\n\n");
+    asm_f_fde(ctx, ast->name);
+
+    free(body.data);
+    ctx->tail.size = 0;
+    asm_clear_locals(ctx);
+    ctx->out = &ctx->text;
+}
+
+// Emits the array value computed at compile time to buf, laid out like the
+// arrays array() makes with the elements on a fresh cache line. Arrays it
+// holds are emitted first, each once however often it is referenced.
+// labels maps arrays of ctfe to their table id plus one.
+static void asm_f_table(asm_ctx_t* ctx, ctfe_t* ctfe, ctfe_value_t value, asm_buf_t* buf,
+                        int* labels, char* label, size_t size) {
+    ctfe_array_t* array = ctfe_array(ctfe, value);
+    if (array->length == 0) {
+        snprintf(label, size, "__skull_array_empty");
+        ctx->arrays = true;
+        return;
+    }
+    if (!labels[value.value]) {
+        // Numbered up front, so an array holding itself refers to its own label
+        labels[value.value] = ++ctx->label_count;
+        char element[64];
+        for (long i = 0; i < array->length; i++) {
+            if (array->items[i].is_array) asm_f_table(ctx, ctfe, array->items[i], buf, labels, element, sizeof(element));
+        }
+
+        asm_emit(buf, "align 64\n"
+                      "    dq 0, 0, 0, 0, 0, 0, 0, %ld\n"
+                      "__skull_table_%d:", array->length, labels[value.value]);
+        for (long i = 0; i < array->length; i++) {
+            asm_emit(buf, i % 8 ? ", " : "\n    dq ");
+            if (array->items[i].is_array) {
+                asm_f_table(ctx, ctfe, array->items[i], buf, labels, element, sizeof(element));
+                asm_emit(buf, "%s", element);
+            } else {
+                asm_emit(buf, "%lld", (long long) array->items[i].value);
+            }
+        }
+        asm_emit(buf, "\n");
+    }
+    snprintf(label, size, "__skull_table_%d", labels[value.value]);
+}
+
+// The bits of the double value stands for
+static unsigned long long asm_double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (unsigned long long) bits;
+}
+
+// Top level `name = <int>`, `name = <float>` or `name: type`
+void asm_f_global(asm_ctx_t* ctx, ast_t* ast) {
+    if (type_is_vector(ast->data_type)) {
+        asm_error("Vectors can only be local variables", ast->name);
+    }
+    if (asm_record(ctx, ast->data_type)) {
+        asm_error("Records can only be local variables", ast->name);
+    }
+    // Tables computed at compile time hold 8 byte elements
+    if (ast->type == AST_ASSIGNMENT && asm_array_record(ctx, ast->data_type)) {
+        asm_error("Arrays of records start out empty, initializing", ast->name);
+    }
+    if (ast->type == AST_VARIABLE && type_is_array(ast->data_type)) {
+        asm_emit(&ctx->data, "global %s\n"
+                             "%s: dq __skull_array_empty\n", ast->name, ast->name);
+        ctx->arrays = true;
+        return;
+    }
+    if (ast->type == AST_VARIABLE) {
+        asm_emit(&ctx->bss, "global %s\n"
+                            "%s: resq 1\n", ast->name, ast->name);
+        return;
+    }
+
+    // Initializers calling functions are evaluated at compile time, arrays
+    // they give are emitted writable as the global owns them
+    if (ast->value && ast->value->type != AST_INT && ctfe_is_constant(ast->value)) {
+        ctfe_t* ctfe = init_ctfe(ctx->functions, ctx->symbols);
+        ctfe_value_t value;
+        if (!ctfe_evaluate(ctfe, ast->value, &value)) {
+            asm_error("Global initializer cannot be computed at compile time", ast->name);
+        }
+        if (value.is_array) {
+            char label[64];
+            int* labels = calloc(ctfe->arrays->size, sizeof(int));
+            if (!labels) {
+                fprintf(stderr, "Memory allocation failed for constant table\n");
+                exit(1);
+            }
+            asm_f_table(ctx, ctfe, value, &ctx->data, labels, label, sizeof(label));
+            asm_emit(&ctx->data, "global %s\n"
+                                 "%s: dq %s\n", ast->name, ast->name, label);
+            free(labels);
+        } else if (type_is_float(ast->data_type)) {
+            asm_emit(&ctx->data, "global %s\n"
+                                 "%s: dq 0x%016llx\n", ast->name, ast->name, asm_double_bits((double) value.value));
+        } else {
+            asm_emit(&ctx->data, "global %s\n"
+                                 "%s: dq %lld\n", ast->name, ast->name, (long long) value.value);
+        }
+        free_ctfe(ctfe);
+        return;
+    }
+    if (ast->value && ast->value->type == AST_FLOAT) {
+        if (ast->data_type && !type_is_float(ast->data_type)) {
+            asm_error("Floats only become ints through int(), assigning to", ast->name);
+        }
+        asm_emit(&ctx->data, "global %s\n"
+                             "%s: dq 0x%016llx\n", ast->name, ast->name, asm_double_bits(strtod(ast->value->name, NULL)));
+        return;
+    }
+    if (!ast->value || ast->value->type != AST_INT) {
+        asm_error("Global must be initialized with a number constant or a call computable at compile time", ast->name);
+    }
+    if (type_is_float(ast->data_type)) {
+        asm_emit(&ctx->data, "global %s\n"
+                             "%s: dq 0x%016llx\n", ast->name, ast->name, asm_double_bits(ast->value->int_value));
+        return;
+    }
+    asm_emit(&ctx->data, "global %s\n"
+                         "%s: dq %d\n", ast->name, ast->name, ast->value->int_value);
+}
+
+static void asm_infer(asm_ctx_t* ctx, ast_t* callee, ast_t* call, int* types);
+
+// Static type of what ast evaluates to, 0 when unknown
+static int asm_type_of(asm_ctx_t* ctx, ast_t* ast) {
+    switch (ast->type) {
+        case AST_INT: return typename_to_int("int");
+        case AST_FLOAT: return TYPE_FLOAT;
+        case AST_STRING: return typename_to_int("string");
+        case AST_VARIABLE:
+        case AST_INDEX: {
+            asm_local_t* local = asm_find_local(ctx, ast->name);
+            module_symbol_t* symbol = module_interface_find(ctx->symbols, ast->name);
+            int type = local ? local->data_type : (symbol ? symbol->data_type : 0);
+            if (ast->type == AST_VARIABLE) return type;
+            // Lanes of a vector are read as a scalar of their kind
+            if (type_is_vector(type)) return type_is_float_vector(type) ? TYPE_FLOAT : typename_to_int("int");
+            return type_element(type);
+        }
+        case AST_BINARY: {
+            int lhs = asm_type_of(ctx, (ast_t*) ast->children->items[0]);
+            int rhs = asm_type_of(ctx, (ast_t*) ast->children->items[1]);
+            int vector = type_is_vector(lhs) ? lhs : (type_is_vector(rhs) ? rhs : 0);
+            if (!vector && asm_is_comparison(ast->int_value)) return typename_to_int("int");
+            if (!vector) return type_is_float(lhs) || type_is_float(rhs) ? TYPE_FLOAT : typename_to_int("int");
+            // Comparing vectors gives a mask of all ones or zeros per lane
+            return asm_is_comparison(ast->int_value) ? type_vector_of(type_lanes(vector), false) : vector;
+        }
+        case AST_CALL: {
+            module_symbol_t* symbol = module_interface_find(ctx->symbols, ast->name);
+            ast_t* callee = asm_find_function(ctx, ast->name);
+            if (symbol && asm_is_generic(callee)) {
+                int types[TYPE_MAX_PARAMS] = {0};
+                asm_infer(ctx, callee, ast, types);
+                return type_substitute(symbol->data_type, types);
+            }
+            if (symbol) return symbol->data_type;
+            record_t* record = record_named(ctx->records, ast->name);
+            if (record) return record->type;
+            if (strcmp(ast->name, "array") == 0 || strcmp(ast->name, "region_array") == 0) {
+                return type_array_of(typename_to_int("int"));
+            }
+            if (strcmp(ast->name, "concat") == 0) return typename_to_int("string");
+            if (type_is_vector(typename_to_int(ast->name))) return typename_to_int(ast->name);
+            if (strcmp(ast->name, "shuffle") == 0 && ast->value && ast->value->children->size) {
+                return asm_type_of(ctx, (ast_t*) ast->value->children->items[0]);
+            }
+            if (strcmp(ast->name, "float") == 0 || strcmp(ast->name, "sqrt") == 0) return TYPE_FLOAT;
+            if ((strcmp(ast->name, "hsum") == 0 || strcmp(ast->name, "hmin") == 0 || strcmp(ast->name, "hmax") == 0) &&
+                ast->value && ast->value->children->size &&
+                type_is_float_vector(asm_type_of(ctx, (ast_t*) ast->value->children->items[0]))) {
+                return TYPE_FLOAT;
+            }
+            return typename_to_int("int");
+        }
+        case AST_FIELD: {
+            record_t* record = asm_record(ctx, asm_type_of(ctx, ast->value));
+            record_field_t* field = record ? record_field(record, ast->name) : NULL;
+            return field ? field->data_type : 0;
+        }
+        case AST_FIELD_ASSIGNMENT: return asm_type_of(ctx, (ast_t*) ast->children->items[0]);
+        default: return asm_type(ctx, ast->data_type);
+    }
+}
+
+// Binds the type parameters of callee from the types of the arguments of
+// call, Array<T> given an Array<int> binds T to int
+static void asm_infer(asm_ctx_t* ctx, ast_t* callee, ast_t* call, int* types) {
+    ast_t* function = callee->value;
+    size_t count = call->value && call->value->children ? call->value->children->size : 0;
+    if (function->children && count > function->children->size) count = function->children->size;
+
+    for (size_t i = 0; i < count; i++) {
+        int param = ((ast_t*) function->children->items[i])->data_type;
+        int index = type_param_index(param);
+        if (index < 0) continue;
+
+        int arg = asm_type_of(ctx, (ast_t*) call->value->children->items[i]);
+        if (!arg) continue;
+        for (; type_is_array(param); param -= TYPE_ARRAY, arg -= TYPE_ARRAY) {
+            if (!type_is_array(arg)) asm_error("Argument is not an array in call to", callee->name);
+        }
+        if (types[index] && types[index] != arg) {
+            asm_error("Conflicting types for a type parameter in call to", callee->name);
+        }
+        types[index] = arg;
+    }
+
+    for (int k = 0; k < function->int_value; k++) {
+        if (!types[k]) asm_error("Cannot infer every type parameter in call to", callee->name);
+    }
+}
+
+// The code of callee specialized for the arguments of call, the first
+// request of a list of type arguments queues it to be emitted
+static asm_instance_t* asm_instantiate(asm_ctx_t* ctx, ast_t* callee, ast_t* call) {
+    int types[TYPE_MAX_PARAMS] = {0};
+    asm_infer(ctx, callee, call, types);
+
+    for (size_t i = 0; i < ctx->instances->size; i++) {
+        asm_instance_t* instance = (asm_instance_t*) ctx->instances->items[i];
+        if (instance->function == callee && memcmp(instance->types, types, sizeof(types)) == 0) {
+            return instance;
+        }
+    }
+    if (ctx->instances->size >= ASM_MAX_INSTANCES) {
+        asm_error("Too many instantiations, unbounded generic recursion in", callee->name);
+    }
+
+    // name__int__Array_string for name<int, Array<string>>
+    char name[512];
+    size_t len = snprintf(name, sizeof(name), "%s", callee->name);
+    for (int k = 0; k < callee->value->int_value && len < sizeof(name); k++) {
+        len += snprintf(name + len, sizeof(name) - len, "__");
+        if (len < sizeof(name)) len += type_mangle(types[k], name + len, sizeof(name) - len);
+    }
+    if (len >= sizeof(name)) asm_error("Instantiation name too long for", callee->name);
+
+    asm_instance_t* instance = calloc(1, sizeof(asm_instance_t));
+    if (!instance) {
+        fprintf(stderr, "Memory allocation failed for instance\n");
+        exit(1);
+    }
+    instance->function = callee;
+    memcpy(instance->types, types, sizeof(types));
+    instance->name = strdup(name);
+    list_push(ctx->instances, instance);
+    return instance;
+}
+
+// Whether the array in local name is only ever indexed, measured or loaded
+// into vectors within ast, never written, passed on or copied elsewhere
+static bool asm_is_read_only(asm_ctx_t* ctx, ast_t* ast, const char* name) {
+    if (!ast) return true;
+
+    if (ast->type == AST_INDEX_ASSIGNMENT && strcmp(ast->name, name) == 0) return false;
+    if (ast->type == AST_VARIABLE && !ast->data_type && strcmp(ast->name, name) == 0) return false;
+
+    if (ast->type == AST_CALL && strcmp(ast->name, "return") == 0) return asm_is_read_only(ctx, ast->value, name);
+
+    size_t skip = 0;
+    if (ast->type == AST_CALL && ast->value && ast->value->children->size) {
+        ast_t* first = (ast_t*) ast->value->children->items[0];
+        bool reads = asm_is_builtin(ctx, ast, "len") ||
+                     (type_is_vector(typename_to_int(ast->name)) && ast->value->children->size == 2 &&
+                      !module_interface_find(ctx->symbols, ast->name));
+        if (reads && first->type == AST_VARIABLE && strcmp(first->name, name) == 0) skip = 1;
+    }
+    if (ast->type == AST_CALL) {
+        if (!ast->value) return true;
+        for (size_t i = skip; i < ast->value->children->size; i++) {
+            if (!asm_is_read_only(ctx, (ast_t*) ast->value->children->items[i], name)) return false;
+        }
+        return true;
+    }
+
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            if (!asm_is_read_only(ctx, (ast_t*) ast->children->items[i], name)) return false;
+        }
+    }
+    return asm_is_read_only(ctx, ast->value, name);
+}
+
+// Whether the function callee defines takes or returns records, or arrays
+// of them, which neither the interpreter nor inlining handle
+static bool asm_has_records(asm_ctx_t* ctx, ast_t* callee) {
+    ast_t* function = callee->value;
+    size_t count = function->children ? function->children->size : 0;
+    for (size_t i = 0; i <= count; i++) {
+        int type = i < count ? ((ast_t*) function->children->items[i])->data_type : function->data_type;
+        while (type_is_array(type)) type = type_element(type);
+        if (asm_record(ctx, type)) return true;
+    }
+    return false;
+}
+
+// Replaces a call of a function of this module with constant arguments by
+// the value the interpreter computes for it: integers become immediates and
+// arrays of integers tables in .rodata. Unless the result is only read, each
+// execution gets its own copy of the table, as it got its own array before.
+// Returns false to leave it a call.
+static bool asm_f_constant(asm_ctx_t* ctx, ast_t* ast) {
+    ast_t* callee = asm_find_function(ctx, ast->name);
+    if (!callee || asm_has_records(ctx, callee) || !ctfe_is_constant(ast)) return false;
+
+    ctfe_t* ctfe = init_ctfe(ctx->functions, ctx->symbols);
+    ctfe_value_t value;
+    bool constant = ctfe_evaluate(ctfe, ast, &value);
+    ctfe_array_t* array = constant ? ctfe_array(ctfe, value) : NULL;
+    // Copies of nested arrays would share the inner ones
+    for (long i = 0; array && i < array->length; i++) {
+        if (array->items[i].is_array) constant = false;
+    }
+    if (!constant) {
+        free_ctfe(ctfe);
+        return false;
+    }
+
+    if (!array) {
+        asm_emit(ctx->out, "    mov rax, %lld\n", (long long) value.value);
+        free_ctfe(ctfe);
+        return true;
+    }
+
+    char label[64];
+    int* labels = calloc(ctfe->arrays->size, sizeof(int));
+    if (!labels) {
+        fprintf(stderr, "Memory allocation failed for constant table\n");
+        exit(1);
+    }
+    asm_f_table(ctx, ctfe, value, &ctx->rodata, labels, label, sizeof(label));
+    if (ast == ctx->read_only_call || array->length == 0) {
+        asm_emit(ctx->out, "    lea rax, [%s]\n", label);
+    } else {
+        bool misaligned = ctx->depth % 2 != 0;
+        asm_emit(ctx->out, "    lea rdi, [%s]\n", label);
+        if (misaligned) asm_emit(ctx->out, "    sub rsp, 8\n");
+        asm_emit(ctx->out, "    call __skull_array_copy\n");
+        if (misaligned) asm_emit(ctx->out, "    add rsp, 8\n");
+        ctx->arrays = true;
+    }
+    ctx->folded = ast;
+    ctx->folded_length = array->length;
+
+    free(labels);
+    free_ctfe(ctfe);
+    return true;
+}
+
+// Elements the array ast evaluates to is known to have, 0 when unknown
+static long asm_known_length(asm_ctx_t* ctx, ast_t* ast) {
+    if (ast == ctx->folded) return ctx->folded_length;
+    if (asm_is_builtin(ctx, ast, "array") && ast->value && ast->value->children->size == 1) {
+        ast_t* length = (ast_t*) ast->value->children->items[0];
+        return length->type == AST_INT && length->int_value > 0 ? length->int_value : 0;
+    }
+    if (ast->type == AST_VARIABLE && !ast->data_type) {
+        asm_local_t* local = asm_find_local(ctx, ast->name);
+        return local ? local->length : 0;
+    }
+    return 0;
+}
+
+// Evaluates ast into xmm0 as a float, ints are converted
+static void asm_f_as_float(asm_ctx_t* ctx, ast_t* ast) {
+    int type = asm_type_of(ctx, ast);
+    if (type_is_vector(type) || type_is_array(type) || asm_record(ctx, type)) asm_error("Expected a number", ast->name);
+
+    asm_f(ctx, ast);
+    if (!type_is_float(type)) asm_float_insn(ctx, "cvtsi2sd", "rax");
+}
+
+// Converts the value of an expression of type from for a variable of type
+// to. Ints widen to floats, floats only become ints through int().
+static void asm_convert(asm_ctx_t* ctx, int from, int to, const char* name) {
+    if (type_is_vector(from) || type_is_vector(to)) return;
+    if (type_is_float(to) && !type_is_float(from)) asm_float_insn(ctx, "cvtsi2sd", "rax");
+    if (!type_is_float(to) && type_is_float(from)) asm_error("Floats only become ints through int(), assigning to", name);
+}
+
+// Evaluates ast where a value of type is expected, array() there makes the
+// elements of an array of records
+static void asm_f_expecting(asm_ctx_t* ctx, ast_t* ast, int type) {
+    record_t* record = asm_array_record(ctx, type);
+    if (record && asm_is_builtin(ctx, ast, "region_array")) {
+        asm_error("Arrays of records are made by array(), not", "region_array");
+    }
+    if (record && asm_is_builtin(ctx, ast, "array")) ctx->new_records = record;
+    asm_f(ctx, ast);
+    ctx->new_records = NULL;
+}
+
+static bool asm_mentions(ast_t* ast, const char* name) {
+    if (!ast) return false;
+    if (ast->type == AST_VARIABLE && strcmp(ast->name, name) == 0) return true;
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            if (asm_mentions((ast_t*) ast->children->items[i], name)) return true;
+        }
+    }
+    return asm_mentions(ast->value, name);
+}
+
+// Evaluates the record value ast to its address in rax. Returns the slot of
+// the temporary it was built in, 0 when rax points at a local or an element.
+static int asm_f_record(asm_ctx_t* ctx, ast_t* ast) {
+    ctx->record_temp = 0;
+    asm_f(ctx, ast);
+    int temp = ctx->record_temp;
+    ctx->record_temp = 0;
+    return temp;
+}
+
+// `Name(args)` stores one argument per field, in declaration order, to the
+// record in the slot at offset
+static void asm_f_construct(asm_ctx_t* ctx, ast_t* ast, record_t* record, int offset) {
+    size_t count = asm_arg_count(ast);
+    if (count != record->field_count) {
+        fprintf(stderr, "ERROR: '%s' takes %zu arguments but %zu were given\n", ast->name, record->field_count, count);
+        exit(1);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        ast_t* arg = asm_arg(ast, i);
+        record_field_t* field = &record->fields[i];
+        int type = asm_type_of(ctx, arg);
+        if (asm_record(ctx, type) || type_is_vector(type)) {
+            asm_error("Argument does not match the type of field", field->name);
+        }
+
+        char address[32];
+        snprintf(address, sizeof(address), "rbp-%d", offset - field->offset);
+        if (type_is_float(field->data_type)) {
+            asm_f_as_float(ctx, arg);
+            asm_emit(ctx->out, "    %smovsd [%s], xmm0\n", asm_vex(ctx), address);
+            continue;
+        }
+        if (type_is_float(type)) asm_error("Floats only become ints through int(), assigning to field", field->name);
+        asm_f_expecting(ctx, arg, field->data_type);
+        asm_store_field(ctx, field, address, "rax", "al");
+    }
+}
+
+// The temporary slot at offset, NULL when no such slot is in scope
+static asm_local_t* asm_find_temp(asm_ctx_t* ctx, int offset) {
+    for (size_t i = ctx->locals->size; i > ctx->scope_start; i--) {
+        asm_local_t* local = (asm_local_t*) ctx->locals->items[i - 1];
+        if (local->offset == offset && !local->name[0]) return local;
+    }
+    return NULL;
+}
+
+// `name = value` of a record copies it to the local's slot. A new local
+// takes over the temporary a value was built in, and constructors build in
+// place unless their arguments read the local. Evaluates to the local.
+static bool asm_f_record_assignment(asm_ctx_t* ctx, ast_t* ast) {
+    asm_local_t* local = asm_find_local(ctx, ast->name);
+    module_symbol_t* symbol = local ? NULL : module_interface_find(ctx->symbols, ast->name);
+    int type = asm_type_of(ctx, ast->value);
+    int target = local ? local->data_type : (symbol ? symbol->data_type : (ast->data_type ? asm_type(ctx, ast->data_type) : type));
+    record_t* record = asm_record(ctx, target);
+    if (!record && !asm_record(ctx, type)) return false;
+    if (symbol) asm_error("Records can only be local variables", ast->name);
+    if (!record) asm_error("Records are only assigned to locals of their type, not", ast->name);
+    if (type != target) asm_error("Assigned value does not match the record type of", ast->name);
+
+    if (ast->value->type == AST_CALL && record_named(ctx->records, ast->value->name) &&
+        !asm_mentions(ast->value, ast->name)) {
+        if (!local) local = asm_add_local(ctx, ast->name, record->type);
+        asm_f_construct(ctx, ast->value, record, local->offset);
+    } else {
+        int temp = asm_f_record(ctx, ast->value);
+        asm_local_t* slot = temp && !local ? asm_find_temp(ctx, temp) : NULL;
+        if (slot) {
+            free(slot->name);
+            slot->name = strdup(ast->name);
+            local = slot;
+        } else {
+            if (!local) local = asm_add_local(ctx, ast->name, record->type);
+            asm_copy(ctx, "rbp", -local->offset, "rax", 0, record->size);
+        }
+    }
+    asm_emit(ctx->out, "    lea rax, [rbp-%d]\n", local->offset);
+    return true;
+}
+
+// `name = expr` inside a function, the first assignment declares a local
+void asm_f_assignment(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_assignment");
+    if (ast->value && ast->value->type == AST_FUNCTION) {
+        asm_error("Functions can only be defined at the top level", ast->name);
+    }
+    if (ast->value && ast->value->type == AST_RECORD) {
+        asm_error("Records can only be declared at the top level", ast->name);
+    }
+    if (asm_f_record_assignment(ctx, ast)) return;
+
+    // A table computed at compile time is used in place when nothing
+    // could write to it
+    if (ctx->inline_depth == 0 && !module_interface_find(ctx->symbols, ast->name) &&
+        asm_is_read_only(ctx, ctx->body, ast->name)) {
+        ctx->read_only_call = ast->value;
+    }
+    asm_local_t* target = asm_find_local(ctx, ast->name);
+    module_symbol_t* global = target ? NULL : module_interface_find(ctx->symbols, ast->name);
+    asm_f_expecting(ctx, ast->value, target ? target->data_type : (global ? global->data_type : asm_type(ctx, ast->data_type)));
+    ctx->read_only_call = NULL;
+    long length = asm_known_length(ctx, ast->value);
+
+    int type = asm_type_of(ctx, ast->value);
+    asm_local_t* local = asm_find_local(ctx, ast->name);
+    if (local) {
+        if ((type_is_vector(type) || type_is_vector(local->data_type)) && type != local->data_type) {
+            asm_error("Assigned value does not match the vector type of", ast->name);
+        }
+        asm_convert(ctx, type, local->data_type, ast->name);
+        asm_store_local(ctx, local, length);
+        return;
+    }
+
+    module_symbol_t* symbol = module_interface_find(ctx->symbols, ast->name);
+    if (symbol && symbol->kind == MODULE_SYMBOL_GLOBAL) {
+        if (type_is_vector(type)) {
+            asm_error("Vectors can only be local variables", ast->name);
+        }
+        asm_convert(ctx, type, symbol->data_type, ast->name);
+        if (type_is_float(symbol->data_type)) {
+            asm_emit(ctx->out, "    %smovsd [%s], xmm0\n", asm_vex(ctx), ast->name);
+        } else {
+            asm_emit(ctx->out, "    mov [%s], rax\n", ast->name);
+        }
+        return;
+    }
+    if (symbol) {
+        asm_error("Cannot assign to function", ast->name);
+    }
+
+    if (ast->data_type) {
+        int declared = asm_type(ctx, ast->data_type);
+        asm_convert(ctx, type, declared, ast->name);
+        type = declared;
+    }
+    local = asm_add_local(ctx, ast->name, type);
+    asm_store_local(ctx, local, length);
+}
+
+void asm_f_variable(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_variable");
+    asm_local_t* local = asm_find_local(ctx, ast->name);
+
+    // `name: type` declares a zeroed local, arrays start out empty
+    if (ast->data_type) {
+        int type = asm_type(ctx, ast->data_type);
+        record_t* record = asm_record(ctx, type);
+        if (!local || (record && local->data_type != type)) local = asm_add_local(ctx, ast->name, type);
+        if (record) {
+            asm_zero(ctx, "rbp", -local->offset, (record->size + 7) & ~7);
+            asm_emit(ctx->out, "    lea rax, [rbp-%d]\n", local->offset);
+            return;
+        }
+        if (type_is_array(type)) {
+            asm_emit(ctx->out, "    lea rax, [__skull_array_empty]\n");
+            ctx->arrays = true;
+        } else if (type_is_vector(type)) {
+            asm_vector_zero(ctx, type);
+        } else if (type_is_float(type)) {
+            asm_float_insn(ctx, "xorps", "xmm0");
+        } else {
+            asm_emit(ctx->out, "    xor eax, eax\n");
+        }
+        asm_store_local(ctx, local, 0);
+        return;
+    }
+
+    if (local && type_is_vector(local->data_type)) {
+        asm_emit(ctx->out, "    %s %s, [rbp-%d]\n", asm_vmove(ctx, local->data_type), asm_vreg(local->data_type, 0), local->offset);
+        return;
+    }
+    if (local && type_is_float(local->data_type)) {
+        asm_emit(ctx->out, "    %smovsd xmm0, [rbp-%d]\n", asm_vex(ctx), local->offset);
+        return;
+    }
+    // Records are used through their address
+    if (local && asm_record(ctx, local->data_type)) {
+        asm_emit(ctx->out, "    lea rax, [rbp-%d]\n", local->offset);
+        return;
+    }
+    if (local) {
+        asm_emit(ctx->out, "    mov rax, [rbp-%d]\n", local->offset);
+        return;
+    }
+
+    module_symbol_t* symbol = module_interface_find(ctx->symbols, ast->name);
+    if (symbol && symbol->kind == MODULE_SYMBOL_GLOBAL && type_is_float(symbol->data_type)) {
+        asm_emit(ctx->out, "    %smovsd xmm0, [%s]\n", asm_vex(ctx), ast->name);
+        return;
+    }
+    if (symbol && symbol->kind == MODULE_SYMBOL_GLOBAL) {
+        asm_emit(ctx->out, "    mov rax, [%s]\n", ast->name);
+        return;
+    }
+
+    asm_error(symbol ? "Function used as a value" : "Undefined variable", ast->name);
+}
+
+static bool asm_f_builtin(asm_ctx_t* ctx, ast_t* ast);
+
+// Arguments and results go through general purpose registers
+static void asm_check_scalar(asm_ctx_t* ctx, ast_t* ast, const char* function) {
+    if (type_is_vector(asm_type_of(ctx, ast))) {
+        asm_error("Vectors cannot be passed to or returned from functions, in", function);
+    }
+}
+
+// Zeroes the words of frame space an array that stays in the function
+// takes and points rax at its elements
+static void asm_f_stack_array(asm_ctx_t* ctx, asm_alloc_t* alloc, long length, long words) {
+    if (words <= 8) {
+        for (long i = 0; i < words; i++) {
+            asm_emit(ctx->out, "    mov qword [rbp-%ld], 0\n", alloc->offset - 8 - i * 8);
+        }
+    } else {
+        asm_emit(ctx->out, "    lea rdi, [rbp-%d]\n"
+                           "    mov ecx, %ld\n"
+                           "    xor eax, eax\n"
+                           "    rep stosq\n", alloc->offset - 8, words);
+    }
+    asm_emit(ctx->out, "    mov qword [rbp-%d], %ld\n"
+                       "    lea rax, [rbp-%d]\n", alloc->offset, length, alloc->offset - 8);
+}
+
+// Keeps the heap object in rax in its slot to be freed on return. The one
+// made by the last run of the same code is unreachable by now, only its
+// local held it and the assignment replaces it.
+static void asm_f_owned(asm_ctx_t* ctx, asm_alloc_t* alloc) {
+    asm_emit(ctx->out, "    mov rdi, [rbp-%d]\n"
+                       "    mov [rbp-%d], rax\n"
+                       "    push rax\n"
+                       "    call __skull_free\n"
+                       "    pop rax\n", alloc->offset, alloc->offset);
+}
+
+// len(array) and array(length), the latter allocates zeroed elements, of
+// the record an array of records is expected to hold
+static bool asm_f_array_builtin(asm_ctx_t* ctx, ast_t* ast) {
+    bool len = strcmp(ast->name, "len") == 0;
+    if (!len && strcmp(ast->name, "array") != 0) return false;
+    record_t* record = len ? NULL : ctx->new_records;
+    ctx->new_records = NULL;
+
+    size_t count = ast->value && ast->value->children ? ast->value->children->size : 0;
+    if (count != 1) {
+        fprintf(stderr, "ERROR: '%s' takes 1 argument but %zu were given\n", ast->name, count);
+        exit(1);
+    }
+
+    ast_t* arg = (ast_t*) ast->value->children->items[0];
+    asm_alloc_t* alloc = len ? NULL : asm_find_alloc(ctx, ast);
+    if (alloc && alloc->on_stack) {
+        long words = record ? (arg->int_value * record->element_size + 7) / 8 : arg->int_value;
+        asm_f_stack_array(ctx, alloc, arg->int_value, words);
+        return true;
+    }
+
+    asm_f(ctx, arg);
+    if (len) {
+        int type = asm_type_of(ctx, arg);
+        if (type && !type_is_array(type)) asm_error("len() of a value that is not an array", arg->name);
+        asm_emit(ctx->out, "    mov rax, [rax-8]\n");
+    } else if (record) {
+        asm_emit(ctx->out, "    mov rdi, rax\n"
+                           "    mov esi, %d\n"
+                           "    call __skull_records_new\n", record->element_size);
+        if (alloc) asm_f_owned(ctx, alloc);
+        ctx->arrays = true;
+    } else {
+        asm_emit(ctx->out, "    mov rdi, rax\n"
+                           "    call __skull_array_new\n");
+        if (alloc) asm_f_owned(ctx, alloc);
+        ctx->arrays = true;
+    }
+    return true;
+}
+
+// Evaluates an argument for a parameter of type onto the stack, floats as
+// their bits. Ints passed for floats are converted.
+static void asm_push_arg(asm_ctx_t* ctx, ast_t* arg, int type, const char* function) {
+    if (type_is_float(type)) {
+        asm_f_as_float(ctx, arg);
+        asm_push_float(ctx);
+        return;
+    }
+    if (type_is_float(asm_type_of(ctx, arg))) {
+        asm_error("Floats only become ints through int(), in a call to", function);
+    }
+    if (asm_record(ctx, asm_type_of(ctx, arg))) {
+        asm_error("Records are only passed for parameters of their type, in a call to", function);
+    }
+    asm_f_expecting(ctx, arg, type);
+    asm_emit(ctx->out, "    push rax\n");
+    ctx->depth++;
+}
+
+// Whether ast stores to the local called name or declares it anew
+static bool asm_writes(ast_t* ast, const char* name) {
+    if (!ast) return false;
+    if ((ast->type == AST_ASSIGNMENT || (ast->type == AST_VARIABLE && ast->data_type)) && strcmp(ast->name, name) == 0) {
+        return true;
+    }
+    if (ast->type == AST_FIELD_ASSIGNMENT) {
+        ast_t* base = ((ast_t*) ast->children->items[0])->value;
+        if (base->type == AST_VARIABLE && strcmp(base->name, name) == 0) return true;
+    }
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            if (asm_writes((ast_t*) ast->children->items[i], name)) return true;
+        }
+    }
+    return asm_writes(ast->value, name);
+}
+
+// Evaluates argument i of call, a record, to a slot holding it until the
+// call. A local is passed from its own slot unless a later argument
+// assigns it.
+static int asm_f_record_arg(asm_ctx_t* ctx, ast_t* call, size_t i, record_t* record) {
+    ast_t* arg = asm_arg(call, i);
+    if (asm_type_of(ctx, arg) != record->type) {
+        asm_error("Argument does not match the record type of a parameter of", call->name);
+    }
+
+    asm_local_t* local = arg->type == AST_VARIABLE && !arg->data_type ? asm_find_local(ctx, arg->name) : NULL;
+    bool written = false;
+    for (size_t j = i + 1; local && j < asm_arg_count(call); j++) {
+        if (asm_writes(asm_arg(call, j), arg->name)) written = true;
+    }
+    if (local && !written) return local->offset;
+
+    int temp = asm_f_record(ctx, arg);
+    if (temp) return temp;
+    asm_local_t* copy = asm_add_local(ctx, "", record->type);
+    asm_copy(ctx, "rbp", -copy->offset, "rax", 0, record->size);
+    return copy->offset;
+}
+
+// Arguments are evaluated left to right onto the stack, then popped
+// into the System V argument registers
+void asm_f_call(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_call");
+    if (strcmp(ast->name, "return") == 0) {
+        asm_f_return(ctx, ast);
+        return;
+    }
+
+    module_symbol_t* symbol = module_interface_find(ctx->symbols, ast->name);
+    record_t* record = symbol ? NULL : record_named(ctx->records, ast->name);
+    if (record) {
+        asm_local_t* temp = asm_add_local(ctx, "", record->type);
+        asm_f_construct(ctx, ast, record, temp->offset);
+        asm_emit(ctx->out, "    lea rax, [rbp-%d]\n", temp->offset);
+        ctx->record_temp = temp->offset;
+        return;
+    }
+    if (!symbol && asm_f_builtin(ctx, ast)) return;
+    if (!symbol) asm_error("Call to undefined function", ast->name);
+    if (symbol->kind != MODULE_SYMBOL_FUNCTION) asm_error("Called object is not a function", ast->name);
+
+    size_t count = ast->value && ast->value->children ? ast->value->children->size : 0;
+    if ((int) count != symbol->param_count) {
+        fprintf(stderr, "ERROR: '%s' takes %d arguments but %zu were given\n", ast->name, symbol->param_count, count);
+        exit(1);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        asm_check_scalar(ctx, (ast_t*) ast->value->children->items[i], ast->name);
+    }
+
+    char key[1024];
+    snprintf(key, sizeof(key), "call:%s:%s:%d", ctx->function, ast->name, ctx->call_site++);
+
+    // Calls that compute the same value every time are replaced by it
+    if (asm_f_constant(ctx, ast)) return;
+
+    // Generic functions are called through their instance for these arguments
+    ast_t* callee = asm_find_function(ctx, ast->name);
+    asm_instance_t* instance = asm_is_generic(callee) ? asm_instantiate(ctx, callee, ast) : NULL;
+
+    // Hot calls to small functions of this module are inlined, and without
+    // a profile calls to tiny functions that call nothing themselves
+    if (callee && !asm_is_generic(callee) && ctx->inline_depth < ASM_MAX_INLINE_DEPTH &&
+        strcmp(callee->name, ctx->function) != 0 && !asm_has_records(ctx, callee) &&
+        ((ctx->profile && asm_count_statements(callee->value->value) <= ASM_INLINE_MAX_NODES &&
+          profile_is_hot(ctx->profile, profile_count(ctx->profile, key))) ||
+         (ctx->inline_small && !ctx->instrument && !asm_calls_functions(ctx, callee->value->value) &&
+          asm_count_statements(callee->value->value) <= ASM_INLINE_SMALL_NODES))) {
+        asm_f_inline(ctx, ast, callee);
+        return;
+    }
+
+    // Ints go to the System V integer registers and floats to xmm0 to
+    // xmm7, each class numbered on its own. Records and what finds no
+    // register wait in slots of the frame.
+    int types[MODULE_MAX_PARAMS] = {0};
+    asm_arg_t args[MODULE_MAX_PARAMS];
+    int slots[MODULE_MAX_PARAMS];
+    for (size_t i = 0; i < count; i++) {
+        types[i] = type_substitute(symbol->param_types[i], instance ? instance->types : NULL);
+    }
+    record_t* returned = asm_record(ctx, type_substitute(symbol->data_type, instance ? instance->types : NULL));
+    bool hidden = returned && returned->classes[0] == RECORD_MEMORY;
+    int stack = asm_classify(ctx, types, count, hidden, args);
+    for (size_t i = 0; i < count; i++) {
+        if (args[i].record) {
+            slots[i] = asm_f_record_arg(ctx, ast, i, args[i].record);
+            continue;
+        }
+        asm_push_arg(ctx, (ast_t*) ast->value->children->items[i], types[i], ast->name);
+        if (args[i].stack >= 0) {
+            slots[i] = asm_add_local(ctx, "", typename_to_int("int"))->offset;
+            asm_emit(ctx->out, "    pop qword [rbp-%d]\n", slots[i]);
+            ctx->depth--;
+        }
+    }
+    if (ctx->instrument) asm_count(ctx, key);
+    for (size_t i = count; i > 0; i--) {
+        asm_arg_t* arg = &args[i - 1];
+        if (arg->record || arg->stack >= 0) continue;
+        if (type_is_float(types[i - 1])) {
+            asm_pop_float(ctx, arg->regs[0]);
+        } else {
+            asm_emit(ctx->out, "    pop %s\n", asm_arg_regs[arg->regs[0]]);
+            ctx->depth--;
+        }
+    }
+
+    // Calls nested in arguments of an outer call see its pushes, the stack
+    // arguments go below them on a 16 byte boundary
+    int area = stack + (ctx->depth * 8 + stack) % 16;
+    if (area) asm_emit(ctx->out, "    sub rsp, %d\n", area);
+    for (size_t i = 0; i < count; i++) {
+        asm_arg_t* arg = &args[i];
+        if (arg->stack >= 0) {
+            asm_copy(ctx, "rsp", arg->stack, "rbp", -slots[i], arg->record ? arg->record->size : 8);
+            continue;
+        }
+        for (int k = 0; arg->record && k < record_eightbytes(arg->record); k++) {
+            if (arg->record->classes[k] == RECORD_SSE) {
+                asm_emit(ctx->out, "    %smovsd xmm%d, [rbp-%d]\n", asm_vex(ctx), arg->regs[k], slots[i] - 8 * k);
+            } else {
+                asm_emit(ctx->out, "    mov %s, [rbp-%d]\n", asm_arg_regs[arg->regs[k]], slots[i] - 8 * k);
+            }
+        }
+    }
+    int result = returned ? asm_add_local(ctx, "", returned->type)->offset : 0;
+    if (hidden) asm_emit(ctx->out, "    lea rdi, [rbp-%d]\n", result);
+    asm_emit(ctx->out, "    call %s\n", instance ? instance->name : ast->name);
+    if (area) asm_emit(ctx->out, "    add rsp, %d\n", area);
+
+    // A record returned in registers is stored to a temporary like one
+    // returned in memory
+    if (!returned) return;
+    int ints = 0, floats = 0;
+    for (int k = 0; !hidden && k < record_eightbytes(returned); k++) {
+        if (returned->classes[k] == RECORD_SSE) {
+            asm_emit(ctx->out, "    %smovsd [rbp-%d], xmm%d\n", asm_vex(ctx), result - 8 * k, floats++);
+        } else {
+            asm_emit(ctx->out, "    mov [rbp-%d], %s\n", result - 8 * k, ints++ ? "rdx" : "rax");
+        }
+    }
+    asm_emit(ctx->out, "    lea rax, [rbp-%d]\n", result);
+    ctx->record_temp = result;
+}
+
+// Puts the record ast evaluates to where the caller expects it: by class
+// of its eightbytes in rax and rdx or xmm0 and xmm1, or copied to the
+// memory the caller passed
+static void asm_f_record_return(asm_ctx_t* ctx, ast_t* ast, record_t* record) {
+    if (asm_type_of(ctx, ast) != record->type) asm_error("Returned value does not match the return type of", ctx->function);
+
+    bool local = ast->type == AST_VARIABLE && !ast->data_type && asm_find_local(ctx, ast->name);
+    int temp = asm_f_record(ctx, ast);
+    if (record->classes[0] == RECORD_MEMORY) {
+        asm_emit(ctx->out, "    mov rdx, [rbp-%d]\n", ctx->return_slot);
+        asm_copy(ctx, "rdx", 0, "rax", 0, record->size);
+        asm_emit(ctx->out, "    mov rax, rdx\n");
+        return;
+    }
+
+    // Whole words are only read from slots, the last element of an array
+    // may end its memory
+    if (!temp && !local && record->size % 8) {
+        asm_local_t* copy = asm_add_local(ctx, "", record->type);
+        asm_copy(ctx, "rbp", -copy->offset, "rax", 0, record->size);
+        asm_emit(ctx->out, "    lea rax, [rbp-%d]\n", copy->offset);
+    }
+    asm_emit(ctx->out, "    mov r10, rax\n");
+    int ints = 0, floats = 0;
+    for (int k = 0; k < record_eightbytes(record); k++) {
+        if (record->classes[k] == RECORD_SSE) {
+            asm_emit(ctx->out, "    %smovsd xmm%d, [r10+%d]\n", asm_vex(ctx), floats++, 8 * k);
+        } else {
+            asm_emit(ctx->out, "    mov %s, [r10+%d]\n", ints++ ? "rdx" : "rax", 8 * k);
+        }
+    }
+}
+
+void asm_f_return(asm_ctx_t* ctx, ast_t* ast) {
+    record_t* record = asm_record(ctx, ctx->return_type);
+    if (ast->value && record) {
+        asm_f_record_return(ctx, ast->value, record);
+    } else if (ast->value && type_is_float(ctx->return_type)) {
+        asm_check_scalar(ctx, ast->value, ctx->function);
+        asm_f_as_float(ctx, ast->value);
+    } else if (ast->value) {
+        asm_check_scalar(ctx, ast->value, ctx->function);
+        if (type_is_float(asm_type_of(ctx, ast->value))) {
+            asm_error("Floats only become ints through int(), returning from", ctx->function);
+        }
+        if (asm_record(ctx, asm_type_of(ctx, ast->value))) {
+            asm_error("Returned value does not match the return type of", ctx->function);
+        }
+        asm_f_expecting(ctx, ast->value, ctx->return_type);
+    } else {
+        asm_f_zero_return(ctx);
+    }
+
+    // Drop anything an enclosing call left pushed
+    if (ctx->depth > ctx->return_depth) {
+        asm_emit(ctx->out, "    add rsp, %d\n", (ctx->depth - ctx->return_depth) * 8);
+    }
+    asm_emit(ctx->out, "    jmp %s\n", ctx->return_label);
+}
+
+// Emits the body of callee in place of the call. The arguments are bound to
+// fresh slots of the caller's frame and `return` jumps past the body.
+void asm_f_inline(asm_ctx_t* ctx, ast_t* ast, ast_t* callee) {
+    ast_t* function = callee->value;
+    size_t count = ast->value && ast->value->children ? ast->value->children->size : 0;
+
+    // Every argument is evaluated before any parameter name is visible
+    for (size_t i = 0; i < count; i++) {
+        ast_t* param = (ast_t*) function->children->items[i];
+        asm_push_arg(ctx, (ast_t*) ast->value->children->items[i], param->data_type, callee->name);
+    }
+
+    // Floats were pushed as their bits, which the slot takes as they are
+    size_t scope_start = ctx->scope_start;
+    ctx->scope_start = ctx->locals->size;
+    for (size_t i = count; i > 0; i--) {
+        ast_t* param = (ast_t*) function->children->items[i - 1];
+        asm_local_t* local = asm_add_local(ctx, param->name, param->data_type);
+        asm_emit(ctx->out, "    pop rax\n"
+                           "    mov [rbp-%d], rax\n", local->offset);
+        asm_forget(ctx, local->offset);
+        ctx->depth--;
+    }
+
+    char return_label[32];
+    int return_depth = ctx->return_depth;
+    int return_type = ctx->return_type;
+    const char* caller = ctx->function;
+    const char* line_source = ctx->line_source;
+    int call_site = ctx->call_site;
+    int branch_site = ctx->branch_site;
+    memcpy(return_label, ctx->return_label, sizeof(return_label));
+
+    snprintf(ctx->return_label, sizeof(ctx->return_label), ".inline_%d", ctx->label_count++);
+    ctx->return_depth = ctx->depth;
+    ctx->return_type = function->data_type;
+    ctx->function = callee->name;
+    ctx->line_source = asm_origin(ctx, function);
+    ctx->call_site = 0;
+    ctx->branch_site = 0;
+    ctx->inline_depth++;
+
+    // Objects that stay in the callee get slots of the caller's frame, laid
+    // out as asm_f_function would above the callee's locals
+    size_t first_alloc = ctx->allocations->size;
+    int allocated = 0;
+    asm_find_allocations(ctx, function, function->value, &allocated);
+    int base = 0;
+    for (int i = 0; i < allocated; i += 8) {
+        int offset = asm_add_local(ctx, "", typename_to_int("int"))->offset;
+        if (i == 0) base = offset - 8;
+    }
+    bool frees = false;
+    for (size_t i = first_alloc; i < ctx->allocations->size; i++) {
+        asm_alloc_t* alloc = (asm_alloc_t*) ctx->allocations->items[i];
+        alloc->offset += base;
+        if (!alloc->on_stack) {
+            asm_emit(ctx->out, "    mov qword [rbp-%d], 0\n", alloc->offset);
+            frees = true;
+        }
+    }
+
+    asm_emit(ctx->out, "    ; inlined %s\n", callee->name);
+    if (function->value) asm_f(ctx, function->value);
+    asm_f_zero_return(ctx);
+    asm_emit(ctx->out, "%s:\n", ctx->return_label);
+
+    // and the heap ones are freed where the body returns to the caller,
+    // records are never inlined so rax or xmm0 holds the result
+    if (frees) {
+        asm_emit(ctx->out, "    push rax\n"
+                           "    sub rsp, 8\n"
+                           "    movsd [rsp], xmm0\n");
+        for (size_t i = first_alloc; i < ctx->allocations->size; i++) {
+            asm_alloc_t* alloc = (asm_alloc_t*) ctx->allocations->items[i];
+            if (!alloc->on_stack) asm_emit(ctx->out, "    mov rdi, [rbp-%d]\n"
+                                                     "    call __skull_free\n", alloc->offset);
+        }
+        asm_emit(ctx->out, "    movsd xmm0, [rsp]\n"
+                           "    add rsp, 8\n"
+                           "    pop rax\n");
+    }
+    while (ctx->allocations->size > first_alloc) {
+        free(ctx->allocations->items[--ctx->allocations->size]);
+    }
+
+    ctx->inline_depth--;
+    ctx->return_type = return_type;
+    ctx->call_site = call_site;
+    ctx->branch_site = branch_site;
+    ctx->line_source = line_source;
+    ctx->function = caller;
+    ctx->return_depth = return_depth;
+    memcpy(ctx->return_label, return_label, sizeof(return_label));
+
+    // The callee's locals go out of scope, their slots stay in the frame
+    while (ctx->locals->size > ctx->scope_start) {
+        asm_local_t* local = (asm_local_t*) ctx->locals->items[--ctx->locals->size];
+        free(local->name);
+        free(local);
+    }
+    ctx->scope_start = scope_start;
+}
+
+void asm_f_int(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_int");
+    asm_emit(ctx->out, "    mov rax, %d\n", ast->int_value);
+}
+
+void asm_f_float(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_float");
+    asm_float_constant(ctx, ast->name, 0);
+}
+
+// String literals are NUL terminated bytes in .rodata, like argv's strings
+void asm_f_string(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_string");
+    int id = ctx->label_count++;
+    asm_emit(&ctx->rodata, "__skull_str_%d: db ", id);
+    for (const unsigned char* c = (const unsigned char*) ast->name; *c; c++) {
+        asm_emit(&ctx->rodata, "%u, ", *c);
+    }
+    asm_emit(&ctx->rodata, "0\n");
+    asm_emit(ctx->out, "    lea rax, [__skull_str_%d]\n", id);
+}
+
+// Loads the array called name into rcx, returns its slot or NULL for a global
+static asm_local_t* asm_load_array(asm_ctx_t* ctx, const char* name) {
+    asm_local_t* local = asm_find_local(ctx, name);
+    module_symbol_t* symbol = local ? NULL : module_interface_find(ctx->symbols, name);
+    if (!local && (!symbol || symbol->kind != MODULE_SYMBOL_GLOBAL)) {
+        asm_error(symbol ? "Function used as a value" : "Undefined variable", name);
+    }
+
+    int type = local ? local->data_type : symbol->data_type;
+    if (type && !type_is_array(type)) asm_error("Indexed value is not an array", name);
+
+    if (local) {
+        asm_emit(ctx->out, "    mov rcx, [rbp-%d]\n", local->offset);
+    } else {
+        asm_emit(ctx->out, "    mov rcx, [%s]\n", name);
+    }
+    return local;
+}
+
+// Whether the facts gathered so far prove the count elements from index on
+// within the array in slot array. Globals are never proven, any call may
+// replace them.
+static bool asm_index_in_range(asm_ctx_t* ctx, asm_local_t* array, ast_t* index, int count) {
+    if (!array) return false;
+    if (index->type == AST_INT) return index->int_value >= 0 && index->int_value + (long) count <= array->length;
+    if (index->type != AST_VARIABLE || index->data_type || count != 1) return false;
+
+    asm_local_t* local = asm_find_local(ctx, index->name);
+    if (!local) return false;
+    for (size_t i = 0; i < ctx->facts->size; i++) {
+        asm_fact_t* fact = (asm_fact_t*) ctx->facts->items[i];
+        if (fact->array == array->offset && fact->index == local->offset) return true;
+    }
+    return false;
+}
+
+// Checks count elements from the index in rax on against the length of the
+// array in rcx, negative indices compare as huge. Past a passing check the
+// index stays in range until either slot is stored to again.
+static void asm_check_index(asm_ctx_t* ctx, asm_local_t* array, ast_t* index, int count) {
+    if (count == 1) {
+        asm_emit(ctx->out, "    cmp rax, [rcx-8]\n"
+                           "    jae __skull_bounds_fail\n");
+    } else {
+        asm_emit(ctx->out, "    mov rdx, [rcx-8]\n"
+                           "    sub rdx, %d\n"
+                           "    jb __skull_bounds_fail\n"
+                           "    cmp rax, rdx\n"
+                           "    ja __skull_bounds_fail\n", count);
+    }
+    ctx->arrays = true;
+    if (!array) return;
+
+    if (index->type == AST_INT) {
+        if (index->int_value >= 0) array->length = MAX(array->length, index->int_value + (long) count);
+        return;
+    }
+
+    asm_local_t* local = index->type == AST_VARIABLE && !index->data_type ? asm_find_local(ctx, index->name) : NULL;
+    if (local) asm_add_fact(ctx, array->offset, local->offset);
+}
+
+// Slot of the vector local called name whose lane index is accessed,
+// NULL when name is not a vector
+static asm_local_t* asm_find_lane(asm_ctx_t* ctx, const char* name, ast_t* index) {
+    asm_local_t* local = asm_find_local(ctx, name);
+    if (!local || !type_is_vector(local->data_type)) return NULL;
+
+    if (index->type != AST_INT || index->int_value < 0 || index->int_value >= type_lanes(local->data_type)) {
+        asm_error("Lanes of a vector are indexed with a constant below its lane count", name);
+    }
+    return local;
+}
+
+// Points reg at the element of the array of records in rcx whose index is
+// in rax
+static void asm_element_address(asm_ctx_t* ctx, record_t* record, const char* reg) {
+    int size = record->element_size;
+    if (size == 1 || size == 2 || size == 4 || size == 8) {
+        asm_emit(ctx->out, "    lea %s, [rcx+rax*%d]\n", reg, size);
+    } else {
+        asm_emit(ctx->out, "    imul %s, rax, %d\n"
+                           "    add %s, rcx\n", reg, size, reg);
+    }
+}
+
+// Address of field in the element of the array of records in rcx whose
+// index is in rax. Arrays of a record(soa) keep one column per field, each
+// starting at the length times the bytes of the columns before it.
+static void asm_element_field(asm_ctx_t* ctx, record_t* record, record_field_t* field, char* address, size_t size) {
+    int element = record->element_size;
+    if (record->layout != RECORD_SOA && (element == 1 || element == 2 || element == 4 || element == 8)) {
+        snprintf(address, size, "rcx+rax*%d+%d", element, field->offset);
+    } else if (record->layout != RECORD_SOA) {
+        asm_element_address(ctx, record, "rdx");
+        snprintf(address, size, "rdx+%d", field->offset);
+    } else if (field->column) {
+        asm_emit(ctx->out, "    imul rdx, [rcx-8], %d\n"
+                           "    add rdx, rcx\n", field->column);
+        snprintf(address, size, "rdx+rax*%d", field->size);
+    } else {
+        snprintf(address, size, "rcx+rax*%d", field->size);
+    }
+}
+
+// Copies field from src to dst through r11
+static void asm_move_field(asm_ctx_t* ctx, record_field_t* field, const char* dst, const char* src) {
+    if (field->size == 1) {
+        asm_emit(ctx->out, "    mov r11b, byte [%s]\n"
+                           "    mov byte [%s], r11b\n", src, dst);
+    } else {
+        asm_emit(ctx->out, "    mov r11, [%s]\n"
+                           "    mov [%s], r11\n", src, dst);
+    }
+}
+
+// `name[index]`, elements are 8 bytes wide. Lanes of vectors are read
+// straight from their slot, float lanes widened to a float. Records are
+// used through their address, the fields of an element of a record(soa)
+// array gathered into a temporary.
+void asm_f_index(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_index");
+    ast_t* index = ast->value;
+    asm_local_t* vector = asm_find_lane(ctx, ast->name, index);
+    if (vector) {
+        int offset = vector->offset - index->int_value * 4;
+        if (type_is_float_vector(vector->data_type)) {
+            char lane[32];
+            snprintf(lane, sizeof(lane), "dword [rbp-%d]", offset);
+            asm_float_insn(ctx, "cvtss2sd", lane);
+        } else {
+            asm_emit(ctx->out, "    movsxd rax, dword [rbp-%d]\n", offset);
+        }
+        return;
+    }
+
+    asm_f(ctx, index);
+    asm_local_t* array = asm_load_array(ctx, ast->name);
+    if (!asm_index_in_range(ctx, array, index, 1)) {
+        asm_check_index(ctx, array, index, 1);
+    }
+    record_t* record = asm_record(ctx, asm_type_of(ctx, ast));
+    if (record && record->layout == RECORD_SOA) {
+        asm_local_t* temp = asm_add_local(ctx, "", record->type);
+        for (size_t i = 0; i < record->field_count; i++) {
+            char src[32], dst[32];
+            asm_element_field(ctx, record, &record->fields[i], src, sizeof(src));
+            snprintf(dst, sizeof(dst), "rbp-%d", temp->offset - record->fields[i].offset);
+            asm_move_field(ctx, &record->fields[i], dst, src);
+        }
+        asm_emit(ctx->out, "    lea rax, [rbp-%d]\n", temp->offset);
+        ctx->record_temp = temp->offset;
+        return;
+    }
+    if (record) {
+        asm_element_address(ctx, record, "rax");
+        ctx->record_temp = 0;
+        return;
+    }
+    if (type_is_float(asm_type_of(ctx, ast))) {
+        asm_emit(ctx->out, "    %smovsd xmm0, [rcx+rax*8]\n", asm_vex(ctx));
+    } else {
+        asm_emit(ctx->out, "    mov rax, [rcx+rax*8]\n");
+    }
+}
+
+// `name[index] = value` of a record copies it to the element, a field at a
+// time for record(soa). Evaluates to the address of the value.
+static void asm_f_record_store(asm_ctx_t* ctx, ast_t* ast, ast_t* index, record_t* record) {
+    if (asm_type_of(ctx, ast->value) != record->type) {
+        asm_error("Assigned value does not match the record type of the elements of", ast->name);
+    }
+    asm_f_record(ctx, ast->value);
+    asm_emit(ctx->out, "    push rax\n");
+    ctx->depth++;
+    asm_f(ctx, index);
+    asm_emit(ctx->out, "    pop r10\n");
+    ctx->depth--;
+
+    asm_local_t* array = asm_load_array(ctx, ast->name);
+    if (!asm_index_in_range(ctx, array, index, 1)) {
+        asm_check_index(ctx, array, index, 1);
+    }
+    if (record->layout == RECORD_SOA) {
+        for (size_t i = 0; i < record->field_count; i++) {
+            char src[32], dst[32];
+            asm_element_field(ctx, record, &record->fields[i], dst, sizeof(dst));
+            snprintf(src, sizeof(src), "r10+%d", record->fields[i].offset);
+            asm_move_field(ctx, &record->fields[i], dst, src);
+        }
+    } else {
+        asm_element_address(ctx, record, "rdx");
+        asm_copy(ctx, "rdx", 0, "r10", 0, record->size);
+    }
+    asm_emit(ctx->out, "    mov rax, r10\n");
+    ctx->record_temp = 0;
+}
+
+// `name[index] = expr`, evaluates to the stored value. Floats are stored
+// as their bits.
+void asm_f_index_assignment(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_index_assignment");
+    ast_t* index = (ast_t*) ast->children->items[0];
+    ast_t target = *ast;
+    target.type = AST_INDEX;
+    target.value = index;
+    record_t* record = asm_record(ctx, asm_type_of(ctx, &target));
+    if (record) {
+        asm_f_record_store(ctx, ast, index, record);
+        return;
+    }
+    int type = asm_type_of(ctx, ast->value);
+    asm_check_scalar(ctx, ast->value, ast->name);
+    asm_f(ctx, ast->value);
+
+    asm_local_t* vector = asm_find_lane(ctx, ast->name, index);
+    if (vector) {
+        int offset = vector->offset - index->int_value * 4;
+        if (type_is_float_vector(vector->data_type)) {
+            asm_float_insn(ctx, type_is_float(type) ? "cvtsd2ss" : "cvtsi2ss", type_is_float(type) ? "xmm0" : "rax");
+            asm_emit(ctx->out, "    %smovss [rbp-%d], xmm0\n", asm_vex(ctx), offset);
+        } else if (type_is_float(type)) {
+            asm_error("Floats only become ints through int(), assigning to a lane of", ast->name);
+        } else {
+            asm_emit(ctx->out, "    mov [rbp-%d], eax\n", offset);
+        }
+        return;
+    }
+
+    // The element type is the indexed expression's
+    ast_t element = *ast;
+    element.type = AST_INDEX;
+    element.value = index;
+    int element_type = asm_type_of(ctx, &element);
+    asm_convert(ctx, type, element_type, ast->name);
+    if (type_is_float(element_type)) asm_emit(ctx->out, "    %smovq rax, xmm0\n", asm_vex(ctx));
+
+    asm_emit(ctx->out, "    push rax\n");
+    ctx->depth++;
+    asm_f(ctx, index);
+    asm_emit(ctx->out, "    pop rdx\n");
+    ctx->depth--;
+
+    asm_local_t* array = asm_load_array(ctx, ast->name);
+    if (!asm_index_in_range(ctx, array, index, 1)) {
+        asm_check_index(ctx, array, index, 1);
+    }
+    asm_emit(ctx->out, "    mov [rcx+rax*8], rdx\n"
+                       "    mov rax, rdx\n");
+    if (type_is_float(element_type)) asm_emit(ctx->out, "    %smovq xmm0, rax\n", asm_vex(ctx));
+}
+
+// The field ast names, of the record its value is, in *record
+static record_field_t* asm_find_field(asm_ctx_t* ctx, ast_t* ast, record_t** record) {
+    *record = asm_record(ctx, asm_type_of(ctx, ast->value));
+    if (!*record) asm_error("Field of a value that is not a record", ast->name);
+    record_field_t* field = record_field(*record, ast->name);
+    if (!field) {
+        fprintf(stderr, "ERROR: Record '%s' has no field '%s'\n", (*record)->name, ast->name);
+        exit(1);
+    }
+    return field;
+}
+
+// Address of field in the record base: in a local's slot, in an element of
+// an array of records, or for any other record value at its address in
+// rax. Only the first two can be stored to.
+static void asm_f_field_address(asm_ctx_t* ctx, ast_t* base, record_t* record, record_field_t* field, bool store,
+                                char* address, size_t size) {
+    asm_local_t* local = base->type == AST_VARIABLE && !base->data_type ? asm_find_local(ctx, base->name) : NULL;
+    if (local) {
+        snprintf(address, size, "rbp-%d", local->offset - field->offset);
+        return;
+    }
+    if (base->type == AST_INDEX) {
+        asm_f(ctx, base->value);
+        asm_local_t* array = asm_load_array(ctx, base->name);
+        if (!asm_index_in_range(ctx, array, base->value, 1)) {
+            asm_check_index(ctx, array, base->value, 1);
+        }
+        asm_element_field(ctx, record, field, address, size);
+        return;
+    }
+    if (store) asm_error("Fields are assigned in local records and array elements only, field", field->name);
+    asm_f_record(ctx, base);
+    snprintf(address, size, "rax+%d", field->offset);
+}
+
+// `value.name`, bytes widened to an int
+void asm_f_field(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_field");
+    record_t* record;
+    record_field_t* field = asm_find_field(ctx, ast, &record);
+    char address[64];
+    asm_f_field_address(ctx, ast->value, record, field, false, address, sizeof(address));
+    asm_load_field(ctx, field, address);
+}
+
+// `value.name = expr`, evaluates to the stored value. The value is computed
+// before the index of an element, like for `name[index] = expr`.
+void asm_f_field_assignment(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_field_assignment");
+    ast_t* target = (ast_t*) ast->children->items[0];
+    record_t* record;
+    record_field_t* field = asm_find_field(ctx, target, &record);
+    int type = asm_type_of(ctx, ast->value);
+    if (asm_record(ctx, type) || type_is_vector(type)) {
+        asm_error("Assigned value does not match the type of field", field->name);
+    }
+
+    bool is_float = type_is_float(field->data_type);
+    if (is_float) {
+        asm_f_as_float(ctx, ast->value);
+        asm_emit(ctx->out, "    %smovq rax, xmm0\n", asm_vex(ctx));
+    } else {
+        if (type_is_float(type)) asm_error("Floats only become ints through int(), assigning to field", field->name);
+        asm_f_expecting(ctx, ast->value, field->data_type);
+    }
+
+    char address[64];
+    if (target->value->type != AST_INDEX) {
+        asm_f_field_address(ctx, target->value, record, field, true, address, sizeof(address));
+        asm_store_field(ctx, field, address, "rax", "al");
+        return;
+    }
+    asm_emit(ctx->out, "    push rax\n");
+    ctx->depth++;
+    asm_f_field_address(ctx, target->value, record, field, true, address, sizeof(address));
+    asm_emit(ctx->out, "    pop r10\n");
+    ctx->depth--;
+    asm_store_field(ctx, field, address, "r10", "r10b");
+    asm_emit(ctx->out, "    mov rax, r10\n");
+    if (is_float) asm_emit(ctx->out, "    %smovq xmm0, rax\n", asm_vex(ctx));
+}
+
+// Spills vector register 0 on top of the pushed values, always 32 bytes
+// so depth keeps counting 8 byte slots
+static void asm_push_vector(asm_ctx_t* ctx, int type) {
+    asm_emit(ctx->out, "    sub rsp, 32\n"
+                       "    %s [rsp], %s\n", asm_vmove(ctx, type), asm_vreg(type, 0));
+    ctx->depth += 4;
+}
+
+static void asm_pop_vector(asm_ctx_t* ctx, int type, int n) {
+    asm_emit(ctx->out, "    %s %s, [rsp]\n"
+                       "    add rsp, 32\n", asm_vmove(ctx, type), asm_vreg(type, n));
+    ctx->depth -= 4;
+}
+
+// Broadcasts the scalar of type from, an int in rax or a float in xmm0, to
+// every lane of register 0
+static void asm_vector_splat(asm_ctx_t* ctx, int type, int from) {
+    bool is_float = type_is_float_vector(type);
+    if (type_is_float(from) && !is_float) {
+        asm_error("Floats only become ints through int(), broadcasting to", "vector");
+    }
+    if (type_is_float(from)) {
+        asm_float_insn(ctx, "cvtsd2ss", "xmm0");
+        if (ctx->isa == ASM_ISA_AVX2) {
+            asm_emit(ctx->out, "    vbroadcastss %s, xmm0\n", asm_vreg(type, 0));
+        } else {
+            asm_emit(ctx->out, "    shufps xmm0, xmm0, 0\n");
+        }
+        return;
+    }
+    if (ctx->isa == ASM_ISA_AVX2) {
+        asm_emit(ctx->out, is_float ? "    vcvtsi2ss xmm0, xmm0, rax\n"
+                                      "    vbroadcastss %s, xmm0\n"
+                                    : "    vmovd xmm0, eax\n"
+                                      "    vpbroadcastd %s, xmm0\n", asm_vreg(type, 0));
+    } else {
+        asm_emit(ctx->out, is_float ? "    cvtsi2ss xmm0, rax\n"
+                                      "    shufps xmm0, xmm0, 0\n"
+                                    : "    movd xmm0, eax\n"
+                                      "    pshufd xmm0, xmm0, 0\n");
+    }
+}
+
+// Converts register 0 between int and float lanes, float to int truncates
+static void asm_vector_convert(asm_ctx_t* ctx, int type, bool to_float) {
+    const char* insn = to_float ? "cvtdq2ps" : "cvttps2dq";
+    if (ctx->isa == ASM_ISA_AVX2) {
+        asm_emit(ctx->out, "    v%s %s, %s\n", insn, asm_vreg(type, 0), asm_vreg(type, 0));
+    } else {
+        asm_emit(ctx->out, "    %s xmm0, xmm0\n", insn);
+    }
+}
+
+// Emits lanes 32 bit values to .rodata, returns the id of their label
+static int asm_vector_rodata(asm_ctx_t* ctx, const uint32_t* values, int lanes) {
+    int id = ctx->label_count++;
+    asm_emit(&ctx->rodata, "align 32\n"
+                           "__skull_vconst_%d: dd ", id);
+    for (int i = 0; i < lanes; i++) {
+        asm_emit(&ctx->rodata, i ? ", 0x%08x" : "0x%08x", values[i]);
+    }
+    asm_emit(&ctx->rodata, "\n");
+    return id;
+}
+
+// Evaluates ast into register 0 as a vector of type, scalars are broadcast
+static void asm_f_vector(asm_ctx_t* ctx, ast_t* ast, int type) {
+    int ast_type = asm_type_of(ctx, ast);
+    if (type_is_vector(ast_type) && ast_type != type) {
+        asm_error("Mismatched vector types in expression", ast->name);
+    }
+
+    asm_f(ctx, ast);
+    if (!type_is_vector(ast_type)) asm_vector_splat(ctx, type, ast_type);
+}
+
+static void asm_expect_args(ast_t* ast, size_t count) {
+    if (asm_arg_count(ast) != count) {
+        fprintf(stderr, "ERROR: '%s' takes %zu arguments but %zu were given\n", ast->name, count, asm_arg_count(ast));
+        exit(1);
+    }
+}
+
+// `type(xs, i)`, the lanes from xs[i] on with every element narrowed to
+// 32 bits: the low half of each 8 byte element is packed together
+static void asm_f_vector_load(asm_ctx_t* ctx, ast_t* ast, int type) {
+    ast_t* array_ast = asm_arg(ast, 0);
+    ast_t* index = asm_arg(ast, 1);
+    int lanes = type_lanes(type);
+    if (array_ast->type != AST_VARIABLE) asm_error("Vectors are loaded from an array variable", ast->name);
+
+    asm_check_scalar(ctx, index, ast->name);
+    asm_f(ctx, index);
+    asm_local_t* array = asm_load_array(ctx, array_ast->name);
+    if (!asm_index_in_range(ctx, array, index, lanes)) {
+        asm_check_index(ctx, array, index, lanes);
+    }
+
+    if (ctx->isa == ASM_ISA_AVX2) {
+        asm_emit(ctx->out, "    vmovdqu ymm0, [rcx+rax*8]\n"
+                           "    vpshufd ymm0, ymm0, 0x08\n"
+                           "    vpermq ymm0, ymm0, 0x08\n");
+        if (lanes == 8) {
+            asm_emit(ctx->out, "    vmovdqu ymm1, [rcx+rax*8+32]\n"
+                               "    vpshufd ymm1, ymm1, 0x08\n"
+                               "    vpermq ymm1, ymm1, 0x08\n"
+                               "    vinserti128 ymm0, ymm0, xmm1, 1\n");
+        }
+    } else {
+        asm_emit(ctx->out, "    movdqu xmm0, [rcx+rax*8]\n"
+                           "    movdqu xmm1, [rcx+rax*8+16]\n"
+                           "    pshufd xmm0, xmm0, 0x08\n"
+                           "    pshufd xmm1, xmm1, 0x08\n"
+                           "    punpcklqdq xmm0, xmm1\n");
+    }
+    if (type_is_float_vector(type)) asm_vector_convert(ctx, type, true);
+}
+
+// `store(xs, i, v)`, the lanes of v into xs[i] on sign extended to 64 bits,
+// float lanes are truncated
+static void asm_f_vector_store(asm_ctx_t* ctx, ast_t* ast) {
+    asm_expect_args(ast, 3);
+    ast_t* array_ast = asm_arg(ast, 0);
+    ast_t* index = asm_arg(ast, 1);
+    ast_t* value = asm_arg(ast, 2);
+    int type = asm_type_of(ctx, value);
+    int lanes = type_lanes(type);
+    if (array_ast->type != AST_VARIABLE) asm_error("Vectors are stored to an array variable", ast->name);
+    if (!type_is_vector(type)) asm_error("store() takes a vector", ast->name);
+
+    asm_f(ctx, value);
+    if (type_is_float_vector(type)) asm_vector_convert(ctx, type, false);
+    type = type_vector_of(lanes, false);
+    asm_push_vector(ctx, type);
+
+    asm_check_scalar(ctx, index, ast->name);
+    asm_f(ctx, index);
+    asm_local_t* array = asm_load_array(ctx, array_ast->name);
+    if (!asm_index_in_range(ctx, array, index, lanes)) {
+        asm_check_index(ctx, array, index, lanes);
+    }
+    asm_pop_vector(ctx, type, 0);
+
+    if (ctx->isa == ASM_ISA_AVX2 && lanes == 8) {
+        asm_emit(ctx->out, "    vextracti128 xmm1, ymm0, 1\n"
+                           "    vpmovsxdq ymm0, xmm0\n"
+                           "    vpmovsxdq ymm1, xmm1\n"
+                           "    vmovdqu [rcx+rax*8], ymm0\n"
+                           "    vmovdqu [rcx+rax*8+32], ymm1\n");
+    } else if (ctx->isa == ASM_ISA_AVX2) {
+        asm_emit(ctx->out, "    vpmovsxdq ymm0, xmm0\n"
+                           "    vmovdqu [rcx+rax*8], ymm0\n");
+    } else {
+        // Interleave the lanes with their sign, SSE2 has no pmovsxdq
+        asm_emit(ctx->out, "    movdqa xmm1, xmm0\n"
+                           "    psrad xmm1, 31\n"
+                           "    movdqa xmm2, xmm0\n"
+                           "    punpckldq xmm2, xmm1\n"
+                           "    punpckhdq xmm0, xmm1\n"
+                           "    movdqu [rcx+rax*8], xmm2\n"
+                           "    movdqu [rcx+rax*8+16], xmm0\n");
+    }
+    asm_emit(ctx->out, "    xor eax, eax\n");
+}
+
+// `type(...)`: one scalar is broadcast, one vector with as many lanes is
+// converted, (xs, i) loads from an array, one scalar per lane builds it
+static void asm_f_vector_new(asm_ctx_t* ctx, ast_t* ast, int type) {
+    int lanes = type_lanes(type);
+    size_t count = asm_arg_count(ast);
+    if (lanes == 8 && ctx->isa != ASM_ISA_AVX2) asm_error("8 lane vectors need --isa avx2", ast->name);
+
+    if (count == 1) {
+        ast_t* arg = asm_arg(ast, 0);
+        int from = asm_type_of(ctx, arg);
+        asm_f(ctx, arg);
+        if (!type_is_vector(from)) {
+            asm_vector_splat(ctx, type, from);
+        } else if (type_lanes(from) != lanes) {
+            asm_error("Vector conversions keep the number of lanes", ast->name);
+        } else if (from != type) {
+            asm_vector_convert(ctx, type, type_is_float_vector(type));
+        }
+        return;
+    }
+    if (count == 2 && type_is_array(asm_type_of(ctx, asm_arg(ast, 0)))) {
+        asm_f_vector_load(ctx, ast, type);
+        return;
+    }
+    if (count != (size_t) lanes) {
+        fprintf(stderr, "ERROR: '%s' takes 1, 2 or %d arguments but %zu were given\n", ast->name, lanes, count);
+        exit(1);
+    }
+
+    // Literal lanes become a constant
+    uint32_t values[8];
+    bool constant = true;
+    for (int i = 0; i < lanes; i++) {
+        ast_t* arg = asm_arg(ast, i);
+        if (arg->type != AST_INT && (arg->type != AST_FLOAT || !type_is_float_vector(type))) {
+            constant = false;
+            break;
+        }
+        float f = arg->type == AST_FLOAT ? strtof(arg->name, NULL) : (float) arg->int_value;
+        if (type_is_float_vector(type)) memcpy(&values[i], &f, sizeof(f));
+        else values[i] = (uint32_t) arg->int_value;
+    }
+    if (constant) {
+        int id = asm_vector_rodata(ctx, values, lanes);
+        asm_emit(ctx->out, "    %s %s, [__skull_vconst_%d]\n", asm_vmove(ctx, type), asm_vreg(type, 0), id);
+        return;
     }
 
-    return value;
+    // Float lanes are narrowed one by one, each to its 32 bits in eax
+    bool is_float = type_is_float_vector(type);
+    for (int i = 0; i < lanes; i++) {
+        int lane = asm_type_of(ctx, asm_arg(ast, i));
+        asm_check_scalar(ctx, asm_arg(ast, i), ast->name);
+        if (type_is_float(lane) && !is_float) {
+            asm_error("Floats only become ints through int(), in", ast->name);
+        }
+        asm_f(ctx, asm_arg(ast, i));
+        if (is_float) {
+            asm_float_insn(ctx, type_is_float(lane) ? "cvtsd2ss" : "cvtsi2ss", type_is_float(lane) ? "xmm0" : "rax");
+            asm_emit(ctx->out, "    %smovd eax, xmm0\n", asm_vex(ctx));
+        }
+        asm_emit(ctx->out, "    push rax\n");
+        ctx->depth++;
+    }
+    // The lanes are gathered in the red zone, nothing runs in between
+    for (int i = 0; i < lanes; i++) {
+        asm_emit(ctx->out, "    mov rax, [rsp+%d]\n"
+                           "    mov [rsp-%d], eax\n", (lanes - 1 - i) * 8, 32 - i * 4);
+    }
+    int ints = type_vector_of(lanes, false);
+    asm_emit(ctx->out, "    %s %s, [rsp-32]\n"
+                       "    add rsp, %d\n", asm_vmove(ctx, ints), asm_vreg(ints, 0), lanes * 8);
+    ctx->depth -= lanes;
 }
 
-char* asm_f_assignment(ast_t* ast) {
-    char* s = calloc(1, sizeof(char));
-    if (ast->value && ast->value->type == AST_FUNCTION) {
-        const char* template = "global %s\n"
-                               "%s:\n"
-                               "    push rbp\n"
-                               "    mov rsp, rbp\n";
-        s = realloc(s, (strlen(template) + (strlen(ast->name)*2) + 1) * sizeof(char));
-        sprintf(s, template, ast->name, ast->name);
+// `shuffle(v, lane...)` takes every lane of the result from the given
+// lane of v
+static void asm_f_vector_shuffle(asm_ctx_t* ctx, ast_t* ast) {
+    size_t count = asm_arg_count(ast);
+    int type = count ? asm_type_of(ctx, asm_arg(ast, 0)) : 0;
+    int lanes = type_lanes(type);
+    if (!type_is_vector(type)) asm_error("shuffle() takes a vector", ast->name);
+    asm_expect_args(ast, lanes + 1);
+
+    uint32_t values[8];
+    int imm = 0;
+    for (int i = 0; i < lanes; i++) {
+        ast_t* lane = asm_arg(ast, i + 1);
+        if (lane->type != AST_INT || lane->int_value < 0 || lane->int_value >= lanes) {
+            asm_error("Shuffle lanes are constants below the lane count", ast->name);
+        }
+        values[i] = lane->int_value;
+        imm |= lane->int_value << (2 * i);
+    }
+
+    asm_f(ctx, asm_arg(ast, 0));
+    if (lanes == 4) {
+        asm_emit(ctx->out, "    %spshufd xmm0, xmm0, 0x%02x\n", ctx->isa == ASM_ISA_AVX2 ? "v" : "", imm);
+    } else {
+        int id = asm_vector_rodata(ctx, values, lanes);
+        asm_emit(ctx->out, "    vmovdqu ymm1, [__skull_vconst_%d]\n"
+                           "    vpermd ymm0, ymm1, ymm0\n", id);
+    }
+}
+
+// hsum(), hmin() and hmax() fold the upper half of the lanes onto the lower
+// half until one lane is left, which comes back as an int
+static void asm_f_vector_reduce(asm_ctx_t* ctx, ast_t* ast, int op) {
+    asm_expect_args(ast, 1);
+    int type = asm_type_of(ctx, asm_arg(ast, 0));
+    if (!type_is_vector(type)) asm_error("Horizontal reductions take a vector", ast->name);
+
+    const char* v = ctx->isa == ASM_ISA_AVX2 ? "v" : "";
+    int half = type_vector_of(4, type_is_float_vector(type));
+    asm_f(ctx, asm_arg(ast, 0));
+    if (type_lanes(type) == 8) {
+        asm_emit(ctx->out, "    vextracti128 xmm1, ymm0, 1\n");
+        asm_vector_op(ctx, half, op);
+    }
+    asm_emit(ctx->out, "    %spshufd xmm1, xmm0, 0x4e\n", v);
+    asm_vector_op(ctx, half, op);
+    asm_emit(ctx->out, "    %spshufd xmm1, xmm0, 0xb1\n", v);
+    asm_vector_op(ctx, half, op);
+
+    if (type_is_float_vector(type)) {
+        asm_float_insn(ctx, "cvtss2sd", "xmm0");
+    } else {
+        asm_emit(ctx->out, "    %smovd eax, xmm0\n"
+                           "    movsxd rax, eax\n", v);
+    }
+}
+
+// float(x) and int(x) convert between the two, int() truncates toward
+// zero, and sqrt(x)
+static bool asm_f_float_builtin(asm_ctx_t* ctx, ast_t* ast) {
+    bool to_int = strcmp(ast->name, "int") == 0;
+    bool sqrt = strcmp(ast->name, "sqrt") == 0;
+    if (!to_int && !sqrt && strcmp(ast->name, "float") != 0) return false;
+
+    asm_expect_args(ast, 1);
+    ast_t* arg = asm_arg(ast, 0);
+    int type = asm_type_of(ctx, arg);
+    if (type_is_vector(type) || type_is_array(type) || asm_record(ctx, type)) asm_error("Expected a number in", ast->name);
+
+    if (to_int) {
+        asm_f(ctx, arg);
+        if (type_is_float(type)) asm_emit(ctx->out, "    %scvttsd2si rax, xmm0\n", asm_vex(ctx));
+        return true;
+    }
+    asm_f_as_float(ctx, arg);
+    if (sqrt) asm_float_insn(ctx, "sqrtsd", "xmm0");
+    return true;
+}
+
+// Routines of the I/O and heap runtimes are defined by the object of the
+// executable or shared library, module objects refer to the ones they call
+static bool asm_has_runtime(asm_ctx_t* ctx) {
+    return ctx->entry || ctx->shared;
+}
+
+static void asm_runtime_extern(asm_ctx_t* ctx, const char* routine) {
+    if (asm_has_runtime(ctx)) return;
+    for (size_t i = 0; i < ctx->externs->size; i++) {
+        if (strcmp((char*) ctx->externs->items[i], routine) == 0) return;
+    }
+    list_push(ctx->externs, strdup(routine));
+}
+
+static void asm_io_call(asm_ctx_t* ctx, const char* routine) {
+    asm_runtime_extern(ctx, routine);
+    asm_emit(ctx->out, "    call %s\n", routine);
+    ctx->io = true;
+}
+
+// print(x) and println(x) write an int or a string to stdout, println()
+// just the newline. flush() writes out what is buffered, read_int() and
+// read_byte() read from stdin.
+static bool asm_f_io_builtin(asm_ctx_t* ctx, ast_t* ast) {
+    bool print = strcmp(ast->name, "print") == 0;
+    bool println = strcmp(ast->name, "println") == 0;
+    if (print || (println && asm_arg_count(ast))) {
+        asm_expect_args(ast, 1);
+        ast_t* arg = asm_arg(ast, 0);
+        int type = asm_type_of(ctx, arg);
+        if (type_is_float(type) || type_is_vector(type) || type_is_array(type) || asm_record(ctx, type)) {
+            asm_error("Expected an int or a string in", ast->name);
+        }
+        asm_f(ctx, arg);
+        asm_emit(ctx->out, "    mov rdi, rax\n");
+        asm_io_call(ctx, type == typename_to_int("string") ? "__skull_print_string" : "__skull_print_int");
+        if (println) asm_io_call(ctx, "__skull_print_newline");
+    } else if (println) {
+        asm_io_call(ctx, "__skull_print_newline");
+    } else if (strcmp(ast->name, "flush") == 0) {
+        asm_expect_args(ast, 0);
+        asm_io_call(ctx, "__skull_flush");
+    } else if (strcmp(ast->name, "read_int") == 0) {
+        asm_expect_args(ast, 0);
+        asm_io_call(ctx, "__skull_read_int");
+    } else if (strcmp(ast->name, "read_byte") == 0) {
+        asm_expect_args(ast, 0);
+        asm_io_call(ctx, "__skull_read_byte");
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// concat(a, b) makes a new string holding a followed by b
+static bool asm_f_string_builtin(asm_ctx_t* ctx, ast_t* ast) {
+    if (strcmp(ast->name, "concat") != 0) return false;
+
+    asm_expect_args(ast, 2);
+    for (size_t i = 0; i < 2; i++) {
+        int type = asm_type_of(ctx, asm_arg(ast, i));
+        if (type && type != typename_to_int("string")) asm_error("Expected a string in", ast->name);
+    }
+    asm_f(ctx, asm_arg(ast, 0));
+    asm_emit(ctx->out, "    push rax\n");
+    ctx->depth++;
+    asm_f(ctx, asm_arg(ast, 1));
+    asm_emit(ctx->out, "    mov rsi, rax\n"
+                       "    pop rdi\n"
+                       "    call __skull_concat\n");
+    ctx->depth--;
+
+    asm_alloc_t* alloc = asm_find_alloc(ctx, ast);
+    if (alloc) asm_f_owned(ctx, alloc);
+    ctx->arrays = true;
+    return true;
+}
+
+// region() makes a region, region_array(r, n) allocates n zeroed elements
+// in it and region_reset(r) gives back everything allocated in it at once
+static bool asm_f_region_builtin(asm_ctx_t* ctx, ast_t* ast) {
+    if (strcmp(ast->name, "region") == 0) {
+        asm_expect_args(ast, 0);
+        asm_runtime_extern(ctx, "__skull_region_new");
+        asm_emit(ctx->out, "    call __skull_region_new\n");
+    } else if (strcmp(ast->name, "region_array") == 0) {
+        asm_expect_args(ast, 2);
+        asm_f(ctx, asm_arg(ast, 0));
+        asm_emit(ctx->out, "    push rax\n");
+        ctx->depth++;
+        asm_f(ctx, asm_arg(ast, 1));
+        asm_emit(ctx->out, "    mov rsi, rax\n"
+                           "    pop rdi\n");
+        ctx->depth--;
+        asm_runtime_extern(ctx, "__skull_region_array");
+        asm_emit(ctx->out, "    call __skull_region_array\n");
+    } else if (strcmp(ast->name, "region_reset") == 0) {
+        asm_expect_args(ast, 1);
+        asm_f(ctx, asm_arg(ast, 0));
+        asm_runtime_extern(ctx, "__skull_region_reset");
+        asm_emit(ctx->out, "    mov rdi, rax\n"
+                           "    call __skull_region_reset\n");
+    } else {
+        return false;
+    }
+    ctx->arrays = true;
+    return true;
+}
+
+// Builtins, a function of the program with the same name shadows them
+static bool asm_f_builtin(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_builtin");
+    int type = typename_to_int(ast->name);
+    if (type_is_vector(type)) asm_f_vector_new(ctx, ast, type);
+    else if (strcmp(ast->name, "shuffle") == 0) asm_f_vector_shuffle(ctx, ast);
+    else if (strcmp(ast->name, "store") == 0) asm_f_vector_store(ctx, ast);
+    else if (strcmp(ast->name, "hsum") == 0) asm_f_vector_reduce(ctx, ast, TOKEN_PLUS);
+    else if (strcmp(ast->name, "hmin") == 0) asm_f_vector_reduce(ctx, ast, ASM_VECTOR_MIN);
+    else if (strcmp(ast->name, "hmax") == 0) asm_f_vector_reduce(ctx, ast, ASM_VECTOR_MAX);
+    else if (asm_f_float_builtin(ctx, ast)) return true;
+    else if (asm_f_io_builtin(ctx, ast)) return true;
+    else if (asm_f_string_builtin(ctx, ast)) return true;
+    else if (asm_f_region_builtin(ctx, ast)) return true;
+    else return asm_f_array_builtin(ctx, ast);
+    return true;
+}
+
+// Condition code under which the int comparison op holds, NULL for other
+// operators
+static const char* asm_condition(int op) {
+    switch (op) {
+        case TOKEN_EQ:  return "e";
+        case TOKEN_NEQ: return "ne";
+        case TOKEN_LT:  return "l";
+        case TOKEN_GT:  return "g";
+        case TOKEN_LTE: return "le";
+        case TOKEN_GTE: return "ge";
+        default:        return NULL;
+    }
+}
+
+// Evaluates lhs into rax and rhs into rcx. Literal right hand sides become
+// immediates instead, except for the divisions. rhs_operand is what to use
+// for rhs.
+static void asm_f_int_operands(asm_ctx_t* ctx, ast_t* lhs, ast_t* rhs, int op, char* rhs_operand, size_t size) {
+    asm_f(ctx, lhs);
+    if (rhs->type == AST_INT && op != TOKEN_DIVIDE && op != TOKEN_MODULUS) {
+        snprintf(rhs_operand, size, "%d", rhs->int_value);
+        return;
+    }
+    asm_emit(ctx->out, "    push rax\n");
+    ctx->depth++;
+    asm_f(ctx, rhs);
+    asm_emit(ctx->out, "    mov rcx, rax\n"
+                       "    pop rax\n");
+    ctx->depth--;
+    snprintf(rhs_operand, size, "rcx");
+}
+
+// Evaluates ast into register 0 as a value of type, a float or float vector
+static void asm_f_operand(asm_ctx_t* ctx, ast_t* ast, int type) {
+    if (type_is_vector(type)) asm_f_vector(ctx, ast, type);
+    else asm_f_as_float(ctx, ast);
+}
+
+// With --fma, `a * b + c`, `a * b - c` and `c - a * b` of type become one
+// fused instruction with c in register 0. False when ast is none of them.
+static bool asm_f_fma(asm_ctx_t* ctx, ast_t* ast, int type) {
+    int op = ast->int_value;
+    if (!ctx->fma || (op != TOKEN_PLUS && op != TOKEN_MINUS)) return false;
+
+    ast_t* lhs = (ast_t*) ast->children->items[0];
+    ast_t* rhs = (ast_t*) ast->children->items[1];
+    bool left = lhs->type == AST_BINARY && lhs->int_value == TOKEN_MULTIPLY && asm_type_of(ctx, lhs) == type;
+    bool right = !left && rhs->type == AST_BINARY && rhs->int_value == TOKEN_MULTIPLY && asm_type_of(ctx, rhs) == type;
+    if (!left && !right) return false;
+
+    ast_t* mul = left ? lhs : rhs;
+    ast_t* c = left ? rhs : lhs;
+    const char* insn = "vfmadd231";
+    if (op == TOKEN_MINUS) insn = left ? "vfmsub231" : "vfnmadd231";
+
+    bool vector = type_is_vector(type);
+    for (int i = 0; i < 2; i++) {
+        asm_f_operand(ctx, (ast_t*) mul->children->items[i], type);
+        if (vector) asm_push_vector(ctx, type);
+        else asm_push_float(ctx);
+    }
+    asm_f_operand(ctx, c, type);
+    for (int n = 2; n > 0; n--) {
+        if (vector) asm_pop_vector(ctx, type, n);
+        else asm_pop_float(ctx, n);
+    }
+    asm_emit(ctx->out, "    %s%s %s, %s, %s\n", insn, vector ? "ps" : "sd",
+             vector ? asm_vreg(type, 0) : "xmm0", vector ? asm_vreg(type, 1) : "xmm1", vector ? asm_vreg(type, 2) : "xmm2");
+    return true;
+}
+
+// Floats are doubles in xmm0, comparisons give 0 or 1 and are false when
+// either side is NaN, except != which is true. Float locals on the right
+// are used straight from their slot.
+static void asm_f_float_binary(asm_ctx_t* ctx, ast_t* ast) {
+    ast_t* lhs = (ast_t*) ast->children->items[0];
+    ast_t* rhs = (ast_t*) ast->children->items[1];
+    int op = ast->int_value;
+    if (op == TOKEN_MODULUS) asm_error("Floats have no remainder", "%");
+    if (asm_f_fma(ctx, ast, TYPE_FLOAT)) return;
+
+    char rhs_operand[32] = "xmm1";
+    asm_local_t* local = rhs->type == AST_VARIABLE && !rhs->data_type ? asm_find_local(ctx, rhs->name) : NULL;
+    asm_f_as_float(ctx, lhs);
+    if (local && type_is_float(local->data_type)) {
+        snprintf(rhs_operand, sizeof(rhs_operand), "qword [rbp-%d]", local->offset);
+    } else if (rhs->type == AST_FLOAT) {
+        asm_float_constant(ctx, rhs->name, 1);
+    } else {
+        asm_push_float(ctx);
+        asm_f_as_float(ctx, rhs);
+        asm_emit(ctx->out, "    %smovapd xmm1, xmm0\n", asm_vex(ctx));
+        asm_pop_float(ctx, 0);
+    }
+
+    const char* v = asm_vex(ctx);
+    const char* condition = NULL;
+    switch (op) {
+        case TOKEN_PLUS:     asm_float_insn(ctx, "addsd", rhs_operand); return;
+        case TOKEN_MINUS:    asm_float_insn(ctx, "subsd", rhs_operand); return;
+        case TOKEN_MULTIPLY: asm_float_insn(ctx, "mulsd", rhs_operand); return;
+        case TOKEN_DIVIDE:   asm_float_insn(ctx, "divsd", rhs_operand); return;
+        case TOKEN_EQ:       condition = "e"; break;
+        case TOKEN_NEQ:      condition = "ne"; break;
+        case TOKEN_GT:       condition = "a"; break;
+        case TOKEN_GTE:      condition = "ae"; break;
+        case TOKEN_LT:       condition = "a"; break;
+        case TOKEN_LTE:      condition = "ae"; break;
+        default:
+            fprintf(stderr, "ERROR: Unknown binary operator '%d'\n", op);
+            exit(1);
+    }
+
+    // < and <= compare the other way around, so NaN gives 0 through CF
+    if (op == TOKEN_LT || op == TOKEN_LTE) {
+        if (strcmp(rhs_operand, "xmm1") != 0) asm_emit(ctx->out, "    %smovsd xmm1, %s\n", v, rhs_operand);
+        asm_emit(ctx->out, "    %sucomisd xmm1, xmm0\n", v);
+    } else {
+        asm_emit(ctx->out, "    %sucomisd xmm0, %s\n", v, rhs_operand);
+    }
+    asm_emit(ctx->out, "    set%s al\n", condition);
+    if (op == TOKEN_EQ) asm_emit(ctx->out, "    setnp cl\n    and al, cl\n");
+    if (op == TOKEN_NEQ) asm_emit(ctx->out, "    setp cl\n    or al, cl\n");
+    asm_emit(ctx->out, "    movzx eax, al\n");
+}
+
+// Scalars are 64 bit ints and comparisons give 0 or 1. With a vector on
+// either side the other side is broadcast and the operator applies per lane.
+// With a float on either side both are floats.
+void asm_f_binary(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_binary");
+    ast_t* lhs = (ast_t*) ast->children->items[0];
+    ast_t* rhs = (ast_t*) ast->children->items[1];
+    int op = ast->int_value;
+    int lhs_type = asm_type_of(ctx, lhs);
+    int rhs_type = asm_type_of(ctx, rhs);
+    if (asm_record(ctx, lhs_type) || asm_record(ctx, rhs_type)) {
+        asm_error("Records have no operators, only their fields do", "record");
+    }
+
+    if (type_is_vector(lhs_type) || type_is_vector(rhs_type)) {
+        int type = type_is_vector(lhs_type) ? lhs_type : rhs_type;
+        if (type_is_float_vector(type) && asm_f_fma(ctx, ast, type)) return;
+        asm_f_vector(ctx, lhs, type);
+        asm_push_vector(ctx, type);
+        asm_f_vector(ctx, rhs, type);
+        asm_emit(ctx->out, "    %smovaps %s, %s\n", ctx->isa == ASM_ISA_AVX2 ? "v" : "", asm_vreg(type, 1), asm_vreg(type, 0));
+        asm_pop_vector(ctx, type, 0);
+        asm_vector_op(ctx, type, op);
+        return;
+    }
+    if (type_is_float(lhs_type) || type_is_float(rhs_type)) {
+        asm_f_float_binary(ctx, ast);
+        return;
+    }
+
+    char rhs_operand[16];
+    asm_f_int_operands(ctx, lhs, rhs, op, rhs_operand, sizeof(rhs_operand));
+    switch (op) {
+        case TOKEN_PLUS:     asm_emit(ctx->out, "    add rax, %s\n", rhs_operand); return;
+        case TOKEN_MINUS:    asm_emit(ctx->out, "    sub rax, %s\n", rhs_operand); return;
+        case TOKEN_MULTIPLY: asm_emit(ctx->out, "    imul rax, %s\n", rhs_operand); return;
+        case TOKEN_DIVIDE:   asm_emit(ctx->out, "    cqo\n    idiv rcx\n"); return;
+        case TOKEN_MODULUS:  asm_emit(ctx->out, "    cqo\n    idiv rcx\n    mov rax, rdx\n"); return;
+        default: break;
+    }
+
+    const char* condition = asm_condition(op);
+    if (!condition) {
+        fprintf(stderr, "ERROR: Unknown binary operator '%d'\n", op);
+        exit(1);
+    }
+    asm_emit(ctx->out, "    cmp rax, %s\n"
+                       "    set%s al\n"
+                       "    movzx eax, al\n", rhs_operand, condition);
+}
+
+// The state before a branch, then the meet of the states at the ends of
+// the branches that reach the code after it
+static void asm_flow_save(asm_ctx_t* ctx, asm_flow_t* flow) {
+    flow->reached = true;
+    flow->count = ctx->locals->size;
+    flow->fact_count = ctx->facts->size;
+    flow->lengths = malloc((flow->count + 1) * sizeof(long));
+    flow->facts = malloc((flow->fact_count + 1) * sizeof(asm_fact_t));
+    if (!flow->lengths || !flow->facts) {
+        fprintf(stderr, "Memory allocation failed for branch state\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < flow->count; i++) {
+        flow->lengths[i] = ((asm_local_t*) ctx->locals->items[i])->length;
+    }
+    for (size_t i = 0; i < flow->fact_count; i++) {
+        flow->facts[i] = *(asm_fact_t*) ctx->facts->items[i];
+    }
+}
+
+static void asm_flow_restore(asm_ctx_t* ctx, const asm_flow_t* flow) {
+    for (size_t i = 0; i < flow->count && i < ctx->locals->size; i++) {
+        ((asm_local_t*) ctx->locals->items[i])->length = flow->lengths[i];
+    }
+    asm_clear_facts(ctx);
+    for (size_t i = 0; i < flow->fact_count; i++) {
+        asm_fact_t* fact = malloc(sizeof(asm_fact_t));
+        if (!fact) {
+            fprintf(stderr, "Memory allocation failed for range fact\n");
+            exit(1);
+        }
+        *fact = flow->facts[i];
+        list_push(ctx->facts, fact);
+    }
+}
+
+// Narrows joined to what also holds right now: the shorter known length
+// and only the facts both have
+static void asm_flow_meet(asm_ctx_t* ctx, asm_flow_t* joined) {
+    if (!joined->reached) {
+        asm_flow_save(ctx, joined);
+        return;
+    }
+    for (size_t i = 0; i < joined->count && i < ctx->locals->size; i++) {
+        joined->lengths[i] = MIN(joined->lengths[i], ((asm_local_t*) ctx->locals->items[i])->length);
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < joined->fact_count; i++) {
+        bool holds = false;
+        for (size_t j = 0; j < ctx->facts->size && !holds; j++) {
+            asm_fact_t* fact = (asm_fact_t*) ctx->facts->items[j];
+            holds = fact->array == joined->facts[i].array && fact->index == joined->facts[i].index;
+        }
+        if (holds) joined->facts[kept++] = joined->facts[i];
+    }
+    joined->fact_count = kept;
+}
+
+static void asm_flow_free(asm_flow_t* flow) {
+    free(flow->lengths);
+    free(flow->facts);
+}
+
+static bool asm_is_int_like(asm_ctx_t* ctx, int type) {
+    return !type_is_float(type) && !type_is_vector(type) && !type_is_array(type) && !asm_record(ctx, type);
+}
+
+// The int local ast names, NULL for anything else
+static asm_local_t* asm_guard_local(asm_ctx_t* ctx, ast_t* ast) {
+    if (ast->type != AST_VARIABLE || ast->data_type) return NULL;
+    asm_local_t* local = asm_find_local(ctx, ast->name);
+    return local && asm_is_int_like(ctx, local->data_type) ? local : NULL;
+}
+
+// Adds the range facts that hold where the condition of a branch is true,
+// or false when holds is not set. `k >= 0` makes k non-negative, and `k <
+// len(xs)` on a non-negative k makes it an index of xs, so nested ifs
+// `if (k >= 0) { if (k < len(xs)) { ... } }` need no check on xs[k].
+static void asm_guard_facts(asm_ctx_t* ctx, ast_t* condition, bool holds) {
+    if (condition->type != AST_BINARY || !asm_condition(condition->int_value)) return;
+    ast_t* lhs = (ast_t*) condition->children->items[0];
+    ast_t* rhs = (ast_t*) condition->children->items[1];
+    int op = condition->int_value;
+    if (!holds) {
+        switch (op) {
+            case TOKEN_LT:  op = TOKEN_GTE; break;
+            case TOKEN_GTE: op = TOKEN_LT; break;
+            case TOKEN_GT:  op = TOKEN_LTE; break;
+            case TOKEN_LTE: op = TOKEN_GT; break;
+            case TOKEN_EQ:  op = TOKEN_NEQ; break;
+            default:        return;
+        }
+    }
+    if (!asm_guard_local(ctx, lhs)) {
+        ast_t* swap = lhs;
+        lhs = rhs;
+        rhs = swap;
+        switch (op) {
+            case TOKEN_LT:  op = TOKEN_GT; break;
+            case TOKEN_GT:  op = TOKEN_LT; break;
+            case TOKEN_LTE: op = TOKEN_GTE; break;
+            case TOKEN_GTE: op = TOKEN_LTE; break;
+            default:        break;
+        }
+    }
+
+    asm_local_t* index = asm_guard_local(ctx, lhs);
+    if (!index) return;
+    if (rhs->type == AST_INT) {
+        if ((op == TOKEN_GTE || op == TOKEN_EQ) && rhs->int_value >= 0) asm_add_fact(ctx, 0, index->offset);
+        if (op == TOKEN_GT && rhs->int_value >= -1) asm_add_fact(ctx, 0, index->offset);
+        return;
+    }
+    if (op != TOKEN_LT || !asm_is_builtin(ctx, rhs, "len") || asm_arg_count(rhs) != 1) return;
+
+    ast_t* arg = (ast_t*) rhs->value->children->items[0];
+    asm_local_t* array = arg->type == AST_VARIABLE ? asm_find_local(ctx, arg->name) : NULL;
+    if (!array || !type_is_array(array->data_type)) return;
+    for (size_t i = 0; i < ctx->facts->size; i++) {
+        asm_fact_t* fact = (asm_fact_t*) ctx->facts->items[i];
+        if (fact->array == 0 && fact->index == index->offset) {
+            asm_add_fact(ctx, array->offset, index->offset);
+            return;
+        }
+    }
+}
+
+// Whether control never gets past ast, it returns on every path
+static bool asm_returns(ast_t* ast) {
+    if (!ast) return false;
+    switch (ast->type) {
+        case AST_CALL:
+            return strcmp(ast->name, "return") == 0;
+        case AST_COMPOUND:
+            return ast->children && ast->children->size &&
+                   asm_returns((ast_t*) ast->children->items[ast->children->size - 1]);
+        case AST_IF:
+            return ast->children->size == 2 &&
+                   asm_returns((ast_t*) ast->children->items[0]) && asm_returns((ast_t*) ast->children->items[1]);
+        case AST_MATCH: {
+            bool otherwise = false;
+            for (size_t i = 0; i < ast->children->size; i++) {
+                ast_t* arm = (ast_t*) ast->children->items[i];
+                if (!asm_returns(arm->value)) return false;
+                if (arm->children->size == 0) otherwise = true;
+            }
+            return otherwise;
+        }
+        default:
+            return false;
+    }
+}
 
-        ast_t* as_val = ast->value;
-        char* as_val_val = asm_f(as_val->value);
+// Emits one branch from the state before it, with what guard tells when it
+// is as holds says, and meets its end into joined. Names it declares are not
+// visible past it.
+static void asm_f_branch(asm_ctx_t* ctx, ast_t* block, ast_t* guard, bool holds, const asm_flow_t* before,
+                         asm_flow_t* joined) {
+    asm_flow_restore(ctx, before);
+    if (guard) asm_guard_facts(ctx, guard, holds);
 
-        s = realloc(s, strlen(s) + strlen(as_val_val) + 1);
-        strcat(s, as_val_val);
-        free(as_val_val);
+    size_t count = ctx->locals->size;
+    asm_f(ctx, block);
+    while (ctx->locals->size > count) {
+        asm_local_t* local = (asm_local_t*) ctx->locals->items[--ctx->locals->size];
+        free(local->name);
+        free(local);
     }
-    return s;
+
+    if (!asm_returns(block)) asm_flow_meet(ctx, joined);
+}
+
+// The code after the branches goes on from their meet. When none of them
+// gets there it is dead and any state will do.
+static void asm_flow_join(asm_ctx_t* ctx, asm_flow_t* before, asm_flow_t* joined) {
+    asm_flow_restore(ctx, joined->reached ? joined : before);
+    asm_flow_free(before);
+    if (joined->reached) asm_flow_free(joined);
+}
+
+// Evaluates the condition ast into the flags, returns the condition code
+// under which it holds. Int comparisons set the flags directly.
+static const char* asm_f_condition(asm_ctx_t* ctx, ast_t* ast) {
+    if (!asm_is_int_like(ctx, asm_type_of(ctx, ast))) asm_error("Expected an int or a comparison as condition", "if");
+
+    if (ast->type == AST_BINARY && asm_condition(ast->int_value)) {
+        ast_t* lhs = (ast_t*) ast->children->items[0];
+        ast_t* rhs = (ast_t*) ast->children->items[1];
+        if (asm_is_int_like(ctx, asm_type_of(ctx, lhs)) && asm_is_int_like(ctx, asm_type_of(ctx, rhs))) {
+            char rhs_operand[16];
+            asm_f_int_operands(ctx, lhs, rhs, ast->int_value, rhs_operand, sizeof(rhs_operand));
+            asm_emit(ctx->out, "    cmp rax, %s\n", rhs_operand);
+            return asm_condition(ast->int_value);
+        }
+    }
+    asm_f(ctx, ast);
+    asm_emit(ctx->out, "    test rax, rax\n");
+    return "nz";
 }
 
-char* asm_f_variable(ast_t* ast, int id) {
-    char* s = calloc(1, sizeof(char));
+static const char* asm_negate(const char* condition) {
+    static const char* pairs[][2] = { { "e", "ne" }, { "l", "ge" }, { "g", "le" }, { "nz", "z" } };
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+        if (strcmp(pairs[i][0], condition) == 0) return pairs[i][1];
+        if (strcmp(pairs[i][1], condition) == 0) return pairs[i][0];
+    }
+    return NULL;
+}
+
+// The int local a block consisting of just `name = value` assigns, NULL
+// for any other block
+static asm_local_t* asm_select_target(asm_ctx_t* ctx, ast_t* block, ast_t** value) {
+    if (!block || block->type != AST_COMPOUND || !block->children || block->children->size != 1) return NULL;
+    ast_t* assignment = (ast_t*) block->children->items[0];
+    if (assignment->type != AST_ASSIGNMENT || assignment->data_type || !assignment->value) return NULL;
+
+    asm_local_t* local = asm_find_local(ctx, assignment->name);
+    if (!local || !asm_is_int_like(ctx, local->data_type)) return NULL;
+    *value = assignment->value;
+    return local;
+}
+
+// A value a select may read whether or not it is picked: an int literal,
+// or an int local or global read in place
+static bool asm_select_operand(asm_ctx_t* ctx, ast_t* ast, char* operand, size_t size) {
     if (ast->type == AST_INT) {
-        const char* template = "%d";
-        s = realloc(s, (strlen(template) + 256) * sizeof(char));
-        sprintf(s, template, ast->int_value);
+        snprintf(operand, size, "%d", ast->int_value);
+        return true;
+    }
+    if (ast->type != AST_VARIABLE || ast->data_type) return false;
+
+    asm_local_t* local = asm_find_local(ctx, ast->name);
+    module_symbol_t* symbol = local ? NULL : module_interface_find(ctx->symbols, ast->name);
+    if (local && asm_is_int_like(ctx, local->data_type)) {
+        snprintf(operand, size, "qword [rbp-%d]", local->offset);
+        return true;
+    }
+    if (symbol && symbol->kind == MODULE_SYMBOL_GLOBAL && asm_is_int_like(ctx, symbol->data_type)) {
+        snprintf(operand, size, "qword [%s]", ast->name);
+        return true;
+    }
+    return false;
+}
+
+// `if (c) { x = a; } else { x = b; }` and `if (c) { x = a; }` where reading
+// a and b cannot fault become a conditional move. False for any other if.
+static bool asm_f_select(asm_ctx_t* ctx, ast_t* ast) {
+    ast_t* then = (ast_t*) ast->children->items[0];
+    ast_t* otherwise = ast->children->size > 1 ? (ast_t*) ast->children->items[1] : NULL;
+
+    ast_t* a = NULL;
+    ast_t* b = NULL;
+    char a_operand[64], b_operand[64];
+    asm_local_t* target = asm_select_target(ctx, then, &a);
+    if (!target || !asm_select_operand(ctx, a, a_operand, sizeof(a_operand))) return false;
+    if (otherwise) {
+        if (asm_select_target(ctx, otherwise, &b) != target) return false;
+        if (!asm_select_operand(ctx, b, b_operand, sizeof(b_operand))) return false;
+    } else {
+        snprintf(b_operand, sizeof(b_operand), "qword [rbp-%d]", target->offset);
+    }
+
+    // mov leaves the flags alone, cmov takes no immediate
+    const char* condition = asm_f_condition(ctx, ast->value);
+    asm_emit(ctx->out, "    mov rax, %s\n", b_operand);
+    if (a->type == AST_INT) {
+        asm_emit(ctx->out, "    mov rcx, %s\n"
+                           "    cmov%s rax, rcx\n", a_operand, condition);
     } else {
-        const char* template = "%d(rsp)";
-        s = realloc(s, (strlen(template) + 8) * sizeof(char));
-        sprintf(s, template, id);
+        asm_emit(ctx->out, "    cmov%s rax, %s\n", condition, a_operand);
     }
-    return s;
+    asm_store_local(ctx, target, 0);
+    return true;
 }
 
-char* asm_f_call(ast_t* ast) {
-    char* s = calloc(1, sizeof(char));
-    if (strcmp(ast->name, "return") == 0) {
-        ast_t* first_arg = (ast_t*) ast->value->children->size ? ast->value->children->items[0] : (void*) 0;
-        char* var_s = calloc(2, sizeof(char));
-        var_s[0] = '0';
-        var_s[1] = '\0';
+// `if (cond) { ... } else { ... }`, an else if is the else branch
+void asm_f_if(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_if");
+    if (asm_f_select(ctx, ast)) return;
+
+    ast_t* then = (ast_t*) ast->children->items[0];
+    ast_t* otherwise = ast->children->size > 1 ? (ast_t*) ast->children->items[1] : NULL;
+    int id = ctx->label_count++;
+    int site = ctx->branch_site++;
+    const char* condition = asm_f_condition(ctx, ast->value);
+    asm_flow_t before, joined = {0};
+    asm_flow_save(ctx, &before);
+
+    // The profile saw the test fail more often: the else branch falls
+    // through and the then branch is jumped to, after the function's ret
+    // when there is no else
+    if (asm_arm_count(ctx, "if", site, "else") > asm_arm_count(ctx, "if", site, "then")) {
+        asm_emit(ctx->out, "    j%s .then_%d\n", condition, id);
+        asm_buf_t* out = ctx->out;
+        asm_buf_t block = {0};
+        if (otherwise) {
+            asm_count_arm(ctx, "if", site, "else");
+            asm_f_branch(ctx, otherwise, ast->value, false, &before, &joined);
+            if (!asm_returns(otherwise)) asm_emit(ctx->out, "    jmp .end_if_%d\n", id);
+        } else {
+            asm_emit(ctx->out, ".end_if_%d:\n", id);
+            ctx->out = &block;
+        }
+        asm_emit(ctx->out, ".then_%d:\n", id);
+        asm_count_arm(ctx, "if", site, "then");
+        asm_f_branch(ctx, then, ast->value, true, &before, &joined);
+        if (otherwise) {
+            asm_emit(ctx->out, ".end_if_%d:\n", id);
+        } else {
+            if (!asm_returns(then)) asm_emit(ctx->out, "    jmp .end_if_%d\n", id);
+            ctx->out = out;
+            asm_emit(&ctx->tail, "%s", block.data);
+            free(block.data);
+            asm_flow_restore(ctx, &before);
+            asm_guard_facts(ctx, ast->value, false);
+            asm_flow_meet(ctx, &joined);
+        }
+        asm_flow_join(ctx, &before, &joined);
+        return;
+    }
+
+    asm_emit(ctx->out, "    j%s .else_%d\n", asm_negate(condition), id);
+    asm_count_arm(ctx, "if", site, "then");
+    asm_f_branch(ctx, then, ast->value, true, &before, &joined);
+    if (otherwise) {
+        if (!asm_returns(then)) asm_emit(ctx->out, "    jmp .end_if_%d\n", id);
+        asm_emit(ctx->out, ".else_%d:\n", id);
+        asm_count_arm(ctx, "if", site, "else");
+        asm_f_branch(ctx, otherwise, ast->value, false, &before, &joined);
+        asm_emit(ctx->out, ".end_if_%d:\n", id);
+    } else {
+        asm_emit(ctx->out, ".else_%d:\n", id);
+        asm_count_arm(ctx, "if", site, "else");
+        asm_flow_restore(ctx, &before);
+        asm_guard_facts(ctx, ast->value, false);
+        asm_flow_meet(ctx, &joined);
+    }
+    asm_flow_join(ctx, &before, &joined);
+}
+
+static int asm_case_compare(const void* a, const void* b) {
+    long x = ((const asm_case_t*) a)->label;
+    long y = ((const asm_case_t*) b)->label;
+    return (x > y) - (x < y);
+}
+
+// Whether sorted labels are dense enough for a table indexed by them
+static bool asm_cases_dense(const asm_case_t* cases, size_t count) {
+    if (count == 0) return false;
+    long range = cases[count - 1].label - cases[0].label + 1;
+    return range <= ASM_MATCH_TABLE_SPREAD * (long) count && range <= ASM_MATCH_TABLE_MAX;
+}
+
+// Compares the value in rax against cases[lo, hi) and jumps to the arm of
+// the one it equals, or to the arm for `_`. Few labels are compared in
+// turn, those of the arms the profile saw run most first, more are split in
+// halves around the middle one. The search ends in front of arm following, so
+// no jump is needed when that is the arm for `_`.
+static void asm_f_match_search(asm_ctx_t* ctx, const asm_case_t* cases, size_t lo, size_t hi, int id, size_t otherwise,
+                               size_t following) {
+    if (hi - lo <= ASM_MATCH_CHAIN_MAX) {
+        bool compared[ASM_MATCH_CHAIN_MAX] = {false};
+        for (size_t n = lo; n < hi; n++) {
+            size_t next = hi;
+            for (size_t i = lo; i < hi; i++) {
+                if (!compared[i - lo] && (next == hi || cases[i].count > cases[next].count)) next = i;
+            }
+            compared[next - lo] = true;
+            asm_emit(ctx->out, "    cmp rax, %ld\n"
+                               "    je ..@skull_case_%d_%zu\n", cases[next].label, id, cases[next].arm);
+        }
+        if (otherwise != following) asm_emit(ctx->out, "    jmp ..@skull_case_%d_%zu\n", id, otherwise);
+        return;
+    }
+
+    size_t mid = lo + (hi - lo) / 2;
+    int left = ctx->label_count++;
+    asm_emit(ctx->out, "    cmp rax, %ld\n"
+                       "    je ..@skull_case_%d_%zu\n"
+                       "    jl .match_left_%d\n", cases[mid].label, id, cases[mid].arm, left);
+    asm_f_match_search(ctx, cases, mid + 1, hi, id, otherwise, SIZE_MAX);
+    asm_emit(ctx->out, ".match_left_%d:\n", left);
+    asm_f_match_search(ctx, cases, lo, mid, id, otherwise, following);
+}
+
+// Jumps through a table in .rodata with an entry for every value from the
+// lowest label to the highest, values outside go to the arm for `_`
+static void asm_f_match_table(asm_ctx_t* ctx, const asm_case_t* cases, size_t count, int id, size_t otherwise) {
+    long low = cases[0].label;
+    long range = cases[count - 1].label - low + 1;
+    if (low) asm_emit(ctx->out, "    sub rax, %ld\n", low);
+    asm_emit(ctx->out, "    cmp rax, %ld\n"
+                       "    ja ..@skull_case_%d_%zu\n"
+                       "    lea rcx, [__skull_jump_%d]\n"
+                       "    jmp [rcx+rax*8]\n", range - 1, id, otherwise, id);
+
+    asm_emit(&ctx->rodata, "align 8\n"
+                           "__skull_jump_%d:", id);
+    size_t next = 0;
+    for (long value = low; value < low + range; value++) {
+        size_t arm = otherwise;
+        if (cases[next].label == value) arm = cases[next++].arm;
+        asm_emit(&ctx->rodata, (value - low) % 4 == 0 ? "\n    dq ..@skull_case_%d_%zu" : ", ..@skull_case_%d_%zu", id, arm);
+    }
+    asm_emit(&ctx->rodata, "\n");
+}
+
+// A match whose every case, `_` included, only assigns an int literal to
+// the same local loads the value from a table without branching. Values
+// outside the labels read the one for `_` at the end of the table.
+static bool asm_f_match_values(asm_ctx_t* ctx, ast_t* ast, const asm_case_t* cases, size_t count, int id, size_t otherwise) {
+    if (count < 2 || otherwise == ast->children->size || !asm_cases_dense(cases, count)) return false;
 
-        if (first_arg && first_arg->type == AST_VARIABLE) {
-            char* as_var_s = asm_f_variable(first_arg, 0);
-            var_s = realloc(var_s, (strlen(as_var_s) + 1) * sizeof(char));
-            strcpy(var_s, as_var_s);
-            free(as_var_s);
+    asm_local_t* target = NULL;
+    for (size_t i = 0; i < ast->children->size; i++) {
+        ast_t* value = NULL;
+        asm_local_t* local = asm_select_target(ctx, ((ast_t*) ast->children->items[i])->value, &value);
+        if (!local || (target && local != target) || value->type != AST_INT) return false;
+        target = local;
+    }
+
+    long low = cases[0].label;
+    long range = cases[count - 1].label - low + 1;
+    int fallback = ((ast_t*) ((ast_t*) ((ast_t*) ast->children->items[otherwise])->value->children->items[0])->value)->int_value;
+    asm_emit(&ctx->rodata, "align 8\n"
+                           "__skull_values_%d:", id);
+    size_t next = 0;
+    for (long value = low; value <= low + range; value++) {
+        int result = fallback;
+        if (next < count && cases[next].label == value) {
+            ast_t* arm = (ast_t*) ast->children->items[cases[next++].arm];
+            result = ((ast_t*) ((ast_t*) arm->value->children->items[0])->value)->int_value;
+        }
+        asm_emit(&ctx->rodata, (value - low) % 8 ? ", %d" : "\n    dq %d", result);
+    }
+    asm_emit(&ctx->rodata, "\n");
+
+    if (low) asm_emit(ctx->out, "    sub rax, %ld\n", low);
+    asm_emit(ctx->out, "    mov ecx, %ld\n"
+                       "    cmp rax, rcx\n"
+                       "    cmovae rax, rcx\n"
+                       "    lea rcx, [__skull_values_%d]\n"
+                       "    mov rax, [rcx+rax*8]\n", range, id);
+    asm_store_local(ctx, target, 0);
+    return true;
+}
+
+// `match (value) { ... }` dispatches with a compare chain, a binary search
+// or a jump table, whichever suits how many labels there are and how
+// densely they are spread. Arms do not fall through.
+void asm_f_match(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_match");
+    if (!asm_is_int_like(ctx, asm_type_of(ctx, ast->value))) asm_error("Expected an int to match", "match");
+
+    size_t arms = ast->children->size;
+    size_t otherwise = arms;
+    size_t count = 0;
+    for (size_t i = 0; i < arms; i++) {
+        ast_t* arm = (ast_t*) ast->children->items[i];
+        if (arm->children->size == 0 && otherwise != arms) asm_error("Only one `_` case is allowed in", "match");
+        if (arm->children->size == 0) otherwise = i;
+        count += arm->children->size;
+    }
+
+    asm_case_t* cases = malloc((count + 1) * sizeof(asm_case_t));
+    if (!cases) {
+        fprintf(stderr, "Memory allocation failed for match cases\n");
+        exit(1);
+    }
+    // Arms go in the order of their runs in the profile, the hottest right
+    // after the dispatch, and "match:<function>:<site>:<arms>" counts values
+    // no arm takes
+    int site = ctx->branch_site++;
+    size_t* order = malloc((arms + 1) * sizeof(size_t));
+    uint64_t* runs = malloc((arms + 1) * sizeof(uint64_t));
+    if (!order || !runs) {
+        fprintf(stderr, "Memory allocation failed for match cases\n");
+        exit(1);
+    }
+    char arm_name[32];
+    for (size_t i = 0; i < arms; i++) {
+        snprintf(arm_name, sizeof(arm_name), "%zu", i);
+        runs[i] = asm_arm_count(ctx, "match", site, arm_name);
+        size_t j = i;
+        while (j > 0 && runs[order[j - 1]] < runs[i]) {
+            order[j] = order[j - 1];
+            j--;
         }
-        const char* template = "    mov %s, rax\n"
-                               "    mov rbp, rsp\n"
-                               "    pop rbp\n\n"
-                               "    ret\n";
-        char* ret_s = calloc(strlen(template) + 128, sizeof(char));
-        sprintf(ret_s, template, first_arg ? first_arg->int_value : 0);
-        s = realloc(s, (strlen(ret_s) + 1) * sizeof(char));
-        strcat(s, ret_s);
-        free(ret_s);
+        order[j] = i;
+    }
+
+    count = 0;
+    for (size_t i = 0; i < arms; i++) {
+        ast_t* arm = (ast_t*) ast->children->items[i];
+        for (size_t j = 0; j < arm->children->size; j++) {
+            cases[count].label = ((ast_t*) arm->children->items[j])->int_value;
+            cases[count].count = runs[i];
+            cases[count++].arm = i;
+        }
+    }
+    qsort(cases, count, sizeof(asm_case_t), asm_case_compare);
+    for (size_t i = 1; i < count; i++) {
+        if (cases[i].label == cases[i - 1].label) asm_error("Duplicate case label in", "match");
     }
 
-    return s;
+    int id = ctx->label_count++;
+    asm_f(ctx, ast->value);
+    if (asm_f_match_values(ctx, ast, cases, count, id, otherwise)) {
+        free(cases);
+        free(order);
+        free(runs);
+        return;
+    }
+    if (count >= ASM_MATCH_TABLE_MIN && asm_cases_dense(cases, count)) {
+        asm_f_match_table(ctx, cases, count, id, otherwise);
+    } else {
+        asm_f_match_search(ctx, cases, 0, count, id, otherwise, arms ? order[0] : SIZE_MAX);
+    }
+    free(cases);
+
+    asm_flow_t before, joined = {0};
+    asm_flow_save(ctx, &before);
+    for (size_t n = 0; n < arms; n++) {
+        size_t i = order[n];
+        ast_t* arm = (ast_t*) ast->children->items[i];
+        asm_line(ctx, arm);
+        asm_emit(ctx->out, "..@skull_case_%d_%zu:\n", id, i);
+        snprintf(arm_name, sizeof(arm_name), "%zu", i);
+        asm_count_arm(ctx, "match", site, arm_name);
+        asm_f_branch(ctx, arm->value, NULL, false, &before, &joined);
+        if (!asm_returns(arm->value)) asm_emit(ctx->out, "    jmp .end_match_%d\n", id);
+    }
+    free(order);
+    free(runs);
+    // Without `_` unmatched values skip every arm
+    if (otherwise == arms) {
+        asm_emit(ctx->out, "..@skull_case_%d_%zu:\n", id, arms);
+        snprintf(arm_name, sizeof(arm_name), "%zu", arms);
+        asm_count_arm(ctx, "match", site, arm_name);
+        asm_flow_restore(ctx, &before);
+        asm_flow_meet(ctx, &joined);
+    }
+    asm_emit(ctx->out, ".end_match_%d:\n", id);
+    asm_flow_join(ctx, &before, &joined);
+}
+
+// The executable's object carries the I/O runtime when it or a module it
+// imports may use it
+static bool asm_has_io_runtime(asm_ctx_t* ctx) {
+    return asm_has_runtime(ctx) && (ctx->io || ctx->externs->size);
+}
+
+// Arrays point at their first element with the length in the 8 bytes
+// before it, the same layout the kernel gives argv with argc in front.
+// Heap objects come zeroed from __skull_alloc, after a 64 byte header so
+// they start on a fresh cache line. The header ends with the size of the
+// block, then the length for arrays.
+static void asm_f_array_runtime(asm_ctx_t* ctx, asm_buf_t* out) {
+    // Panics write their message after what stdout has buffered
+    const char* flush = "";
+    if (asm_has_io_runtime(ctx) || ctx->io) {
+        flush = "    push rsi\n"
+                "    push rdx\n"
+                "    call __skull_flush\n"
+                "    pop rdx\n"
+                "    pop rsi\n";
+    }
+    asm_emit(out, "__skull_array_new:          ; rdi: length\n"
+                  "    mov rax, 0x0fffffffffffff00\n"
+                  "    cmp rdi, rax\n"
+                  "    ja .invalid           ; negative or too large\n"
+                  "    push rdi\n"
+                  "    shl rdi, 3\n"
+                  "    call __skull_alloc\n"
+                  "    pop rdi\n"
+                  "    mov [rax-8], rdi\n"
+                  "    ret\n"
+                  ".invalid:\n"
+                  "    lea rsi, [__skull_array_invalid]\n"
+                  "    mov rdx, __skull_array_invalid_end - __skull_array_invalid\n"
+                  "    jmp __skull_panic\n\n"
+                  "__skull_records_new:        ; rdi: length, rsi: bytes per element\n"
+                  "    mov rax, 0x0fffffffffffff00\n"
+                  "    cmp rdi, rax\n"
+                  "    ja __skull_array_new.invalid\n"
+                  "    push rdi\n"
+                  "    mov rax, rdi\n"
+                  "    mul rsi\n"
+                  "    jc __skull_array_new.invalid\n"
+                  "    mov rdi, rax\n"
+                  "    mov rax, 0x0fffffffffffff00\n"
+                  "    cmp rdi, rax\n"
+                  "    ja __skull_array_new.invalid\n"
+                  "    call __skull_alloc\n"
+                  "    pop rdi\n"
+                  "    mov [rax-8], rdi\n"
+                  "    ret\n\n"
+                  "__skull_concat:             ; rdi, rsi: strings, returns a fresh one holding both\n"
+                  "    push rbx\n"
+                  "    push r12\n"
+                  "    mov rbx, rdi\n"
+                  "    mov r12, rsi\n"
+                  "    xor eax, eax\n"
+                  "    mov rcx, -1\n"
+                  "    repne scasb\n"
+                  "    not rcx\n"
+                  "    lea rdx, [rcx-1]      ; length of the first\n"
+                  "    mov rdi, r12\n"
+                  "    mov rcx, -1\n"
+                  "    repne scasb\n"
+                  "    not rcx               ; the second with its terminator\n"
+                  "    push rdx\n"
+                  "    push rcx\n"
+                  "    lea rdi, [rdx+rcx]\n"
+                  "    call __skull_alloc\n"
+                  "    pop rdx\n"
+                  "    pop rcx\n"
+                  "    mov rdi, rax\n"
+                  "    mov rsi, rbx\n"
+                  "    rep movsb\n"
+                  "    mov rsi, r12\n"
+                  "    mov rcx, rdx\n"
+                  "    rep movsb\n"
+                  "    pop r12\n"
+                  "    pop rbx\n"
+                  "    ret\n\n"
+                  "__skull_array_copy:        ; rdi: array, returns a fresh copy of it\n"
+                  "    push rdi\n"
+                  "    mov rdi, [rdi-8]\n"
+                  "    call __skull_array_new\n"
+                  "    pop rsi\n"
+                  "    mov rdi, rax\n"
+                  "    mov rcx, [rax-8]\n"
+                  "    rep movsq\n"
+                  "    ret\n\n"
+                  "__skull_bounds_fail:\n"
+                  "    lea rsi, [__skull_bounds]\n"
+                  "    mov rdx, __skull_bounds_end - __skull_bounds\n"
+                  "__skull_panic:\n"
+                  "%s"
+                  "    mov edi, 2\n"
+                  "    mov eax, 1            ; write\n"
+                  "    syscall\n"
+                  "    mov edi, 1\n"
+                  "    mov eax, 60           ; exit\n"
+                  "    syscall\n\n"
+                  "section .rodata\n"
+                  "__skull_array_invalid: db \"skull: invalid array length\", 10\n"
+                  "__skull_array_invalid_end:\n"
+
+                  "__skull_bounds: db \"skull: index out of bounds\", 10\n"
+                  "__skull_bounds_end:\n"
+                  "align 8\n"
+                  "    dq 0\n"
+                  "__skull_array_empty:\n\n", flush);
+}
+
+// The executable's object carries the heap runtime when it or a module it
+// imports may allocate
+static bool asm_has_heap_runtime(asm_ctx_t* ctx) {
+    return asm_has_runtime(ctx) && (ctx->arrays || ctx->externs->size);
+}
+
+// The allocator shared by every object of a program. __skull_alloc rounds
+// small requests up to whole cache lines, takes a block from its free list or
+// carves one from the current chunk, and zeroes recycled blocks.
+// __skull_free puts small blocks back on their list and unmaps large ones.
+// Regions hand out arrays by bumping a pointer through a list of chunks and
+// are reset as a whole. Counters of both are written to stderr on exit
+// when SKULL_ALLOC_STATS is set.
+static void asm_f_heap_runtime(asm_buf_t* out) {
+    asm_emit(out, "section .text\n"
+                  "global __skull_alloc\n"
+                  "__skull_alloc:              ; rdi: bytes, returns them zeroed\n"
+                  "    inc qword [__skull_heap_counts]\n"
+                  "    add [__skull_heap_counts+16], rdi\n"
+                  "    lea rsi, [rdi+127]\n"
+                  "    and rsi, -64          ; header and bytes in whole cache lines\n"
+                  "    cmp rsi, %d\n"
+                  "    ja .large\n"
+                  "    mov r8, rsi\n"
+                  "    mov rcx, rsi\n"
+                  "    shr rcx, 6            ; the class is the number of lines\n"
+                  "    lea rdx, [__skull_free_lists]\n"
+                  "    mov rax, [rdx+rcx*8]\n"
+                  "    test rax, rax\n"
+                  "    jz .carve\n"
+                  "    mov r9, [rax]\n"
+                  "    mov [rdx+rcx*8], r9\n"
+                  "    mov rdx, rax\n"
+                  "    lea rdi, [rax+64]     ; the header is written anew\n"
+                  "    lea rcx, [r8-64]\n"
+                  "    shr rcx, 3\n"
+                  "    xor eax, eax\n"
+                  "    rep stosq\n"
+                  "    mov rax, rdx\n"
+                  "    jmp .ready\n"
+                  ".carve:\n"
+                  "    mov rax, [__skull_bump]\n"
+                  "    lea r9, [rax+r8]\n"
+                  "    cmp r9, [__skull_bump_end]\n"
+                  "    ja .refill\n"
+                  "    mov [__skull_bump], r9\n"
+                  "    jmp .ready\n"
+                  ".refill:                  ; what is left of the chunk is dropped\n"
+                  "    push r8\n"
+                  "    mov esi, %d\n"
+                  "    call __skull_map\n"
+                  "    pop r8\n"
+                  "    lea r9, [rax+r8]\n"
+                  "    mov [__skull_bump], r9\n"
+                  "    add rsi, rax\n"
+                  "    mov [__skull_bump_end], rsi\n"
+                  ".ready:\n"
+                  "    add rax, 64\n"
+                  "    mov [rax-16], r8\n"
+                  "    ret\n"
+                  ".large:\n"
+                  "    call __skull_map\n"
+                  "    add rax, 64\n"
+                  "    mov [rax-16], rsi\n"
+                  "    ret\n\n"
+                  "global __skull_free\n"
+                  "__skull_free:               ; rdi: what __skull_alloc returned, or 0\n"
+                  "    test rdi, rdi\n"
+                  "    jz .done\n"
+                  "    inc qword [__skull_heap_counts+8]\n"
+                  "    mov rsi, [rdi-16]\n"
+                  "    sub rdi, 64\n"
+                  "    cmp rsi, %d\n"
+                  "    ja .unmap\n"
+                  "    mov rcx, rsi\n"
+                  "    shr rcx, 6\n"
+                  "    lea rdx, [__skull_free_lists]\n"
+                  "    mov rax, [rdx+rcx*8]\n"
+                  "    mov [rdi], rax\n"
+                  "    mov [rdx+rcx*8], rdi\n"
+                  "    ret\n"
+                  ".unmap:\n"
+                  "    mov eax, 11           ; munmap\n"
+                  "    syscall\n"
+                  ".done:\n"
+                  "    ret\n\n"
+                  "__skull_map:                ; rsi: bytes, returns fresh pages, keeps rsi\n"
+                  "    add [__skull_heap_counts+24], rsi\n"
+                  "    xor edi, edi\n"
+                  "    mov edx, 3            ; PROT_READ | PROT_WRITE\n"
+                  "    mov r10d, 0x22        ; MAP_PRIVATE | MAP_ANONYMOUS\n"
+                  "    mov r8, -1\n"
+                  "    xor r9d, r9d\n"
+                  "    mov eax, 9            ; mmap\n"
+                  "    syscall\n"
+                  "    cmp rax, -4096\n"
+                  "    ja .failed\n"
+                  "    ret\n"
+                  ".failed:\n"
+                  "    lea rsi, [__skull_out_of_memory]\n"
+                  "    mov rdx, __skull_out_of_memory_end - __skull_out_of_memory\n"
+                  "    jmp __skull_panic\n\n",
+             ASM_HEAP_SMALL_MAX, ASM_HEAP_CHUNK, ASM_HEAP_SMALL_MAX);
+
+    // A region is 4 words: its first chunk, the current one, the bump
+    // pointer and the end of the current chunk. Chunks start with the next
+    // chunk and their size.
+    asm_emit(out, "global __skull_region_new\n"
+                  "__skull_region_new:\n"
+                  "    mov edi, 32\n"
+                  "    jmp __skull_alloc\n\n"
+                  "global __skull_region_array\n"
+                  "__skull_region_array:       ; rdi: region, rsi: length\n"
+                  "    mov rax, 0x0fffffffffffff00\n"
+                  "    cmp rsi, rax\n"
+                  "    ja .invalid\n"
+                  "    inc qword [__skull_heap_counts+32]\n"
+                  "    lea rdx, [rsi*8+23]   ; elements and length, 16 byte aligned\n"
+                  "    and rdx, -16\n"
+                  ".retry:\n"
+                  "    mov rax, [rdi+16]\n"
+                  "    lea rcx, [rax+rdx]\n"
+                  "    cmp rcx, [rdi+24]\n"
+                  "    ja .next\n"
+                  "    mov [rdi+16], rcx\n"
+                  "    mov r8, rax\n"
+                  "    mov rdi, rax\n"
+                  "    mov rcx, rdx\n"
+                  "    shr rcx, 3\n"
+                  "    xor eax, eax\n"
+                  "    rep stosq\n"
+                  "    mov [r8], rsi\n"
+                  "    lea rax, [r8+8]\n"
+                  "    ret\n"
+                  ".next:                    ; the chunk after the current one if the array fits\n"
+                  "    mov rcx, [rdi+8]\n"
+                  "    test rcx, rcx\n"
+                  "    jz .map\n"
+                  "    mov rax, [rcx]\n"
+                  "    test rax, rax\n"
+                  "    jz .map\n"
+                  "    mov r8, [rax+8]\n"
+                  "    sub r8, 16\n"
+                  "    cmp r8, rdx\n"
+                  "    jae .use\n"
+                  ".map:                     ; otherwise a new one goes after the current one\n"
+                  "    push rdi\n"
+                  "    push rsi\n"
+                  "    push rdx\n"
+                  "    lea rsi, [rdx+16]\n"
+                  "    cmp rsi, %d\n"
+                  "    jae .sized\n"
+                  "    mov esi, %d\n"
+                  ".sized:\n"
+                  "    call __skull_map\n"
+                  "    mov [rax+8], rsi\n"
+                  "    pop rdx\n"
+                  "    pop rsi\n"
+                  "    pop rdi\n"
+                  "    mov rcx, [rdi+8]\n"
+                  "    test rcx, rcx\n"
+                  "    jz .first\n"
+                  "    mov r8, [rcx]\n"
+                  "    mov [rax], r8\n"
+                  "    mov [rcx], rax\n"
+                  "    jmp .use\n"
+                  ".first:\n"
+                  "    mov [rdi], rax\n"
+                  ".use:\n"
+                  "    mov [rdi+8], rax\n"
+                  "    lea rcx, [rax+16]\n"
+                  "    mov [rdi+16], rcx\n"
+                  "    add rax, [rax+8]\n"
+                  "    mov [rdi+24], rax\n"
+                  "    jmp .retry\n"
+                  ".invalid:\n"
+                  "    lea rsi, [__skull_array_invalid]\n"
+                  "    mov rdx, __skull_array_invalid_end - __skull_array_invalid\n"
+                  "    jmp __skull_panic\n\n"
+                  "global __skull_region_reset\n"
+                  "__skull_region_reset:       ; rdi: region, everything in it is given back\n"
+                  "    mov rax, [rdi]\n"
+                  "    test rax, rax\n"
+                  "    jz .done\n"
+                  "    mov [rdi+8], rax\n"
+                  "    lea rcx, [rax+16]\n"
+                  "    mov [rdi+16], rcx\n"
+                  "    add rax, [rax+8]\n"
+                  "    mov [rdi+24], rax\n"
+                  ".done:\n"
+                  "    ret\n\n", ASM_REGION_CHUNK, ASM_REGION_CHUNK);
+
+    asm_emit(out, "__skull_heap_exit:          ; writes the counters when SKULL_ALLOC_STATS is set\n"
+                  "    mov rsi, [__skull_envp]\n"
+                  "    test rsi, rsi         ; libraries only know it when the loader passed it\n"
+                  "    jz .done\n"
+                  ".variable:\n"
+                  "    mov rdi, [rsi]\n"
+                  "    test rdi, rdi\n"
+                  "    jz .done\n"
+                  "    add rsi, 8\n"
+                  "    lea rdx, [__skull_stats_variable]\n"
+                  ".compare:\n"
+                  "    mov al, [rdx]\n"
+                  "    test al, al\n"
+                  "    jz .write\n"
+                  "    cmp al, [rdi]\n"
+                  "    jne .variable\n"
+                  "    inc rdi\n"
+                  "    inc rdx\n"
+                  "    jmp .compare\n"
+                  ".write:\n"
+                  "    push r12\n"
+                  "    sub rsp, 512\n"
+                  "    mov rdi, rsp\n"
+                  "    lea rsi, [__skull_stats_labels]\n"
+                  "    lea r12, [__skull_heap_counts]\n"
+                  ".label:\n"
+                  "    mov al, [rsi]\n"
+                  "    inc rsi\n"
+                  "    test al, al\n"
+                  "    jz .number\n"
+                  "    mov [rdi], al\n"
+                  "    inc rdi\n"
+                  "    jmp .label\n"
+                  ".number:                  ; digits are made backwards at the end of the buffer\n"
+                  "    mov rax, [r12]\n"
+                  "    add r12, 8\n"
+                  "    lea r8, [rsp+512]\n"
+                  "    mov ecx, 10\n"
+                  ".digit:\n"
+                  "    xor edx, edx\n"
+                  "    div rcx\n"
+                  "    add dl, 48\n"
+                  "    dec r8\n"
+                  "    mov [r8], dl\n"
+                  "    test rax, rax\n"
+                  "    jnz .digit\n"
+                  "    lea rdx, [rsp+512]\n"
+                  ".put:\n"
+                  "    mov al, [r8]\n"
+                  "    mov [rdi], al\n"
+                  "    inc rdi\n"
+                  "    inc r8\n"
+                  "    cmp r8, rdx\n"
+                  "    jb .put\n"
+                  "    cmp byte [rsi], 0     ; the labels end with an empty one\n"
+                  "    jne .label\n"
+                  "    mov byte [rdi], 10\n"
+                  "    lea rdx, [rdi+1]\n"
+                  "    sub rdx, rsp\n"
+                  "    mov rsi, rsp\n"
+                  "    mov edi, 2\n"
+                  "    mov eax, 1            ; write\n"
+                  "    syscall\n"
+                  "    add rsp, 512\n"
+                  "    pop r12\n"
+                  ".done:\n"
+                  "    ret\n\n"
+                  "section .rodata\n"
+                  "__skull_out_of_memory: db \"skull: out of memory\", 10\n"
+                  "__skull_out_of_memory_end:\n"
+                  "__skull_stats_variable: db \"SKULL_ALLOC_STATS=\", 0\n"
+                  "__skull_stats_labels:\n"
+                  "    db \"skull: allocations \", 0, \", frees \", 0, \", bytes requested \", 0\n"
+                  "    db \", bytes mapped \", 0, \", region arrays \", 0, 0\n"
+                  "section .bss\n"
+                  "alignb 8\n"
+                  "__skull_free_lists: resq %d\n"
+                  "__skull_bump: resq 1\n"
+                  "__skull_bump_end: resq 1\n"
+                  "__skull_heap_counts: resq 5 ; allocations, frees, bytes, mapped, region arrays\n"
+                  "__skull_envp: resq 1\n\n", ASM_HEAP_SMALL_MAX / 64 + 1);
+}
+
+// Buffered stdout and stdin on raw syscalls. Output collects in a 64 KiB
+// buffer written with one write per flush, on a full buffer, before reading
+// stdin so prompts show, and when main returns. Input is read 64 KiB at a
+// time.
+static void asm_f_io_runtime(asm_buf_t* out) {
+    asm_emit(out, "section .text\n"
+                  "global __skull_write\n"
+                  "__skull_write:             ; rsi: bytes, rdx: count\n"
+                  "    mov rax, [__skull_out_len]\n"
+                  "    lea rcx, [rax+rdx]\n"
+                  "    cmp rcx, 65536\n"
+                  "    jbe .copy\n"
+                  "    push rsi\n"
+                  "    push rdx\n"
+                  "    call __skull_flush\n"
+                  "    pop rdx\n"
+                  "    pop rsi\n"
+                  "    xor eax, eax\n"
+                  "    cmp rdx, 65536\n"
+                  "    jbe .copy\n"
+                  "    mov edi, 1            ; larger than the buffer, written as is\n"
+                  "    jmp __skull_write_all\n"
+                  ".copy:\n"
+                  "    lea rdi, [__skull_out]\n"
+                  "    add rdi, rax\n"
+                  "    add rax, rdx\n"
+                  "    mov [__skull_out_len], rax\n"
+                  "    mov rcx, rdx\n"
+                  "    rep movsb\n"
+                  "    ret\n\n"
+                  "global __skull_flush\n"
+                  "__skull_flush:\n"
+                  "    lea rsi, [__skull_out]\n"
+                  "    mov rdx, [__skull_out_len]\n"
+                  "    mov qword [__skull_out_len], 0\n"
+                  "    mov edi, 1\n"
+                  "__skull_write_all:         ; edi: fd, rsi: bytes, rdx: count\n"
+                  "    test rdx, rdx\n"
+                  "    jz .done\n"
+                  "    mov eax, 1            ; write, again only after a short write\n"
+                  "    syscall\n"
+                  "    test rax, rax\n"
+                  "    jle .done\n"
+                  "    add rsi, rax\n"
+                  "    sub rdx, rax\n"
+                  "    jmp __skull_write_all\n"
+                  ".done:\n"
+                  "    ret\n\n"
+                  "global __skull_print_string\n"
+                  "__skull_print_string:      ; rdi: NUL terminated string\n"
+                  "    mov rsi, rdi\n"
+                  "    xor eax, eax\n"
+                  "    mov rcx, -1\n"
+                  "    repne scasb\n"
+                  "    not rcx\n"
+                  "    lea rdx, [rcx-1]\n"
+                  "    jmp __skull_write\n\n"
+                  "global __skull_print_newline\n"
+                  "__skull_print_newline:\n"
+                  "    lea rsi, [__skull_newline]\n"
+                  "    mov edx, 1\n"
+                  "    jmp __skull_write\n\n"
+                  "global __skull_print_int\n"
+                  "__skull_print_int:         ; rdi: value, digits go backwards into the stack\n"
+                  "    sub rsp, 32\n"
+                  "    lea rsi, [rsp+32]\n"
+                  "    mov rax, rdi\n"
+                  "    mov ecx, 10\n"
+                  "    test rax, rax\n"
+                  "    jns .digit\n"
+                  "    neg rax               ; the minimum stays itself, right when unsigned\n"
+                  ".digit:\n"
+                  "    xor edx, edx\n"
+                  "    div rcx\n"
+                  "    add dl, 48\n"
+                  "    dec rsi\n"
+                  "    mov [rsi], dl\n"
+                  "    test rax, rax\n"
+                  "    jnz .digit\n"
+                  "    test rdi, rdi\n"
+                  "    jns .write\n"
+                  "    dec rsi\n"
+                  "    mov byte [rsi], 45    ; -\n"
+                  ".write:\n"
+                  "    lea rdx, [rsp+32]\n"
+                  "    sub rdx, rsi\n"
+                  "    call __skull_write\n"
+                  "    add rsp, 32\n"
+                  "    ret\n\n"
+                  "global __skull_read_byte\n"
+                  "__skull_read_byte:         ; the next byte of stdin, -1 at its end\n"
+                  "    mov rax, [__skull_in_pos]\n"
+                  "    cmp rax, [__skull_in_len]\n"
+                  "    jb .take\n"
+                  "    call __skull_flush\n"
+                  "    xor edi, edi\n"
+                  "    lea rsi, [__skull_in]\n"
+                  "    mov edx, 65536\n"
+                  "    xor eax, eax          ; read\n"
+                  "    syscall\n"
+                  "    test rax, rax\n"
+                  "    jle .end\n"
+                  "    mov [__skull_in_len], rax\n"
+                  "    xor eax, eax\n"
+                  ".take:\n"
+                  "    lea rcx, [__skull_in]\n"
+                  "    movzx edx, byte [rcx+rax]\n"
+                  "    inc rax\n"
+                  "    mov [__skull_in_pos], rax\n"
+                  "    mov eax, edx\n"
+                  "    ret\n"
+                  ".end:\n"
+                  "    mov qword [__skull_in_pos], 0\n"
+                  "    mov qword [__skull_in_len], 0\n"
+                  "    mov rax, -1\n"
+                  "    ret\n\n"
+                  "global __skull_read_int\n"
+                  "__skull_read_int:          ; skips white space, then an optional - and digits, 0 at the end\n"
+                  "    push rbx\n"
+                  "    push r12\n"
+                  "    xor ebx, ebx\n"
+                  "    xor r12d, r12d\n"
+                  ".skip:\n"
+                  "    call __skull_read_byte\n"
+                  "    test rax, rax\n"
+                  "    js .sign\n"
+                  "    cmp eax, 32\n"
+                  "    jbe .skip\n"
+                  "    cmp eax, 45           ; -\n"
+                  "    jne .digit\n"
+                  "    mov r12d, 1\n"
+                  ".next:\n"
+                  "    call __skull_read_byte\n"
+                  ".digit:\n"
+                  "    sub rax, 48\n"
+                  "    cmp rax, 9\n"
+                  "    ja .done\n"
+                  "    imul rbx, rbx, 10\n"
+                  "    add rbx, rax\n"
+                  "    jmp .next\n"
+                  ".done:\n"
+                  "    cmp rax, -49          ; the end of stdin, nothing to put back\n"
+                  "    je .sign\n"
+                  "    dec qword [__skull_in_pos]\n"
+                  ".sign:\n"
+                  "    mov rax, rbx\n"
+                  "    test r12d, r12d\n"
+                  "    jz .return\n"
+                  "    neg rax\n"
+                  ".return:\n"
+                  "    pop r12\n"
+                  "    pop rbx\n"
+                  "    ret\n\n"
+                  "section .rodata\n"
+                  "__skull_newline: db 10\n"
+                  "section .bss\n"
+                  "alignb 64\n"
+                  "__skull_out: resb 65536\n"
+                  "__skull_in: resb 65536\n"
+                  "__skull_out_len: resq 1\n"
+                  "__skull_in_pos: resq 1\n"
+                  "__skull_in_len: resq 1\n\n");
 }
 
-char* asm_f_int(ast_t* ast) {
-    // Not directly emitted unless in context
-    return strdup("");
+// Writes the counter block to profile_path, called after main returns
+static void asm_f_profile_dump(asm_buf_t* out) {
+    asm_emit(out, "__skull_prof_dump:\n"
+                  "    mov rax, 2            ; open\n"
+                  "    lea rdi, [__skull_prof_path]\n"
+                  "    mov rsi, 0x241        ; O_WRONLY | O_CREAT | O_TRUNC\n"
+                  "    mov rdx, 0o644\n"
+                  "    syscall\n"
+                  "    test rax, rax\n"
+                  "    js .done\n"
+                  "    mov rdi, rax\n"
+                  "    push rdi\n"
+                  "    mov rax, 1            ; write\n"
+                  "    lea rsi, [__skull_prof]\n"
+                  "    mov rdx, __skull_prof_end - __skull_prof\n"
+                  "    syscall\n"
+                  "    pop rdi\n"
+                  "    mov rax, 3            ; close\n"
+                  "    syscall\n"
+                  ".done:\n"
+                  "    ret\n\n");
+}
+
+// The counters laid out exactly as profile_load reads them
+static void asm_f_profile_data(asm_ctx_t* ctx, asm_buf_t* out) {
+    asm_emit(out, "section .data\n"
+                  "__skull_prof_path: db \"%s\", 0\n"
+                  "align 8\n"
+                  "__skull_prof:\n"
+                  "    db \"%s\"\n"
+                  "    dd %d\n"
+                  "    dq %zu\n"
+                  "__skull_prof_counts:\n", ctx->profile_path, PROFILE_MAGIC, PROFILE_VERSION, ctx->counters->size);
+    if (ctx->counters->size) {
+        asm_emit(out, "    times %zu dq 0\n", ctx->counters->size);
+    }
+    for (size_t i = 0; i < ctx->counters->size; i++) {
+        asm_emit(out, "    db \"%s\", 0\n", (char*) ctx->counters->items[i]);
+    }
+    asm_emit(out, "__skull_prof_end:\n\n");
 }
 
-char* asm_f_root(ast_t* ast) {
-    const char* section_text = "section .text\n"
-                               "global _start\n"
-                               "_start:\n"
-                               "    mov rdi, [rsp]        ; argc\n"
-                               "    lea rsi, [rsp+8]      ; argv\n"
-                               "    call main\n"
-                               "    mov rdi, rax\n"
-                               "    mov rax, 60\n"
-                               "    syscall\n\n";
+// Stable insertion sort by entry count, hottest first
+static void asm_sort_functions(asm_ctx_t* ctx) {
+    size_t count = ctx->functions->size;
+    uint64_t* counts = malloc(count * sizeof(uint64_t) + 1);
+    if (!counts) {
+        fprintf(stderr, "Memory allocation failed in asm_sort_functions\n");
+        exit(1);
+    }
+
+    char key[512];
+    for (size_t i = 0; i < count; i++) {
+        snprintf(key, sizeof(key), "fn:%s", ((ast_t*) ctx->functions->items[i])->name);
+        counts[i] = profile_count(ctx->profile, key);
+    }
 
-    char* value = calloc(strlen(section_text) + 1, sizeof(char));
-    strcpy(value, section_text);
+    for (size_t i = 1; i < count; i++) {
+        void* function = ctx->functions->items[i];
+        uint64_t function_count = counts[i];
+        size_t j = i;
+        while (j > 0 && counts[j - 1] < function_count) {
+            ctx->functions->items[j] = ctx->functions->items[j - 1];
+            counts[j] = counts[j - 1];
+            j--;
+        }
+        ctx->functions->items[j] = function;
+        counts[j] = function_count;
+    }
 
-    char* next_value = asm_f(ast);
-    value = realloc(value, strlen(value) + strlen(next_value) + 1);
-    strcat(value, next_value);
-    free(next_value);
+    free(counts);
+}
 
-    return value;
+// What a shared library adds around its functions: array allocation and
+// freeing for C callers, and initializers the loader runs. glibc passes
+// initializers main's arguments, the environment is kept for the allocator
+// counters. The finalizer flushes stdout when the process exits or the
+// library is unloaded, saving every register C expects to survive.
+static void asm_f_shared_entry(asm_ctx_t* ctx, asm_buf_t* out) {
+    asm_emit(out, "global skull_array:function\n"
+                  "skull_array:                ; int64_t* skull_array(int64_t length)\n"
+                  "    jmp __skull_array_new\n\n"
+                  "global skull_free:function\n"
+                  "skull_free:                 ; void skull_free(void* array)\n"
+                  "    jmp __skull_free\n\n"
+                  "__skull_init:               ; rdi: argc, rsi: argv, rdx: envp\n"
+                  "    mov [__skull_envp], rdx\n"
+                  "    ret\n\n"
+                  "__skull_fini:\n"
+                  "    push rbx\n"
+                  "    push rbp\n"
+                  "    push r12\n"
+                  "    push r13\n"
+                  "    push r14\n"
+                  "    push r15\n"
+                  "    sub rsp, 8\n");
+    if (asm_has_io_runtime(ctx)) asm_emit(out, "    call __skull_flush\n");
+    asm_emit(out, "    call __skull_heap_exit\n"
+                  "    add rsp, 8\n"
+                  "    pop r15\n"
+                  "    pop r14\n"
+                  "    pop r13\n"
+                  "    pop r12\n"
+                  "    pop rbp\n"
+                  "    pop rbx\n"
+                  "    ret\n\n"
+                  "section .init_array progbits alloc noexec write align=8\n"
+                  "    dq __skull_init\n"
+                  "section .fini_array progbits alloc noexec write align=8\n"
+                  "    dq __skull_fini\n"
+                  "section .text\n");
 }
 
-char* asm_f(ast_t* ast) {
-    char* next_value = NULL;
+char* asm_f_root(asm_ctx_t* ctx, ast_t* ast) {
+    TRACE_SCOPE("asm_f_root");
+    // Declare every top level symbol first so functions can call
+    // each other regardless of their order in the file
+    for (size_t i = 0; i < ast->children->size; i++) {
+        ast_t* child = (ast_t*) ast->children->items[i];
+        if (child->type == AST_IMPORT) continue;
+
+        // A record declared again, by a module merged into this one or
+        // redeclaring an imported one, has to declare it the same way
+        if (child->type == AST_ASSIGNMENT && child->value && child->value->type == AST_RECORD) {
+            record_t* record = init_record(child->name, child->value);
+            record_t* previous = record_named(ctx->records, record->name);
+            if (previous && !record_same(previous, record)) asm_error("Conflicting declarations of record", record->name);
+            if (previous) {
+                free_record(record);
+                continue;
+            }
+            if (record->type <= TYPE_F32X8) asm_error("Records cannot be named after a builtin type", record->name);
+            if (record_find(ctx->records, record->type)) asm_error("Record name collides with another record's type", record->name);
+            list_push(ctx->records, record);
+            continue;
+        }
+
+        module_symbol_t* symbol = module_symbol_from_assignment(child);
+        if (!symbol) {
+            fprintf(stderr, "ERROR: Only functions, globals and imports are allowed at the top level (AST type '%d')\n", child->type);
+            exit(1);
+        }
+        asm_add_symbol(ctx, symbol);
+    }
+    for (size_t i = 0; i < ctx->records->size; i++) {
+        record_t* record = (record_t*) ctx->records->items[i];
+        if (module_interface_find(ctx->symbols, record->name)) asm_error("Record named like a function or global", record->name);
+        for (size_t j = 0; j < record->field_count; j++) {
+            if (asm_array_record(ctx, record->fields[j].data_type) || asm_record(ctx, record->fields[j].data_type)) {
+                asm_error("Records cannot hold records", record->fields[j].name);
+            }
+        }
+    }
+
+    // Functions are gathered first, initializers of globals may call them
+    for (size_t i = 0; i < ast->children->size; i++) {
+        ast_t* child = (ast_t*) ast->children->items[i];
+        if (child->type == AST_ASSIGNMENT && child->value && child->value->type == AST_FUNCTION) {
+            list_push(ctx->functions, child);
+        }
+    }
+    ctx->escape = init_escape(ctx->functions, ctx->symbols, ctx->records);
+    for (size_t i = 0; i < ast->children->size; i++) {
+        ast_t* child = (ast_t*) ast->children->items[i];
+        if (child->type == AST_IMPORT) continue;
+        if (child->type == AST_ASSIGNMENT && child->value &&
+            (child->value->type == AST_FUNCTION || child->value->type == AST_RECORD)) continue;
+        asm_f_global(ctx, child);
+    }
+
+    // With a profile the hottest functions go first so they share pages
+    // and cache lines, the rest keeps source order
+    if (ctx->profile) {
+        asm_sort_functions(ctx);
+    }
+    for (size_t i = 0; i < ctx->functions->size; i++) {
+        ast_t* function = (ast_t*) ctx->functions->items[i];
+        if (!asm_is_generic(function)) asm_f_function(ctx, function);
+    }
+
+    // Generic functions only exist as their instances, which may request
+    // further instances while they are emitted
+    for (size_t i = 0; i < ctx->instances->size; i++) {
+        asm_instance_t* instance = (asm_instance_t*) ctx->instances->items[i];
+        ast_t function = *instance->function;
+        function.name = instance->name;
+        ctx->type_args = instance->types;
+        asm_f_function(ctx, &function);
+        ctx->type_args = NULL;
+    }
+
+    if (ctx->io && ctx->arrays) asm_runtime_extern(ctx, "__skull_flush");
+    if (ctx->arrays) {
+        asm_runtime_extern(ctx, "__skull_alloc");
+        asm_runtime_extern(ctx, "__skull_free");
+    }
+    // The heap runtime panics through the array runtime, and libraries
+    // export array allocation to their callers
+    if (asm_has_heap_runtime(ctx) || ctx->shared) ctx->arrays = true;
+
+    asm_buf_t out = {0};
+    asm_emit(&out, "default rel\n\n");
+    for (size_t i = 0; i < ctx->externs->size; i++) {
+        asm_emit(&out, "extern %s\n", (char*) ctx->externs->items[i]);
+    }
+
+    asm_emit(&out, "section .text\n");
+    if (ctx->entry) {
+        module_symbol_t* main_symbol = module_interface_find(ctx->symbols, "main");
+        if (!main_symbol || main_symbol->kind != MODULE_SYMBOL_FUNCTION) {
+            fprintf(stderr, "ERROR: No main function defined\n");
+            exit(1);
+        }
+        asm_emit(&out, "global _start\n"
+                       "_start:\n"
+                       "    mov rdi, [rsp]        ; argc\n"
+                       "    lea rsi, [rsp+8]      ; argv, an array as argc sits right before it\n");
+        if (asm_has_heap_runtime(ctx)) {
+            asm_emit(&out, "    lea rax, [rsi+rdi*8+8]\n"
+                           "    mov [__skull_envp], rax\n");
+        }
+        asm_emit(&out, "    call main\n");
+        if (ctx->instrument) {
+            asm_emit(&out, "    push rax\n"
+                           "    call __skull_prof_dump\n"
+                           "    pop rax\n");
+        }
+        if (asm_has_io_runtime(ctx)) {
+            asm_emit(&out, "    push rax\n"
+                           "    call __skull_flush\n"
+                           "    pop rax\n");
+        }
+        if (asm_has_heap_runtime(ctx)) {
+            asm_emit(&out, "    push rax\n"
+                           "    call __skull_heap_exit\n"
+                           "    pop rax\n");
+        }
+        asm_emit(&out, "    mov rdi, rax\n"
+                       "    mov rax, 60\n"
+                       "    syscall\n\n");
+        if (ctx->instrument) asm_f_profile_dump(&out);
+    }
+    if (ctx->shared) asm_f_shared_entry(ctx, &out);
+    if (ctx->text.size) asm_emit(&out, "%s", ctx->text.data);
+    if (ctx->arrays) asm_f_array_runtime(ctx, &out);
+    if (asm_has_heap_runtime(ctx)) asm_f_heap_runtime(&out);
+    if (asm_has_io_runtime(ctx)) asm_f_io_runtime(&out);
+    // The linker script gathers .text.unlikely of every object in one place
+    if (ctx->cold.size) asm_emit(&out, "section .text.unlikely progbits alloc exec nowrite align=16\n%s", ctx->cold.data);
+    if (ctx->data.size) asm_emit(&out, "section .data\n%s\n", ctx->data.data);
+    // Jump tables and nested tables hold addresses, which a library only
+    // knows once loaded. The loader fills them in and protects them again
+    if (ctx->rodata.size) {
+        asm_emit(&out, "section %s\n%s\n", ctx->shared ? ".data.rel.ro progbits alloc noexec write align=64" : ".rodata",
+                 ctx->rodata.data);
+    }
+    if (ctx->entry && ctx->instrument) asm_f_profile_data(ctx, &out);
+    if (ctx->bss.size) asm_emit(&out, "section .bss\n%s\n", ctx->bss.data);
+    if (ctx->eh_frame.size) {
+        // CIE shared by every FDE: code alignment 1, data alignment -8,
+        // return address in r16, pc relative FDE pointers, on entry the
+        // CFA is rsp+8 with the return address at CFA-8
+        asm_emit(&out, "section .eh_frame progbits alloc noexec nowrite align=8\n"
+                       "__skull_cie:\n"
+                       "    dd __skull_cie_end - __skull_cie - 4\n"
+                       "    dd 0                           ; CIE id\n"
+                       "    db 1                           ; version\n"
+                       "    db \"zR\", 0\n"
+                       "    db 1, 0x78, 16                 ; code align, data align, return address\n"
+                       "    db 1, 0x1b                     ; augmentation: pcrel sdata4 pointers\n"
+                       "    db 0x0c, 7, 8                  ; cfa rsp+8\n"
+                       "    db 0x90, 1                     ; return address at cfa-8\n"
+                       "    align 8, db 0\n"
+                       "__skull_cie_end:\n"
+                       "%s\n", ctx->eh_frame.data);
+    }
+
+    return out.data;
+}
 
+void asm_f(asm_ctx_t* ctx, ast_t* ast) {
     switch (ast->type) {
-        case AST_COMPOUND:   next_value = asm_f_compound(ast); break;
-        case AST_ASSIGNMENT: next_value = asm_f_assignment(ast); break;
-        case AST_VARIABLE:   next_value = asm_f_variable(ast, 0); break;
-        case AST_CALL:       next_value = asm_f_call(ast); break;
-        case AST_INT:        next_value = asm_f_int(ast); break;
+        case AST_COMPOUND:   asm_f_compound(ctx, ast); break;
+        case AST_ASSIGNMENT: asm_f_assignment(ctx, ast); break;
+        case AST_VARIABLE:   asm_f_variable(ctx, ast); break;
+        case AST_CALL:       asm_f_call(ctx, ast); break;
+        case AST_INT:        asm_f_int(ctx, ast); break;
+        case AST_FLOAT:      asm_f_float(ctx, ast); break;
+        case AST_STRING:     asm_f_string(ctx, ast); break;
+        case AST_INDEX:      asm_f_index(ctx, ast); break;
+        case AST_INDEX_ASSIGNMENT: asm_f_index_assignment(ctx, ast); break;
+        case AST_FIELD:      asm_f_field(ctx, ast); break;
+        case AST_FIELD_ASSIGNMENT: asm_f_field_assignment(ctx, ast); break;
+        case AST_BINARY:     asm_f_binary(ctx, ast); break;
+        case AST_IF:         asm_f_if(ctx, ast); break;
+        case AST_MATCH:      asm_f_match(ctx, ast); break;
+        case AST_NOOP:       break;
         default:
             fprintf(stderr, "ERROR: No frontend for AST type: '%d'\n", ast->type);
             exit(1);
     }
-
-    return next_value;
 }
 
 #endif // SKULL_ASM_H_IMPLEMENTATION
@@ -3,6 +3,14 @@
 
 #include "list.h"
 
+// Move of the spans of a statement and of everything nested in it that
+// `parse_incremental` has not applied yet, `incremental_settle` applies it
+typedef struct {
+    int offset;
+    int line;
+    int column;               // Only for spans on the first line of the statement
+} ast_shift_t;
+
 typedef struct astStruct {
     enum {
         AST_COMPOUND,
@@ -14,6 +22,19 @@ typedef struct astStruct {
         AST_INT,
         AST_NOOP,
         AST_ASSIGNMENT,
+        AST_IMPORT,
+        AST_INDEX,              // name[value]
+        AST_INDEX_ASSIGNMENT,   // name[children[0]] = value
+        AST_BINARY,             // children[0] op children[1], int_value is the operator token
+        AST_FLOAT,              // name is the literal as written
+        AST_STRING,             // name is the literal with its escapes decoded
+        AST_IF,                 // if value children[0], else children[1] when there are two
+        AST_MATCH,              // value against the AST_CASEs in children
+        AST_CASE,               // value runs for the AST_INT labels in children, none for `_`
+        AST_RECORD,             // Fields are the AST_VARIABLEs in children, hot ones with int_value 1,
+                                // name is the layout asked for, NULL for the default
+        AST_FIELD,              // value.name
+        AST_FIELD_ASSIGNMENT,   // children[0], an AST_FIELD, = value
     } type;
 
     list_t* children;
@@ -21,9 +42,17 @@ typedef struct astStruct {
     struct astStruct* value;
     int int_value;
     int data_type;
+
+    // Source span, only recorded for statements of a compound
+    unsigned int src_start;   // Offset of the first token
+    unsigned int src_end;     // Offset just past the last token
+    unsigned int line;        // Line of the first token
+    unsigned int column;      // Column of the first token
+    ast_shift_t* shifts;      // Roots updated by parse_incremental only: pending moves, one per child
 } ast_t;
 
 ast_t* init_ast(int type);
+void free_ast(ast_t* ast);
 
 #ifdef SKULL_AST_H_IMPLEMENTATION
 
@@ -31,12 +60,28 @@ ast_t* init_ast(int type) {
     ast_t* ast = calloc(1, sizeof(struct astStruct));
     ast->type = type;
 
-    if (type == AST_COMPOUND) {
+    if (type == AST_COMPOUND || type == AST_BINARY || type == AST_IF || type == AST_MATCH || type == AST_CASE ||
+        type == AST_RECORD) {
         ast->children = init_list(sizeof(struct astStruct));
     }
 
     return ast;
 }
 
+void free_ast(ast_t* ast) {
+    if (!ast) return;
+
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            free_ast((ast_t*) ast->children->items[i]);
+        }
+        free_list(ast->children);
+    }
+    free_ast(ast->value);
+    free(ast->name);
+    free(ast->shifts);
+    free(ast);
+}
+
 #endif // SKULL_AST_H_IMPLEMENTATION
 #endif // SKULL_AST_H
\ No newline at end of file
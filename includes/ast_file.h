@@ -0,0 +1,177 @@
+#ifndef SKULL_AST_FILE_H
+#define SKULL_AST_FILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ast_pool.h"
+
+// On disk form of an ast_pool_t. Every section is stored exactly as it sits
+// in memory and starts 8 byte aligned, so a loaded file is used in place
+// through mmap without decoding anything.
+//
+//   header | nodes | children | spans | name offsets | name data
+#define AST_FILE_MAGIC "SKAF"
+#define AST_FILE_VERSION 6
+
+// Pass as source_hash to load a file whatever source it came from
+#define AST_FILE_ANY_SOURCE 0
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_hash;     // Hash of the source the tree was parsed from
+    uint32_t node_size;       // sizeof(ast_node_t) of the writer
+    uint32_t root;
+    uint32_t node_count;
+    uint32_t child_count;
+    uint32_t span_count;
+    uint32_t name_count;
+    uint32_t name_bytes;
+    uint64_t nodes_offset;
+    uint64_t children_offset;
+    uint64_t spans_offset;
+    uint64_t name_offsets_offset;
+    uint64_t names_offset;
+} ast_file_header_t;
+
+uint64_t ast_file_hash(const char* src, size_t size);
+bool ast_file_write(const char* path, ast_pool_t* pool, uint64_t source_hash);
+ast_pool_t* ast_file_load(const char* path, uint64_t source_hash);
+
+#ifdef SKULL_AST_FILE_H_IMPLEMENTATION
+
+#define AST_FILE_ALIGN(x) (((x) + 7) & ~(uint64_t) 7)
+
+uint64_t ast_file_hash(const char* src, size_t size) {
+    // FNV-1a, 64 bit
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char) src[i];
+        hash *= 1099511628211ull;
+    }
+    // Keep 0 free for AST_FILE_ANY_SOURCE
+    return hash ? hash : 1;
+}
+
+static bool ast_file_put(FILE* fp, const void* data, size_t size, uint64_t offset) {
+    if (fseek(fp, (long) offset, SEEK_SET) != 0) return false;
+    return size == 0 || fwrite(data, 1, size, fp) == size;
+}
+
+bool ast_file_write(const char* path, ast_pool_t* pool, uint64_t source_hash) {
+    ast_file_header_t header = {0};
+    memcpy(header.magic, AST_FILE_MAGIC, 4);
+    header.version = AST_FILE_VERSION;
+    header.source_hash = source_hash;
+    header.node_size = sizeof(ast_node_t);
+    header.root = pool->root;
+    header.node_count = (uint32_t) pool->size;
+    header.child_count = (uint32_t) pool->children_size;
+    header.span_count = (uint32_t) pool->spans_size;
+    header.name_count = (uint32_t) pool->names.count;
+    header.name_bytes = (uint32_t) pool->names.size;
+
+    header.nodes_offset = AST_FILE_ALIGN(sizeof(ast_file_header_t));
+    header.children_offset = AST_FILE_ALIGN(header.nodes_offset + (uint64_t) header.node_count * sizeof(ast_node_t));
+    header.spans_offset = AST_FILE_ALIGN(header.children_offset + (uint64_t) header.child_count * sizeof(ast_ref_t));
+    header.name_offsets_offset = AST_FILE_ALIGN(header.spans_offset + (uint64_t) header.span_count * sizeof(ast_span_t));
+    header.names_offset = AST_FILE_ALIGN(header.name_offsets_offset + (uint64_t) header.name_count * sizeof(uint32_t));
+
+    // Write to a temporary name first so readers never map a half written file
+    char tmp_path[4096];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int) sizeof(tmp_path)) {
+        fprintf(stderr, "Error: AST file path too long: %s\n", path);
+        return false;
+    }
+
+    FILE* fp = fopen(tmp_path, "wb");
+    if (!fp) {
+        fprintf(stderr, "Could not open file for writing '%s'\n", tmp_path);
+        return false;
+    }
+
+    bool ok = ast_file_put(fp, &header, sizeof(header), 0) &&
+              ast_file_put(fp, pool->nodes, header.node_count * sizeof(ast_node_t), header.nodes_offset) &&
+              ast_file_put(fp, pool->children, header.child_count * sizeof(ast_ref_t), header.children_offset) &&
+              ast_file_put(fp, pool->spans, header.span_count * sizeof(ast_span_t), header.spans_offset) &&
+              ast_file_put(fp, pool->names.offsets, header.name_count * sizeof(uint32_t), header.name_offsets_offset) &&
+              ast_file_put(fp, pool->names.data, header.name_bytes, header.names_offset);
+
+    if (fclose(fp) != 0) ok = false;
+    if (!ok || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error: Failed to write AST file %s\n", path);
+        remove(tmp_path);
+        return false;
+    }
+
+    return true;
+}
+
+// Maps an AST file and returns a read only pool viewing it, or NULL when the
+// file is missing, truncated, from another version or from another source.
+// Node and name references inside the sections are trusted as written.
+ast_pool_t* ast_file_load(const char* path, uint64_t source_hash) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(ast_file_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t) st.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return NULL;
+
+    ast_file_header_t* header = (ast_file_header_t*) mapping;
+    bool valid = memcmp(header->magic, AST_FILE_MAGIC, 4) == 0 &&
+                 header->version == AST_FILE_VERSION &&
+                 header->node_size == sizeof(ast_node_t) &&
+                 (source_hash == AST_FILE_ANY_SOURCE || header->source_hash == source_hash) &&
+                 header->node_count > 0 && header->root < header->node_count &&
+                 header->nodes_offset + (uint64_t) header->node_count * sizeof(ast_node_t) <= size &&
+                 header->children_offset + (uint64_t) header->child_count * sizeof(ast_ref_t) <= size &&
+                 header->span_count > 0 &&
+                 header->spans_offset + (uint64_t) header->span_count * sizeof(ast_span_t) <= size &&
+                 header->name_offsets_offset + (uint64_t) header->name_count * sizeof(uint32_t) <= size &&
+                 header->names_offset + header->name_bytes <= size;
+    if (!valid) {
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    ast_pool_t* pool = calloc(1, sizeof(ast_pool_t));
+    if (!pool) {
+        fprintf(stderr, "Memory allocation failed for AST pool\n");
+        exit(1);
+    }
+
+    char* base = (char*) mapping;
+    pool->nodes = (ast_node_t*) (base + header->nodes_offset);
+    pool->size = pool->capacity = header->node_count;
+    pool->children = (ast_ref_t*) (base + header->children_offset);
+    pool->children_size = pool->children_capacity = header->child_count;
+    pool->spans = (ast_span_t*) (base + header->spans_offset);
+    pool->spans_size = pool->spans_capacity = header->span_count;
+    pool->names.offsets = (uint32_t*) (base + header->name_offsets_offset);
+    pool->names.count = pool->names.offsets_capacity = header->name_count;
+    pool->names.data = base + header->names_offset;
+    pool->names.size = pool->names.capacity = header->name_bytes;
+    pool->root = header->root;
+    pool->mapping = mapping;
+    pool->mapping_size = size;
+
+    return pool;
+}
+
+#endif // SKULL_AST_FILE_H_IMPLEMENTATION
+#endif // SKULL_AST_FILE_H
@@ -0,0 +1,325 @@
+#ifndef SKULL_AST_POOL_H
+#define SKULL_AST_POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "ast.h"
+#include "utils.h"
+
+// Flat copy of a parsed tree: nodes in one array, linked by index, children
+// in another and names interned. The compiler itself still builds and walks
+// ast_t, the parser, codegen, CTFE and escape analysis included. Only the AST
+// file behind --emit-ast and --ast-cache and the --bench-ast comparison use
+// the pool, converting with ast_pool_from_ast and ast_pool_to_ast. Porting
+// the parser and the walkers to the pool is still to be done.
+
+// Index of a node inside an ast_pool_t, 0 means no node
+typedef uint32_t ast_ref_t;
+#define AST_NONE 0
+
+// Compact counterpart of ast_t, children are the range
+// pool->children[first_child .. first_child + child_count)
+typedef struct {
+    uint8_t type;
+    uint32_t name;          // Intern id, 0 when the node has no name
+    ast_ref_t value;
+    uint32_t first_child;
+    uint32_t child_count;
+    int32_t int_value;
+    int32_t data_type;
+    uint32_t span;          // Index into pool->spans, 0 when the node has no source span
+} ast_node_t;
+
+// Source span of a statement, kept out of the nodes since most have none
+typedef struct {
+    uint32_t src_start;
+    uint32_t src_end;
+    uint32_t line;
+    uint32_t column;
+} ast_span_t;
+
+// Every distinct name is stored once, ids index into offsets
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+    uint32_t* offsets;
+    size_t count;
+    size_t offsets_capacity;
+    uint32_t* table;        // Open addressing, holds id + 1, 0 is empty
+    size_t table_capacity;
+} intern_t;
+
+typedef struct {
+    ast_node_t* nodes;
+    size_t size;
+    size_t capacity;
+    ast_ref_t* children;
+    size_t children_size;
+    size_t children_capacity;
+    ast_span_t* spans;      // Entry 0 is unused
+    size_t spans_size;
+    size_t spans_capacity;
+    intern_t names;
+    ast_ref_t root;
+    void* mapping;          // Set when the pool views a mapped AST file, which is read only
+    size_t mapping_size;
+} ast_pool_t;
+
+void init_intern(intern_t* names);
+uint32_t intern(intern_t* names, const char* str);
+const char* intern_str(intern_t* names, uint32_t id);
+void free_intern(intern_t* names);
+
+ast_pool_t* init_ast_pool(size_t capacity);
+ast_ref_t ast_pool_add(ast_pool_t* pool, ast_t* ast);
+ast_pool_t* ast_pool_from_ast(ast_t* root);
+ast_t* ast_pool_to_ast(ast_pool_t* pool, ast_ref_t ref);
+void free_ast_pool(ast_pool_t* pool);
+
+#define AST_NODE(pool, ref) (&(pool)->nodes[(ref)])
+#define AST_CHILD(pool, node, i) ((pool)->children[(node)->first_child + (i)])
+
+#ifdef SKULL_AST_POOL_H_IMPLEMENTATION
+
+static uint32_t intern_hash(const char* str) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    while (*str) {
+        hash ^= (unsigned char) *str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void intern_grow_table(intern_t* names) {
+    size_t capacity = names->table_capacity ? names->table_capacity * 2 : 64;
+    uint32_t* table = calloc(capacity, sizeof(uint32_t));
+    if (!table) {
+        fprintf(stderr, "Memory allocation failed for intern table\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < names->count; i++) {
+        size_t slot = intern_hash(names->data + names->offsets[i]) & (capacity - 1);
+        while (table[slot]) slot = (slot + 1) & (capacity - 1);
+        table[slot] = (uint32_t) i + 1;
+    }
+
+    free(names->table);
+    names->table = table;
+    names->table_capacity = capacity;
+}
+
+void init_intern(intern_t* names) {
+    memset(names, 0, sizeof(intern_t));
+    // Id 0 is the empty name
+    intern(names, "");
+}
+
+uint32_t intern(intern_t* names, const char* str) {
+    if ((names->count + 1) * 2 > names->table_capacity) {
+        intern_grow_table(names);
+    }
+
+    size_t mask = names->table_capacity - 1;
+    size_t slot = intern_hash(str) & mask;
+    while (names->table[slot]) {
+        uint32_t id = names->table[slot] - 1;
+        if (strcmp(names->data + names->offsets[id], str) == 0) return id;
+        slot = (slot + 1) & mask;
+    }
+
+    size_t len = strlen(str) + 1;
+    if (names->size + len > names->capacity) {
+        names->capacity = MAX(names->capacity * 2, names->size + len + 256);
+        names->data = realloc(names->data, names->capacity);
+    }
+    if (names->count == names->offsets_capacity) {
+        names->offsets_capacity = names->offsets_capacity ? names->offsets_capacity * 2 : 64;
+        names->offsets = realloc(names->offsets, names->offsets_capacity * sizeof(uint32_t));
+    }
+    if (!names->data || !names->offsets) {
+        fprintf(stderr, "Memory allocation failed in intern\n");
+        exit(1);
+    }
+
+    memcpy(names->data + names->size, str, len);
+    names->offsets[names->count] = (uint32_t) names->size;
+    names->size += len;
+    names->table[slot] = (uint32_t) names->count + 1;
+
+    return (uint32_t) names->count++;
+}
+
+const char* intern_str(intern_t* names, uint32_t id) {
+    return names->data + names->offsets[id];
+}
+
+void free_intern(intern_t* names) {
+    free(names->data);
+    free(names->offsets);
+    free(names->table);
+    memset(names, 0, sizeof(intern_t));
+}
+
+ast_pool_t* init_ast_pool(size_t capacity) {
+    ast_pool_t* pool = calloc(1, sizeof(ast_pool_t));
+    if (!pool) {
+        fprintf(stderr, "Memory allocation failed for AST pool\n");
+        exit(1);
+    }
+    if (capacity < 16) capacity = 16;
+
+    pool->nodes = malloc(capacity * sizeof(ast_node_t));
+    pool->children = malloc(capacity * sizeof(ast_ref_t));
+    pool->spans = calloc(16, sizeof(ast_span_t));
+    if (!pool->nodes || !pool->children || !pool->spans) {
+        fprintf(stderr, "Memory allocation failed for AST pool\n");
+        exit(1);
+    }
+    pool->capacity = capacity;
+    pool->children_capacity = capacity;
+    pool->spans_size = 1;
+    pool->spans_capacity = 16;
+    init_intern(&pool->names);
+
+    // Node 0 stands for "no node"
+    memset(&pool->nodes[0], 0, sizeof(ast_node_t));
+    pool->nodes[0].type = AST_NOOP;
+    pool->size = 1;
+
+    return pool;
+}
+
+static ast_ref_t ast_pool_reserve(ast_pool_t* pool) {
+    if (pool->size == pool->capacity) {
+        pool->capacity *= 2;
+        pool->nodes = realloc(pool->nodes, pool->capacity * sizeof(ast_node_t));
+        if (!pool->nodes) {
+            fprintf(stderr, "Memory reallocation failed for AST pool\n");
+            exit(1);
+        }
+    }
+    return (ast_ref_t) pool->size++;
+}
+
+static uint32_t ast_pool_add_span(ast_pool_t* pool, ast_t* ast) {
+    if (pool->spans_size == pool->spans_capacity) {
+        pool->spans_capacity *= 2;
+        pool->spans = realloc(pool->spans, pool->spans_capacity * sizeof(ast_span_t));
+        if (!pool->spans) {
+            fprintf(stderr, "Memory reallocation failed for AST pool\n");
+            exit(1);
+        }
+    }
+    pool->spans[pool->spans_size] = (ast_span_t) { ast->src_start, ast->src_end, ast->line, ast->column };
+    return (uint32_t) pool->spans_size++;
+}
+
+// Copies a subtree into the pool, children of a node end up next to each other
+ast_ref_t ast_pool_add(ast_pool_t* pool, ast_t* ast) {
+    if (!ast) return AST_NONE;
+
+    ast_ref_t ref = ast_pool_reserve(pool);
+    ast_node_t node = {0};
+    node.type = (uint8_t) ast->type;
+    node.name = ast->name ? intern(&pool->names, ast->name) : 0;
+    node.int_value = ast->int_value;
+    node.data_type = ast->data_type;
+    node.span = ast->line ? ast_pool_add_span(pool, ast) : 0;
+    node.value = ast_pool_add(pool, ast->value);
+
+    if (ast->children && ast->children->size) {
+        // Children add their own subtrees first, so collect the refs before
+        // committing them as one range
+        size_t count = ast->children->size;
+        ast_ref_t* refs = malloc(count * sizeof(ast_ref_t));
+        if (!refs) {
+            fprintf(stderr, "Memory allocation failed in ast_pool_add\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < count; i++) {
+            refs[i] = ast_pool_add(pool, (ast_t*) ast->children->items[i]);
+        }
+
+        if (pool->children_size + count > pool->children_capacity) {
+            pool->children_capacity = MAX(pool->children_capacity * 2, pool->children_size + count);
+            pool->children = realloc(pool->children, pool->children_capacity * sizeof(ast_ref_t));
+            if (!pool->children) {
+                fprintf(stderr, "Memory reallocation failed for AST pool\n");
+                exit(1);
+            }
+        }
+        memcpy(pool->children + pool->children_size, refs, count * sizeof(ast_ref_t));
+        node.first_child = (uint32_t) pool->children_size;
+        node.child_count = (uint32_t) count;
+        pool->children_size += count;
+        free(refs);
+    }
+
+    pool->nodes[ref] = node;
+    return ref;
+}
+
+ast_pool_t* ast_pool_from_ast(ast_t* root) {
+    ast_pool_t* pool = init_ast_pool(256);
+    pool->root = ast_pool_add(pool, root);
+    return pool;
+}
+
+// Rebuilds the pointer tree the parser produces from a pool node
+ast_t* ast_pool_to_ast(ast_pool_t* pool, ast_ref_t ref) {
+    if (ref == AST_NONE) return NULL;
+
+    ast_node_t* node = AST_NODE(pool, ref);
+    ast_t* ast = init_ast(node->type);
+    ast->name = node->name ? strdup(intern_str(&pool->names, node->name)) : NULL;
+    ast->int_value = node->int_value;
+    ast->data_type = node->data_type;
+    if (node->span) {
+        ast_span_t* span = &pool->spans[node->span];
+        ast->src_start = span->src_start;
+        ast->src_end = span->src_end;
+        ast->line = span->line;
+        ast->column = span->column;
+    }
+    ast->value = ast_pool_to_ast(pool, node->value);
+
+    if (node->child_count) {
+        if (!ast->children) ast->children = init_list(sizeof(struct astStruct));
+        ast->children->items = malloc(node->child_count * sizeof(void*));
+        if (!ast->children->items) {
+            fprintf(stderr, "Memory allocation failed in ast_pool_to_ast\n");
+            exit(1);
+        }
+        for (uint32_t i = 0; i < node->child_count; i++) {
+            ast->children->items[i] = ast_pool_to_ast(pool, AST_CHILD(pool, node, i));
+        }
+        ast->children->size = node->child_count;
+    }
+
+    return ast;
+}
+
+void free_ast_pool(ast_pool_t* pool) {
+    if (!pool) return;
+
+    if (pool->mapping) {
+        munmap(pool->mapping, pool->mapping_size);
+        free(pool);
+        return;
+    }
+
+    free(pool->nodes);
+    free(pool->children);
+    free(pool->spans);
+    free_intern(&pool->names);
+    free(pool);
+}
+
+#endif // SKULL_AST_POOL_H_IMPLEMENTATION
+#endif // SKULL_AST_POOL_H
@@ -0,0 +1,392 @@
+#ifndef SKULL_CTFE_H
+#define SKULL_CTFE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "list.h"
+#include "ast.h"
+#include "token.h"
+#include "types.h"
+#include "module.h"
+
+// Compile time evaluation of calls to pure functions of the module. The
+// interpreter walks the same tree the code generator does and gives up,
+// leaving the call to run, on anything whose result is not fixed at compile
+// time: globals, imported functions, vectors, a trap such as an index out of
+// bounds or a division by zero, and running past one of the limits below.
+#ifndef CTFE_MAX_STEPS
+#define CTFE_MAX_STEPS (1 << 20)    // Nodes evaluated per call
+#endif
+#ifndef CTFE_MAX_CELLS
+#define CTFE_MAX_CELLS (1 << 16)    // Array elements allocated per call
+#endif
+#ifndef CTFE_MAX_DEPTH
+#define CTFE_MAX_DEPTH 64           // Nested calls
+#endif
+
+typedef struct {
+    bool is_array;
+    int64_t value;      // The integer, or the index of the array in ctfe->arrays
+} ctfe_value_t;
+
+typedef struct {
+    long length;
+    ctfe_value_t* items;
+} ctfe_array_t;
+
+typedef struct {
+    const char* name;
+    ctfe_value_t value;
+} ctfe_local_t;
+
+typedef struct {
+    list_t* functions;          // ast_t*, the assignments defining functions that may be evaluated
+    module_interface_t* symbols;  // Names that are globals when a function assigns them
+    list_t* arrays;             // ctfe_array_t*, every array made so far
+    list_t* locals;             // ctfe_local_t*, of the function being evaluated
+    size_t steps;
+    size_t cells;
+    int depth;
+    bool failed;
+    bool returning;             // A return is unwinding to the function it left
+    ctfe_value_t result;        // What that return gave
+} ctfe_t;
+
+ctfe_t* init_ctfe(list_t* functions, module_interface_t* symbols);
+bool ctfe_is_constant(ast_t* ast);
+bool ctfe_evaluate(ctfe_t* ctfe, ast_t* ast, ctfe_value_t* out);
+ctfe_array_t* ctfe_array(ctfe_t* ctfe, ctfe_value_t value);
+void free_ctfe(ctfe_t* ctfe);
+
+#ifdef SKULL_CTFE_H_IMPLEMENTATION
+
+ctfe_t* init_ctfe(list_t* functions, module_interface_t* symbols) {
+    ctfe_t* ctfe = calloc(1, sizeof(ctfe_t));
+    if (!ctfe) {
+        fprintf(stderr, "Memory allocation failed for compile time evaluation\n");
+        exit(1);
+    }
+    ctfe->functions = functions;
+    ctfe->symbols = symbols;
+    ctfe->arrays = init_list(sizeof(ctfe_array_t*));
+    ctfe->locals = init_list(sizeof(ctfe_local_t*));
+    return ctfe;
+}
+
+static void ctfe_free_locals(list_t* locals) {
+    for (size_t i = 0; i < locals->size; i++) {
+        free(locals->items[i]);
+    }
+    free_list(locals);
+}
+
+void free_ctfe(ctfe_t* ctfe) {
+    if (!ctfe) return;
+
+    for (size_t i = 0; i < ctfe->arrays->size; i++) {
+        ctfe_array_t* array = (ctfe_array_t*) ctfe->arrays->items[i];
+        free(array->items);
+        free(array);
+    }
+    free_list(ctfe->arrays);
+    ctfe_free_locals(ctfe->locals);
+    free(ctfe);
+}
+
+// Whether ast computes the same value wherever it is, only literals,
+// operators and calls of such
+bool ctfe_is_constant(ast_t* ast) {
+    if (!ast) return true;
+
+    switch (ast->type) {
+        case AST_INT: return true;
+        case AST_BINARY:
+            return ctfe_is_constant((ast_t*) ast->children->items[0]) &&
+                   ctfe_is_constant((ast_t*) ast->children->items[1]);
+        case AST_CALL:
+            if (strcmp(ast->name, "return") == 0) return false;
+            if (!ast->value || !ast->value->children) return true;
+            for (size_t i = 0; i < ast->value->children->size; i++) {
+                if (!ctfe_is_constant((ast_t*) ast->value->children->items[i])) return false;
+            }
+            return true;
+        default: return false;
+    }
+}
+
+ctfe_array_t* ctfe_array(ctfe_t* ctfe, ctfe_value_t value) {
+    return value.is_array ? (ctfe_array_t*) ctfe->arrays->items[value.value] : NULL;
+}
+
+static ctfe_value_t ctfe_fail(ctfe_t* ctfe) {
+    ctfe->failed = true;
+    return (ctfe_value_t) {0};
+}
+
+static ctfe_value_t ctfe_int(int64_t value) {
+    return (ctfe_value_t) { .is_array = false, .value = value };
+}
+
+static ctfe_value_t ctfe_new_array(ctfe_t* ctfe, int64_t length) {
+    if (length < 0 || (uint64_t) length > CTFE_MAX_CELLS - ctfe->cells) return ctfe_fail(ctfe);
+
+    ctfe_array_t* array = malloc(sizeof(ctfe_array_t));
+    ctfe_value_t* items = calloc(length ? length : 1, sizeof(ctfe_value_t));
+    if (!array || !items) {
+        fprintf(stderr, "Memory allocation failed for compile time evaluation\n");
+        exit(1);
+    }
+    array->length = length;
+    array->items = items;
+    ctfe->cells += length;
+    list_push(ctfe->arrays, array);
+    return (ctfe_value_t) { .is_array = true, .value = (int64_t) ctfe->arrays->size - 1 };
+}
+
+static ctfe_local_t* ctfe_find_local(ctfe_t* ctfe, const char* name) {
+    for (size_t i = 0; i < ctfe->locals->size; i++) {
+        ctfe_local_t* local = (ctfe_local_t*) ctfe->locals->items[i];
+        if (strcmp(local->name, name) == 0) return local;
+    }
+    return NULL;
+}
+
+// A new name is a local, unless it is a global the function would write.
+// Parameters are always locals.
+static bool ctfe_store(ctfe_t* ctfe, const char* name, ctfe_value_t value, bool is_param) {
+    ctfe_local_t* local = ctfe_find_local(ctfe, name);
+    if (!local) {
+        if (!is_param && module_interface_find(ctfe->symbols, name)) return false;
+        local = malloc(sizeof(ctfe_local_t));
+        if (!local) {
+            fprintf(stderr, "Memory allocation failed for compile time evaluation\n");
+            exit(1);
+        }
+        local->name = name;
+        list_push(ctfe->locals, local);
+    }
+    local->value = value;
+    return true;
+}
+
+// The element of name at index, NULL after failing
+static ctfe_value_t* ctfe_element(ctfe_t* ctfe, const char* name, ctfe_value_t index) {
+    ctfe_local_t* local = ctfe_find_local(ctfe, name);
+    ctfe_array_t* array = local ? ctfe_array(ctfe, local->value) : NULL;
+    if (!array || index.is_array || index.value < 0 || index.value >= array->length) {
+        ctfe_fail(ctfe);
+        return NULL;
+    }
+    return &array->items[index.value];
+}
+
+static ctfe_value_t ctfe_eval(ctfe_t* ctfe, ast_t* ast);
+
+// Same results as the generated code, which wraps around on overflow and
+// traps on the divisions idiv traps on
+static ctfe_value_t ctfe_binary(ctfe_t* ctfe, ast_t* ast) {
+    ctfe_value_t lhs = ctfe_eval(ctfe, (ast_t*) ast->children->items[0]);
+    if (ctfe->failed || ctfe->returning) return lhs;
+    ctfe_value_t rhs = ctfe_eval(ctfe, (ast_t*) ast->children->items[1]);
+    if (ctfe->failed || ctfe->returning) return rhs;
+    if (lhs.is_array || rhs.is_array) return ctfe_fail(ctfe);
+
+    uint64_t a = (uint64_t) lhs.value;
+    uint64_t b = (uint64_t) rhs.value;
+    switch (ast->int_value) {
+        case TOKEN_PLUS:     return ctfe_int((int64_t) (a + b));
+        case TOKEN_MINUS:    return ctfe_int((int64_t) (a - b));
+        case TOKEN_MULTIPLY: return ctfe_int((int64_t) (a * b));
+        case TOKEN_DIVIDE:
+        case TOKEN_MODULUS:
+            if (rhs.value == 0 || (lhs.value == INT64_MIN && rhs.value == -1)) return ctfe_fail(ctfe);
+            return ctfe_int(ast->int_value == TOKEN_DIVIDE ? lhs.value / rhs.value : lhs.value % rhs.value);
+        case TOKEN_EQ:       return ctfe_int(lhs.value == rhs.value);
+        case TOKEN_NEQ:      return ctfe_int(lhs.value != rhs.value);
+        case TOKEN_LT:       return ctfe_int(lhs.value < rhs.value);
+        case TOKEN_GT:       return ctfe_int(lhs.value > rhs.value);
+        case TOKEN_LTE:      return ctfe_int(lhs.value <= rhs.value);
+        case TOKEN_GTE:      return ctfe_int(lhs.value >= rhs.value);
+        default:             return ctfe_fail(ctfe);
+    }
+}
+
+// Whether values of type, after peeling off arrays, are ints or type
+// parameters standing for them
+static bool ctfe_is_integral(int type) {
+    while (type_is_array(type)) type = type_element(type);
+    return !type_is_float(type) && !type_is_vector(type);
+}
+
+static ast_t* ctfe_find_function(ctfe_t* ctfe, const char* name) {
+    for (size_t i = 0; i < ctfe->functions->size; i++) {
+        ast_t* function = (ast_t*) ctfe->functions->items[i];
+        if (strcmp(function->name, name) == 0) return function;
+    }
+    return NULL;
+}
+
+static ctfe_value_t ctfe_invoke(ctfe_t* ctfe, ast_t* ast) {
+    // return takes its value directly instead of a list of arguments
+    if (strcmp(ast->name, "return") == 0) {
+        ctfe_value_t value = ast->value ? ctfe_eval(ctfe, ast->value) : ctfe_int(0);
+        if (ctfe->failed || ctfe->returning) return value;
+        ctfe->result = value;
+        ctfe->returning = true;
+        return value;
+    }
+
+    size_t count = ast->value && ast->value->children ? ast->value->children->size : 0;
+    ctfe_value_t args[MODULE_MAX_PARAMS];
+    if (count > MODULE_MAX_PARAMS) return ctfe_fail(ctfe);
+    for (size_t i = 0; i < count; i++) {
+        args[i] = ctfe_eval(ctfe, (ast_t*) ast->value->children->items[i]);
+        if (ctfe->failed || ctfe->returning) return args[i];
+    }
+
+    // Only builtins whose result does not depend on the machine
+    ast_t* callee = ctfe_find_function(ctfe, ast->name);
+    if (!callee && count == 1 && strcmp(ast->name, "len") == 0) {
+        ctfe_array_t* array = ctfe_array(ctfe, args[0]);
+        return array ? ctfe_int(array->length) : ctfe_fail(ctfe);
+    }
+    if (!callee && count == 1 && strcmp(ast->name, "array") == 0) {
+        return args[0].is_array ? ctfe_fail(ctfe) : ctfe_new_array(ctfe, args[0].value);
+    }
+
+    ast_t* function = callee ? callee->value : NULL;
+    size_t param_count = function && function->children ? function->children->size : 0;
+    if (!function || count != param_count || ctfe->depth >= CTFE_MAX_DEPTH) return ctfe_fail(ctfe);
+
+    // Only integer arithmetic is evaluated, floats are left to the machine
+    if (!ctfe_is_integral(function->data_type)) return ctfe_fail(ctfe);
+    for (size_t i = 0; i < count; i++) {
+        if (!ctfe_is_integral(((ast_t*) function->children->items[i])->data_type)) return ctfe_fail(ctfe);
+    }
+
+    list_t* caller_locals = ctfe->locals;
+    ctfe->locals = init_list(sizeof(ctfe_local_t*));
+    ctfe->depth++;
+    for (size_t i = 0; i < count; i++) {
+        ctfe_store(ctfe, ((ast_t*) function->children->items[i])->name, args[i], true);
+    }
+
+    // Falling off the end returns 0
+    ctfe_value_t result = ctfe_int(0);
+    if (function->value) ctfe_eval(ctfe, function->value);
+    if (ctfe->returning) result = ctfe->result;
+    ctfe->returning = false;
+
+    ctfe->depth--;
+    ctfe_free_locals(ctfe->locals);
+    ctfe->locals = caller_locals;
+    return result;
+}
+
+static ctfe_value_t ctfe_eval(ctfe_t* ctfe, ast_t* ast) {
+    if (ctfe->failed || ++ctfe->steps > CTFE_MAX_STEPS) return ctfe_fail(ctfe);
+
+    switch (ast->type) {
+        case AST_INT: return ctfe_int(ast->int_value);
+        case AST_NOOP: return ctfe_int(0);
+        case AST_BINARY: return ctfe_binary(ctfe, ast);
+        case AST_CALL: return ctfe_invoke(ctfe, ast);
+
+        case AST_COMPOUND: {
+            ctfe_value_t value = ctfe_int(0);
+            for (size_t i = 0; i < ast->children->size && !ctfe->failed && !ctfe->returning; i++) {
+                value = ctfe_eval(ctfe, (ast_t*) ast->children->items[i]);
+            }
+            return value;
+        }
+
+        case AST_VARIABLE: {
+            // `name: type` declares a zeroed local, arrays start out empty.
+            // A bare type parameter may stand for either, vectors are never
+            // constant.
+            if (ast->data_type) {
+                int type = ast->data_type;
+                if (!ctfe_is_integral(type) || (type_param_index(type) >= 0 && !type_is_array(type))) {
+                    return ctfe_fail(ctfe);
+                }
+                ctfe_value_t value = type_is_array(type) ? ctfe_new_array(ctfe, 0) : ctfe_int(0);
+                if (ctfe->failed || !ctfe_store(ctfe, ast->name, value, false)) return ctfe_fail(ctfe);
+                return value;
+            }
+            ctfe_local_t* local = ctfe_find_local(ctfe, ast->name);
+            return local ? local->value : ctfe_fail(ctfe);
+        }
+
+        case AST_ASSIGNMENT: {
+            if (!ast->value || ast->value->type == AST_FUNCTION || !ctfe_is_integral(ast->data_type)) return ctfe_fail(ctfe);
+            ctfe_value_t value = ctfe_eval(ctfe, ast->value);
+            if (ctfe->failed || ctfe->returning) return value;
+            if (!ctfe_store(ctfe, ast->name, value, false)) return ctfe_fail(ctfe);
+            return value;
+        }
+
+        case AST_INDEX: {
+            ctfe_value_t index = ctfe_eval(ctfe, ast->value);
+            if (ctfe->failed || ctfe->returning) return index;
+            ctfe_value_t* element = ctfe_element(ctfe, ast->name, index);
+            return element ? *element : ctfe_fail(ctfe);
+        }
+
+        case AST_INDEX_ASSIGNMENT: {
+            ctfe_value_t value = ctfe_eval(ctfe, ast->value);
+            if (ctfe->failed || ctfe->returning) return value;
+            ctfe_value_t index = ctfe_eval(ctfe, (ast_t*) ast->children->items[0]);
+            if (ctfe->failed || ctfe->returning) return index;
+            ctfe_value_t* element = ctfe_element(ctfe, ast->name, index);
+            if (!element) return ctfe_fail(ctfe);
+            *element = value;
+            return value;
+        }
+
+        case AST_IF: {
+            ctfe_value_t condition = ctfe_eval(ctfe, ast->value);
+            if (ctfe->failed || ctfe->returning) return condition;
+            if (condition.is_array) return ctfe_fail(ctfe);
+            if (condition.value) return ctfe_eval(ctfe, (ast_t*) ast->children->items[0]);
+            if (ast->children->size > 1) return ctfe_eval(ctfe, (ast_t*) ast->children->items[1]);
+            return ctfe_int(0);
+        }
+
+        case AST_MATCH: {
+            ctfe_value_t value = ctfe_eval(ctfe, ast->value);
+            if (ctfe->failed || ctfe->returning) return value;
+            if (value.is_array) return ctfe_fail(ctfe);
+            ast_t* otherwise = NULL;
+            for (size_t i = 0; i < ast->children->size; i++) {
+                ast_t* arm = (ast_t*) ast->children->items[i];
+                if (arm->children->size == 0) otherwise = arm;
+                for (size_t j = 0; j < arm->children->size; j++) {
+                    if (((ast_t*) arm->children->items[j])->int_value == value.value) return ctfe_eval(ctfe, arm->value);
+                }
+            }
+            return otherwise ? ctfe_eval(ctfe, otherwise->value) : ctfe_int(0);
+        }
+
+        default: return ctfe_fail(ctfe);
+    }
+}
+
+// Evaluates ast, usually a call, in an empty scope. Returns false when its
+// value is not known at compile time.
+bool ctfe_evaluate(ctfe_t* ctfe, ast_t* ast, ctfe_value_t* out) {
+    ctfe->steps = 0;
+    ctfe->cells = 0;
+    ctfe->depth = 0;
+    ctfe->failed = false;
+    ctfe->returning = false;
+
+    *out = ctfe_eval(ctfe, ast);
+    // A return outside of any function is not a value
+    return !ctfe->failed && !ctfe->returning;
+}
+
+#endif // SKULL_CTFE_H_IMPLEMENTATION
+#endif // SKULL_CTFE_H
@@ -0,0 +1,158 @@
+#ifndef SKULL_ESCAPE_H
+#define SKULL_ESCAPE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "list.h"
+#include "ast.h"
+#include "module.h"
+#include "record.h"
+#include "trace.h"
+
+// Escape analysis: whether an array or string held by a local may still be
+// reachable once the function holding it returns. It escapes when the local
+// is returned, assigned to another name or an array element, or passed to a
+// function that lets that parameter escape. Builtins only read or write
+// through their arguments. Uses are matched by name over the whole body, a
+// local escapes when any use of its name does. Records keep whatever they
+// are built from or have stored into their fields.
+typedef struct {
+    list_t* functions;          // ast_t*, the assignments defining the module's functions
+    module_interface_t* symbols;  // Anything found here and not in functions is imported
+    list_t* records;            // record_t*, whose constructors keep every argument
+    bool** params;              // params[i][j]: parameter j of function i escapes
+} escape_t;
+
+escape_t* init_escape(list_t* functions, module_interface_t* symbols, list_t* records);
+bool escape_local(escape_t* escape, ast_t* body, const char* name);
+void free_escape(escape_t* escape);
+
+#ifdef SKULL_ESCAPE_H_IMPLEMENTATION
+
+static size_t escape_param_count(ast_t* function) {
+    return function->value->children ? function->value->children->size : 0;
+}
+
+static bool escape_mentions(ast_t* ast, const char* name) {
+    if (!ast) return false;
+    if (ast->type == AST_VARIABLE && strcmp(ast->name, name) == 0) return true;
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            if (escape_mentions((ast_t*) ast->children->items[i], name)) return true;
+        }
+    }
+    return escape_mentions(ast->value, name);
+}
+
+// Whether function may keep argument index, imported functions are opaque
+// and builtins keep nothing
+static bool escape_kept(escape_t* escape, const char* function, size_t index) {
+    if (record_named(escape->records, function)) return true;
+    if (!module_interface_find(escape->symbols, function)) return false;
+    for (size_t i = 0; i < escape->functions->size; i++) {
+        ast_t* candidate = (ast_t*) escape->functions->items[i];
+        if (strcmp(candidate->name, function) == 0) {
+            return index >= escape_param_count(candidate) || escape->params[i][index];
+        }
+    }
+    return true;
+}
+
+// Whether the value ast computes, kept by whatever it is handed to when
+// captured, may carry name out of the function
+static bool escape_uses(escape_t* escape, ast_t* ast, const char* name, bool captured) {
+    if (!ast) return false;
+
+    switch (ast->type) {
+        case AST_VARIABLE:
+            return captured && !ast->data_type && strcmp(ast->name, name) == 0;
+        case AST_ASSIGNMENT:
+            // Storing into the local itself keeps it where it was
+            return escape_uses(escape, ast->value, name, strcmp(ast->name, name) != 0);
+        case AST_INDEX_ASSIGNMENT:
+            return escape_uses(escape, ast->value, name, true) ||
+                   (ast->children && escape_uses(escape, (ast_t*) ast->children->items[0], name, false));
+        case AST_FIELD_ASSIGNMENT:
+            return escape_uses(escape, ast->value, name, true) ||
+                   escape_uses(escape, (ast_t*) ast->children->items[0], name, false);
+        case AST_CALL: {
+            if (strcmp(ast->name, "return") == 0) return escape_uses(escape, ast->value, name, true);
+            if (!ast->value || !ast->value->children) return false;
+
+            for (size_t i = 0; i < ast->value->children->size; i++) {
+                ast_t* arg = (ast_t*) ast->value->children->items[i];
+                if (escape_mentions(arg, name) &&
+                    escape_uses(escape, arg, name, escape_kept(escape, ast->name, i))) return true;
+            }
+            return false;
+        }
+        default:
+            break;
+    }
+
+    // Operators, conditions and statements only read their operands
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            if (escape_uses(escape, (ast_t*) ast->children->items[i], name, false)) return true;
+        }
+    }
+    return escape_uses(escape, ast->value, name, false);
+}
+
+// Parameters start out kept in and escape once a use is found that lets
+// them, repeated until no more are found, so recursion keeps its arguments
+// in when nothing else lets them out
+escape_t* init_escape(list_t* functions, module_interface_t* symbols, list_t* records) {
+    TRACE_SCOPE("init_escape");
+    escape_t* escape = calloc(1, sizeof(escape_t));
+    if (escape) escape->params = calloc(functions->size + 1, sizeof(bool*));
+    if (!escape || !escape->params) {
+        fprintf(stderr, "Memory allocation failed for escape analysis\n");
+        exit(1);
+    }
+    escape->functions = functions;
+    escape->symbols = symbols;
+    escape->records = records;
+    for (size_t i = 0; i < functions->size; i++) {
+        escape->params[i] = calloc(escape_param_count((ast_t*) functions->items[i]) + 1, sizeof(bool));
+        if (!escape->params[i]) {
+            fprintf(stderr, "Memory allocation failed for escape analysis\n");
+            exit(1);
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < functions->size; i++) {
+            ast_t* function = ((ast_t*) functions->items[i])->value;
+            for (size_t j = 0; j < escape_param_count((ast_t*) functions->items[i]); j++) {
+                ast_t* param = (ast_t*) function->children->items[j];
+                if (!escape->params[i][j] && escape_uses(escape, function->value, param->name, false)) {
+                    escape->params[i][j] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return escape;
+}
+
+bool escape_local(escape_t* escape, ast_t* body, const char* name) {
+    return escape_uses(escape, body, name, false);
+}
+
+void free_escape(escape_t* escape) {
+    if (!escape) return;
+
+    for (size_t i = 0; i < escape->functions->size; i++) {
+        free(escape->params[i]);
+    }
+    free(escape->params);
+    free(escape);
+}
+
+#endif // SKULL_ESCAPE_H_IMPLEMENTATION
+#endif // SKULL_ESCAPE_H
@@ -0,0 +1,230 @@
+#ifndef SKULL_INCREMENTAL_H
+#define SKULL_INCREMENTAL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer.h"
+#include "parser.h"
+#include "ast.h"
+
+typedef struct {
+    unsigned int start;    // Offset where the edit begins (same in old and new source)
+    unsigned int old_end;  // End of the replaced text in the old source
+    unsigned int new_end;  // End of the inserted text in the new source
+} source_edit_t;
+
+ast_t* parse_incremental(ast_t* root, char* src, size_t src_size, source_edit_t edit);
+void incremental_settle(ast_t* root);
+unsigned int incremental_start(ast_t* root, size_t i);
+unsigned int incremental_end(ast_t* root, size_t i);
+
+#ifdef SKULL_INCREMENTAL_H_IMPLEMENTATION
+
+// Spans of the top level statements as they are now. The nodes keep them as
+// parsed and root->shifts holds the moves of every later edit, so an edit
+// adds to one array entry per statement past it instead of touching the
+// nodes and everything nested in them.
+unsigned int incremental_start(ast_t* root, size_t i) {
+    ast_t* statement = (ast_t*) root->children->items[i];
+    return statement->src_start + (root->shifts ? root->shifts[i].offset : 0);
+}
+
+unsigned int incremental_end(ast_t* root, size_t i) {
+    ast_t* statement = (ast_t*) root->children->items[i];
+    return statement->src_end + (root->shifts ? root->shifts[i].offset : 0);
+}
+
+static unsigned int incremental_line(ast_t* root, size_t i) {
+    ast_t* statement = (ast_t*) root->children->items[i];
+    return statement->line + (root->shifts ? root->shifts[i].line : 0);
+}
+
+static unsigned int incremental_column(ast_t* root, size_t i) {
+    ast_t* statement = (ast_t*) root->children->items[i];
+    return statement->column + (root->shifts ? root->shifts[i].column : 0);
+}
+
+// Applies a pending shift to a statement and the spans nested in it,
+// `first_line` is the line the statement started on when they were recorded
+static void incremental_apply(ast_t* ast, ast_shift_t* shift, unsigned int first_line) {
+    if (!ast) return;
+
+    // Match arms only keep a line, statements the whole span
+    if (ast->src_end) {
+        ast->src_start += shift->offset;
+        ast->src_end += shift->offset;
+        if (ast->line == first_line) {
+            ast->column += shift->column;
+        }
+    }
+    if (ast->line) {
+        ast->line += shift->line;
+    }
+
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            incremental_apply((ast_t*) ast->children->items[i], shift, first_line);
+        }
+    }
+    incremental_apply(ast->value, shift, first_line);
+}
+
+// Writes the pending moves into the nodes. Only root->shifts changes on an
+// edit, anything reading spans of a tree updated by `parse_incremental`
+// calls this first.
+void incremental_settle(ast_t* root) {
+    if (!root || !root->children || !root->shifts) return;
+
+    for (size_t i = 0; i < root->children->size; i++) {
+        ast_shift_t* shift = &root->shifts[i];
+        if (!shift->offset && !shift->line && !shift->column) continue;
+
+        ast_t* statement = (ast_t*) root->children->items[i];
+        incremental_apply(statement, shift, statement->line);
+    }
+
+    free(root->shifts);
+    root->shifts = NULL;
+}
+
+// Index of the first statement whose span ends at or after offset
+static size_t incremental_find(ast_t* root, unsigned int offset) {
+    size_t lo = 0;
+    size_t hi = root->children->size;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (incremental_end(root, mid) < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// Updates a tree produced by `parse` after the source was edited. Only the
+// statements around the edit are relexed and reparsed, parsing stops as soon
+// as it lines up with the start of an unchanged statement again, which then
+// gets reused together with everything after it.
+ast_t* parse_incremental(ast_t* root, char* src, size_t src_size, source_edit_t edit) {
+    if (!root || root->type != AST_COMPOUND || !src) return NULL;
+
+    size_t n = root->children->size;
+    ast_t** items = (ast_t**) root->children->items;
+    long delta = (long) edit.new_end - (long) edit.old_end;
+
+    // Restart one statement before the first one touching the edit, the
+    // previous statement looks ahead at its first token and may absorb it
+    size_t restart = incremental_find(root, edit.start);
+    unsigned int offset = 0, line = 1, column = 1;
+    if (restart > 0) {
+        restart--;
+        offset = incremental_start(root, restart);
+        line = incremental_line(root, restart);
+        column = incremental_column(root, restart);
+    }
+
+    lexer_t* lexer = init_lexer_at(src, src_size, offset, line, column);
+    parser_t* parser = init_parser(lexer);
+
+    if (offset == 0 && parser->token->type == TOKEN_LBRACE) {
+        // A braced root is closed by `parse_compound`, reparse it whole
+        ast_t* whole = parse(parser);
+        for (size_t i = 0; i < n; i++) {
+            free_ast(items[i]);
+        }
+        free_list(root->children);
+        free(root->shifts);
+        root->shifts = NULL;
+        root->children = whole->children;
+        whole->children = NULL;
+        free_ast(whole);
+        free_parser(parser);
+        free(lexer);
+        return root;
+    }
+
+    if (!root->shifts) {
+        root->shifts = calloc(n ? n : 1, sizeof(ast_shift_t));
+        if (!root->shifts) {
+            fprintf(stderr, "Memory allocation failed in parse_incremental\n");
+            exit(1);
+        }
+    }
+    ast_shift_t* shifts = root->shifts;
+
+    list_t* fresh = init_list(sizeof(struct astStruct));
+
+    size_t keep = restart;
+    while (1) {
+        if (parser->token->type == TOKEN_EOF || parser->token->type == TOKEN_RBRACE) {
+            // `parse` stops at a stray top level brace, so nothing after it survives
+            keep = n;
+            break;
+        }
+
+        // Skip statements that were swallowed by the reparse or overlap the edit
+        while (keep < n && (incremental_start(root, keep) < edit.old_end ||
+                            (long) incremental_start(root, keep) + delta < (long) parser->token->offset)) {
+            keep++;
+        }
+
+        if (keep < n && (long) incremental_start(root, keep) + delta == (long) parser->token->offset) {
+            break;
+        }
+
+        list_push(fresh, parse_statement(parser));
+    }
+
+    // Reused statements past the edit move by the size and line count of the
+    // edit, the ones sharing the line the reparse ended on also sideways
+    if (keep < n) {
+        int line_delta = (int) parser->token->line - (int) incremental_line(root, keep);
+        int column_delta = (int) parser->token->column - (int) incremental_column(root, keep);
+        unsigned int shared_line = incremental_line(root, keep);
+
+        for (size_t i = keep; i < n && column_delta && incremental_line(root, i) == shared_line; i++) {
+            shifts[i].column += column_delta;
+        }
+        for (size_t i = keep; i < n; i++) {
+            shifts[i].offset += (int) delta;
+            shifts[i].line += line_delta;
+        }
+    }
+
+    for (size_t i = restart; i < keep; i++) {
+        free_ast(items[i]);
+    }
+
+    // Splice the fresh statements in place of the dropped ones
+    size_t tail = n - keep;
+    size_t new_size = restart + fresh->size + tail;
+    if (new_size > n) {
+        items = realloc(items, sizeof(void*) * new_size);
+        shifts = realloc(shifts, sizeof(ast_shift_t) * new_size);
+        if (!items || !shifts) {
+            fprintf(stderr, "Memory allocation failed in parse_incremental\n");
+            exit(1);
+        }
+    }
+    memmove(items + restart + fresh->size, items + keep, sizeof(void*) * tail);
+    memmove(shifts + restart + fresh->size, shifts + keep, sizeof(ast_shift_t) * tail);
+    if (fresh->size) {
+        memcpy(items + restart, fresh->items, sizeof(void*) * fresh->size);
+        memset(shifts + restart, 0, sizeof(ast_shift_t) * fresh->size);
+    }
+    root->children->items = (void**) items;
+    root->shifts = shifts;
+    root->children->size = new_size;
+
+    free_list(fresh);
+    free_parser(parser);
+    free(lexer);
+    return root;
+}
+
+#endif // SKULL_INCREMENTAL_H_IMPLEMENTATION
+#endif // SKULL_INCREMENTAL_H
@@ -0,0 +1,268 @@
+#ifndef SKULL_IPO_H
+#define SKULL_IPO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "list.h"
+#include "ast.h"
+#include "types.h"
+#include "ctfe.h"
+#include "trace.h"
+
+// Interprocedural passes over a whole program, every module merged into one
+// tree whose only entry is main. A parameter every call passes the same
+// literal becomes that literal in the function's body, operators on
+// literals are folded, which can make calls evaluable at compile time,
+// and functions no call reaches from main or a global are dropped.
+typedef struct {
+    size_t propagated;      // Parameters replaced by the literal every call passes
+    size_t folded;          // Operators on literals replaced by their value
+    size_t removed;         // Functions nothing reaches
+} ipo_stats_t;
+
+ipo_stats_t ipo_optimize(ast_t* root);
+
+#ifdef SKULL_IPO_H_IMPLEMENTATION
+
+static bool ipo_is_function(ast_t* ast) {
+    return ast->type == AST_ASSIGNMENT && ast->value && ast->value->type == AST_FUNCTION;
+}
+
+static bool ipo_same_literal(ast_t* a, ast_t* b) {
+    if (a->type != b->type) return false;
+    if (a->type == AST_INT) return a->int_value == b->int_value;
+    return strcmp(a->name, b->name) == 0;
+}
+
+static ast_t* ipo_copy_literal(ast_t* literal) {
+    ast_t* copy = init_ast(literal->type);
+    copy->int_value = literal->int_value;
+    copy->data_type = literal->data_type;
+    if (literal->name) copy->name = strdup(literal->name);
+    return copy;
+}
+
+typedef struct {
+    const char* function;
+    size_t index;
+    const char* param;      // Passing it on to the same position keeps the literal
+    bool inside;            // Walking the function's own body
+    ast_t* literal;         // What the calls seen so far pass
+    size_t calls;           // from outside the function
+    bool varies;
+} ipo_args_t;
+
+static void ipo_find_args(ipo_args_t* args, ast_t* ast) {
+    if (!ast || args->varies) return;
+
+    if (ast->type == AST_CALL && strcmp(ast->name, args->function) == 0) {
+        size_t count = ast->value && ast->value->children ? ast->value->children->size : 0;
+        ast_t* arg = args->index < count ? (ast_t*) ast->value->children->items[args->index] : NULL;
+        if (arg && args->inside && arg->type == AST_VARIABLE && !arg->data_type &&
+            strcmp(arg->name, args->param) == 0) {
+            // Recursion handing the parameter on
+        } else if (arg && (arg->type == AST_INT || arg->type == AST_FLOAT) &&
+                   (!args->literal || ipo_same_literal(args->literal, arg))) {
+            args->literal = arg;
+            if (!args->inside) args->calls++;
+        } else {
+            args->varies = true;
+            return;
+        }
+    }
+
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            ipo_find_args(args, (ast_t*) ast->children->items[i]);
+        }
+    }
+    ipo_find_args(args, ast->value);
+}
+
+// Whether the body stores into name or declares a local shadowing it
+static bool ipo_writes(ast_t* ast, const char* name) {
+    if (!ast) return false;
+    if ((ast->type == AST_ASSIGNMENT || ast->type == AST_INDEX_ASSIGNMENT) && strcmp(ast->name, name) == 0) return true;
+    if (ast->type == AST_VARIABLE && ast->data_type && strcmp(ast->name, name) == 0) return true;
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            if (ipo_writes((ast_t*) ast->children->items[i], name)) return true;
+        }
+    }
+    return ipo_writes(ast->value, name);
+}
+
+// Replaces reads of name in ast by copies of literal, returns what takes
+// the place of ast
+static ast_t* ipo_substitute(ast_t* ast, const char* name, ast_t* literal) {
+    if (!ast) return NULL;
+    if (ast->type == AST_VARIABLE && !ast->data_type && strcmp(ast->name, name) == 0) {
+        free_ast(ast);
+        return ipo_copy_literal(literal);
+    }
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            ast->children->items[i] = ipo_substitute((ast_t*) ast->children->items[i], name, literal);
+        }
+    }
+    ast->value = ipo_substitute(ast->value, name, literal);
+    return ast;
+}
+
+static bool ipo_mentions(ast_t* ast, const char* name) {
+    if (!ast) return false;
+    if (ast->type == AST_VARIABLE && strcmp(ast->name, name) == 0) return true;
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            if (ipo_mentions((ast_t*) ast->children->items[i], name)) return true;
+        }
+    }
+    return ipo_mentions(ast->value, name);
+}
+
+// Literals only go where their own type is expected, an int literal
+// would turn float arithmetic into integer arithmetic
+static bool ipo_fits(ast_t* literal, int type) {
+    if (literal->type == AST_FLOAT) return type_is_float(type);
+    return !type_is_float(type) && !type_is_array(type) && !type_is_vector(type) &&
+           type != typename_to_int("string") && type_param_index(type) < 0;
+}
+
+static size_t ipo_propagate(ast_t* root) {
+    size_t propagated = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < root->children->size; i++) {
+            ast_t* assignment = (ast_t*) root->children->items[i];
+            if (!ipo_is_function(assignment) || strcmp(assignment->name, "main") == 0) continue;
+
+            ast_t* function = assignment->value;
+            size_t count = function->children ? function->children->size : 0;
+            for (size_t j = 0; j < count; j++) {
+                ast_t* param = (ast_t*) function->children->items[j];
+                if (!ipo_mentions(function->value, param->name) || ipo_writes(function->value, param->name)) continue;
+
+                ipo_args_t args = { assignment->name, j, param->name, false, NULL, 0, false };
+                for (size_t k = 0; k < root->children->size && !args.varies; k++) {
+                    ast_t* child = (ast_t*) root->children->items[k];
+                    args.inside = child == assignment;
+                    ipo_find_args(&args, child);
+                }
+                if (args.varies || !args.calls || !ipo_fits(args.literal, param->data_type)) continue;
+
+                ast_t* literal = ipo_copy_literal(args.literal);
+                function->value = ipo_substitute(function->value, param->name, literal);
+                free_ast(literal);
+                propagated++;
+                changed = true;
+            }
+        }
+    }
+    return propagated;
+}
+
+// Folds operators whose operands are int literals, bottom up. Values that
+// do not fit a literal and traps are left to run.
+static ast_t* ipo_fold(ctfe_t* ctfe, ast_t* ast, size_t* folded) {
+    if (!ast) return NULL;
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            ast->children->items[i] = ipo_fold(ctfe, (ast_t*) ast->children->items[i], folded);
+        }
+    }
+    ast->value = ipo_fold(ctfe, ast->value, folded);
+
+    if (ast->type != AST_BINARY || ((ast_t*) ast->children->items[0])->type != AST_INT ||
+        ((ast_t*) ast->children->items[1])->type != AST_INT) {
+        return ast;
+    }
+    ctfe_value_t value;
+    if (!ctfe_evaluate(ctfe, ast, &value) || value.value < INT32_MIN || value.value > INT32_MAX) return ast;
+
+    ast_t* literal = init_ast(AST_INT);
+    literal->int_value = (int) value.value;
+    free_ast(ast);
+    (*folded)++;
+    return literal;
+}
+
+static bool ipo_is_reached(list_t* reached, const char* name) {
+    for (size_t i = 0; i < reached->size; i++) {
+        if (strcmp((char*) reached->items[i], name) == 0) return true;
+    }
+    return false;
+}
+
+static void ipo_find_calls(ast_t* ast, list_t* reached) {
+    if (!ast) return;
+    if (ast->type == AST_CALL && !ipo_is_reached(reached, ast->name)) list_push(reached, ast->name);
+    if (ast->children) {
+        for (size_t i = 0; i < ast->children->size; i++) {
+            ipo_find_calls((ast_t*) ast->children->items[i], reached);
+        }
+    }
+    ipo_find_calls(ast->value, reached);
+}
+
+// Keeps main, whatever the initializers of globals call and everything
+// those call in turn
+static size_t ipo_remove_unreached(ast_t* root) {
+    list_t* reached = init_list(sizeof(char*));
+    list_push(reached, "main");
+    for (size_t i = 0; i < root->children->size; i++) {
+        ast_t* child = (ast_t*) root->children->items[i];
+        if (!ipo_is_function(child)) ipo_find_calls(child, reached);
+    }
+
+    // reached grows while it is walked, every name once
+    for (size_t i = 0; i < reached->size; i++) {
+        for (size_t j = 0; j < root->children->size; j++) {
+            ast_t* child = (ast_t*) root->children->items[j];
+            if (ipo_is_function(child) && strcmp(child->name, (char*) reached->items[i]) == 0) {
+                ipo_find_calls(child->value->value, reached);
+                break;
+            }
+        }
+    }
+
+    size_t removed = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < root->children->size; i++) {
+        ast_t* child = (ast_t*) root->children->items[i];
+        if (ipo_is_function(child) && !ipo_is_reached(reached, child->name)) {
+            free_ast(child);
+            removed++;
+            continue;
+        }
+        root->children->items[kept++] = child;
+    }
+    root->children->size = kept;
+    free_list(reached);
+    return removed;
+}
+
+ipo_stats_t ipo_optimize(ast_t* root) {
+    TRACE_SCOPE("ipo_optimize");
+    ipo_stats_t stats = {0};
+
+    stats.propagated = ipo_propagate(root);
+
+    list_t* none = init_list(sizeof(ast_t*));
+    ctfe_t* ctfe = init_ctfe(none, NULL);
+    for (size_t i = 0; i < root->children->size; i++) {
+        ast_t* child = (ast_t*) root->children->items[i];
+        if (ipo_is_function(child)) child->value->value = ipo_fold(ctfe, child->value->value, &stats.folded);
+    }
+    free_ctfe(ctfe);
+    free_list(none);
+
+    stats.removed = ipo_remove_unreached(root);
+    return stats;
+}
+
+#endif // SKULL_IPO_H_IMPLEMENTATION
+#endif // SKULL_IPO_H
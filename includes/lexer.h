@@ -7,6 +7,7 @@
 #include <ctype.h>
 #include "token.h"
 #include "utils.h"
+#include "trace.h"
 
 typedef struct lexerStruct {
     char *src;
@@ -18,13 +19,15 @@ typedef struct lexerStruct {
 } lexer_t;
 
 lexer_t *init_lexer(char *src);
+lexer_t *init_lexer_at(char *src, size_t src_size, unsigned int offset, unsigned int line, unsigned int column);
 void lexer_advance(lexer_t* lexer);
 void lexer_skip_whitespace(lexer_t* lexer);
-token_t* lexer_advance_current(lexer_t* lexer, int type);
-token_t* lexer_parse_id(lexer_t* lexer);
-token_t* lexer_parse_number(lexer_t* lexer);
-token_t* lexer_advance_with(lexer_t* lexer, token_t* token);
+void lexer_skip_id(lexer_t* lexer);
+void lexer_skip_number(lexer_t* lexer);
+bool lexer_skip_fraction(lexer_t* lexer);
+void lexer_skip_string(lexer_t* lexer);
 char lexer_peek(lexer_t* lexer, int offset);
+tokenType lexer_scan(lexer_t* lexer, token_span_t* span);
 token_t* lexer_next_token(lexer_t* lexer);
 void lexer_error(lexer_t* lexer, const char* message);
 
@@ -45,6 +48,24 @@ lexer_t *init_lexer(char *src) {
     return lexer;
 }
 
+// Starts lexing in the middle of a buffer, used when relexing an edited region
+// or lexing one chunk of a file. The caller must pass a position that is not
+// inside a token or a comment, lexing stops at src_size.
+lexer_t *init_lexer_at(char *src, size_t src_size, unsigned int offset, unsigned int line, unsigned int column) {
+    lexer_t *lexer = calloc(1, sizeof(struct lexerStruct));
+    if (!lexer) {
+        fprintf(stderr, "Memory allocation failed for lexer\n");
+        exit(1);
+    }
+    lexer->src = src;
+    lexer->src_size = src_size;
+    lexer->i = MIN(offset, src_size);
+    lexer->c = lexer->i < src_size ? src[lexer->i] : '\0';
+    lexer->line = line;
+    lexer->column = column;
+    return lexer;
+}
+
 void lexer_advance(lexer_t* lexer) {
     if (lexer->i < lexer->src_size && lexer->c != '\0') {
         // Update line and column counters
@@ -56,7 +77,8 @@ void lexer_advance(lexer_t* lexer) {
         }
         
         lexer->i += 1;
-        lexer->c = lexer->src[lexer->i];
+        // src_size may end before the terminator when lexing a chunk
+        lexer->c = lexer->i < lexer->src_size ? lexer->src[lexer->i] : '\0';
     }
 }
 
@@ -66,110 +88,55 @@ void lexer_skip_whitespace(lexer_t* lexer) {
     }
 }
 
-token_t* lexer_advance_current(lexer_t* lexer, int type) {
-    char* value = calloc(2, sizeof(char));
-    if (!value) {
-        lexer_error(lexer, "Memory allocation failed");
-        return NULL;
-    }
-    value[0] = lexer->c;
-    value[1] = '\0';
-
-    token_t* token = init_token(value, type);
-    if (!token) {
-        free(value);
-        lexer_error(lexer, "Failed to create token");
-        return NULL;
+void lexer_skip_id(lexer_t* lexer) {
+    while (isalnum(lexer->c) || lexer->c == '_') {
+        lexer_advance(lexer);
     }
-    
-    // Set token line and column info
-    token->line = lexer->line;
-    token->column = lexer->column;
-    
-    lexer_advance(lexer);
-    return token;
 }
 
-token_t* lexer_parse_id(lexer_t* lexer) {
-    unsigned int start_column = lexer->column;
-    unsigned int start_line = lexer->line;
-    
-    char* value = calloc(1, sizeof(char));
-    if (!value) {
-        lexer_error(lexer, "Memory allocation failed");
-        return NULL;
-    }
-    
-    while (isalpha(lexer->c) || lexer->c == '_' || (strlen(value) > 0 && isdigit(lexer->c))) {
-        size_t current_len = strlen(value);
-        value = realloc(value, (current_len + 2) * sizeof(char));
-        if (!value) {
-            lexer_error(lexer, "Memory allocation failed");
-            return NULL;
-        }
-        value[current_len] = lexer->c;
-        value[current_len + 1] = '\0';
+void lexer_skip_number(lexer_t* lexer) {
+    while (isdigit(lexer->c)) {
         lexer_advance(lexer);
     }
-    
-    token_t* token = init_token(value, TOKEN_ID);
-    if (!token) {
-        free(value);
-        lexer_error(lexer, "Failed to create token");
-        return NULL;
-    }
-    
-    // Set token line and column info
-    token->line = start_line;
-    token->column = start_column;
-    
-    return token;
 }
 
-token_t* lexer_parse_number(lexer_t* lexer) {
-    unsigned int start_column = lexer->column;
-    unsigned int start_line = lexer->line;
-    
-    char* value = calloc(1, sizeof(char));
-    if (!value) {
-        lexer_error(lexer, "Memory allocation failed");
-        return NULL;
-    }
-    
-    while (isdigit(lexer->c)) {
-        size_t current_len = strlen(value);
-        value = realloc(value, (current_len + 2) * sizeof(char));
-        if (!value) {
-            lexer_error(lexer, "Memory allocation failed");
-            return NULL;
-        }
-        value[current_len] = lexer->c;
-        value[current_len + 1] = '\0';
+// The fraction and exponent after the digits of a float literal, 1.5 or
+// 2.0e-3. Returns false when there is neither and the number is an int.
+bool lexer_skip_fraction(lexer_t* lexer) {
+    bool is_float = false;
+    if (lexer->c == '.' && isdigit(lexer_peek(lexer, 1))) {
         lexer_advance(lexer);
+        lexer_skip_number(lexer);
+        is_float = true;
     }
-    
-    token_t* token = init_token(value, TOKEN_INT);
-    if (!token) {
-        free(value);
-        lexer_error(lexer, "Failed to create token");
-        return NULL;
+
+    char sign = lexer_peek(lexer, 1);
+    if ((lexer->c == 'e' || lexer->c == 'E') &&
+        (isdigit(sign) || ((sign == '+' || sign == '-') && isdigit(lexer_peek(lexer, 2))))) {
+        lexer_advance(lexer);
+        if (!isdigit(lexer->c)) lexer_advance(lexer);
+        lexer_skip_number(lexer);
+        is_float = true;
     }
-    
-    // Set token line and column info
-    token->line = start_line;
-    token->column = start_column;
-    
-    return token;
+    return is_float;
 }
 
-token_t* lexer_advance_with(lexer_t* lexer, token_t* token) {
+// A string literal up to and including its closing quote. Escapes are
+// decoded by the parser, literals end on the line they start like every
+// other token.
+void lexer_skip_string(lexer_t* lexer) {
+    lexer_advance(lexer);
+    while (lexer->c != '"') {
+        if (lexer->c == '\\') lexer_advance(lexer);
+        if (lexer->c == '\0' || lexer->c == '\n') lexer_error(lexer, "Unterminated string literal");
+        lexer_advance(lexer);
+    }
     lexer_advance(lexer);
-    return token;
 }
 
 char lexer_peek(lexer_t* lexer, int offset) {
-    size_t target_index = MIN(lexer->i + offset, lexer->src_size);
-    return lexer->src[target_index];
+    size_t target_index = lexer->i + offset;
+    return target_index < lexer->src_size ? lexer->src[target_index] : '\0';
 }
 
 void lexer_error(lexer_t* lexer, const char* message) {
@@ -179,77 +146,114 @@ void lexer_error(lexer_t* lexer, const char* message) {
     exit(1);
 }
 
-token_t* lexer_next_token(lexer_t* lexer) {
+// Scans the next token without allocating, the token text is
+// src[span->offset .. span->offset + span->length)
+tokenType lexer_scan(lexer_t* lexer, token_span_t* span) {
+    TRACE_SCOPE("lexer_scan");
     while (lexer->c != '\0') {
         lexer_skip_whitespace(lexer);
         
         // Skip comments
         if (lexer->c == '/' && lexer_peek(lexer, 1) == '/') {
+            TRACE_SCOPE("comment");
             while (lexer->c != '\0' && lexer->c != '\n') {
                 lexer_advance(lexer);
             }
             continue;
         }
-        
-        if (isalpha(lexer->c) || lexer->c == '_') 
-            return lexer_parse_id(lexer);
-        
-        if (isdigit(lexer->c)) 
-            return lexer_parse_number(lexer);
 
-        switch (lexer->c) {
-            case '=': {
-                if (lexer_peek(lexer, 1) == '=') {
-                    lexer_advance(lexer);
-                    return lexer_advance_with(lexer, init_token("==", TOKEN_EQ));
-                }
-                return lexer_advance_current(lexer, TOKEN_ASSIGN);
-            }
-            case '!': {
-                if (lexer_peek(lexer, 1) == '=') {
-                    lexer_advance(lexer);
-                    return lexer_advance_with(lexer, init_token("!=", TOKEN_NEQ));
-                }
-                return lexer_advance_current(lexer, TOKEN_BANG);
+        if (lexer->c == '\0') break;
+
+        span->offset = lexer->i;
+        span->line = lexer->line;
+        span->column = lexer->column;
+        
+        if (isalpha(lexer->c) || lexer->c == '_') {
+            TRACE_SCOPE("id");
+            lexer_skip_id(lexer);
+            span->type = TOKEN_ID;
+        } else if (isdigit(lexer->c)) {
+            TRACE_SCOPE("number");
+            lexer_skip_number(lexer);
+            span->type = lexer_skip_fraction(lexer) ? TOKEN_FLOAT : TOKEN_INT;
+        } else if (lexer->c == '"') {
+            TRACE_SCOPE("string");
+            lexer_skip_string(lexer);
+            span->type = TOKEN_STRING;
+        } else {
+            TRACE_SCOPE("operator");
+            switch (lexer->c) {
+                case '=': span->type = lexer_peek(lexer, 1) == '=' ? TOKEN_EQ : TOKEN_ASSIGN; break;
+                case '!': span->type = lexer_peek(lexer, 1) == '=' ? TOKEN_NEQ : TOKEN_BANG; break;
+                case '-': span->type = lexer_peek(lexer, 1) == '>' ? TOKEN_FUNC_TYPE : TOKEN_MINUS; break;
+                case '(': span->type = TOKEN_LPAREN; break;
+                case ')': span->type = TOKEN_RPAREN; break;
+                case '{': span->type = TOKEN_LBRACE; break;
+                case '}': span->type = TOKEN_RBRACE; break;
+                case '[': span->type = TOKEN_LBRACKET; break;
+                case ']': span->type = TOKEN_RBRACKET; break;
+                case ':': span->type = TOKEN_COLON; break;
+                case ';': span->type = TOKEN_SEMI; break;
+                case ',': span->type = TOKEN_COMMA; break;
+                case '.': span->type = TOKEN_DOT; break;
+                case '<': span->type = lexer_peek(lexer, 1) == '=' ? TOKEN_LTE : TOKEN_LT; break;
+                case '>': span->type = lexer_peek(lexer, 1) == '=' ? TOKEN_GTE : TOKEN_GT; break;
+                case '+': span->type = TOKEN_PLUS; break;
+                case '/': span->type = TOKEN_DIVIDE; break;
+                case '*': span->type = TOKEN_MULTIPLY; break;
+                case '%': span->type = TOKEN_MODULUS; break;
+                default: 
+                    lexer_error(lexer, "Unexpected token");
+                    break;
             }
-            case '(': return lexer_advance_current(lexer, TOKEN_LPAREN);
-            case ')': return lexer_advance_current(lexer, TOKEN_RPAREN);
-            case '{': return lexer_advance_current(lexer, TOKEN_LBRACE);
-            case '}': return lexer_advance_current(lexer, TOKEN_RBRACE);
-            case ':': return lexer_advance_current(lexer, TOKEN_COLON);
-            case ';': return lexer_advance_current(lexer, TOKEN_SEMI);
-            case ',': return lexer_advance_current(lexer, TOKEN_COMMA);
-            case '<': return lexer_advance_current(lexer, TOKEN_LT);
-            case '>': return lexer_advance_current(lexer, TOKEN_GT);
-            case '-': {
-                if (lexer_peek(lexer, 1) == '>') {
-                    unsigned int start_line = lexer->line;
-                    unsigned int start_column = lexer->column;
-                    token_t* token = init_token("->", TOKEN_FUNC_TYPE);
-                    token->line = start_line;
-                    token->column = start_column;
-                    lexer_advance(lexer);
-                    return lexer_advance_with(lexer, token);
-                }
-                return lexer_advance_current(lexer, TOKEN_MINUS);
+
+            // Two character operators
+            if (span->type == TOKEN_EQ || span->type == TOKEN_NEQ || span->type == TOKEN_FUNC_TYPE ||
+                span->type == TOKEN_LTE || span->type == TOKEN_GTE) {
+                lexer_advance(lexer);
             }
-            case '+': return lexer_advance_current(lexer, TOKEN_PLUS);
-            case '/': return lexer_advance_current(lexer, TOKEN_DIVIDE);
-            case '*': return lexer_advance_current(lexer, TOKEN_MULTIPLY);
-            case '%': return lexer_advance_current(lexer, TOKEN_MODULUS);
-            case '\0': break;
-            default: 
-                lexer_error(lexer, "Unexpected token");
-                break;
+            lexer_advance(lexer);
+        }
+
+        span->length = lexer->i - span->offset;
+        return span->type;
+    }
+
+    span->type = TOKEN_EOF;
+    span->offset = lexer->i;
+    span->length = 0;
+    span->line = lexer->line;
+    span->column = lexer->column;
+    return TOKEN_EOF;
+}
+
+token_t* lexer_next_token(lexer_t* lexer) {
+    TRACE_SCOPE("lexer_next_token");
+    token_span_t span;
+    lexer_scan(lexer, &span);
+
+    char* value = NULL;
+    if (span.type != TOKEN_EOF) {
+        value = strndup(lexer->src + span.offset, span.length);
+        if (!value) {
+            lexer_error(lexer, "Memory allocation failed");
+            return NULL;
         }
     }
 
-    token_t* eof_token = init_token(NULL, TOKEN_EOF);
-    if (eof_token) {
-        eof_token->line = lexer->line;
-        eof_token->column = lexer->column;
+    token_t* token = init_token(value, span.type);
+    if (!token) {
+        free(value);
+        lexer_error(lexer, "Failed to create token");
+        return NULL;
     }
-    return eof_token;
+
+    // Set token line and column info
+    token->line = span.line;
+    token->column = span.column;
+    token->offset = span.offset;
+
+    return token;
 }
 
 #endif // SKULL_LEXER_H_IMPLEMENTATION
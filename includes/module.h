@@ -0,0 +1,472 @@
+#ifndef SKULL_MODULE_H
+#define SKULL_MODULE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include "ast.h"
+#include "list.h"
+#include "utils.h"
+#include "types.h"
+#include "record.h"
+
+#define MODULE_INTERFACE_MAGIC "skull-interface"
+#define MODULE_INTERFACE_VERSION 2
+
+// Integer arguments passed in registers by the System V ABI
+#define MODULE_MAX_PARAMS 6
+
+enum {
+    MODULE_SYMBOL_FUNCTION,
+    MODULE_SYMBOL_GLOBAL,
+};
+
+typedef struct {
+    char* name;
+    int kind;
+    int data_type;             // Return type of a function, type of a global
+    int param_count;
+    int param_types[MODULE_MAX_PARAMS];
+} module_symbol_t;
+
+// What importers of a module get to see: the top level functions and
+// globals it defines and the modules it imports itself
+typedef struct {
+    list_t* symbols;           // module_symbol_t*
+    list_t* imports;           // char*
+} module_interface_t;
+
+module_interface_t* init_module_interface(void);
+void free_module_interface(module_interface_t* iface);
+module_symbol_t* module_symbol_from_assignment(ast_t* ast);
+module_interface_t* module_interface_from_ast(ast_t* root);
+module_symbol_t* module_interface_find(module_interface_t* iface, const char* name);
+char* module_interface_to_str(module_interface_t* iface);
+bool module_interface_write(const char* path, module_interface_t* iface);
+bool module_symbol_has_c_type(module_symbol_t* symbol);
+void module_write_c_header(const char* path, const char* guard, module_interface_t* iface, list_t* records);
+module_interface_t* module_interface_read(const char* path);
+bool module_path(const char* source, const char* ext, char* out, size_t size);
+bool module_find_source(const char* name, const char* from, list_t* search_dirs, char* out, size_t size);
+bool module_write_deps(const char* path, const char* target, const char* source, list_t* deps, const char* options);
+list_t* module_read_deps(const char* path, char* options, size_t options_size);
+bool module_is_fresh(const char* target, list_t* deps);
+
+#ifdef SKULL_MODULE_H_IMPLEMENTATION
+
+module_interface_t* init_module_interface(void) {
+    module_interface_t* iface = calloc(1, sizeof(module_interface_t));
+    if (!iface) {
+        fprintf(stderr, "Memory allocation failed for module interface\n");
+        exit(1);
+    }
+    iface->symbols = init_list(sizeof(module_symbol_t*));
+    iface->imports = init_list(sizeof(char*));
+    return iface;
+}
+
+void free_module_interface(module_interface_t* iface) {
+    if (!iface) return;
+
+    for (size_t i = 0; i < iface->symbols->size; i++) {
+        module_symbol_t* symbol = (module_symbol_t*) iface->symbols->items[i];
+        free(symbol->name);
+        free(symbol);
+    }
+    for (size_t i = 0; i < iface->imports->size; i++) {
+        free(iface->imports->items[i]);
+    }
+    free_list(iface->symbols);
+    free_list(iface->imports);
+    free(iface);
+}
+
+// Symbol for a top level `name = ...` assignment, NULL for anything
+// that does not define a function or a global, records included
+module_symbol_t* module_symbol_from_assignment(ast_t* ast) {
+    if (ast->type != AST_ASSIGNMENT && ast->type != AST_VARIABLE) return NULL;
+    if (ast->type == AST_ASSIGNMENT && ast->value && ast->value->type == AST_RECORD) return NULL;
+    // A bare name is not a declaration
+    if (ast->type == AST_VARIABLE && !ast->data_type) return NULL;
+
+    module_symbol_t* symbol = calloc(1, sizeof(module_symbol_t));
+    if (!symbol) {
+        fprintf(stderr, "Memory allocation failed for module symbol\n");
+        exit(1);
+    }
+    symbol->name = strdup(ast->name);
+
+    if (ast->type == AST_ASSIGNMENT && ast->value && ast->value->type == AST_FUNCTION) {
+        ast_t* function = ast->value;
+        symbol->kind = MODULE_SYMBOL_FUNCTION;
+        symbol->data_type = function->data_type;
+
+        size_t count = function->children ? function->children->size : 0;
+        if (count > MODULE_MAX_PARAMS) {
+            fprintf(stderr, "ERROR: Function '%s' takes %zu parameters, at most %d are supported\n",
+                    ast->name, count, MODULE_MAX_PARAMS);
+            exit(1);
+        }
+        symbol->param_count = (int) count;
+        for (size_t i = 0; i < count; i++) {
+            symbol->param_types[i] = ((ast_t*) function->children->items[i])->data_type;
+        }
+    } else {
+        symbol->kind = MODULE_SYMBOL_GLOBAL;
+        symbol->data_type = ast->data_type ? ast->data_type : (ast->value ? ast->value->data_type : 0);
+    }
+
+    return symbol;
+}
+
+module_interface_t* module_interface_from_ast(ast_t* root) {
+    module_interface_t* iface = init_module_interface();
+
+    for (size_t i = 0; i < root->children->size; i++) {
+        ast_t* child = (ast_t*) root->children->items[i];
+        if (child->type == AST_IMPORT) {
+            list_push(iface->imports, strdup(child->name));
+            continue;
+        }
+
+        // Generic functions are instantiated from their body, which an
+        // interface does not carry, so they stay private to their module
+        if (child->type == AST_ASSIGNMENT && child->value && child->value->type == AST_FUNCTION &&
+            child->value->int_value) {
+            continue;
+        }
+
+        module_symbol_t* symbol = module_symbol_from_assignment(child);
+        if (symbol) list_push(iface->symbols, symbol);
+    }
+
+    return iface;
+}
+
+module_symbol_t* module_interface_find(module_interface_t* iface, const char* name) {
+    for (size_t i = 0; i < iface->symbols->size; i++) {
+        module_symbol_t* symbol = (module_symbol_t*) iface->symbols->items[i];
+        if (strcmp(symbol->name, name) == 0) return symbol;
+    }
+    return NULL;
+}
+
+// One symbol per line:
+//   import <module>
+//   func <name> <return type> <param count> <param types...>
+//   global <name> <type>
+char* module_interface_to_str(module_interface_t* iface) {
+    size_t size = 64;
+    for (size_t i = 0; i < iface->imports->size; i++) {
+        size += strlen(iface->imports->items[i]) + 16;
+    }
+    for (size_t i = 0; i < iface->symbols->size; i++) {
+        size += strlen(((module_symbol_t*) iface->symbols->items[i])->name) + 32 + MODULE_MAX_PARAMS * 12;
+    }
+
+    char* s = calloc(size, sizeof(char));
+    if (!s) {
+        fprintf(stderr, "Memory allocation failed for module interface\n");
+        exit(1);
+    }
+
+    size_t len = sprintf(s, "%s %d\n", MODULE_INTERFACE_MAGIC, MODULE_INTERFACE_VERSION);
+    for (size_t i = 0; i < iface->imports->size; i++) {
+        len += sprintf(s + len, "import %s\n", (char*) iface->imports->items[i]);
+    }
+    for (size_t i = 0; i < iface->symbols->size; i++) {
+        module_symbol_t* symbol = (module_symbol_t*) iface->symbols->items[i];
+        if (symbol->kind == MODULE_SYMBOL_FUNCTION) {
+            len += sprintf(s + len, "func %s %d %d", symbol->name, symbol->data_type, symbol->param_count);
+            for (int p = 0; p < symbol->param_count; p++) {
+                len += sprintf(s + len, " %d", symbol->param_types[p]);
+            }
+            len += sprintf(s + len, "\n");
+        } else {
+            len += sprintf(s + len, "global %s %d\n", symbol->name, symbol->data_type);
+        }
+    }
+
+    return s;
+}
+
+// Leaves the file and its timestamp alone when the interface did not change,
+// so modules importing it are not rebuilt. Returns true when it was written.
+bool module_interface_write(const char* path, module_interface_t* iface) {
+    char* s = module_interface_to_str(iface);
+
+    if (access(path, F_OK) == 0) {
+        char* old = read_file(path);
+        if (old && strcmp(old, s) == 0) {
+            free(old);
+            free(s);
+            return false;
+        }
+        free(old);
+    }
+
+    write_file(path, s);
+    free(s);
+    return true;
+}
+
+// Vectors have no C type of the same calling convention, functions taking
+// or returning them are left out of libraries
+bool module_symbol_has_c_type(module_symbol_t* symbol) {
+    if (symbol->kind != MODULE_SYMBOL_FUNCTION) return false;
+    if (type_is_vector(symbol->data_type)) return false;
+    for (int i = 0; i < symbol->param_count; i++) {
+        if (type_is_vector(symbol->param_types[i])) return false;
+    }
+    return true;
+}
+
+// Arrays point at their first element with the length right before it.
+// Records are their typedef, arrays of a record(soa) are one block of
+// columns C has no type for.
+static size_t module_c_type(int type, list_t* records, char* out, size_t size) {
+    int depth = 0;
+    for (; type_is_array(type); type -= TYPE_ARRAY) depth++;
+
+    record_t* record = record_find(records, type);
+    const char* name = "int64_t";
+    if (type == TYPE_FLOAT) name = "double";
+    else if (type == typename_to_int("void") && !depth) name = "void";
+    else if (type == typename_to_int("string")) name = "const char*";
+    else if (record && record->layout == RECORD_SOA && depth) name = "void";
+    else if (record) name = record->name;
+    size_t len = snprintf(out, size, "%s", name);
+    for (int i = 0; i < depth && len + 1 < size; i++) out[len++] = '*';
+    out[len < size ? len : size - 1] = '\0';
+    return len;
+}
+
+// Fields in the order of their offsets, which is the order C lays them
+// out in, so the struct matches the record byte for byte
+static size_t module_c_record(record_t* record, char* s) {
+    size_t len = sprintf(s, "typedef struct {\n");
+    for (int offset = 0; offset < record->size; offset++) {
+        for (size_t i = 0; i < record->field_count; i++) {
+            record_field_t* field = &record->fields[i];
+            if (field->offset != offset) continue;
+
+            const char* type = "int64_t";
+            if (type_is_array(field->data_type)) type = NULL;
+            else if (field->data_type == TYPE_FLOAT) type = "double";
+            else if (field->data_type == typename_to_int("string")) type = "const char*";
+            else if (field->data_type == typename_to_int("char")) type = "uint8_t";
+            else if (field->data_type == typename_to_int("bool")) type = "bool";
+
+            char array[64];
+            if (!type) module_c_type(field->data_type, NULL, array, sizeof(array));
+            len += sprintf(s + len, "    %s %s;\n", type ? type : array, field->name);
+        }
+    }
+    len += sprintf(s + len, "} %s;\n\n", record->name);
+    return len;
+}
+
+// C declarations of the functions a shared library exports and the
+// records they use, guard names the include guard
+void module_write_c_header(const char* path, const char* guard, module_interface_t* iface, list_t* records) {
+    size_t size = 1024 + strlen(guard) * 2;
+    for (size_t i = 0; i < iface->symbols->size; i++) {
+        size += strlen(((module_symbol_t*) iface->symbols->items[i])->name) + 64 + MODULE_MAX_PARAMS * 64;
+    }
+    for (size_t i = 0; records && i < records->size; i++) {
+        record_t* record = (record_t*) records->items[i];
+        size += strlen(record->name) + 32;
+        for (size_t j = 0; j < record->field_count; j++) size += strlen(record->fields[j].name) + 80;
+    }
+
+    char* s = calloc(size, sizeof(char));
+    if (!s) {
+        fprintf(stderr, "Memory allocation failed for C header\n");
+        exit(1);
+    }
+
+    size_t len = sprintf(s, "#ifndef %s\n#define %s\n\n#include <stdint.h>\n%s\n"
+                            "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n"
+                            "// Arrays hold 8 byte elements, their length sits right before the first\n"
+                            "int64_t* skull_array(int64_t length);\n"
+                            "void skull_free(void* array);\n"
+                            "static inline int64_t skull_length(const void* array) { return ((const int64_t*) array)[-1]; }\n\n",
+                         guard, guard, records && records->size ? "#include <stdbool.h>\n" : "");
+    for (size_t i = 0; records && i < records->size; i++) {
+        len += module_c_record((record_t*) records->items[i], s + len);
+    }
+    char type[64];
+    for (size_t i = 0; i < iface->symbols->size; i++) {
+        module_symbol_t* symbol = (module_symbol_t*) iface->symbols->items[i];
+        if (!module_symbol_has_c_type(symbol)) continue;
+
+        module_c_type(symbol->data_type, records, type, sizeof(type));
+        len += sprintf(s + len, "%s %s(", type, symbol->name);
+        for (int p = 0; p < symbol->param_count; p++) {
+            module_c_type(symbol->param_types[p], records, type, sizeof(type));
+            len += sprintf(s + len, "%s%s", p ? ", " : "", type);
+        }
+        len += sprintf(s + len, "%s);\n", symbol->param_count ? "" : "void");
+    }
+    sprintf(s + len, "\n#ifdef __cplusplus\n}\n#endif\n\n#endif // %s\n", guard);
+
+    write_file(path, s);
+    free(s);
+}
+
+module_interface_t* module_interface_read(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) return NULL;
+
+    char line[1024];
+    int version = 0;
+    if (!fgets(line, sizeof(line), fp) ||
+        sscanf(line, MODULE_INTERFACE_MAGIC " %d", &version) != 1 ||
+        version != MODULE_INTERFACE_VERSION) {
+        fclose(fp);
+        return NULL;
+    }
+
+    module_interface_t* iface = init_module_interface();
+    char kind[16];
+    char name[512];
+
+    while (fgets(line, sizeof(line), fp)) {
+        int consumed = 0;
+        if (sscanf(line, "%15s %511s%n", kind, name, &consumed) != 2) continue;
+
+        if (strcmp(kind, "import") == 0) {
+            list_push(iface->imports, strdup(name));
+            continue;
+        }
+
+        module_symbol_t* symbol = calloc(1, sizeof(module_symbol_t));
+        if (!symbol) {
+            fprintf(stderr, "Memory allocation failed for module symbol\n");
+            exit(1);
+        }
+        symbol->name = strdup(name);
+
+        char* rest = line + consumed;
+        int n = 0;
+        if (strcmp(kind, "func") == 0) {
+            symbol->kind = MODULE_SYMBOL_FUNCTION;
+            sscanf(rest, "%d %d%n", &symbol->data_type, &symbol->param_count, &n);
+            symbol->param_count = MIN(MAX(symbol->param_count, 0), MODULE_MAX_PARAMS);
+            for (int p = 0; p < symbol->param_count; p++) {
+                rest += n;
+                sscanf(rest, "%d%n", &symbol->param_types[p], &n);
+            }
+        } else {
+            symbol->kind = MODULE_SYMBOL_GLOBAL;
+            sscanf(rest, "%d", &symbol->data_type);
+        }
+        list_push(iface->symbols, symbol);
+    }
+
+    fclose(fp);
+    return iface;
+}
+
+// Swaps the extension of a module source, "dir/math.k" -> "dir/math.ki"
+bool module_path(const char* source, const char* ext, char* out, size_t size) {
+    const char* dot = strrchr(source, '.');
+    const char* slash = strrchr(source, '/');
+    size_t base_len = (dot && (!slash || dot > slash)) ? (size_t) (dot - source) : strlen(source);
+
+    return snprintf(out, size, "%.*s%s", (int) base_len, source, ext) < (int) size;
+}
+
+// Looks for <name>.k next to the importing file first, then in the search dirs
+bool module_find_source(const char* name, const char* from, list_t* search_dirs, char* out, size_t size) {
+    const char* slash = strrchr(from, '/');
+    int written = slash ? snprintf(out, size, "%.*s/%s.k", (int) (slash - from), from, name)
+                        : snprintf(out, size, "%s.k", name);
+    if (written < (int) size && access(out, F_OK) == 0) {
+        return true;
+    }
+
+    for (size_t i = 0; search_dirs && i < search_dirs->size; i++) {
+        if (snprintf(out, size, "%s/%s.k", (char*) search_dirs->items[i], name) < (int) size &&
+            access(out, F_OK) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Make style dependency file: "<target>: <source> <deps...>", followed by a
+// comment line with the code generation options the target was built with
+bool module_write_deps(const char* path, const char* target, const char* source, list_t* deps, const char* options) {
+    FILE* fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "Could not open file for writing '%s'\n", path);
+        return false;
+    }
+
+    fprintf(fp, "%s: %s", target, source);
+    for (size_t i = 0; i < deps->size; i++) {
+        fprintf(fp, " %s", (char*) deps->items[i]);
+    }
+    fprintf(fp, "\n# %s\n", options);
+
+    return fclose(fp) == 0;
+}
+
+// Everything after the colon of a dependency file, NULL if there is none.
+// options receives the recorded code generation options, empty when the
+// file has none
+list_t* module_read_deps(const char* path, char* options, size_t options_size) {
+    options[0] = '\0';
+    if (access(path, F_OK) != 0) return NULL;
+
+    char* s = read_file(path);
+    if (!s) return NULL;
+
+    char* newline = strchr(s, '\n');
+    if (newline) {
+        *newline = '\0';
+        if (strncmp(newline + 1, "# ", 2) == 0) {
+            snprintf(options, options_size, "%.*s", (int) strcspn(newline + 3, "\n"), newline + 3);
+        }
+    }
+
+    char* colon = strchr(s, ':');
+    if (!colon) {
+        free(s);
+        return NULL;
+    }
+
+    list_t* deps = init_list(sizeof(char*));
+    char* save = NULL;
+    for (char* dep = strtok_r(colon + 1, " \t\r\n", &save); dep; dep = strtok_r(NULL, " \t\r\n", &save)) {
+        list_push(deps, strdup(dep));
+    }
+
+    free(s);
+    return deps;
+}
+
+// True when target exists and is at least as new as every dependency
+bool module_is_fresh(const char* target, list_t* deps) {
+    struct stat target_st;
+    if (stat(target, &target_st) != 0) return false;
+
+    for (size_t i = 0; i < deps->size; i++) {
+        struct stat dep_st;
+        if (stat((char*) deps->items[i], &dep_st) != 0) return false;
+        if (dep_st.st_mtim.tv_sec > target_st.st_mtim.tv_sec ||
+            (dep_st.st_mtim.tv_sec == target_st.st_mtim.tv_sec &&
+             dep_st.st_mtim.tv_nsec > target_st.st_mtim.tv_nsec)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#endif // SKULL_MODULE_H_IMPLEMENTATION
+#endif // SKULL_MODULE_H
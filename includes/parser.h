@@ -7,21 +7,43 @@
 #include "lexer.h"
 #include "ast.h"
 #include "token.h"
+#include "tokbuf.h"
 #include "types.h"
+#include "trace.h"
 
 typedef struct parserStruct {
     lexer_t* lexer;
     token_t* token;
+    unsigned int prev_end; // Offset just past the last eaten token
+
+    // Only used when parsing from a pre-lexed token buffer
+    token_buffer_t* tokens;
+    size_t index;          // Index of the current token in tokens
+    token_t view;          // Current token, parser->token points here
+    char* scratch;         // Backs view.value
+
+    // Type parameters of the generic function being parsed
+    char* type_params[TYPE_MAX_PARAMS];
+    int type_param_count;
 } parser_t;
 
 parser_t* init_parser(lexer_t* lexer);
+parser_t* init_parser_tokens(token_buffer_t* tokens);
+void free_parser(parser_t* parser);
 ast_t* parse(parser_t* parser);
 token_t* parser_eat(parser_t* parser, int type);
+tokenType parser_peek(parser_t* parser, size_t offset);
+int parse_type(parser_t* parser);
 ast_t* parse_id(parser_t* parser);
 ast_t* parse_block(parser_t* parser);
+ast_t* parse_primary(parser_t* parser);
 ast_t* parse_expr(parser_t* parser);
 ast_t* parse_list(parser_t* parser);
 ast_t* parse_compound(parser_t* parser);
+ast_t* parse_statement(parser_t* parser);
+ast_t* parse_if(parser_t* parser);
+ast_t* parse_match(parser_t* parser);
+ast_t* parse_record(parser_t* parser);
 
 #ifdef SKULL_PARSER_H_IMPLEMENTATION
 
@@ -33,21 +55,146 @@ parser_t* init_parser(lexer_t* lexer) {
     return parser;
 }
 
+static void parser_load_view(parser_t* parser) {
+    token_span_t span;
+    token_buffer_span(parser->tokens, parser->index, &span);
+
+    memcpy(parser->scratch, parser->tokens->src + span.offset, span.length);
+    parser->scratch[span.length] = '\0';
+
+    parser->view.type = span.type;
+    parser->view.value = span.type == TOKEN_EOF ? NULL : parser->scratch;
+    parser->view.line = span.line;
+    parser->view.column = span.column;
+    parser->view.offset = span.offset;
+    parser->token = &parser->view;
+}
+
+parser_t* init_parser_tokens(token_buffer_t* tokens) {
+    parser_t* parser = calloc(1, sizeof(struct parserStruct));
+    parser->tokens = tokens;
+    parser->index = 0;
+    parser->scratch = calloc(tokens->max_length + 1, sizeof(char));
+    if (!parser->scratch) {
+        fprintf(stderr, "Memory allocation failed for parser\n");
+        exit(1);
+    }
+    parser_load_view(parser);
+
+    return parser;
+}
+
+void free_parser(parser_t* parser) {
+    if (!parser) return;
+
+    if (parser->tokens) {
+        free(parser->scratch);
+    } else {
+        free_token(parser->token);
+    }
+    free(parser);
+}
+
 ast_t* parse(parser_t* parser) {
+    TRACE_SCOPE("parse");
     return parse_compound(parser);
 }
 
+// Type of the token `offset` positions past the current one
+tokenType parser_peek(parser_t* parser, size_t offset) {
+    if (offset == 0) return parser->token->type;
+
+    if (parser->tokens) {
+        size_t index = MIN(parser->index + offset, parser->tokens->size - 1);
+        return parser->tokens->types[index];
+    }
+
+    // Pull mode scans ahead on a copy of the lexer
+    lexer_t lookahead = *parser->lexer;
+    token_span_t span;
+    for (size_t i = 0; i < offset; i++) {
+        if (lexer_scan(&lookahead, &span) == TOKEN_EOF) break;
+    }
+    return span.type;
+}
+
 token_t* parser_eat(parser_t* parser, int type) {
     if (parser->token->type != type) {
         printf("ERROR: Parser found unexpected token: %s, was expecting: %s\n", token_to_str(parser->token), token_type_to_str(type)); 
         exit(1); 
     }
 
-    parser->token = lexer_next_token(parser->lexer);
+    parser->prev_end = parser->token->offset + (parser->token->value ? strlen(parser->token->value) : 0);
+
+    if (parser->tokens) {
+        if (parser->index + 1 < parser->tokens->size) parser->index++;
+        parser_load_view(parser);
+    } else {
+        free_token(parser->token);
+        parser->token = lexer_next_token(parser->lexer);
+    }
     return parser->token;
 }
 
+// `name` or `Array<type>`, which nests as deep as needed
+int parse_type(parser_t* parser) {
+    TRACE_SCOPE("parse_type");
+    if (!parser->token || !parser->token->value) {
+        printf("ERROR: Expected a type at the end of the source\n");
+        exit(1);
+    }
+    bool array = strcmp(parser->token->value, "Array") == 0;
+    int type = typename_to_int(parser->token->value);
+    for (int i = 0; i < parser->type_param_count; i++) {
+        if (strcmp(parser->type_params[i], parser->token->value) == 0) type = TYPE_PARAM + i;
+    }
+    parser_eat(parser, TOKEN_ID);
+
+    // Array is the only type taking an argument
+    if (parser->token->type == TOKEN_LT) {
+        if (!array) {
+            printf("ERROR: Only Array takes a type argument, line %u\n", parser->token->line);
+            exit(1);
+        }
+        parser_eat(parser, TOKEN_LT);
+        int element = parse_type(parser);
+        parser_eat(parser, TOKEN_GT);
+        type = type_array_of(element);
+    }
+    return type;
+}
+
+// `record {` or `record(layout) {` after the `=` of a top level name
+static bool parser_at_record(parser_t* parser) {
+    if (parser->token->type != TOKEN_ID || strcmp(parser->token->value, "record") != 0) return false;
+    return parser_peek(parser, 1) == TOKEN_LBRACE ||
+           (parser_peek(parser, 1) == TOKEN_LPAREN && parser_peek(parser, 2) == TOKEN_ID &&
+            parser_peek(parser, 3) == TOKEN_RPAREN && parser_peek(parser, 4) == TOKEN_LBRACE);
+}
+
+// `value.name`, or `value.name = expr` storing to the field
+static ast_t* parse_field(parser_t* parser, ast_t* value) {
+    if (parser->token->type != TOKEN_DOT) return value;
+    parser_eat(parser, TOKEN_DOT);
+
+    ast_t* ast = init_ast(AST_FIELD);
+    ast->name = strdup(parser->token->value);
+    ast->value = value;
+    parser_eat(parser, TOKEN_ID);
+
+    if (parser->token->type == TOKEN_ASSIGN) {
+        parser_eat(parser, TOKEN_ASSIGN);
+        ast_t* assignment = init_ast(AST_FIELD_ASSIGNMENT);
+        assignment->children = init_list(sizeof(struct astStruct));
+        list_push(assignment->children, ast);
+        assignment->value = parse_expr(parser);
+        return assignment;
+    }
+    return ast;
+}
+
 ast_t* parse_id(parser_t* parser) {
+    TRACE_SCOPE("parse_id");
     char* value = calloc(strlen(parser->token->value) + 1, sizeof(char));
     strcpy(value, parser->token->value);
     parser_eat(parser, TOKEN_ID);
@@ -56,26 +203,44 @@ ast_t* parse_id(parser_t* parser) {
         parser_eat(parser, TOKEN_ASSIGN);
         ast_t* ast = init_ast(AST_ASSIGNMENT);
         ast->name = value;
-        ast->value = parse_expr(parser);
+        ast->value = parser_at_record(parser) ? parse_record(parser) : parse_expr(parser);
         return ast;
     }
 
     ast_t* ast = init_ast(AST_VARIABLE);
     ast->name = value;
 
+    if (parser->token->type == TOKEN_LBRACKET) {
+        parser_eat(parser, TOKEN_LBRACKET);
+        ast->type = AST_INDEX;
+        ast->value = parse_expr(parser);
+        parser_eat(parser, TOKEN_RBRACKET);
+        if (parser->token->type == TOKEN_DOT) return parse_field(parser, ast);
+
+        // `name[index] = expr` keeps the index as its only child
+        if (parser->token->type == TOKEN_ASSIGN) {
+            parser_eat(parser, TOKEN_ASSIGN);
+            ast->type = AST_INDEX_ASSIGNMENT;
+            ast->children = init_list(sizeof(struct astStruct));
+            list_push(ast->children, ast->value);
+            ast->value = parse_expr(parser);
+        }
+        return ast;
+    }
+
     if (parser->token->type == TOKEN_COLON) {
         parser_eat(parser, TOKEN_COLON);
 
-        while (parser->token->type == TOKEN_ID) {
-            ast->data_type = typename_to_int(parser->token->value);
-            parser_eat(parser, TOKEN_ID);
-            
-            if (parser->token->type == TOKEN_LT) {
-                parser_eat(parser, TOKEN_LT);
-                ast->data_type += typename_to_int(parser->token->value);
-                parser_eat(parser, TOKEN_ID);
-                parser_eat(parser, TOKEN_GT);
-            }
+        // One type only, a declaration without `;` is followed by the next statement
+        if (parser->token->type == TOKEN_ID) {
+            ast->data_type = parse_type(parser);
+        }
+
+        // `name: type = expr` declares and assigns at once
+        if (parser->token->type == TOKEN_ASSIGN) {
+            parser_eat(parser, TOKEN_ASSIGN);
+            ast->type = AST_ASSIGNMENT;
+            ast->value = parse_expr(parser);
         }
     } else {
         if (parser->token->type == TOKEN_LPAREN) {
@@ -97,21 +262,19 @@ ast_t* parse_id(parser_t* parser) {
             parser_eat(parser, TOKEN_RPAREN);
             ast->value = args;*/
         }
+        return parse_field(parser, ast);
     }
 
     return ast;
 }
 
 ast_t* parse_block(parser_t* parser) {
+    TRACE_SCOPE("parse_block");
     parser_eat(parser, TOKEN_LBRACE);
     ast_t* ast = init_ast(AST_COMPOUND);
 
     while (parser->token->type != TOKEN_RBRACE) {
-        list_push(ast->children, parse_expr(parser));
-        
-        if (parser->token->type == TOKEN_SEMI) {
-            parser_eat(parser, TOKEN_SEMI);
-        }
+        list_push(ast->children, parse_statement(parser));
     }
 
     parser_eat(parser, TOKEN_RBRACE);
@@ -119,6 +282,7 @@ ast_t* parse_block(parser_t* parser) {
 }
 
 ast_t* parse_int(parser_t* parser) {
+    TRACE_SCOPE("parse_int");
     int int_value = atoi(parser->token->value);
     parser_eat(parser, TOKEN_INT);
 
@@ -128,13 +292,72 @@ ast_t* parse_int(parser_t* parser) {
     return ast;
 }
 
-ast_t* parse_expr(parser_t* parser) {
+// The literal is kept as written, the code generator converts it exactly
+ast_t* parse_float(parser_t* parser) {
+    TRACE_SCOPE("parse_float");
+    ast_t* ast = init_ast(AST_FLOAT);
+    ast->name = strdup(parser->token->value);
+    ast->data_type = TYPE_FLOAT;
+    parser_eat(parser, TOKEN_FLOAT);
+
+    return ast;
+}
+
+// Decodes \n, \t, \r, \\ and \" between the quotes of the literal
+ast_t* parse_string(parser_t* parser) {
+    TRACE_SCOPE("parse_string");
+    const char* literal = parser->token->value;
+    size_t length = strlen(literal);
+    char* text = malloc(length);
+    if (!text) {
+        printf("ERROR: Memory allocation failed for string literal\n");
+        exit(1);
+    }
+
+    size_t n = 0;
+    for (size_t i = 1; i + 1 < length; i++) {
+        char c = literal[i];
+        if (c == '\\') {
+            switch (literal[++i]) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case '\\': c = '\\'; break;
+                case '"': c = '"'; break;
+                default:
+                    printf("ERROR: Unknown escape '\\%c' in string literal, line %u\n", literal[i], parser->token->line);
+                    exit(1);
+            }
+        }
+        text[n++] = c;
+    }
+    text[n] = '\0';
+
+    ast_t* ast = init_ast(AST_STRING);
+    ast->name = text;
+    ast->data_type = typename_to_int("string");
+    parser_eat(parser, TOKEN_STRING);
+
+    return ast;
+}
+
+ast_t* parse_primary(parser_t* parser) {
+    TRACE_SCOPE("parse_primary");
     switch (parser->token->type) {
         case TOKEN_ID: {
+            if (strcmp(parser->token->value, "import") == 0) {
+                parser_eat(parser, TOKEN_ID);
+                ast_t* ast = init_ast(AST_IMPORT);
+                ast->name = strdup(parser->token->value);
+                parser_eat(parser, TOKEN_ID);
+                return ast;
+            }
+            if (strcmp(parser->token->value, "if") == 0) return parse_if(parser);
+            if (strcmp(parser->token->value, "match") == 0) return parse_match(parser);
             if (strcmp(parser->token->value, "return") == 0) {
                 parser_eat(parser, TOKEN_ID);
                 ast_t* ast = init_ast(AST_CALL);
-                ast->name = "return";
+                ast->name = strdup("return");
                 
                 if (parser->token->type == TOKEN_LPAREN) {
                     parser_eat(parser, TOKEN_LPAREN);
@@ -148,19 +371,117 @@ ast_t* parse_expr(parser_t* parser) {
         }
         case TOKEN_LPAREN: return parse_list(parser);
         case TOKEN_INT: return parse_int(parser);
+        case TOKEN_FLOAT: return parse_float(parser);
+        case TOKEN_STRING: return parse_string(parser);
+        case TOKEN_LT: {
+            // `<T, U>(params): type -> { ... }` is a generic function,
+            // int_value counts its type parameters
+            if (parser->type_param_count) {
+                printf("ERROR: Generic functions cannot be nested, line %u\n", parser->token->line);
+                exit(1);
+            }
+            parser_eat(parser, TOKEN_LT);
+            while (parser->token->type == TOKEN_ID) {
+                if (parser->type_param_count == TYPE_MAX_PARAMS) {
+                    printf("ERROR: At most %d type parameters are supported, line %u\n", TYPE_MAX_PARAMS, parser->token->line);
+                    exit(1);
+                }
+                parser->type_params[parser->type_param_count++] = strdup(parser->token->value);
+                parser_eat(parser, TOKEN_ID);
+                if (parser->token->type != TOKEN_COMMA) break;
+                parser_eat(parser, TOKEN_COMMA);
+            }
+            parser_eat(parser, TOKEN_GT);
+
+            ast_t* ast = parse_list(parser);
+            if (ast->type != AST_FUNCTION) {
+                printf("ERROR: Type parameters only go on functions, line %u\n", parser->token->line);
+                exit(1);
+            }
+            ast->int_value = parser->type_param_count;
+            for (int i = 0; i < parser->type_param_count; i++) {
+                free(parser->type_params[i]);
+            }
+            parser->type_param_count = 0;
+            return ast;
+        }
+        case TOKEN_MINUS: {
+            // Negation is 0 - operand, folded for literals
+            parser_eat(parser, TOKEN_MINUS);
+            ast_t* operand = parse_primary(parser);
+            if (operand->type == AST_INT) {
+                operand->int_value = -operand->int_value;
+                return operand;
+            }
+            if (operand->type == AST_FLOAT) {
+                char* negated = malloc(strlen(operand->name) + 2);
+                if (!negated) {
+                    printf("ERROR: Memory allocation failed for float literal\n");
+                    exit(1);
+                }
+                sprintf(negated, "-%s", operand->name);
+                free(operand->name);
+                operand->name = negated;
+                return operand;
+            }
+            ast_t* ast = init_ast(AST_BINARY);
+            ast->int_value = TOKEN_MINUS;
+            list_push(ast->children, init_ast(AST_INT));
+            list_push(ast->children, operand);
+            return ast;
+        }
         default: {printf("ERROR: Parser found unexpected token: %s\n", token_to_str(parser->token)); exit(1);};
     }
 }
 
+// Binding power of a binary operator, 0 for anything else
+static int parser_precedence(tokenType type) {
+    switch (type) {
+        case TOKEN_EQ: case TOKEN_NEQ:
+        case TOKEN_LT: case TOKEN_GT:
+        case TOKEN_LTE: case TOKEN_GTE:   return 1;
+        case TOKEN_PLUS: case TOKEN_MINUS: return 2;
+        case TOKEN_MULTIPLY: case TOKEN_DIVIDE:
+        case TOKEN_MODULUS:                return 3;
+        default:                           return 0;
+    }
+}
+
+// Left associative operators binding at least min_precedence
+static ast_t* parse_binary(parser_t* parser, int min_precedence) {
+    TRACE_SCOPE("parse_binary");
+    ast_t* lhs = parse_primary(parser);
+
+    int precedence;
+    while ((precedence = parser_precedence(parser->token->type)) >= min_precedence) {
+        ast_t* ast = init_ast(AST_BINARY);
+        ast->int_value = parser->token->type;
+        parser_eat(parser, parser->token->type);
+
+        list_push(ast->children, lhs);
+        list_push(ast->children, parse_binary(parser, precedence + 1));
+        lhs = ast;
+    }
+    return lhs;
+}
+
+ast_t* parse_expr(parser_t* parser) {
+    return parse_binary(parser, 1);
+}
+
 ast_t* parse_list(parser_t* parser) {
+    TRACE_SCOPE("parse_list");
     parser_eat(parser, TOKEN_LPAREN);
     ast_t* ast = init_ast(AST_COMPOUND);
     
-    list_push(ast->children, parse_expr(parser));
-
-    while (parser->token->type == TOKEN_COMMA) {
-        parser_eat(parser, TOKEN_COMMA);
+    // `()` is an empty list, for calls and functions without arguments
+    if (parser->token->type != TOKEN_RPAREN) {
         list_push(ast->children, parse_expr(parser));
+
+        while (parser->token->type == TOKEN_COMMA) {
+            parser_eat(parser, TOKEN_COMMA);
+            list_push(ast->children, parse_expr(parser));
+        }
     }
 
     parser_eat(parser, TOKEN_RPAREN);
@@ -168,15 +489,8 @@ ast_t* parse_list(parser_t* parser) {
     if (parser->token->type == TOKEN_COLON) {
         parser_eat(parser, TOKEN_COLON);
 
-        while (parser->token->type == TOKEN_ID) {
-            ast->data_type = typename_to_int(parser->token->value);
-            parser_eat(parser, TOKEN_ID);
-            if (parser->token->type == TOKEN_LT) {
-                parser_eat(parser, TOKEN_LT);
-                ast->data_type += typename_to_int(parser->token->value);
-                parser_eat(parser, TOKEN_ID);
-                parser_eat(parser, TOKEN_GT);
-            }
+        if (parser->token->type == TOKEN_ID) {
+            ast->data_type = parse_type(parser);
         }
     }
 
@@ -185,8 +499,7 @@ ast_t* parse_list(parser_t* parser) {
         parser_eat(parser, TOKEN_FUNC_TYPE);
         
         if (parser->token->type == TOKEN_ID) {
-            ast->data_type = typename_to_int(parser->token->value);
-            parser_eat(parser, TOKEN_ID);
+            ast->data_type = parse_type(parser);
         }
         
         ast->value = parse_block(parser);
@@ -195,7 +508,101 @@ ast_t* parse_list(parser_t* parser) {
     return ast;
 }
 
+// `if (cond) { ... }`, optionally followed by `else { ... }` or `else if`
+ast_t* parse_if(parser_t* parser) {
+    TRACE_SCOPE("parse_if");
+    parser_eat(parser, TOKEN_ID);
+    ast_t* ast = init_ast(AST_IF);
+    parser_eat(parser, TOKEN_LPAREN);
+    ast->value = parse_expr(parser);
+    parser_eat(parser, TOKEN_RPAREN);
+    list_push(ast->children, parse_block(parser));
+
+    if (parser->token->type == TOKEN_ID && strcmp(parser->token->value, "else") == 0) {
+        parser_eat(parser, TOKEN_ID);
+        bool chained = parser->token->type == TOKEN_ID && strcmp(parser->token->value, "if") == 0;
+        list_push(ast->children, chained ? parse_if(parser) : parse_block(parser));
+    }
+    return ast;
+}
+
+// `match (value) { 1, 2 -> { ... } _ -> { ... } }`, labels are integer
+// literals and `_` matches whatever no other case does
+ast_t* parse_match(parser_t* parser) {
+    TRACE_SCOPE("parse_match");
+    parser_eat(parser, TOKEN_ID);
+    ast_t* ast = init_ast(AST_MATCH);
+    parser_eat(parser, TOKEN_LPAREN);
+    ast->value = parse_expr(parser);
+    parser_eat(parser, TOKEN_RPAREN);
+    parser_eat(parser, TOKEN_LBRACE);
+
+    while (parser->token->type != TOKEN_RBRACE) {
+        ast_t* arm = init_ast(AST_CASE);
+        arm->line = parser->token->line;
+        if (parser->token->type == TOKEN_ID && strcmp(parser->token->value, "_") == 0) {
+            parser_eat(parser, TOKEN_ID);
+        } else {
+            while (true) {
+                ast_t* label = parse_primary(parser);
+                if (label->type != AST_INT) {
+                    printf("ERROR: Match cases must be integer literals, line %u\n", arm->line);
+                    exit(1);
+                }
+                list_push(arm->children, label);
+                if (parser->token->type != TOKEN_COMMA) break;
+                parser_eat(parser, TOKEN_COMMA);
+            }
+        }
+        parser_eat(parser, TOKEN_FUNC_TYPE);
+        arm->value = parse_block(parser);
+        list_push(ast->children, arm);
+    }
+
+    parser_eat(parser, TOKEN_RBRACE);
+    return ast;
+}
+
+// `record { x: int; hot y: float; }`, record(c) and record(soa) ask for a
+// layout other than the default. `hot` marks fields read together often.
+ast_t* parse_record(parser_t* parser) {
+    TRACE_SCOPE("parse_record");
+    unsigned int line = parser->token->line;
+    parser_eat(parser, TOKEN_ID);
+    ast_t* ast = init_ast(AST_RECORD);
+    if (parser->token->type == TOKEN_LPAREN) {
+        parser_eat(parser, TOKEN_LPAREN);
+        ast->name = strdup(parser->token->value);
+        parser_eat(parser, TOKEN_ID);
+        parser_eat(parser, TOKEN_RPAREN);
+    }
+    parser_eat(parser, TOKEN_LBRACE);
+
+    while (parser->token->type != TOKEN_RBRACE) {
+        ast_t* field = init_ast(AST_VARIABLE);
+        if (parser->token->type == TOKEN_ID && strcmp(parser->token->value, "hot") == 0 &&
+            parser_peek(parser, 1) == TOKEN_ID) {
+            parser_eat(parser, TOKEN_ID);
+            field->int_value = 1;
+        }
+        field->name = strdup(parser->token->value);
+        parser_eat(parser, TOKEN_ID);
+        parser_eat(parser, TOKEN_COLON);
+        field->data_type = parse_type(parser);
+        list_push(ast->children, field);
+        if (parser->token->type == TOKEN_SEMI) parser_eat(parser, TOKEN_SEMI);
+    }
+    parser_eat(parser, TOKEN_RBRACE);
+
+    if (ast->children->size == 0) {
+        printf("ERROR: A record needs at least one field, line %u\n", line);
+        exit(1);
+    }
+    return ast;
+}
+
 ast_t* parse_compound(parser_t* parser) {
+    TRACE_SCOPE("parse_compound");
     unsigned int should_close = 0;
     if (parser->token->type == TOKEN_LBRACE) {
         parser_eat(parser, TOKEN_LBRACE);
@@ -204,11 +611,7 @@ ast_t* parse_compound(parser_t* parser) {
     ast_t* compound = init_ast(AST_COMPOUND);
 
     while (parser->token->type != TOKEN_EOF && parser->token->type != TOKEN_RBRACE) {
-        list_push(compound->children, parse_expr(parser));
-
-        if (parser->token->type == TOKEN_SEMI) {
-            parser_eat(parser, TOKEN_SEMI);
-        }
+        list_push(compound->children, parse_statement(parser));
     }
 
     if (should_close) {
@@ -218,5 +621,27 @@ ast_t* parse_compound(parser_t* parser) {
     return compound;
 }
 
+// Parses one statement of a compound and records its source span,
+// the trailing semicolon is part of the statement
+ast_t* parse_statement(parser_t* parser) {
+    TRACE_SCOPE("parse_statement");
+    unsigned int start = parser->token->offset;
+    unsigned int line = parser->token->line;
+    unsigned int column = parser->token->column;
+
+    ast_t* ast = parse_expr(parser);
+
+    if (parser->token->type == TOKEN_SEMI) {
+        parser_eat(parser, TOKEN_SEMI);
+    }
+
+    ast->src_start = start;
+    ast->src_end = parser->prev_end;
+    ast->line = line;
+    ast->column = column;
+
+    return ast;
+}
+
 #endif // SKULL_PARSER_H_IMPLEMENTATION
 #endif // SKULL_PARSER_H
\ No newline at end of file
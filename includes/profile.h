@@ -0,0 +1,145 @@
+#ifndef SKULL_PROFILE_H
+#define SKULL_PROFILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "list.h"
+
+// Counters an --instrument build dumps at exit, read back by --profile-use.
+// The file is the counter block of the program copied out verbatim:
+//
+//   "SKPF" | u32 version | u64 count | u64 counters[count] | keys, NUL separated
+//
+// Keys name what a counter counts, so a profile stays usable while the
+// source changes around the functions it measured:
+//   fn:<function>                     entries into a function
+//   call:<caller>:<callee>:<site>     executions of the site-th call in caller
+//   if:<function>:<site>:then|else    runs of either branch of the site-th if or
+//                                     match of function
+//   match:<function>:<site>:<arm>     runs of an arm of a match, arm n for values
+//                                     no arm takes when the match has n arms
+#define PROFILE_MAGIC "SKPF"
+#define PROFILE_VERSION 1
+
+// Edges taken at least this share of the hottest function's entries are hot
+#ifndef PROFILE_HOT_PERCENT
+#define PROFILE_HOT_PERCENT 1
+#endif
+
+typedef struct {
+    char* key;
+    uint64_t count;
+} profile_entry_t;
+
+typedef struct {
+    list_t* entries;     // profile_entry_t*
+    uint64_t max_count;  // Entries of the hottest function
+} skull_profile_t;
+
+skull_profile_t* profile_load(const char* path);
+uint64_t profile_count(skull_profile_t* profile, const char* key);
+bool profile_has(skull_profile_t* profile, const char* key);
+bool profile_is_hot(skull_profile_t* profile, uint64_t count);
+void free_profile(skull_profile_t* profile);
+
+#ifdef SKULL_PROFILE_H_IMPLEMENTATION
+
+// NULL when the file is missing or not a profile
+skull_profile_t* profile_load(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return NULL;
+
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t count = 0;
+    if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, PROFILE_MAGIC, 4) != 0 ||
+        fread(&version, sizeof(version), 1, fp) != 1 || version != PROFILE_VERSION ||
+        fread(&count, sizeof(count), 1, fp) != 1) {
+        fclose(fp);
+        return NULL;
+    }
+
+    uint64_t* counters = malloc(count * sizeof(uint64_t) + 1);
+    if (!counters || fread(counters, sizeof(uint64_t), count, fp) != count) {
+        free(counters);
+        fclose(fp);
+        return NULL;
+    }
+
+    skull_profile_t* profile = calloc(1, sizeof(skull_profile_t));
+    if (!profile) {
+        fprintf(stderr, "Memory allocation failed for profile\n");
+        exit(1);
+    }
+    profile->entries = init_list(sizeof(profile_entry_t*));
+
+    char key[1024];
+    for (uint64_t i = 0; i < count; i++) {
+        size_t len = 0;
+        int c;
+        while ((c = fgetc(fp)) != EOF && c != '\0') {
+            if (len + 1 < sizeof(key)) key[len++] = (char) c;
+        }
+        key[len] = '\0';
+        if (c == EOF && len == 0) break;
+
+        profile_entry_t* entry = malloc(sizeof(profile_entry_t));
+        if (!entry) {
+            fprintf(stderr, "Memory allocation failed for profile\n");
+            exit(1);
+        }
+        entry->key = strdup(key);
+        entry->count = counters[i];
+        list_push(profile->entries, entry);
+
+        if (strncmp(key, "fn:", 3) == 0 && entry->count > profile->max_count) {
+            profile->max_count = entry->count;
+        }
+    }
+
+    free(counters);
+    fclose(fp);
+    return profile;
+}
+
+static profile_entry_t* profile_find(skull_profile_t* profile, const char* key) {
+    for (size_t i = 0; i < profile->entries->size; i++) {
+        profile_entry_t* entry = (profile_entry_t*) profile->entries->items[i];
+        if (strcmp(entry->key, key) == 0) return entry;
+    }
+    return NULL;
+}
+
+// 0 for keys the profile has never seen
+uint64_t profile_count(skull_profile_t* profile, const char* key) {
+    profile_entry_t* entry = profile_find(profile, key);
+    return entry ? entry->count : 0;
+}
+
+// Code added after the training run has no counter, which is not the
+// same as code that never ran
+bool profile_has(skull_profile_t* profile, const char* key) {
+    return profile_find(profile, key) != NULL;
+}
+
+bool profile_is_hot(skull_profile_t* profile, uint64_t count) {
+    return count > 0 && count * 100 >= profile->max_count * PROFILE_HOT_PERCENT;
+}
+
+void free_profile(skull_profile_t* profile) {
+    if (!profile) return;
+
+    for (size_t i = 0; i < profile->entries->size; i++) {
+        profile_entry_t* entry = (profile_entry_t*) profile->entries->items[i];
+        free(entry->key);
+        free(entry);
+    }
+    free_list(profile->entries);
+    free(profile);
+}
+
+#endif // SKULL_PROFILE_H_IMPLEMENTATION
+#endif // SKULL_PROFILE_H
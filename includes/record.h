@@ -0,0 +1,220 @@
+#ifndef SKULL_RECORD_H
+#define SKULL_RECORD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "list.h"
+#include "ast.h"
+#include "types.h"
+
+// Record types, `Name = record { x: float; hot id: int; tag: char; }`.
+// Fields of type char and bool take a byte, any other 8 bytes, and are
+// aligned to their size. By default the fields are reordered: hot ones
+// first so they share the first cache line, the single bytes of both kinds
+// next to each other so only the tail of the record is padding. record(c)
+// keeps the declaration order, which is what a C struct of the same fields
+// gets. record(soa) makes arrays of the record one column per field, so a
+// scan over one field only reads that field.
+enum {
+    RECORD_AUTO,
+    RECORD_C,
+    RECORD_SOA,
+};
+
+// System V class of an eightbyte of a record
+enum {
+    RECORD_MEMORY,
+    RECORD_INTEGER,
+    RECORD_SSE,
+};
+
+typedef struct {
+    char* name;
+    int data_type;
+    int size;               // 1 for char and bool, 8 for anything else
+    int offset;             // In a record and in an element of an array of them
+    int column;             // Bytes per element of the columns before this one, arrays of a record(soa)
+    bool hot;
+} record_field_t;
+
+typedef struct {
+    char* name;
+    int type;               // typename_to_int of the name
+    int layout;             // RECORD_*
+    int size;               // Bytes of a value, a multiple of its alignment
+    int element_size;       // Bytes per element of an array, without padding for record(soa)
+    int classes[2];         // Class of each eightbyte, RECORD_MEMORY for records over 16 bytes
+    size_t field_count;
+    record_field_t* fields; // In declaration order
+} record_t;
+
+record_t* init_record(const char* name, ast_t* ast);
+void free_record(record_t* record);
+record_t* record_find(list_t* records, int type);
+record_t* record_named(list_t* records, const char* name);
+record_field_t* record_field(record_t* record, const char* name);
+int record_eightbytes(record_t* record);
+bool record_same(record_t* a, record_t* b);
+
+#ifdef SKULL_RECORD_H_IMPLEMENTATION
+
+static void record_error(const char* message, const char* name) {
+    fprintf(stderr, "ERROR: %s: '%s'\n", message, name);
+    exit(1);
+}
+
+// Puts field at the next offset its size divides
+static void record_place(record_field_t* field, int* offset) {
+    *offset = (*offset + field->size - 1) / field->size * field->size;
+    field->offset = *offset;
+    *offset += field->size;
+}
+
+// Places the fields that are hot or not and of the size in declaration order
+static void record_place_group(record_t* record, bool hot, int size, int* offset) {
+    for (size_t i = 0; i < record->field_count; i++) {
+        record_field_t* field = &record->fields[i];
+        if (field->hot == hot && field->size == size) record_place(field, offset);
+    }
+}
+
+// Hot 8 byte fields, hot bytes, then the cold ones. When hot bytes are
+// followed by cold bytes, the cold 8 byte fields go last so all the bytes
+// form one run and at most one gap pads them to the next 8 byte field.
+static void record_layout(record_t* record) {
+    int offset = 0;
+    if (record->layout == RECORD_C) {
+        for (size_t i = 0; i < record->field_count; i++) record_place(&record->fields[i], &offset);
+    } else {
+        record_place_group(record, true, 8, &offset);
+        int hot_bytes = offset;
+        record_place_group(record, true, 1, &offset);
+        bool bytes_first = offset != hot_bytes;
+        record_place_group(record, false, bytes_first ? 1 : 8, &offset);
+        record_place_group(record, false, bytes_first ? 8 : 1, &offset);
+    }
+
+    int align = 1;
+    for (size_t i = 0; i < record->field_count; i++) {
+        if (record->fields[i].size > align) align = record->fields[i].size;
+    }
+    record->size = (offset + align - 1) / align * align;
+    record->element_size = record->size;
+
+    // Columns of the 8 byte fields come first, so each starts aligned
+    if (record->layout == RECORD_SOA) {
+        int column = 0;
+        for (int size = 8; size >= 1; size -= 7) {
+            for (size_t i = 0; i < record->field_count; i++) {
+                if (record->fields[i].size != size) continue;
+                record->fields[i].column = column;
+                column += size;
+            }
+        }
+        record->element_size = column;
+    }
+
+    // An eightbyte holding nothing but floats goes to an SSE register
+    record->classes[0] = record->classes[1] = RECORD_MEMORY;
+    if (record->size > 16) return;
+    for (int k = 0; k < record_eightbytes(record); k++) {
+        record->classes[k] = RECORD_SSE;
+        for (size_t i = 0; i < record->field_count; i++) {
+            record_field_t* field = &record->fields[i];
+            if (field->offset / 8 == k && !type_is_float(field->data_type)) record->classes[k] = RECORD_INTEGER;
+        }
+    }
+}
+
+// The record declared by `name = record { ... }`, whose value is ast
+record_t* init_record(const char* name, ast_t* ast) {
+    record_t* record = calloc(1, sizeof(record_t));
+    if (record) record->fields = calloc(ast->children->size, sizeof(record_field_t));
+    if (!record || !record->fields) {
+        fprintf(stderr, "Memory allocation failed for record\n");
+        exit(1);
+    }
+    record->name = strdup(name);
+    record->type = typename_to_int(name);
+
+    record->layout = RECORD_AUTO;
+    if (ast->name && strcmp(ast->name, "c") == 0) record->layout = RECORD_C;
+    else if (ast->name && strcmp(ast->name, "soa") == 0) record->layout = RECORD_SOA;
+    else if (ast->name) record_error("Unknown record layout, expected c or soa", ast->name);
+
+    record->field_count = ast->children->size;
+    for (size_t i = 0; i < record->field_count; i++) {
+        ast_t* declaration = (ast_t*) ast->children->items[i];
+        record_field_t* field = &record->fields[i];
+        if (type_is_vector(declaration->data_type)) record_error("Vectors cannot be record fields", declaration->name);
+        if (type_param_index(declaration->data_type) >= 0) record_error("Record fields have concrete types", declaration->name);
+        if (record_field(record, declaration->name)) record_error("Duplicate field", declaration->name);
+
+        field->name = strdup(declaration->name);
+        field->data_type = declaration->data_type;
+        field->size = declaration->data_type == typename_to_int("char") ||
+                      declaration->data_type == typename_to_int("bool") ? 1 : 8;
+        field->hot = declaration->int_value == 1;
+    }
+
+    record_layout(record);
+    return record;
+}
+
+void free_record(record_t* record) {
+    if (!record) return;
+
+    for (size_t i = 0; i < record->field_count; i++) {
+        free(record->fields[i].name);
+    }
+    free(record->fields);
+    free(record->name);
+    free(record);
+}
+
+// NULL when type is not one of the records
+record_t* record_find(list_t* records, int type) {
+    for (size_t i = 0; records && i < records->size; i++) {
+        record_t* record = (record_t*) records->items[i];
+        if (record->type == type) return record;
+    }
+    return NULL;
+}
+
+record_t* record_named(list_t* records, const char* name) {
+    for (size_t i = 0; records && i < records->size; i++) {
+        record_t* record = (record_t*) records->items[i];
+        if (strcmp(record->name, name) == 0) return record;
+    }
+    return NULL;
+}
+
+// Fields are looked up among the ones filled in so far
+record_field_t* record_field(record_t* record, const char* name) {
+    for (size_t i = 0; i < record->field_count; i++) {
+        if (record->fields[i].name && strcmp(record->fields[i].name, name) == 0) return &record->fields[i];
+    }
+    return NULL;
+}
+
+int record_eightbytes(record_t* record) {
+    return (record->size + 7) / 8;
+}
+
+// Whether both declare the same fields with the same layout, as every
+// module using a record has to
+bool record_same(record_t* a, record_t* b) {
+    if (strcmp(a->name, b->name) != 0 || a->layout != b->layout || a->field_count != b->field_count) return false;
+    for (size_t i = 0; i < a->field_count; i++) {
+        if (strcmp(a->fields[i].name, b->fields[i].name) != 0 || a->fields[i].data_type != b->fields[i].data_type ||
+            a->fields[i].hot != b->fields[i].hot) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif // SKULL_RECORD_H_IMPLEMENTATION
+#endif // SKULL_RECORD_H
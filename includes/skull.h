@@ -9,6 +9,11 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
+#include <spawn.h>
+#include <time.h>
+
+extern char** environ;
 
 typedef struct lexerStruct lexer_t;
 typedef struct parserStruct parser_t;
@@ -19,115 +24,101 @@ typedef struct astStruct ast_t;
 #include "list.h"
 #include "ast.h"
 #include "lexer.h"
+#include "tokbuf.h"
 #include "parser.h"
+#include "incremental.h"
+#include "ast_pool.h"
+#include "ast_file.h"
+#include "record.h"
+#include "module.h"
+#include "profile.h"
+#include "ctfe.h"
+#include "escape.h"
+#include "ipo.h"
+#include "trace.h"
 #include "asm.h"
 
 #define PATH_MAX_SIZE 4096
 
-void skull_compile(char* src, const char* output_filename, bool keep_files);
-void skull_compile_file(const char* filename, const char* output_filename, bool keep_files);
+typedef struct {
+    const char* output_filename;
+    bool keep_files;          // Keep the intermediate .asm and .o files
+    bool ast_cache;           // Reuse <input>ast next to the source while it is unchanged
+    const char* emit_ast;     // Only write the parsed tree to this file
+    bool compile_only;        // Stop at <output>.o and <output>.ki, no entry point and no link
+    list_t* include_dirs;     // char*, searched for imported modules after the importer's directory
+    bool instrument;          // Count function entries, calls and branch arms, the program writes <output>.kprof
+    const char* profile_use;  // Profile of a training run that drives inlining and code placement
+    int isa;                  // ASM_ISA_*, what vector code is lowered to
+    bool fma;                 // Fuse float multiplies and adds, changes rounding
+    bool shared;              // Build a position independent lib<name>.so and its C header
+    bool whole_program;       // Merge every module into one tree and object, optimized across them
+    list_t* sources;          // char*, further sources of a whole program build besides the input
+} skull_options_t;
+
+ast_t* skull_parse(char* src);
+void skull_compile_ast(ast_t* root, const char* filename, skull_options_t* options);
+void skull_compile(char* src, skull_options_t* options);
+void skull_bench_ast(const char* filename, int iterations);
+void skull_bench_phases(const char* filename, int iterations);
+void skull_check_incremental(const char* filename, int edits);
+void skull_compile_file(const char* filename, skull_options_t* options);
 void extract_base_name_and_extension(const char* filename, char* base_name, size_t base_size, char* extension, size_t ext_size);
 const char* skull_strerror(int err);
 
 #ifdef SKULL_H_IMPLEMENTATION
 
-typedef struct {
-    char* data;
-    size_t size;
-    size_t capacity;
-} string_buffer_t;
-
-static string_buffer_t init_string_buffer(size_t initial_capacity) {
-    string_buffer_t buf = {0};
-    buf.data = (char*)malloc(initial_capacity);
-    if (!buf.data) {
-        fprintf(stderr, "Memory allocation failed for string buffer\n");
-        exit(1);
+// Runs argv[0], looked up in PATH, without a shell and waits for it. Its
+// output goes straight to ours
+static bool skull_run(char* const argv[]) {
+    pid_t pid;
+    int err = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+    if (err != 0) {
+        fprintf(stderr, "Error: Failed to run %s (%s)\n", argv[0], skull_strerror(err));
+        return false;
     }
-    buf.data[0] = '\0';
-    buf.size = 0;
-    buf.capacity = initial_capacity;
-    return buf;
-}
 
-static void append_string_buffer(string_buffer_t* buf, const char* str) {
-    if (!buf || !str) return;
-    
-    size_t str_len = strlen(str);
-    if (buf->size + str_len + 1 > buf->capacity) {
-        size_t new_capacity = buf->capacity * 2 > buf->size + str_len + 1 ? buf->capacity * 2 : buf->size + str_len + 1;
-        char* new_data = (char*)realloc(buf->data, new_capacity);
-        if (!new_data) {
-            fprintf(stderr, "Memory reallocation failed for string buffer\n");
-            free(buf->data);
-            exit(1);
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            fprintf(stderr, "Error: Failed to wait for %s (%s)\n", argv[0], skull_strerror(errno));
+            return false;
         }
-        buf->data = new_data;
-        buf->capacity = new_capacity;
     }
-    strcpy(buf->data + buf->size, str);
-    buf->size += str_len;
-}
-
-static void free_string_buffer(string_buffer_t* buf) {
-    if (!buf) return;
-    
-    if (buf->data) {
-        free(buf->data);
-        buf->data = NULL;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Error: %s failed with status %d\n", argv[0],
+                WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+        return false;
     }
-    buf->size = 0;
-    buf->capacity = 0;
+    return true;
 }
 
-static char* sh(const char* binpath, const char* source) {
-    if (!binpath || !source) {
-        fprintf(stderr, "Invalid arguments to sh function\n");
-        return NULL;
-    }
-    
-    string_buffer_t output = init_string_buffer(1024);
-    FILE* fp;
-    char path[PATH_MAX_SIZE];
-    
-    char* cmd = (char*)malloc(PATH_MAX_SIZE);
-    if (!cmd) {
-        fprintf(stderr, "Memory allocation failed for command buffer\n");
-        free_string_buffer(&output);
-        return NULL;
-    }
-
-    if (snprintf(cmd, PATH_MAX_SIZE, "%s %s", binpath, source) >= PATH_MAX_SIZE) {
-        fprintf(stderr, "Command too long: %s %s\n", binpath, source);
-        free(cmd);
-        free_string_buffer(&output);
-        return NULL;
-    }
-
-    fp = popen(cmd, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "Failed to run command: %s (%s)\n", cmd, skull_strerror(errno));
-        free(cmd);
-        free_string_buffer(&output);
-        return NULL;
-    }
-
-    while (fgets(path, sizeof(path), fp) != NULL) {
-        append_string_buffer(&output, path);
-    }
+// An anonymous file in memory, which the tools we run inherit and open as
+// path. -1 when the kernel has none, callers then fall back to disk
+static int skull_memfd(const char* name, char* path, size_t path_size) {
+#ifdef SYS_memfd_create
+    int fd = (int) syscall(SYS_memfd_create, name, 0);
+    if (fd >= 0) snprintf(path, path_size, "/dev/fd/%d", fd);
+    return fd;
+#else
+    (void) name;
+    (void) path;
+    (void) path_size;
+    return -1;
+#endif
+}
 
-    int status = pclose(fp);
-    if (status != 0) {
-        fprintf(stderr, "Command failed with status %d: %s\n", WEXITSTATUS(status), cmd);
-        free(cmd);
-        free_string_buffer(&output);
-        return NULL; // Return NULL on failure
+static bool skull_write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= written;
     }
-
-    free(cmd);
-    char* result = strdup(output.data);
-    free_string_buffer(&output);
-    return result;
+    return true;
 }
 
 const char* skull_strerror(int err) {
@@ -158,39 +149,434 @@ void extract_base_name_and_extension(const char* filename, char* base_name, size
     }
 }
 
-void skull_compile(char* src, const char* output_filename, bool keep_files) {
-    if (!src) {
-        fprintf(stderr, "Error: Source code is NULL\n");
-        return;
-    }
+ast_t* skull_parse(char* src) {
+    // Lex the whole file up front, the parser then only indexes into the buffer.
+    // Large files are split over all CPUs
+    size_t src_size = strlen(src);
+    token_buffer_t* tokens = lexer_tokenize_parallel(src, src_size, 0);
 
+#ifdef SKULL_VERIFY_LEXER
+    // Differential check of the chunked lexer against a plain sequential
+    // run, on every thread count from 2 to 8. graveyard lsc-lexer-check
+    // builds this with small chunks so even short sources get split.
     lexer_t* lexer = init_lexer(src);
-    if (!lexer) {
-        fprintf(stderr, "Error: Failed to initialize lexer\n");
-        return;
+    token_buffer_t* expected = lexer_tokenize(lexer);
+    for (unsigned int threads = 2; threads <= 8; threads++) {
+        token_buffer_t* chunked = lexer_tokenize_parallel(src, src_size, threads);
+        if (!token_buffer_equal(chunked, expected)) {
+            fprintf(stderr, "Error: Lexing on %u threads differs from the sequential lexer\n", threads);
+            exit(1);
+        }
+        free_token_buffer(chunked);
+    }
+    if (!token_buffer_equal(tokens, expected)) {
+        fprintf(stderr, "Error: Parallel lexer output differs from the sequential lexer\n");
+        exit(1);
     }
+    free_token_buffer(expected);
+    free(lexer);
+#endif
 
-    parser_t* parser = init_parser(lexer);
+    parser_t* parser = init_parser_tokens(tokens);
     if (!parser) {
         fprintf(stderr, "Error: Failed to initialize parser\n");
-        free(lexer);
-        return;
+        free_token_buffer(tokens);
+        return NULL;
     }
 
     ast_t* root = parse(parser);
+    free_parser(parser);
+    free_token_buffer(tokens);
+    return root;
+}
+
+void skull_compile(char* src, skull_options_t* options) {
+    if (!src) {
+        fprintf(stderr, "Error: Source code is NULL\n");
+        return;
+    }
+
+    ast_t* root = skull_parse(src);
     if (!root) {
         fprintf(stderr, "Error: Parsing failed, invalid syntax\n");
-        free(parser);
-        free(lexer);
         return;
     }
 
+    skull_compile_ast(root, NULL, options);
+}
+
+// Assembles s into obj_filename with nasm. nasm reads the source from a
+// memfd, it is only written to asm_filename when keep is set or there are
+// no memfds
+static bool skull_assemble(const char* s, const char* asm_filename, const char* obj_filename, bool keep) {
+    char memfd_path[32];
+    int fd = keep ? -1 : skull_memfd("skull.asm", memfd_path, sizeof(memfd_path));
+    const char* input = asm_filename;
+    if (fd >= 0) {
+        if (!skull_write_all(fd, s, strlen(s))) {
+            fprintf(stderr, "Error: Failed to write assembly to memory (%s)\n", skull_strerror(errno));
+            close(fd);
+            return false;
+        }
+        input = memfd_path;
+    } else {
+        write_file(asm_filename, (char*) s);
+        if (access(asm_filename, F_OK) != 0) {
+            fprintf(stderr, "Error: Failed to write assembly file %s (%s)\n", asm_filename, skull_strerror(errno));
+            return false;
+        }
+    }
+
+    char* argv[] = {"nasm", "-felf64", "-g", "-F", "dwarf", (char*) input, "-o", (char*) obj_filename, NULL};
+    bool ok = skull_run(argv);
+    if (!ok) fprintf(stderr, "Error: Failed to assemble %s\n", asm_filename);
+
+    if (fd >= 0) {
+        close(fd);
+    } else if (!keep && remove(asm_filename) != 0) {
+        fprintf(stderr, "Warning: Failed to remove %s (%s)\n", asm_filename, skull_strerror(errno));
+    }
+    return ok;
+}
+
+// Links the program object with the objects of every module it imports.
+// With a version script it links a shared library exporting what the
+// script lists, calls between its own functions stay direct.
+static bool skull_link(const char* obj_filename, list_t* objects, const char* executable_name,
+                       const char* version_script) {
+    char** argv = calloc(objects->size + 12, sizeof(char*));
+    if (!argv) {
+        fprintf(stderr, "Memory allocation failed for ld arguments\n");
+        return false;
+    }
+    size_t argc = 0;
+    argv[argc++] = "ld";
+    if (version_script) {
+        argv[argc++] = "-shared";
+        argv[argc++] = "-Bsymbolic";
+        argv[argc++] = "-z";
+        argv[argc++] = "noexecstack";
+        argv[argc++] = "--version-script";
+        argv[argc++] = (char*) version_script;
+    } else {
+        argv[argc++] = "-e";
+        argv[argc++] = "_start";
+    }
+    argv[argc++] = "--eh-frame-hdr";
+    argv[argc++] = (char*) obj_filename;
+    for (size_t i = 0; i < objects->size; i++) {
+        argv[argc++] = (char*) objects->items[i];
+    }
+    argv[argc++] = "-o";
+    argv[argc++] = (char*) executable_name;
+
+    bool ok = skull_run(argv);
+    if (!ok) fprintf(stderr, "Error: Failed to link %s\n", executable_name);
+    free(argv);
+    return ok;
+}
+
+// Version script exporting the functions of iface a C caller can use along
+// with the array helpers, everything else stays local to the library
+static char* skull_export_script(module_interface_t* iface) {
+    size_t size = 128;
+    for (size_t i = 0; i < iface->symbols->size; i++) {
+        size += strlen(((module_symbol_t*) iface->symbols->items[i])->name) + 8;
+    }
+    char* s = calloc(size, sizeof(char));
+    if (!s) {
+        fprintf(stderr, "Memory allocation failed for version script\n");
+        exit(1);
+    }
+
+    size_t len = sprintf(s, "{\n  global:\n    skull_array;\n    skull_free;\n");
+    for (size_t i = 0; i < iface->symbols->size; i++) {
+        module_symbol_t* symbol = (module_symbol_t*) iface->symbols->items[i];
+        if (module_symbol_has_c_type(symbol)) len += sprintf(s + len, "    %s;\n", symbol->name);
+    }
+    sprintf(s + len, "  local: *;\n};\n");
+    return s;
+}
+
+// Writes the library's header next to it, <base>.h guarded by the upper
+// cased base name
+static void skull_write_header(const char* base_name, module_interface_t* iface, list_t* records) {
+    char header_filename[PATH_MAX_SIZE];
+    char guard[PATH_MAX_SIZE];
+    if (snprintf(header_filename, PATH_MAX_SIZE, "%s.h", base_name) >= PATH_MAX_SIZE) {
+        fprintf(stderr, "Error: Output filename too long\n");
+        exit(1);
+    }
+
+    const char* name = strrchr(base_name, '/');
+    name = name ? name + 1 : base_name;
+    size_t len = 0;
+    if (isdigit((unsigned char) *name)) guard[len++] = '_';
+    for (; *name && len + 3 < PATH_MAX_SIZE; name++) {
+        guard[len++] = isalnum((unsigned char) *name) ? toupper((unsigned char) *name) : '_';
+    }
+    strcpy(guard + len, "_H");
+
+    module_write_c_header(header_filename, guard, iface, records);
+}
+
+static bool skull_list_contains(list_t* list, const char* str) {
+    for (size_t i = 0; i < list->size; i++) {
+        if (strcmp((char*) list->items[i], str) == 0) return true;
+    }
+    return false;
+}
+
+typedef struct {
+    skull_options_t* options;
+    list_t* visiting;   // Sources of the modules being built, to catch import cycles
+    list_t* objects;    // Objects of every module built or found up to date so far
+    skull_profile_t* profile;   // Loaded --profile-use, modules are built with it too
+} skull_build_t;
+
+static module_interface_t* skull_build_module(skull_build_t* build, const char* name, const char* from);
+
+// Brings every module imported by root up to date and makes their symbols
+// visible to ctx. deps, when given, receives the interface file of each.
+static void skull_import_modules(skull_build_t* build, asm_ctx_t* ctx, ast_t* root, const char* filename, list_t* deps) {
+    for (size_t i = 0; i < root->children->size; i++) {
+        ast_t* child = (ast_t*) root->children->items[i];
+        if (child->type != AST_IMPORT) continue;
+
+        module_interface_t* iface = skull_build_module(build, child->name, filename);
+        asm_import(ctx, iface);
+        free_module_interface(iface);
+
+        if (deps) {
+            char source[PATH_MAX_SIZE];
+            char ki_filename[PATH_MAX_SIZE];
+            module_find_source(child->name, filename, build->options->include_dirs, source, PATH_MAX_SIZE);
+            module_path(source, ".ki", ki_filename, PATH_MAX_SIZE);
+            list_push(deps, strdup(ki_filename));
+        }
+    }
+}
+
+// Moves the top level of source, after that of every module it imports, to
+// the end of program. Each source is merged once however many import it.
+// root is the input, already parsed and on the visiting list, NULL for
+// modules and further sources.
+static void skull_merge_source(skull_build_t* build, asm_ctx_t* ctx, list_t* program, list_t* merged,
+                               const char* source, ast_t* root) {
+    // The same file may be named in different ways
+    char path[PATH_MAX_SIZE];
+    if (!realpath(source, path)) snprintf(path, sizeof(path), "%s", source);
+
+    bool input = root != NULL;
+    if (skull_list_contains(merged, path)) {
+        free_ast(root);
+        return;
+    }
+    if (!input && skull_list_contains(build->visiting, path)) {
+        fprintf(stderr, "Error: Import cycle through %s\n", source);
+        exit(1);
+    }
+    list_push(build->visiting, strdup(path));
+
+    if (!root) {
+        char* src = read_file(source);
+        if (!src) {
+            fprintf(stderr, "Error: Failed to read file %s (%s)\n", source, skull_strerror(errno));
+            exit(1);
+        }
+        root = skull_parse(src);
+        free(src);
+        if (!root) {
+            fprintf(stderr, "Error: Parsing failed, invalid syntax in %s\n", source);
+            exit(1);
+        }
+    }
+
+    for (size_t i = 0; i < root->children->size; i++) {
+        ast_t* child = (ast_t*) root->children->items[i];
+        if (child->type != AST_IMPORT) continue;
+
+        char module[PATH_MAX_SIZE];
+        if (!module_find_source(child->name, source, build->options->include_dirs, module, PATH_MAX_SIZE)) {
+            fprintf(stderr, "Error: Module '%s' imported from %s not found\n", child->name, source);
+            exit(1);
+        }
+        skull_merge_source(build, ctx, program, merged, module, NULL);
+    }
+
+    for (size_t i = 0; i < root->children->size; i++) {
+        ast_t* child = (ast_t*) root->children->items[i];
+        if (child->type == AST_IMPORT) {
+            free_ast(child);
+            continue;
+        }
+        if (child->type == AST_ASSIGNMENT && child->value && child->value->type == AST_FUNCTION) {
+            for (size_t j = 0; j < program->size; j++) {
+                ast_t* other = (ast_t*) program->items[j];
+                if (other->type == AST_ASSIGNMENT && other->value && other->value->type == AST_FUNCTION &&
+                    strcmp(other->name, child->name) == 0) {
+                    fprintf(stderr, "ERROR: Function '%s' of %s is defined by another module as well\n",
+                            child->name, source);
+                    exit(1);
+                }
+            }
+            if (!input) asm_add_origin(ctx, child->value, source);
+        }
+        list_push(program, child);
+    }
+    root->children->size = 0;
+    free_ast(root);
+
+    free(build->visiting->items[--build->visiting->size]);
+    list_push(merged, strdup(path));
+}
+
+// Whole program builds compile root together with the modules it imports
+// and the further sources given, instead of an object per module. The
+// input's own functions keep their lines in the input, merged ones record
+// their source.
+static void skull_merge_program(skull_build_t* build, asm_ctx_t* ctx, ast_t* root, const char* filename) {
+    list_t* program = init_list(sizeof(ast_t*));
+    list_t* merged = init_list(sizeof(char*));
+    for (size_t i = 0; i < build->options->sources->size; i++) {
+        skull_merge_source(build, ctx, program, merged, (char*) build->options->sources->items[i], NULL);
+    }
+
+    // The input goes last, after everything it can call
+    ast_t* input = init_ast(AST_COMPOUND);
+    for (size_t i = 0; i < root->children->size; i++) list_push(input->children, root->children->items[i]);
+    root->children->size = 0;
+    skull_merge_source(build, ctx, program, merged, filename ? filename : "main.k", input);
+
+    free_list(root->children);
+    root->children = program;
+    for (size_t i = 0; i < merged->size; i++) free(merged->items[i]);
+    free_list(merged);
+}
+
+// Code generation options a module object depends on, recorded in its
+// dependency file so that building with other ones recompiles it
+static void skull_module_options(skull_build_t* build, char* out, size_t size) {
+    skull_options_t* options = build->options;
+    snprintf(out, size, "isa=%s fma=%d profile=%s", options->isa == ASM_ISA_AVX2 ? "avx2" : "sse2",
+             options->fma ? 1 : 0, options->profile_use ? options->profile_use : "-");
+}
+
+// Compiles <name>.k to <name>.o and <name>.ki unless its dependency file shows
+// both are newer than the source, the interfaces of its imports and the
+// profile, and that they were built with the current options. The
+// interface is only rewritten when it changes, so editing the body of a
+// function rebuilds that module alone and not the modules importing it.
+static module_interface_t* skull_build_module(skull_build_t* build, const char* name, const char* from) {
+    char source[PATH_MAX_SIZE];
+    char obj_filename[PATH_MAX_SIZE];
+    char ki_filename[PATH_MAX_SIZE];
+    char deps_filename[PATH_MAX_SIZE];
+    char asm_filename[PATH_MAX_SIZE];
+
+    if (!module_find_source(name, from ? from : "main.k", build->options->include_dirs, source, PATH_MAX_SIZE)) {
+        fprintf(stderr, "Error: Module '%s' imported from %s not found\n", name, from ? from : "<source>");
+        exit(1);
+    }
+    if (skull_list_contains(build->visiting, source)) {
+        fprintf(stderr, "Error: Import cycle through module '%s' (%s)\n", name, source);
+        exit(1);
+    }
+    if (!module_path(source, ".o", obj_filename, PATH_MAX_SIZE) ||
+        !module_path(source, ".ki", ki_filename, PATH_MAX_SIZE) ||
+        !module_path(source, ".d", deps_filename, PATH_MAX_SIZE) ||
+        !module_path(source, ".asm", asm_filename, PATH_MAX_SIZE)) {
+        fprintf(stderr, "Error: Module path too long: %s\n", source);
+        exit(1);
+    }
+
+    // Already handled through another import
+    module_interface_t* iface = module_interface_read(ki_filename);
+    if (iface && skull_list_contains(build->objects, obj_filename)) {
+        return iface;
+    }
+
+    list_push(build->visiting, strdup(source));
+
+    char options[PATH_MAX_SIZE];
+    char built_options[PATH_MAX_SIZE];
+    skull_module_options(build, options, PATH_MAX_SIZE);
+    list_t* deps = module_read_deps(deps_filename, built_options, PATH_MAX_SIZE);
+    if (iface && deps && strcmp(options, built_options) == 0) {
+        // The imports have to be current before their interfaces can be compared
+        for (size_t i = 0; i < iface->imports->size; i++) {
+            free_module_interface(skull_build_module(build, (char*) iface->imports->items[i], source));
+        }
+
+        if (module_is_fresh(obj_filename, deps)) {
+            for (size_t i = 0; i < deps->size; i++) free(deps->items[i]);
+            free_list(deps);
+            free(build->visiting->items[--build->visiting->size]);
+            list_push(build->objects, strdup(obj_filename));
+            return iface;
+        }
+    }
+    if (deps) {
+        for (size_t i = 0; i < deps->size; i++) free(deps->items[i]);
+        free_list(deps);
+    }
+    free_module_interface(iface);
+
+    printf("Compiling module: %s\n", source);
+    char* src = read_file(source);
+    if (!src) {
+        fprintf(stderr, "Error: Failed to read file %s (%s)\n", source, skull_strerror(errno));
+        exit(1);
+    }
+    ast_t* root = skull_parse(src);
+    if (!root) {
+        fprintf(stderr, "Error: Parsing failed, invalid syntax in %s\n", source);
+        exit(1);
+    }
+
+    asm_ctx_t* ctx = init_asm_ctx();
+    ctx->source_name = source;
+    ctx->isa = build->options->isa;
+    ctx->fma = build->options->fma;
+    ctx->profile = build->profile;
+    deps = init_list(sizeof(char*));
+    if (build->options->profile_use) list_push(deps, strdup(build->options->profile_use));
+    skull_import_modules(build, ctx, root, source, deps);
+
+    char* s = asm_f_root(ctx, root);
+    if (!skull_assemble(s, asm_filename, obj_filename, build->options->keep_files)) exit(1);
+
+    iface = module_interface_from_ast(root);
+    module_interface_write(ki_filename, iface);
+    module_write_deps(deps_filename, obj_filename, source, deps, options);
+
+    for (size_t i = 0; i < deps->size; i++) free(deps->items[i]);
+    free_list(deps);
+    free(s);
+    free_asm_ctx(ctx);
+    free_ast(root);
+    free(src);
+
+    free(build->visiting->items[--build->visiting->size]);
+    list_push(build->objects, strdup(obj_filename));
+    return iface;
+}
+
+// filename is the source root was parsed from, imports are looked up next to
+// it. It may be NULL when the source did not come from a file.
+void skull_compile_ast(ast_t* root, const char* filename, skull_options_t* options) {
+    const char* output_filename = options->output_filename;
     const char* default_name = "main";
     char base_name[PATH_MAX_SIZE] = {0};
     char extension[PATH_MAX_SIZE] = {0};
     char executable_name[PATH_MAX_SIZE] = {0};
     char asm_filename[PATH_MAX_SIZE] = {0};
     char obj_filename[PATH_MAX_SIZE] = {0};
+    char ki_filename[PATH_MAX_SIZE] = {0};
+    char profile_filename[PATH_MAX_SIZE] = {0};
+    char script_filename[PATH_MAX_SIZE] = {0};
+    char obj_memfd[32] = {0};
+    int obj_fd = -1;
 
     if (output_filename) {
         extract_base_name_and_extension(output_filename, base_name, PATH_MAX_SIZE, extension, PATH_MAX_SIZE);
@@ -204,104 +590,158 @@ void skull_compile(char* src, const char* output_filename, bool keep_files) {
     }
 
     // Use unique names for intermediate files
-    if (snprintf(asm_filename, PATH_MAX_SIZE, "%s.asm", base_name) >= PATH_MAX_SIZE) {
-        fprintf(stderr, "Error: Assembly filename too long\n");
-        free(root);
-        free(parser);
-        free(lexer);
+    if (snprintf(asm_filename, PATH_MAX_SIZE, "%s.asm", base_name) >= PATH_MAX_SIZE ||
+        snprintf(obj_filename, PATH_MAX_SIZE, "%s.o", base_name) >= PATH_MAX_SIZE ||
+        snprintf(ki_filename, PATH_MAX_SIZE, "%s.ki", base_name) >= PATH_MAX_SIZE ||
+        snprintf(profile_filename, PATH_MAX_SIZE, "%s.kprof", executable_name) >= PATH_MAX_SIZE ||
+        snprintf(script_filename, PATH_MAX_SIZE, "%s.ver", base_name) >= PATH_MAX_SIZE) {
+        fprintf(stderr, "Error: Output filename too long\n");
+        free_ast(root);
         return;
     }
-    if (snprintf(obj_filename, PATH_MAX_SIZE, "%s.o", base_name) >= PATH_MAX_SIZE) {
-        fprintf(stderr, "Error: Object filename too long\n");
-        free(root);
-        free(parser);
-        free(lexer);
-        return;
+
+    skull_build_t build = {0};
+    build.options = options;
+    build.visiting = init_list(sizeof(char*));
+    build.objects = init_list(sizeof(char*));
+    if (filename) list_push(build.visiting, strdup(filename));
+
+    asm_ctx_t* ctx = init_asm_ctx();
+    // A module compiled on its own has no entry point, neither does a library
+    ctx->entry = !options->compile_only && !options->shared;
+    ctx->shared = options->shared;
+    ctx->instrument = options->instrument;
+    ctx->isa = options->isa;
+    ctx->fma = options->fma;
+    ctx->source_name = filename;
+    ctx->profile_path = strdup(profile_filename);
+
+    skull_profile_t* profile = NULL;
+    if (options->profile_use) {
+        profile = profile_load(options->profile_use);
+        if (!profile) {
+            fprintf(stderr, "Error: %s is not a profile written by an --instrument build\n", options->profile_use);
+            exit(1);
+        }
+        ctx->profile = profile;
+        build.profile = profile;
+    }
+
+    // Module objects are built for executables, their code and data are not
+    // position independent
+    if (options->shared) {
+        for (size_t i = 0; i < root->children->size; i++) {
+            if (((ast_t*) root->children->items[i])->type == AST_IMPORT) {
+                fprintf(stderr, "ERROR: Shared libraries cannot import modules, '%s' is imported\n",
+                        ((ast_t*) root->children->items[i])->name);
+                exit(1);
+            }
+        }
+    }
+    if (options->whole_program) {
+        skull_merge_program(&build, ctx, root, filename);
+        ipo_stats_t stats = ipo_optimize(root);
+        printf("Whole program: %zu parameters propagated, %zu operators folded, %zu functions removed\n",
+               stats.propagated, stats.folded, stats.removed);
+        ctx->inline_small = true;
+    } else {
+        skull_import_modules(&build, ctx, root, filename, NULL);
     }
 
-    char* s = asm_f_root(root);
+    char* s = asm_f_root(ctx, root);
     if (!s) {
         fprintf(stderr, "Error: Failed to generate assembly code\n");
-        free(root);
-        free(parser);
-        free(lexer);
-        return;
+        goto cleanup;
     }
 
-    write_file(asm_filename, s);
-    if (access(asm_filename, F_OK) != 0) {
-        fprintf(stderr, "Error: Failed to write assembly file %s (%s)\n", asm_filename, skull_strerror(errno));
-        free(s);
-        free(root);
-        free(parser);
-        free(lexer);
-        return;
+    // A program's object only has to live until ld read it, so it stays in
+    // memory unless it is asked for
+    if (!options->compile_only && !options->keep_files) {
+        obj_fd = skull_memfd("skull.o", obj_memfd, sizeof(obj_memfd));
     }
+    const char* obj_path = obj_fd >= 0 ? obj_memfd : obj_filename;
 
-    // Assemble the .asm file to an object file using nasm
-    char nasm_cmd[PATH_MAX_SIZE * 2];
-    if (snprintf(nasm_cmd, sizeof(nasm_cmd), "-felf64 %s -o %s", asm_filename, obj_filename) >= sizeof(nasm_cmd)) {
-        fprintf(stderr, "Error: NASM command too long\n");
-        free(s);
-        free(root);
-        free(parser);
-        free(lexer);
-        return;
+    if (!skull_assemble(s, asm_filename, obj_path, options->keep_files)) goto cleanup;
+
+    if (options->compile_only) {
+        module_interface_t* iface = module_interface_from_ast(root);
+        module_interface_write(ki_filename, iface);
+        free_module_interface(iface);
+        goto cleanup;
     }
 
-    char* nasm_output = sh("nasm", nasm_cmd);
-    if (!nasm_output || strlen(nasm_output) > 0) {
-        fprintf(stderr, "Error: Failed to assemble %s: %s\n", asm_filename, nasm_output ? nasm_output : "unknown error");
-        free(nasm_output);
-        free(s);
-        free(root);
-        free(parser);
-        free(lexer);
-        return;
+    if (options->shared) {
+        module_interface_t* iface = module_interface_from_ast(root);
+        char* script = skull_export_script(iface);
+        char script_memfd[32];
+        int script_fd = skull_memfd("skull.ver", script_memfd, sizeof(script_memfd));
+        const char* script_path = script_memfd;
+        bool written;
+        if (script_fd >= 0) {
+            written = skull_write_all(script_fd, script, strlen(script));
+        } else {
+            write_file(script_filename, script);
+            written = access(script_filename, F_OK) == 0;
+            script_path = script_filename;
+        }
+        free(script);
+
+        bool linked = written && skull_link(obj_path, build.objects, executable_name, script_path);
+        if (!written) fprintf(stderr, "Error: Failed to write the version script (%s)\n", skull_strerror(errno));
+        if (script_fd >= 0) close(script_fd);
+        else if (!options->keep_files) remove(script_filename);
+        if (linked) skull_write_header(base_name, iface, ctx->records);
+        free_module_interface(iface);
+        if (!linked) goto cleanup;
+    } else if (!skull_link(obj_path, build.objects, executable_name, NULL)) {
+        goto cleanup;
     }
-    free(nasm_output);
 
-    // Link the object file to create the executable using ld
-    char ld_cmd[PATH_MAX_SIZE * 2];
-    if (snprintf(ld_cmd, sizeof(ld_cmd), "-e _start %s -o %s", obj_filename, executable_name) >= sizeof(ld_cmd)) {
-        fprintf(stderr, "Error: LD command too long\n");
-        free(s);
-        free(root);
-        free(parser);
-        free(lexer);
-        return;
+    if (!options->keep_files && obj_fd < 0 && remove(obj_filename) != 0) {
+        fprintf(stderr, "Warning: Failed to remove %s (%s)\n", obj_filename, skull_strerror(errno));
     }
 
-    char* ld_output = sh("ld", ld_cmd);
-    if (!ld_output || strlen(ld_output) > 0) {
-        fprintf(stderr, "Error: Failed to link %s: %s\n", obj_filename, ld_output ? ld_output : "unknown error");
-        free(ld_output);
-        free(s);
-        free(root);
-        free(parser);
-        free(lexer);
-        return;
+cleanup:
+    if (obj_fd >= 0) close(obj_fd);
+    for (size_t i = 0; i < build.objects->size; i++) free(build.objects->items[i]);
+    free_list(build.objects);
+    for (size_t i = 0; i < build.visiting->size; i++) free(build.visiting->items[i]);
+    free_list(build.visiting);
+    free(s);
+    free_asm_ctx(ctx);
+    free_profile(profile);
+    free_ast(root);
+}
+
+// Loads the tree from the AST cache when it was written for this exact source,
+// otherwise parses and refreshes the cache
+static ast_t* skull_parse_cached(char* src, const char* filename) {
+    char cache_filename[PATH_MAX_SIZE];
+    if (snprintf(cache_filename, PATH_MAX_SIZE, "%sast", filename) >= PATH_MAX_SIZE) {
+        return skull_parse(src);
     }
-    free(ld_output);
 
-    if (!keep_files) {
-        if (remove(asm_filename) != 0) {
-            fprintf(stderr, "Warning: Failed to remove %s (%s)\n", asm_filename, skull_strerror(errno));
-        }
-        
-        if (remove(obj_filename) != 0) {
-            fprintf(stderr, "Warning: Failed to remove %s (%s)\n", obj_filename, skull_strerror(errno));
-        }
+    uint64_t hash = ast_file_hash(src, strlen(src));
+    ast_pool_t* pool = ast_file_load(cache_filename, hash);
+    if (pool) {
+        ast_t* root = ast_pool_to_ast(pool, pool->root);
+        free_ast_pool(pool);
+        return root;
     }
 
-    free(s);
-    free(root);
-    free(parser);
-    free(lexer);
+    ast_t* root = skull_parse(src);
+    if (root) {
+        pool = ast_pool_from_ast(root);
+        if (!ast_file_write(cache_filename, pool, hash)) {
+            fprintf(stderr, "Warning: Failed to update AST cache %s\n", cache_filename);
+        }
+        free_ast_pool(pool);
+    }
+    return root;
 }
 
 // Fix 7: Enhanced skull_compile_file with better error handling
-void skull_compile_file(const char* filename, const char* output_filename, bool keep_files) {
+void skull_compile_file(const char* filename, skull_options_t* options) {
     if (!filename) {
         fprintf(stderr, "Error: Input filename is NULL\n");
         return;
@@ -312,14 +752,330 @@ void skull_compile_file(const char* filename, const char* output_filename, bool
         fprintf(stderr, "Error: Failed to read file %s (%s)\n", filename, skull_strerror(errno));
         return;
     }
+
+    if (options->emit_ast) {
+        ast_t* root = skull_parse(src);
+        if (root) {
+            ast_pool_t* pool = ast_pool_from_ast(root);
+            ast_file_write(options->emit_ast, pool, ast_file_hash(src, strlen(src)));
+            free_ast_pool(pool);
+            free_ast(root);
+        }
+        free(src);
+        return;
+    }
     
     // Add additional information for debugging
     printf("Compiling file: %s\n", filename);
-    if (output_filename) {
-        printf("Output executable: %s\n", output_filename);
+    if (options->output_filename) {
+        printf("Output executable: %s\n", options->output_filename);
     }
     
-    skull_compile(src, output_filename, keep_files);
+    ast_t* root = options->ast_cache ? skull_parse_cached(src, filename) : skull_parse(src);
+    if (!root) {
+        fprintf(stderr, "Error: Parsing failed, invalid syntax\n");
+        free(src);
+        return;
+    }
+
+    skull_compile_ast(root, filename, options);
+    free(src);
+}
+
+static double skull_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The walks visit what codegen reads: type, name, value and children
+static long bench_walk_ast(ast_t* ast, size_t* nodes, size_t* bytes) {
+    if (!ast) return 0;
+
+    long sum = ast->type + ast->int_value + ast->data_type + (ast->name ? ast->name[0] : 0);
+    (*nodes)++;
+    *bytes += sizeof(ast_t) + (ast->name ? strlen(ast->name) + 1 : 0);
+
+    sum += bench_walk_ast(ast->value, nodes, bytes);
+    if (ast->children) {
+        *bytes += sizeof(list_t) + ast->children->size * sizeof(void*);
+        for (size_t i = 0; i < ast->children->size; i++) {
+            sum += bench_walk_ast((ast_t*) ast->children->items[i], nodes, bytes);
+        }
+    }
+    return sum;
+}
+
+static long bench_walk_pool(ast_pool_t* pool, ast_ref_t ref) {
+    if (ref == AST_NONE) return 0;
+
+    ast_node_t* node = AST_NODE(pool, ref);
+    long sum = node->type + node->int_value + node->data_type + intern_str(&pool->names, node->name)[0];
+
+    sum += bench_walk_pool(pool, node->value);
+    for (uint32_t i = 0; i < node->child_count; i++) {
+        sum += bench_walk_pool(pool, AST_CHILD(pool, node, i));
+    }
+    return sum;
+}
+
+// Compares walking the parser's pointer tree against the pooled layout
+void skull_bench_ast(const char* filename, int iterations) {
+    char* src = read_file(filename);
+    if (!src) {
+        fprintf(stderr, "Error: Failed to read file %s (%s)\n", filename, skull_strerror(errno));
+        return;
+    }
+    if (iterations <= 0) iterations = 100;
+
+    ast_t* root = skull_parse(src);
+    ast_pool_t* pool = ast_pool_from_ast(root);
+
+    size_t nodes = 0, tree_bytes = 0;
+    long expected = bench_walk_ast(root, &nodes, &tree_bytes);
+    size_t pool_bytes = (pool->size - 1) * sizeof(ast_node_t) + pool->children_size * sizeof(ast_ref_t) +
+                        pool->spans_size * sizeof(ast_span_t) + pool->names.size + pool->names.count * sizeof(uint32_t);
+
+    long sum = 0;
+    double start = skull_now();
+    for (int i = 0; i < iterations; i++) {
+        size_t n = 0, b = 0;
+        sum += bench_walk_ast(root, &n, &b);
+    }
+    double tree_time = skull_now() - start;
+
+    start = skull_now();
+    for (int i = 0; i < iterations; i++) {
+        sum -= bench_walk_pool(pool, pool->root);
+    }
+    double pool_time = skull_now() - start;
+
+    if (sum != 0 || expected != bench_walk_pool(pool, pool->root)) {
+        fprintf(stderr, "Error: Pooled AST does not match the parsed tree\n");
+    }
+
+    printf("AST nodes:     %zu\n", nodes);
+    printf("Pointer tree:  %.2f ns/node, %.1f bytes/node\n",
+           tree_time * 1e9 / ((double) nodes * iterations), (double) tree_bytes / nodes);
+    printf("Pooled tree:   %.2f ns/node, %.1f bytes/node\n",
+           pool_time * 1e9 / ((double) nodes * iterations), (double) pool_bytes / nodes);
+
+    free_ast_pool(pool);
+    free_ast(root);
+    free(src);
+}
+
+// Times lexing, parsing and code generation of filename, each the best of
+// iterations runs, and prints the milliseconds as one JSON object. The lexer
+// runs sequentially so the numbers do not depend on the CPU count, and
+// imports are not built, the file has to stand on its own
+void skull_bench_phases(const char* filename, int iterations) {
+    char* src = read_file(filename);
+    if (!src) {
+        fprintf(stderr, "Error: Failed to read file %s (%s)\n", filename, skull_strerror(errno));
+        exit(1);
+    }
+    if (iterations <= 0) iterations = 10;
+
+    double best[3] = {1e30, 1e30, 1e30};
+    for (int i = 0; i < iterations; i++) {
+        double start = skull_now();
+        lexer_t* lexer = init_lexer(src);
+        token_buffer_t* tokens = lexer_tokenize(lexer);
+        double lexed = skull_now();
+
+        parser_t* parser = init_parser_tokens(tokens);
+        if (!parser) {
+            fprintf(stderr, "Error: Failed to initialize parser\n");
+            exit(1);
+        }
+        ast_t* root = parse(parser);
+        double parsed = skull_now();
+
+        for (size_t j = 0; root->children && j < root->children->size; j++) {
+            if (((ast_t*) root->children->items[j])->type == AST_IMPORT) {
+                fprintf(stderr, "Error: %s imports modules, --bench-phases needs a file that stands on its own\n", filename);
+                exit(1);
+            }
+        }
+
+        asm_ctx_t* ctx = init_asm_ctx();
+        ctx->entry = true;
+        ctx->source_name = filename;
+        char* s = asm_f_root(ctx, root);
+        double generated = skull_now();
+        if (!s) {
+            fprintf(stderr, "Error: Failed to generate assembly code\n");
+            exit(1);
+        }
+
+        if (lexed - start < best[0]) best[0] = lexed - start;
+        if (parsed - lexed < best[1]) best[1] = parsed - lexed;
+        if (generated - parsed < best[2]) best[2] = generated - parsed;
+
+        free(s);
+        free_asm_ctx(ctx);
+        free_ast(root);
+        free_parser(parser);
+        free_token_buffer(tokens);
+        free(lexer);
+    }
+
+    printf("{\"lex\": %.4f, \"parse\": %.4f, \"codegen\": %.4f}\n",
+           best[0] * 1e3, best[1] * 1e3, best[2] * 1e3);
+    free(src);
+}
+
+// Same shape, values and source spans
+static bool check_ast_equal(ast_t* a, ast_t* b) {
+    if (!a || !b) return a == b;
+    if (a->type != b->type || a->int_value != b->int_value || a->data_type != b->data_type ||
+        a->src_start != b->src_start || a->src_end != b->src_end || a->line != b->line || a->column != b->column) {
+        return false;
+    }
+    if ((a->name || b->name) && (!a->name || !b->name || strcmp(a->name, b->name) != 0)) return false;
+    if (!check_ast_equal(a->value, b->value)) return false;
+
+    size_t size = a->children ? a->children->size : 0;
+    if (size != (b->children ? b->children->size : 0)) return false;
+    for (size_t i = 0; i < size; i++) {
+        if (!check_ast_equal((ast_t*) a->children->items[i], (ast_t*) b->children->items[i])) return false;
+    }
+    return true;
+}
+
+static bool check_ident_char(char c) {
+    return isalnum((unsigned char) c) || c == '_' || c == '.';
+}
+
+// Picks a random edit that keeps the source valid: whitespace inserted or
+// taken out of a run, an integer literal replaced, or a whole top level
+// function added in front of a statement or one added earlier removed again.
+// Writes the replacement text to text and returns the edit in old offsets.
+static source_edit_t check_random_edit(const char* src, size_t size, ast_t* root, char* text, size_t* text_size) {
+    size_t statements = root->children->size;
+    while (1) {
+        unsigned int pos = (unsigned int) (rand() % (size + 1));
+        switch (rand() % 5) {
+            case 0: // Whitespace, newlines only outside strings and line comments
+            case 1: {
+                if (pos < size && !isspace((unsigned char) src[pos])) continue;
+                bool newline = rand() % 2;
+                if (newline) {
+                    size_t i = pos;
+                    while (i > 0 && src[i - 1] != '\n') i--;
+                    bool string = false, comment = false;
+                    for (; i < pos && !comment; i++) {
+                        if (src[i] == '\\' && string) i++;
+                        else if (src[i] == '"') string = !string;
+                        else if (!string && src[i] == '/' && i + 1 < pos && src[i + 1] == '/') comment = true;
+                    }
+                    if (string || comment) continue;
+                }
+                text[0] = newline ? '\n' : ' ';
+                *text_size = 1;
+                return (source_edit_t) { pos, pos, pos + 1 };
+            }
+            case 2: { // One character out of a run of equal whitespace
+                if (pos + 1 >= size || !isspace((unsigned char) src[pos]) || src[pos + 1] != src[pos]) continue;
+                *text_size = 0;
+                return (source_edit_t) { pos, pos + 1, pos };
+            }
+            case 3: { // Integer literal
+                if (pos >= size || !isdigit((unsigned char) src[pos]) || (pos > 0 && check_ident_char(src[pos - 1]))) continue;
+                unsigned int end = pos;
+                while (end < size && isdigit((unsigned char) src[end])) end++;
+                if (end < size && check_ident_char(src[end])) continue;
+                *text_size = (size_t) sprintf(text, "%d", rand() % 1000);
+                return (source_edit_t) { pos, end, pos + (unsigned int) *text_size };
+            }
+            default: { // Top level function
+                if (statements == 0) continue;
+                // The spans in the nodes may still wait for incremental_settle
+                size_t index = rand() % statements;
+                ast_t* statement = (ast_t*) root->children->items[index];
+                unsigned int start = incremental_start(root, index);
+                if (statement->name && strncmp(statement->name, "zz", 2) == 0) {
+                    unsigned int end = incremental_end(root, index);
+                    if (end < size && src[end] == '\n') end++;
+                    *text_size = 0;
+                    return (source_edit_t) { start, end, start };
+                }
+                int id = rand() % 100000;
+                *text_size = (size_t) sprintf(text, "zz%d = (): int -> {\n    return(%d);\n}\n", id, id);
+                return (source_edit_t) { start, start, start + (unsigned int) *text_size };
+            }
+        }
+    }
+}
+
+static int check_compare_double(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// Applies random edits to filename and updates the tree with parse_incremental
+// after each. The tree is settled and compared with a full parse of the edited
+// source only every few edits and after the last one, so the pending moves of
+// several edits pile up in between. Prints the time parse_incremental took per edit.
+void skull_check_incremental(const char* filename, int edits) {
+    char* src = read_file(filename);
+    if (!src) {
+        fprintf(stderr, "Error: Failed to read file %s (%s)\n", filename, skull_strerror(errno));
+        exit(1);
+    }
+    size_t size = strlen(src);
+    ast_t* root = skull_parse(src);
+    if (!root || root->type != AST_COMPOUND) {
+        fprintf(stderr, "Error: %s does not parse to a list of statements\n", filename);
+        exit(1);
+    }
+
+    srand(1);
+    double* times = malloc(sizeof(double) * edits);
+    if (!times) {
+        fprintf(stderr, "Memory allocation failed for the edit timings\n");
+        exit(1);
+    }
+
+    char text[64];
+    for (int i = 0; i < edits; i++) {
+        size_t text_size;
+        source_edit_t edit = check_random_edit(src, size, root, text, &text_size);
+
+        size_t new_size = size - (edit.old_end - edit.start) + text_size;
+        char* edited = malloc(new_size + 1);
+        if (!edited) {
+            fprintf(stderr, "Memory allocation failed for the edited source\n");
+            exit(1);
+        }
+        memcpy(edited, src, edit.start);
+        memcpy(edited + edit.start, text, text_size);
+        memcpy(edited + edit.new_end, src + edit.old_end, size - edit.old_end + 1);
+        free(src);
+        src = edited;
+        size = new_size;
+
+        double start = skull_now();
+        root = parse_incremental(root, src, size, edit);
+        times[i] = skull_now() - start;
+
+        if (rand() % 8 != 0 && i + 1 < edits) continue;
+        incremental_settle(root);
+        ast_t* full = skull_parse(src);
+        if (!check_ast_equal(root, full)) {
+            fprintf(stderr, "Error: Edit %d at offset %u differs from a full parse\n", i + 1, edit.start);
+            exit(1);
+        }
+        free_ast(full);
+    }
+
+    qsort(times, edits, sizeof(double), check_compare_double);
+    printf("{\"edits\": %d, \"median\": %.4f, \"p99\": %.4f, \"max\": %.4f}\n", edits,
+           times[edits / 2] * 1e3, times[edits * 99 / 100] * 1e3, times[edits - 1] * 1e3);
+
+    free(times);
+    free_ast(root);
     free(src);
 }
 
@@ -0,0 +1,268 @@
+#ifndef SKULL_TOKBUF_H
+#define SKULL_TOKBUF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "token.h"
+#include "lexer.h"
+
+// Sources smaller than this per thread are not worth splitting
+#ifndef TOKBUF_MIN_CHUNK
+#define TOKBUF_MIN_CHUNK (256 * 1024)
+#endif
+
+// Line and column share one word, line in the high half
+#define TOKBUF_POS(line, column) (((uint64_t) (line) << 32) | (uint32_t) (column))
+#define TOKBUF_LINE(pos) ((unsigned int) ((pos) >> 32))
+#define TOKBUF_COLUMN(pos) ((unsigned int) ((pos) & 0xffffffffu))
+
+// Whole file lexed up front, one array per field so the parser
+// only pulls the types in while it decides what to do next
+typedef struct {
+    uint8_t* types;
+    uint32_t* offsets;
+    uint32_t* lengths;
+    uint64_t* positions;
+    size_t size;
+    size_t capacity;
+    size_t max_length;   // Longest token, sizes the parser's scratch buffer
+    char* src;
+} token_buffer_t;
+
+token_buffer_t* init_token_buffer(char* src, size_t capacity);
+void token_buffer_push(token_buffer_t* tokens, token_span_t* span);
+void token_buffer_span(token_buffer_t* tokens, size_t index, token_span_t* span);
+token_buffer_t* lexer_tokenize(lexer_t* lexer);
+token_buffer_t* lexer_tokenize_parallel(char* src, size_t src_size, unsigned int threads);
+bool token_buffer_equal(token_buffer_t* a, token_buffer_t* b);
+void free_token_buffer(token_buffer_t* tokens);
+
+#ifdef SKULL_TOKBUF_H_IMPLEMENTATION
+
+token_buffer_t* init_token_buffer(char* src, size_t capacity) {
+    token_buffer_t* tokens = calloc(1, sizeof(token_buffer_t));
+    if (!tokens) {
+        fprintf(stderr, "Memory allocation failed for token buffer\n");
+        exit(1);
+    }
+    if (capacity < 16) capacity = 16;
+
+    tokens->types = malloc(capacity * sizeof(uint8_t));
+    tokens->offsets = malloc(capacity * sizeof(uint32_t));
+    tokens->lengths = malloc(capacity * sizeof(uint32_t));
+    tokens->positions = malloc(capacity * sizeof(uint64_t));
+    if (!tokens->types || !tokens->offsets || !tokens->lengths || !tokens->positions) {
+        fprintf(stderr, "Memory allocation failed for token buffer\n");
+        exit(1);
+    }
+    tokens->capacity = capacity;
+    tokens->src = src;
+
+    return tokens;
+}
+
+void token_buffer_push(token_buffer_t* tokens, token_span_t* span) {
+    if (tokens->size == tokens->capacity) {
+        tokens->capacity *= 2;
+        tokens->types = realloc(tokens->types, tokens->capacity * sizeof(uint8_t));
+        tokens->offsets = realloc(tokens->offsets, tokens->capacity * sizeof(uint32_t));
+        tokens->lengths = realloc(tokens->lengths, tokens->capacity * sizeof(uint32_t));
+        tokens->positions = realloc(tokens->positions, tokens->capacity * sizeof(uint64_t));
+        if (!tokens->types || !tokens->offsets || !tokens->lengths || !tokens->positions) {
+            fprintf(stderr, "Memory reallocation failed in token_buffer_push\n");
+            exit(1);
+        }
+    }
+
+    size_t i = tokens->size++;
+    tokens->types[i] = (uint8_t) span->type;
+    tokens->offsets[i] = span->offset;
+    tokens->lengths[i] = span->length;
+    tokens->positions[i] = TOKBUF_POS(span->line, span->column);
+    tokens->max_length = MAX(tokens->max_length, span->length);
+}
+
+void token_buffer_span(token_buffer_t* tokens, size_t index, token_span_t* span) {
+    // Reading past the end keeps returning the trailing EOF
+    if (index >= tokens->size) index = tokens->size - 1;
+
+    span->type = tokens->types[index];
+    span->offset = tokens->offsets[index];
+    span->length = tokens->lengths[index];
+    span->line = TOKBUF_LINE(tokens->positions[index]);
+    span->column = TOKBUF_COLUMN(tokens->positions[index]);
+}
+
+// Lexes everything left in the lexer, the buffer always ends with TOKEN_EOF
+token_buffer_t* lexer_tokenize(lexer_t* lexer) {
+    // Tokens average a few bytes, guess the size to avoid most regrowth
+    token_buffer_t* tokens = init_token_buffer(lexer->src, (lexer->src_size - lexer->i) / 4);
+    token_span_t span;
+
+    do {
+        lexer_scan(lexer, &span);
+        token_buffer_push(tokens, &span);
+    } while (span.type != TOKEN_EOF);
+
+    return tokens;
+}
+
+typedef struct {
+    char* src;
+    size_t start;
+    size_t end;
+    unsigned int lines;   // Newlines inside the chunk
+    unsigned int line;    // Line the chunk starts on
+    token_buffer_t* tokens;
+} lex_chunk_t;
+
+static void* lex_chunk_count_lines(void* arg) {
+    lex_chunk_t* chunk = (lex_chunk_t*) arg;
+    const char* p = chunk->src + chunk->start;
+    const char* end = chunk->src + chunk->end;
+
+    chunk->lines = 0;
+    while (p < end && (p = memchr(p, '\n', end - p))) {
+        chunk->lines++;
+        p++;
+    }
+    return NULL;
+}
+
+static void* lex_chunk_tokenize(void* arg) {
+    lex_chunk_t* chunk = (lex_chunk_t*) arg;
+    lexer_t* lexer = init_lexer_at(chunk->src, chunk->end, chunk->start, chunk->line, 1);
+    chunk->tokens = lexer_tokenize(lexer);
+    free(lexer);
+    return NULL;
+}
+
+static void lex_chunks_run(lex_chunk_t* chunks, size_t count, void* (*fn)(void*)) {
+    pthread_t* workers = calloc(count, sizeof(pthread_t));
+    if (!workers) {
+        fprintf(stderr, "Memory allocation failed for lexer threads\n");
+        exit(1);
+    }
+
+    // The calling thread takes the first chunk itself
+    for (size_t i = 1; i < count; i++) {
+        if (pthread_create(&workers[i], NULL, fn, &chunks[i]) != 0) {
+            fprintf(stderr, "Failed to start lexer thread\n");
+            exit(1);
+        }
+    }
+    fn(&chunks[0]);
+    for (size_t i = 1; i < count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+}
+
+// Lexes a large source on several threads, with the same result as
+// lexer_tokenize on the whole file. Chunks are split right after a newline:
+// tokens never span lines and a `//` comment always ends at one, so the start
+// of a line is always a token boundary. Lines are counted per chunk first so
+// every chunk lexes with its real line numbers, which keeps lexer errors
+// pointing at the right place. Pass 0 threads to use every online CPU.
+token_buffer_t* lexer_tokenize_parallel(char* src, size_t src_size, unsigned int threads) {
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned int) cpus : 1;
+    }
+#ifdef SKULL_TRACE
+    // Trace counters are not shared between threads
+    threads = 1;
+#endif
+    threads = MIN(threads, MAX(src_size / TOKBUF_MIN_CHUNK, 1));
+
+    if (threads <= 1) {
+        lexer_t* lexer = init_lexer_at(src, src_size, 0, 1, 1);
+        token_buffer_t* tokens = lexer_tokenize(lexer);
+        free(lexer);
+        return tokens;
+    }
+
+    lex_chunk_t* chunks = calloc(threads, sizeof(lex_chunk_t));
+    if (!chunks) {
+        fprintf(stderr, "Memory allocation failed for lexer chunks\n");
+        exit(1);
+    }
+
+    size_t count = 0;
+    size_t start = 0;
+    for (unsigned int i = 0; i < threads && start < src_size; i++) {
+        size_t end = src_size;
+        if (i + 1 < threads) {
+            size_t target = MAX(start, src_size / threads * (i + 1));
+            char* newline = memchr(src + target, '\n', src_size - target);
+            end = newline ? (size_t) (newline - src) + 1 : src_size;
+        }
+        chunks[count].src = src;
+        chunks[count].start = start;
+        chunks[count].end = end;
+        count++;
+        start = end;
+    }
+
+    lex_chunks_run(chunks, count, lex_chunk_count_lines);
+
+    unsigned int line = 1;
+    for (size_t i = 0; i < count; i++) {
+        chunks[i].line = line;
+        line += chunks[i].lines;
+    }
+
+    lex_chunks_run(chunks, count, lex_chunk_tokenize);
+
+    // Stitch the chunks together, keeping only the last chunk's EOF
+    size_t total = 1;
+    for (size_t i = 0; i < count; i++) {
+        total += chunks[i].tokens->size - 1;
+    }
+
+    token_buffer_t* tokens = init_token_buffer(src, total);
+    for (size_t i = 0; i < count; i++) {
+        token_buffer_t* part = chunks[i].tokens;
+        size_t n = i + 1 < count ? part->size - 1 : part->size;
+
+        memcpy(tokens->types + tokens->size, part->types, n * sizeof(uint8_t));
+        memcpy(tokens->offsets + tokens->size, part->offsets, n * sizeof(uint32_t));
+        memcpy(tokens->lengths + tokens->size, part->lengths, n * sizeof(uint32_t));
+        memcpy(tokens->positions + tokens->size, part->positions, n * sizeof(uint64_t));
+        tokens->size += n;
+        tokens->max_length = MAX(tokens->max_length, part->max_length);
+
+        free_token_buffer(part);
+    }
+
+    free(chunks);
+    return tokens;
+}
+
+bool token_buffer_equal(token_buffer_t* a, token_buffer_t* b) {
+    if (a->size != b->size) return false;
+
+    return memcmp(a->types, b->types, a->size * sizeof(uint8_t)) == 0 &&
+           memcmp(a->offsets, b->offsets, a->size * sizeof(uint32_t)) == 0 &&
+           memcmp(a->lengths, b->lengths, a->size * sizeof(uint32_t)) == 0 &&
+           memcmp(a->positions, b->positions, a->size * sizeof(uint64_t)) == 0;
+}
+
+void free_token_buffer(token_buffer_t* tokens) {
+    if (!tokens) return;
+
+    free(tokens->types);
+    free(tokens->offsets);
+    free(tokens->lengths);
+    free(tokens->positions);
+    free(tokens);
+}
+
+#endif // SKULL_TOKBUF_H_IMPLEMENTATION
+#endif // SKULL_TOKBUF_H
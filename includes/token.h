@@ -30,9 +30,14 @@ typedef enum {
     TOKEN_MULTIPLY,
     TOKEN_MODULUS,
     TOKEN_INT,
+    TOKEN_FLOAT,
+    TOKEN_STRING,
     TOKEN_RETURN,
     TOKEN_MUTABLE,
     TOKEN_FUNC_TYPE,
+    TOKEN_LBRACKET,
+    TOKEN_RBRACKET,
+    TOKEN_DOT,
 } tokenType;
 
 typedef struct tokenStruct {
@@ -40,8 +45,18 @@ typedef struct tokenStruct {
     tokenType type;
     unsigned int line;    // Track line number for error reporting
     unsigned int column;  // Track column number for error reporting
+    unsigned int offset;  // Byte offset of the first character in the source
 } token_t;
 
+// A token as a slice of the source, filled by lexer_scan without allocating
+typedef struct {
+    tokenType type;
+    unsigned int offset;
+    unsigned int length;
+    unsigned int line;
+    unsigned int column;
+} token_span_t;
+
 token_t *init_token(char *value, int type);
 const char* token_type_to_str(int type);
 char* token_to_str(token_t* token);
@@ -59,6 +74,7 @@ token_t *init_token(char *value, int type) {
     token->type = type;
     token->line = 0;   // Default values
     token->column = 0; // Will be set by lexer
+    token->offset = 0;
     return token;
 }
 
@@ -97,9 +113,14 @@ const char* token_type_to_str(int type) {
         case TOKEN_MULTIPLY: return "TOKEN_MULTIPLY";
         case TOKEN_MODULUS: return "TOKEN_MODULUS";
         case TOKEN_INT: return "TOKEN_INT";
+        case TOKEN_FLOAT: return "TOKEN_FLOAT";
+        case TOKEN_STRING: return "TOKEN_STRING";
         case TOKEN_RETURN: return "TOKEN_RETURN";
         case TOKEN_MUTABLE: return "TOKEN_MUTABLE";
         case TOKEN_FUNC_TYPE: return "TOKEN_FUNC_TYPE";
+        case TOKEN_LBRACKET: return "TOKEN_LBRACKET";
+        case TOKEN_RBRACKET: return "TOKEN_RBRACKET";
+        case TOKEN_DOT: return "TOKEN_DOT";
     }
 
     return "UNKNOWN_TOKEN_TYPE";
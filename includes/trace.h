@@ -0,0 +1,132 @@
+#ifndef SKULL_TRACE_H
+#define SKULL_TRACE_H
+
+// Hot path instrumentation of lsc itself. Built with -DSKULL_TRACE,
+// TRACE_SCOPE(name) counts a call and the cycles until the enclosing block
+// is left, keyed by the chain of scopes open around it. Without it the
+// scopes compile to nothing.
+//
+// When SKULL_TRACE is set in the environment, lsc writes the chains on exit
+// as folded stacks, one "lsc;parse;parse_statement <n>" line each, to
+// $SKULL_TRACE.cycles.folded with the cycles spent in the last frame itself
+// and to $SKULL_TRACE.calls.folded with its calls.
+
+#ifdef SKULL_TRACE
+
+#include <stdint.h>
+
+typedef struct trace_node_t {
+    const char* name;             // Scopes are told apart by the name pointer
+    struct trace_node_t* parent;
+    struct trace_node_t* children;
+    struct trace_node_t* next;
+    uint64_t calls;
+    uint64_t cycles;              // Including the children
+    uint64_t start;
+} trace_node_t;
+
+trace_node_t* trace_enter(const char* name);
+void trace_leave(trace_node_t** node);
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+    trace_node_t* TRACE_CONCAT(trace_scope_, __LINE__) __attribute__((cleanup(trace_leave))) = trace_enter(name)
+
+#else
+#define TRACE_SCOPE(name) ((void) 0)
+#endif // SKULL_TRACE
+
+#ifdef SKULL_TRACE_H_IMPLEMENTATION
+#ifdef SKULL_TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <x86intrin.h>
+
+// The lexer runs on one thread in traced builds, so one tree is enough
+static trace_node_t trace_root = {"lsc", NULL, NULL, NULL, 0, 0, 0};
+static trace_node_t* trace_current = &trace_root;
+
+static void trace_write_node(trace_node_t* node, char* path, size_t length, FILE* cycles, FILE* calls) {
+    size_t name_length = strlen(node->name);
+    if (length + name_length + 2 >= 4096) return;
+    if (length) path[length++] = ';';
+    memcpy(path + length, node->name, name_length + 1);
+    length += name_length;
+
+    // Written before the children, which extend path in place
+    uint64_t self = node->cycles;
+    for (trace_node_t* child = node->children; child; child = child->next) self -= child->cycles;
+    if (node != &trace_root) {
+        fprintf(cycles, "%s %llu\n", path, (unsigned long long) self);
+        fprintf(calls, "%s %llu\n", path, (unsigned long long) node->calls);
+    }
+    for (trace_node_t* child = node->children; child; child = child->next) {
+        trace_write_node(child, path, length, cycles, calls);
+    }
+}
+
+static void trace_write(void) {
+    const char* prefix = getenv("SKULL_TRACE");
+    if (!prefix || !*prefix) return;
+
+    char cycles_path[4096], calls_path[4096];
+    if (snprintf(cycles_path, sizeof(cycles_path), "%s.cycles.folded", prefix) >= (int) sizeof(cycles_path) ||
+        snprintf(calls_path, sizeof(calls_path), "%s.calls.folded", prefix) >= (int) sizeof(calls_path)) {
+        fprintf(stderr, "Warning: SKULL_TRACE path too long, no trace written\n");
+        return;
+    }
+    FILE* cycles = fopen(cycles_path, "w");
+    FILE* calls = fopen(calls_path, "w");
+    if (!cycles || !calls) {
+        fprintf(stderr, "Warning: Failed to write the trace to %s\n", prefix);
+        if (cycles) fclose(cycles);
+        if (calls) fclose(calls);
+        return;
+    }
+
+    // Scopes still open at exit are charged up to now
+    uint64_t now = __rdtsc();
+    for (trace_node_t* node = trace_current; node != &trace_root; node = node->parent) {
+        node->cycles += now - node->start;
+    }
+
+    char path[4096];
+    trace_write_node(&trace_root, path, 0, cycles, calls);
+    fclose(cycles);
+    fclose(calls);
+}
+
+trace_node_t* trace_enter(const char* name) {
+    if (!trace_root.calls++) atexit(trace_write);
+
+    trace_node_t* node = trace_current->children;
+    while (node && node->name != name) node = node->next;
+    if (!node) {
+        node = calloc(1, sizeof(trace_node_t));
+        if (!node) {
+            fprintf(stderr, "Memory allocation failed for trace node\n");
+            exit(1);
+        }
+        node->name = name;
+        node->parent = trace_current;
+        node->next = trace_current->children;
+        trace_current->children = node;
+    }
+
+    node->calls++;
+    trace_current = node;
+    node->start = __rdtsc();
+    return node;
+}
+
+void trace_leave(trace_node_t** node) {
+    (*node)->cycles += __rdtsc() - (*node)->start;
+    trace_current = (*node)->parent;
+}
+
+#endif // SKULL_TRACE
+#endif // SKULL_TRACE_H_IMPLEMENTATION
+#endif // SKULL_TRACE_H
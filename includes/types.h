@@ -1,21 +1,57 @@
 #ifndef SKULL_TYPES_H
 #define SKULL_TYPES_H
 
+#include <stdbool.h>
+#include <stdio.h>
+
+// Array<T> is the type of T plus TYPE_ARRAY, once per level of nesting, so
+// Array<Array<int>> is int + 2 * TYPE_ARRAY. Named types stay well below it.
+#define TYPE_ARRAY (1 << 20)
+
+// Type parameter k of a generic function is TYPE_PARAM + k until the
+// function is instantiated, which substitutes the concrete types
+#define TYPE_PARAM (1 << 19)
+#define TYPE_MAX_PARAMS 8
+
+// Vectors of 32 bit lanes, 16 bytes wide with 4 lanes and 32 with 8
+#define TYPE_I32X4 7
+#define TYPE_I32X8 8
+#define TYPE_F32X4 9
+#define TYPE_F32X8 10
+
+// Scalar floats are 64 bit doubles
+#define TYPE_FLOAT 4
+
 int typename_to_int(const char* name);
+int type_array_of(int element);
+bool type_is_array(int type);
+int type_element(int type);
+bool type_is_float(int type);
+bool type_is_vector(int type);
+bool type_is_float_vector(int type);
+int type_lanes(int type);
+int type_vector_of(int lanes, bool is_float);
+int type_param_index(int type);
+int type_substitute(int type, const int* args);
+size_t type_mangle(int type, char* out, size_t size);
 
 #ifdef SKULL_TYPES_H_IMPLEMENTATION
 
 int typename_to_int(const char* name) {
     if (!name) return 0;
-    
+
     // Map common type names to specific integers
     if (strcmp(name, "int") == 0) return 1;
     if (strcmp(name, "char") == 0) return 2;
     if (strcmp(name, "bool") == 0) return 3;
-    if (strcmp(name, "float") == 0) return 4;
+    if (strcmp(name, "float") == 0) return TYPE_FLOAT;
     if (strcmp(name, "void") == 0) return 5;
     if (strcmp(name, "string") == 0) return 6;
-    
+    if (strcmp(name, "i32x4") == 0) return TYPE_I32X4;
+    if (strcmp(name, "i32x8") == 0) return TYPE_I32X8;
+    if (strcmp(name, "f32x4") == 0) return TYPE_F32X4;
+    if (strcmp(name, "f32x8") == 0) return TYPE_F32X8;
+
     // For unknown types, use the old hashing method
     int t = 0;
     size_t len = strlen(name);
@@ -25,5 +61,69 @@ int typename_to_int(const char* name) {
     return t + 100; // Add offset to avoid conflicts with predefined types
 }
 
+int type_array_of(int element) {
+    return element + TYPE_ARRAY;
+}
+
+bool type_is_array(int type) {
+    return type >= TYPE_ARRAY;
+}
+
+// 0 for anything that is not an array
+int type_element(int type) {
+    return type_is_array(type) ? type - TYPE_ARRAY : 0;
+}
+
+bool type_is_float(int type) {
+    return type == TYPE_FLOAT;
+}
+
+bool type_is_vector(int type) {
+    return type >= TYPE_I32X4 && type <= TYPE_F32X8;
+}
+
+bool type_is_float_vector(int type) {
+    return type == TYPE_F32X4 || type == TYPE_F32X8;
+}
+
+// 0 for anything that is not a vector
+int type_lanes(int type) {
+    if (type == TYPE_I32X4 || type == TYPE_F32X4) return 4;
+    if (type == TYPE_I32X8 || type == TYPE_F32X8) return 8;
+    return 0;
+}
+
+int type_vector_of(int lanes, bool is_float) {
+    if (lanes == 4) return is_float ? TYPE_F32X4 : TYPE_I32X4;
+    return is_float ? TYPE_F32X8 : TYPE_I32X8;
+}
+
+// Index of the type parameter at the bottom of any arrays, -1 for none
+int type_param_index(int type) {
+    while (type_is_array(type)) type -= TYPE_ARRAY;
+    return type >= TYPE_PARAM && type < TYPE_PARAM + TYPE_MAX_PARAMS ? type - TYPE_PARAM : -1;
+}
+
+// type with every type parameter replaced by its argument in args
+int type_substitute(int type, const int* args) {
+    int index = type_param_index(type);
+    if (index < 0 || !args) return type;
+    return type - (TYPE_PARAM + index) + args[index];
+}
+
+// Writes a name for type usable in a symbol, Array<int> is Array_int.
+// Returns the length it needs like snprintf.
+size_t type_mangle(int type, char* out, size_t size) {
+    if (type_is_array(type)) {
+        size_t len = snprintf(out, size, "Array_");
+        return len + type_mangle(type - TYPE_ARRAY, len < size ? out + len : NULL, len < size ? size - len : 0);
+    }
+
+    static const char* names[] = { "unknown", "int", "char", "bool", "float", "void", "string",
+                                   "i32x4", "i32x8", "f32x4", "f32x8" };
+    if (type >= 0 && type <= TYPE_F32X8) return snprintf(out, size, "%s", names[type]);
+    return snprintf(out, size, "t%d", type);
+}
+
 #endif // SKULL_TYPES_H_IMPLEMENTATION
-#endif // SKULL_TYPES_H
\ No newline at end of file
+#endif // SKULL_TYPES_H
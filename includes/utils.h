@@ -18,9 +18,6 @@ void write_file(const char* filename, char* buffer);
 
 char* read_file(const char* filename) {
     FILE * fp;
-    char * line = NULL;
-    size_t len = 0;
-    ssize_t read;
 
     fp = fopen(filename, "rb");
     if (fp == NULL) {
@@ -28,28 +25,36 @@ char* read_file(const char* filename) {
         return NULL;  // Return NULL instead of exiting
     }
 
-    char* buffer = (char*) calloc(1, sizeof(char));
+    // Read in large blocks into a buffer that doubles when full. Appending
+    // line by line with strcat walked the whole buffer again for every line,
+    // quadratic in the file size, which made multi megabyte sources take
+    // longer to read than to lex.
+    size_t size = 0;
+    size_t capacity = 4096;
+    char* buffer = (char*) malloc(capacity);
     if (!buffer) {
         fprintf(stderr, "Memory allocation failed\n");
         fclose(fp);
         return NULL;
     }
-    buffer[0] = '\0';
 
-    while ((read = getline(&line, &len, fp)) != -1) {
-        char* new_buffer = (char*) realloc(buffer, (strlen(buffer) + strlen(line) + 1) * sizeof(char));
-        if (!new_buffer) {
-            fprintf(stderr, "Memory reallocation failed\n");
-            free(buffer);
-            free(line);
-            fclose(fp);
-            return NULL;
+    size_t read;
+    while ((read = fread(buffer + size, 1, capacity - size - 1, fp)) > 0) {
+        size += read;
+        if (size + 1 == capacity) {
+            char* new_buffer = (char*) realloc(buffer, capacity * 2);
+            if (!new_buffer) {
+                fprintf(stderr, "Memory reallocation failed\n");
+                free(buffer);
+                fclose(fp);
+                return NULL;
+            }
+            buffer = new_buffer;
+            capacity *= 2;
         }
-        buffer = new_buffer;
-        strcat(buffer, line);
     }
+    buffer[size] = '\0';
     fclose(fp);
-    if (line) free(line);
 
     return buffer;
 }
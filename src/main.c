@@ -8,12 +8,40 @@
 #include <libgen.h>
 #include "skull.h"
 
+// Long only options
+enum {
+    OPT_BENCH_AST = 256,
+    OPT_AST_CACHE,
+    OPT_EMIT_AST,
+    OPT_INSTRUMENT,
+    OPT_PROFILE_USE,
+    OPT_ISA,
+    OPT_FMA,
+    OPT_BENCH_PHASES,
+    OPT_SHARED,
+    OPT_WHOLE_PROGRAM,
+    OPT_CHECK_INCREMENTAL,
+};
+
 void print_usage(const char* prog_name) {
-    fprintf(stderr, "Usage: %s [options] input_file.k\n", prog_name);
+    fprintf(stderr, "Usage: %s [options] input_file.k [more.k ...]\n", prog_name);
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -o, --output FILE    Specify output executable name\n");
     fprintf(stderr, "  -k, --keep-files     Keep intermediate .asm and .o files\n");
+    fprintf(stderr, "  -c, --compile-only   Build <output>.o and its interface <output>.ki, do not link\n");
+    fprintf(stderr, "      --shared         Build a shared library, lib<input>.so unless -o names it, and its C header\n");
+    fprintf(stderr, "      --whole-program  Compile the input with its imports and any further sources into one optimized object\n");
+    fprintf(stderr, "  -I, --include DIR    Also look for imported modules in DIR\n");
     fprintf(stderr, "  -h, --help           Show this help message\n");
+    fprintf(stderr, "      --ast-cache      Reuse the parsed tree from <input>ast while the source is unchanged\n");
+    fprintf(stderr, "      --emit-ast FILE  Write the parsed tree to FILE, no output is built\n");
+    fprintf(stderr, "      --bench-ast      Time walks of the pointer and the pooled AST and report memory per node, no output is built\n");
+    fprintf(stderr, "      --bench-phases N Time lexing, parsing and codegen, best of N runs, as JSON, no output is built\n");
+    fprintf(stderr, "      --check-incremental N Reparse after N random edits and compare with a full parse, no output is built\n");
+    fprintf(stderr, "      --instrument     Count function entries, calls and branch arms, the program writes them to <output>.kprof on exit\n");
+    fprintf(stderr, "      --profile-use F  Inline hot calls, lay out hot branch arms and functions first and move never run ones to .text.unlikely using profile F\n");
+    fprintf(stderr, "      --isa ISA        Lower vectors to sse2 (default, 4 lanes only) or avx2\n");
+    fprintf(stderr, "      --fma            Fuse float multiplies into the adds using them, needs --isa avx2\n");
 }
 
 void create_output_directory_if_needed(const char* path) {
@@ -35,37 +63,113 @@ void create_output_directory_if_needed(const char* path) {
 }
 
 int main(int argc, char* argv[]) {
-    bool keep_files = false;
+    bool bench_ast = false;
+    int bench_phases = 0;
+    int check_incremental = 0;
     const char* input_filename = NULL;
-    const char* output_filename = "main";
+    bool output_given = false;
+    skull_options_t options = {0};
+    options.output_filename = "main";
+    options.include_dirs = init_list(sizeof(char*));
+    options.sources = init_list(sizeof(char*));
 
     static struct option long_options[] = {
         {"output", required_argument, 0, 'o'},
         {"keep-files", no_argument, 0, 'k'},
+        {"compile-only", no_argument, 0, 'c'},
+        {"include", required_argument, 0, 'I'},
         {"help", no_argument, 0, 'h'},
+        {"bench-ast", no_argument, 0, OPT_BENCH_AST},
+        {"ast-cache", no_argument, 0, OPT_AST_CACHE},
+        {"emit-ast", required_argument, 0, OPT_EMIT_AST},
+        {"instrument", no_argument, 0, OPT_INSTRUMENT},
+        {"profile-use", required_argument, 0, OPT_PROFILE_USE},
+        {"isa", required_argument, 0, OPT_ISA},
+        {"fma", no_argument, 0, OPT_FMA},
+        {"bench-phases", required_argument, 0, OPT_BENCH_PHASES},
+        {"check-incremental", required_argument, 0, OPT_CHECK_INCREMENTAL},
+        {"shared", no_argument, 0, OPT_SHARED},
+        {"whole-program", no_argument, 0, OPT_WHOLE_PROGRAM},
         {0, 0, 0, 0}
     };
 
     int opt;
     int option_index = 0;
-    while ((opt = getopt_long(argc, argv, "o:kh", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "o:kcI:h", long_options, &option_index)) != -1) {
         switch (opt) {
             case 'o':
-                output_filename = optarg;
-                create_output_directory_if_needed(output_filename);
+                options.output_filename = optarg;
+                output_given = true;
+                create_output_directory_if_needed(options.output_filename);
                 break;
             case 'k':
-                keep_files = true;
+                options.keep_files = true;
+                break;
+            case 'c':
+                options.compile_only = true;
+                break;
+            case 'I':
+                list_push(options.include_dirs, optarg);
                 break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
+            case OPT_BENCH_AST:
+                bench_ast = true;
+                break;
+            case OPT_AST_CACHE:
+                options.ast_cache = true;
+                break;
+            case OPT_EMIT_AST:
+                options.emit_ast = optarg;
+                break;
+            case OPT_INSTRUMENT:
+                options.instrument = true;
+                break;
+            case OPT_PROFILE_USE:
+                options.profile_use = optarg;
+                break;
+            case OPT_ISA:
+                options.isa = asm_isa_from_name(optarg);
+                if (options.isa < 0) {
+                    fprintf(stderr, "Error: Unknown instruction set '%s', expected sse2 or avx2\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_FMA:
+                options.fma = true;
+                break;
+            case OPT_SHARED:
+                options.shared = true;
+                break;
+            case OPT_WHOLE_PROGRAM:
+                options.whole_program = true;
+                break;
+            case OPT_BENCH_PHASES:
+                bench_phases = atoi(optarg);
+                if (bench_phases <= 0) {
+                    fprintf(stderr, "Error: --bench-phases needs a positive run count\n");
+                    return 1;
+                }
+                break;
+            case OPT_CHECK_INCREMENTAL:
+                check_incremental = atoi(optarg);
+                if (check_incremental <= 0) {
+                    fprintf(stderr, "Error: --check-incremental needs a positive edit count\n");
+                    return 1;
+                }
+                break;
             default:
                 print_usage(argv[0]);
                 return 1;
         }
     }
 
+    if (options.fma && options.isa != ASM_ISA_AVX2) {
+        fprintf(stderr, "Error: --fma needs --isa avx2\n");
+        return 1;
+    }
+
     if (optind < argc) {
         input_filename = argv[optind];
     } else {
@@ -74,19 +178,81 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    const char* ext = strrchr(input_filename, '.');
-    if (!ext || strcmp(ext, ".k") != 0) {
-        fprintf(stderr, "Error: Input file '%s' must have .k extension\n", input_filename);
-        print_usage(argv[0]);
+    // Further sources only make sense when they become one program
+    if (argc - optind > 1 && !options.whole_program) {
+        fprintf(stderr, "Error: Several input files need --whole-program, modules are found through import\n");
         return 1;
     }
+    for (int i = optind; i < argc; i++) {
+        const char* ext = strrchr(argv[i], '.');
+        if (!ext || strcmp(ext, ".k") != 0) {
+            fprintf(stderr, "Error: Input file '%s' must have .k extension\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
 
-    if (access(input_filename, F_OK) != 0) {
-        fprintf(stderr, "Error: Input file '%s' does not exist\n", input_filename);
+        if (access(argv[i], F_OK) != 0) {
+            fprintf(stderr, "Error: Input file '%s' does not exist\n", argv[i]);
+            return 1;
+        }
+        if (i > optind) list_push(options.sources, argv[i]);
+    }
+
+    // Inlined calls would lose their counters
+    if (options.instrument && options.profile_use) {
+        fprintf(stderr, "Error: --instrument and --profile-use cannot be combined\n");
+        return 1;
+    }
+    if (options.instrument && options.compile_only) {
+        fprintf(stderr, "Error: --instrument needs a program, the counters are written when main returns\n");
+        return 1;
+    }
+
+    // A whole program has one entry and no module objects to share
+    if (options.whole_program && (options.compile_only || options.shared)) {
+        fprintf(stderr, "Error: --whole-program cannot be combined with %s\n",
+                options.compile_only ? "--compile-only" : "--shared");
+        return 1;
+    }
+
+    if (options.shared && (options.compile_only || options.instrument)) {
+        fprintf(stderr, "Error: --shared cannot be combined with %s\n",
+                options.compile_only ? "--compile-only" : "--instrument");
         return 1;
     }
 
-    skull_compile_file(input_filename, output_filename, keep_files);
+    // Libraries are named after their source unless told otherwise
+    char library_name[PATH_MAX_SIZE];
+    if (options.shared && !output_given) {
+        char base_name[PATH_MAX_SIZE];
+        char extension[PATH_MAX_SIZE];
+        extract_base_name_and_extension(input_filename, base_name, PATH_MAX_SIZE, extension, PATH_MAX_SIZE);
+        const char* name = strrchr(base_name, '/');
+        if (snprintf(library_name, PATH_MAX_SIZE, "lib%s.so", name ? name + 1 : base_name) >= PATH_MAX_SIZE) {
+            fprintf(stderr, "Error: Output filename too long\n");
+            return 1;
+        }
+        options.output_filename = library_name;
+    }
+
+    if (bench_ast) {
+        skull_bench_ast(input_filename, 100);
+        return 0;
+    }
+
+    if (bench_phases) {
+        skull_bench_phases(input_filename, bench_phases);
+        return 0;
+    }
+
+    if (check_incremental) {
+        skull_check_incremental(input_filename, check_incremental);
+        return 0;
+    }
+
+    skull_compile_file(input_filename, &options);
+    free_list(options.include_dirs);
+    free_list(options.sources);
 
     return 0;
 }